@@ -0,0 +1,948 @@
+#include "hqbarneshut.hpp"
+#include "hqbatch.hpp"
+#include "hqbvh.hpp"
+#include "hqcells.hpp"
+#include "hqcurve.hpp"
+#include "hqfft.hpp"
+#include "hqfof.hpp"
+#include "hqhash.hpp"
+#include "hqkdtree.hpp"
+#include "hqkmeans.hpp"
+#include "hqmesh.hpp"
+#include "hqnbody.hpp"
+#include "hqnuma.hpp"
+#include "hqoctree.hpp"
+#include "hqparallel.hpp"
+#include "hqperiodic.hpp"
+#include "hqradix.hpp"
+#include "hqspatial.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+using namespace HQ;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// run every benchmark, or only those named on the command line
+static bool selected(int argc, char** argv, const char* name) {
+    if (argc < 2)
+        return true;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], name) == 0)
+            return true;
+    }
+    return false;
+}
+
+#define BENCH(name)                                                            \
+    if (selected(argc, argv, #name)) {                                         \
+        std::cout << "== " << #name << " ==" << std::endl;                     \
+        name();                                                                \
+    }
+
+// a[i] += s * b[i] over static partitions; returns GB/s
+template <typename A> double triad_bandwidth(A& a, const A& b, int reps) {
+    std::size_t count = a.size();
+    vec3<double>* pa = a.data();
+    const vec3<double>* pb = b.data();
+    bench_clock::time_point start = bench_clock::now();
+    for (int r = 0; r < reps; r++) {
+        parallel_for_ranges(
+            0, count,
+            [=](std::size_t lo, std::size_t hi, unsigned) {
+                for (std::size_t i = lo; i < hi; i++) {
+                    pa[i] = pa[i] + pb[i] * 0.5;
+                }
+            },
+            4096);
+    }
+    double t = seconds_since(start);
+    return 3.0 * count * sizeof(vec3<double>) * reps / t / 1e9;
+}
+
+void numa_bandwidth() {
+    const std::size_t count = std::size_t(1) << 22;
+    const int reps = 10;
+    set_pin_threads(true);
+    std::cout << "nodes: " << numa_node_count()
+              << ", threads: " << num_threads() << std::endl;
+    {
+        // serial initialisation: every page lands on the main thread's node
+        std::vector<vec3<double>> a(count), b(count, vec3<double>(1, 2, 3));
+        std::cout << "serial init:      " << triad_bandwidth(a, b, reps)
+                  << " GB/s" << std::endl;
+    }
+    {
+        numa_vec_array<double, 3> a(count), b(count);
+        first_touch_fill(b.data(), b.size(), vec3<double>(1, 2, 3));
+        std::cout << "first touch:      " << triad_bandwidth(a, b, reps)
+                  << " GB/s" << std::endl;
+    }
+    {
+        numa_allocator<vec3<double>> interleave(numa_policy::interleave);
+        numa_vec_array<double, 3> a(count, interleave), b(count, interleave);
+        first_touch_fill(b.data(), b.size(), vec3<double>(1, 2, 3));
+        std::cout << "interleave:       " << triad_bandwidth(a, b, reps)
+                  << " GB/s" << std::endl;
+    }
+    set_pin_threads(false);
+}
+
+// sums a small array that the previous phase may have evicted
+static double sum_working_set(const std::vector<vec4<float>>& w) {
+    vec4<float> acc;
+    for (std::size_t i = 0; i < w.size(); i++) {
+        acc = acc + w[i];
+    }
+    return acc.x + acc.y + acc.z + acc.w;
+}
+
+void streaming_stores() {
+    const std::size_t count = std::size_t(1) << 24; // 256 MiB of vec4<float>
+    std::vector<vec4<float>> in(count, vec4<float>(1, 2, 3, 4));
+    std::vector<vec4<float>> out(count);
+    std::vector<vec4<float>> working((1 << 20) / sizeof(vec4<float>));
+    std::cout << "last level cache: " << (last_level_cache_size() >> 10)
+              << " KiB" << std::endl;
+    const store_policy policies[] = {store_policy::cached,
+                                     store_policy::streaming};
+    const char* names[] = {"cached:   ", "streaming:"};
+    double sink = 0;
+    for (int p = 0; p < 2; p++) {
+        sink += sum_working_set(working); // warm the working set
+        bench_clock::time_point start = bench_clock::now();
+        transform(
+            in.data(), out.data(), count,
+            [](const vec4<float>& v) { return v * 2.0f + 1.0f; }, policies[p]);
+        double write_time = seconds_since(start);
+        start = bench_clock::now();
+        sink += sum_working_set(working);
+        double follow_time = seconds_since(start);
+        std::cout << names[p] << " transform "
+                  << 2.0 * count * sizeof(vec4<float>) / write_time / 1e9
+                  << " GB/s, following phase " << follow_time * 1e6 << " us"
+                  << std::endl;
+    }
+    if (sink == 0)
+        std::cout << std::endl;
+}
+
+void gather_prefetch() {
+    const std::size_t count = std::size_t(1) << 22;
+    std::vector<vec3<float>> src(count, vec3<float>(1, 2, 3)), dst(count);
+    std::vector<std::uint32_t> idx(count);
+    std::uint32_t state = 12345;
+    for (std::size_t i = 0; i < count; i++) {
+        state = state * 1664525u + 1013904223u; // LCG: random order
+        idx[i] = state % count;
+    }
+    gather(src.data(), idx.data(), dst.data(), count); // fault in dst
+    const std::size_t distances[] = {0, 4, 16, 64};
+    for (int d = 0; d < 4; d++) {
+        set_prefetch_distance(distances[d]);
+        bench_clock::time_point start = bench_clock::now();
+        gather(src.data(), idx.data(), dst.data(), count);
+        double t = seconds_since(start);
+        std::cout << "distance " << distances[d] << ": " << count / t / 1e6
+                  << " M gathers/s" << std::endl;
+    }
+    set_prefetch_distance(16);
+}
+
+// deterministic points in the unit cube
+template <std::size_t n>
+std::vector<vec<float, n>> random_points(std::size_t count,
+                                         std::uint32_t seed) {
+    std::vector<vec<float, n>> out(count);
+    for (std::size_t i = 0; i < count; i++) {
+        for (int k = 0; k < (int)n; k++) {
+            seed = seed * 1664525u + 1013904223u;
+            out[i][k] = (float)(seed >> 8) / (float)(1 << 24);
+        }
+    }
+    return out;
+}
+
+template <std::size_t n> void kd_tree_queries() {
+    const std::size_t count = std::size_t(1) << 20, queries = 1 << 16;
+    const std::size_t k = 8, brute_queries = 64;
+    std::vector<vec<float, n>> points = random_points<n>(count, 1);
+    std::vector<vec<float, n>> q = random_points<n>(queries, 2);
+    bench_clock::time_point start = bench_clock::now();
+    kd_tree<float, n> tree(points.data(), count);
+    std::cout << "n = " << n << ": build " << seconds_since(start) << " s";
+    std::vector<neighbor<float>> out(queries * k);
+    start = bench_clock::now();
+    tree.knn(q.data(), queries, k, out.data());
+    std::cout << ", knn " << queries / seconds_since(start) << " queries/s";
+    start = bench_clock::now();
+    float sink = 0;
+    for (std::size_t i = 0; i < brute_queries; i++) {
+        float best = points[0].distance2(q[i]);
+        for (std::size_t j = 1; j < count; j++) {
+            best = std::min(best, points[j].distance2(q[i]));
+        }
+        sink += best;
+    }
+    std::cout << ", brute force nearest "
+              << brute_queries / seconds_since(start) << " queries/s"
+              << (sink < 0 ? "!" : "") << std::endl;
+}
+
+void kd_tree_knn() {
+    kd_tree_queries<3>();
+    kd_tree_queries<8>();
+}
+
+struct triangle {
+    vec3<float> a, b, c;
+};
+
+// Moller-Trumbore; returns the hit parameter or infinity
+static float ray_triangle(const triangle& tri, const ray& r) {
+    const float miss = std::numeric_limits<float>::infinity();
+    vec3<float> e1 = tri.b - tri.a, e2 = tri.c - tri.a;
+    vec3<float> p = r.direction.cross(e2);
+    float det = e1.dot(p);
+    if (std::fabs(det) < 1e-12f)
+        return miss;
+    float inv = 1.0f / det;
+    vec3<float> s = r.origin - tri.a;
+    float u = s.dot(p) * inv;
+    if ((u < 0) || (u > 1))
+        return miss;
+    vec3<float> q = s.cross(e1);
+    float v = r.direction.dot(q) * inv;
+    if ((v < 0) || (u + v > 1))
+        return miss;
+    return e2.dot(q) * inv;
+}
+
+template <std::size_t W>
+void trace(const std::vector<triangle>& tris,
+           const std::vector<aabb<float, 3>>& boxes,
+           const std::vector<ray>& rays) {
+    bench_clock::time_point start = bench_clock::now();
+    bvh<W> tree(boxes.data(), boxes.size());
+    double build = seconds_since(start);
+    const triangle* t = tris.data();
+    auto hit = [t](std::uint32_t p, const ray& r) {
+        return ray_triangle(t[p], r);
+    };
+    std::vector<ray_hit> hits(rays.size());
+    start = bench_clock::now();
+    parallel_for(
+        0, rays.size(),
+        [&](std::size_t i) { hits[i] = tree.closest_hit(rays[i], hit); },
+        256);
+    double closest = seconds_since(start);
+    std::vector<char> blocked(rays.size());
+    start = bench_clock::now();
+    parallel_for(
+        0, rays.size(),
+        [&](std::size_t i) { blocked[i] = tree.any_hit(rays[i], hit); },
+        256);
+    double any = seconds_since(start);
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < hits.size(); i++) {
+        count += hits[i].primitive != bvh<W>::npos ? 1 : 0;
+    }
+    std::cout << W << "-wide: build " << build << " s, closest hit "
+              << rays.size() / closest / 1e6 << " Mrays/s, any hit "
+              << rays.size() / any / 1e6 << " Mrays/s (" << count << " hits)"
+              << std::endl;
+}
+
+void bvh_rays() {
+    const std::size_t count = std::size_t(1) << 20, ray_count = 1 << 18;
+    std::vector<vec3<float>> corners = random_points<3>(3 * count, 3);
+    std::vector<triangle> tris(count);
+    std::vector<aabb<float, 3>> boxes(count);
+    for (std::size_t i = 0; i < count; i++) {
+        // small triangles scattered through the unit cube
+        tris[i].a = corners[3 * i];
+        tris[i].b = tris[i].a + (corners[3 * i + 1] - 0.5f) * 0.02f;
+        tris[i].c = tris[i].a + (corners[3 * i + 2] - 0.5f) * 0.02f;
+        boxes[i].expand(tris[i].a);
+        boxes[i].expand(tris[i].b);
+        boxes[i].expand(tris[i].c);
+    }
+    std::vector<vec3<float>> from = random_points<3>(ray_count, 5);
+    std::vector<vec3<float>> to = random_points<3>(ray_count, 7);
+    std::vector<ray> rays;
+    rays.reserve(ray_count);
+    for (std::size_t i = 0; i < ray_count; i++) {
+        rays.push_back(ray(from[i], to[i] - from[i]));
+    }
+    trace<4>(tris, boxes, rays);
+    trace<8>(tris, boxes, rays);
+}
+
+void cell_list_pairs() {
+    const std::size_t count = std::size_t(1) << 20;
+    const float radius = 0.0197f; // about 32 neighbours per point
+    std::vector<vec3<float>> points = random_points<3>(count, 9);
+    bench_clock::time_point start = bench_clock::now();
+    cell_list<float> cells(points.data(), count, radius);
+    double build = seconds_since(start);
+    std::vector<vec3<float>> force(count);
+    start = bench_clock::now();
+    const vec3<float>* p = points.data();
+    cells.for_each_pair([&](std::uint32_t i, std::uint32_t j, float d2) {
+        force[i] = force[i] + (p[i] - p[j]) * (radius * radius - d2);
+    });
+    double t = seconds_since(start);
+    std::vector<std::uint32_t> neighbours(count);
+    cells.for_each_pair(
+        [&](std::uint32_t i, std::uint32_t, float) { neighbours[i]++; });
+    std::size_t pairs = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        pairs += neighbours[i];
+    }
+    std::cout << "build " << build << " s, " << (double)pairs / count
+              << " neighbours/point, " << pairs / t / 1e6 << " M pairs/s"
+              << std::endl;
+}
+
+void periodic_wrap() {
+    const std::size_t count = std::size_t(1) << 22;
+    const vec3<double> box(1.0, 1.5, 2.0);
+    std::vector<vec3<float>> unit = random_points<3>(count, 13);
+    std::vector<vec3<double>> a(count), b(count);
+    for (std::size_t i = 0; i < count; i++) {
+        for (int k = 0; k < 3; k++) {
+            a[i][k] = b[i][k] = 8.0 * unit[i][k] - 4.0;
+        }
+    }
+    bench_clock::time_point start = bench_clock::now();
+    for (std::size_t i = 0; i < count; i++) {
+        a[i] = wrap(a[i], box);
+    }
+    double scalar = seconds_since(start);
+    start = bench_clock::now();
+    wrap(b.data(), count, box);
+    double batch = seconds_since(start);
+    start = bench_clock::now();
+    double sum = 0;
+    for (std::size_t i = 1; i < count; i++) {
+        sum += distance2_periodic(b[i], b[i - 1], box);
+    }
+    double distance = seconds_since(start);
+    std::cout << "wrap one at a time " << count / scalar / 1e6
+              << " M/s, batch " << count / batch / 1e6
+              << " M/s, distance2_periodic " << count / distance / 1e6
+              << " M/s" << (sum < 0 ? "!" : "") << std::endl;
+}
+
+void curve_encoding() {
+    const std::size_t count = std::size_t(1) << 22;
+    std::vector<vec3<float>> points = random_points<3>(count, 17);
+    aabb<float, 3> box = bounding_box(points.data(), count);
+    std::vector<std::uint64_t> codes(count);
+    bench_clock::time_point start = bench_clock::now();
+    for (std::size_t i = 0; i < count; i++) {
+        codes[i] = morton_encode(points[i], box);
+    }
+    double scalar = seconds_since(start);
+    start = bench_clock::now();
+    morton_encode(points.data(), count, box, codes.data());
+    double morton = seconds_since(start);
+    start = bench_clock::now();
+    hilbert_encode(points.data(), count, box, codes.data());
+    double hilbert = seconds_since(start);
+    std::cout << "morton one at a time " << count / scalar / 1e6
+              << " M/s, batch " << count / morton / 1e6 << " M/s, hilbert "
+              << count / hilbert / 1e6 << " M/s" << std::endl;
+}
+
+// neighbour lists (CSR) of every point within r
+static void neighbour_lists(const std::vector<vec3<float>>& points, float r,
+                            std::vector<std::uint32_t>& start,
+                            std::vector<std::uint32_t>& list) {
+    cell_list<float> cells(points.data(), points.size(), r);
+    start.assign(1, 0);
+    list.clear();
+    for (std::size_t i = 0; i < points.size(); i++) {
+        cells.query(points[i], [&](std::uint32_t j, float) {
+            if (j != i)
+                list.push_back(j);
+        });
+        start.push_back((std::uint32_t)list.size());
+    }
+}
+
+// a mass-weighted pair kernel over neighbour lists; returns seconds per pass
+static double neighbour_kernel(const std::vector<vec3<float>>& points,
+                               const std::vector<float>& masses,
+                               const std::vector<std::uint32_t>& start,
+                               const std::vector<std::uint32_t>& list,
+                               std::vector<vec3<float>>& force) {
+    const int reps = 4;
+    bench_clock::time_point begin = bench_clock::now();
+    for (int r = 0; r < reps; r++) {
+        parallel_for(0, points.size(), [&](std::size_t i) {
+            vec3<float> f(0, 0, 0);
+            for (std::uint32_t e = start[i]; e < start[i + 1]; e++) {
+                std::uint32_t j = list[e];
+                vec3<float> d = points[j] - points[i];
+                f = f + d * (masses[j] / (d.length2() + 1e-6f));
+            }
+            force[i] = f;
+        });
+    }
+    return seconds_since(begin) / reps;
+}
+
+void spatial_sort_neighbours() {
+    const std::size_t count = std::size_t(1) << 21;
+    const float r = 0.0125f; // about 16 neighbours
+    std::vector<vec3<float>> points = random_points<3>(count, 19);
+    std::vector<float> masses(count, 1.0f);
+    std::vector<vec3<float>> force(count);
+    std::vector<std::uint32_t> start, list;
+    neighbour_lists(points, r, start, list);
+    double before = neighbour_kernel(points, masses, start, list, force);
+    const curve_order orders[2] = {curve_order::morton,
+                                   curve_order::hilbert};
+    const char* names[2] = {"morton", "hilbert"};
+    std::cout << "random order " << list.size() / before / 1e6
+              << " M pairs/s";
+    for (int o = 0; o < 2; o++) {
+        std::vector<vec3<float>> sorted = points;
+        bench_clock::time_point begin = bench_clock::now();
+        spatial_sort(sorted.data(), count, orders[o], masses.data());
+        double sort = seconds_since(begin);
+        neighbour_lists(sorted, r, start, list);
+        double after = neighbour_kernel(sorted, masses, start, list, force);
+        std::cout << ", " << names[o] << " (sort " << sort << " s) "
+                  << list.size() / after / 1e6 << " M pairs/s";
+    }
+    std::cout << std::endl;
+}
+
+void radix_sort_vec() {
+    const std::size_t count = std::size_t(1) << 22;
+    std::vector<vec3<float>> points = random_points<3>(count, 23);
+    for (std::size_t i = 0; i < count; i += 2) {
+        points[i].x = -points[i].x;
+    }
+    std::vector<vec3<float>> a = points, b = points;
+    bench_clock::time_point start = bench_clock::now();
+    std::sort(a.begin(), a.end(),
+              [](const vec3<float>& p, const vec3<float>& q) {
+                  return p.x < q.x;
+              });
+    double comparison = seconds_since(start);
+    start = bench_clock::now();
+    radix_sort_by_component(b.data(), count, 0);
+    double radix = seconds_since(start);
+    std::vector<float> keys(count);
+    for (std::size_t i = 0; i < count; i++) {
+        keys[i] = points[i].x;
+    }
+    start = bench_clock::now();
+    radix_sort(keys.data(), count);
+    double key_only = seconds_since(start);
+    std::cout << "std::sort by x " << count / comparison / 1e6
+              << " M/s, radix_sort_by_component " << count / radix / 1e6
+              << " M/s, float keys only " << count / key_only / 1e6 << " M/s"
+              << std::endl;
+}
+
+// voxel keys of a thin spherical shell, as in sparse surface data
+static std::vector<vec3<int>> shell_voxels(std::size_t count) {
+    std::vector<vec3<float>> unit = random_points<3>(count, 29);
+    std::vector<vec3<int>> out(count);
+    for (std::size_t i = 0; i < count; i++) {
+        vec3<float> d = unit[i] * 2.0f - vec3<float>(1, 1, 1);
+        d = d * (1000.0f / std::max(d.length(), 1e-6f));
+        out[i] = vec3<int>((int)d.x, (int)d.y, (int)d.z);
+    }
+    return out;
+}
+
+static bool has(const std::unordered_map<vec3<int>, int>& map,
+                const vec3<int>& key) {
+    return map.find(key) != map.end();
+}
+
+static bool has(const vec_hash_map<int, 3, int>& map, const vec3<int>& key) {
+    return map.contains(key);
+}
+
+template <typename M>
+static void time_voxel_map(M& map, const std::vector<vec3<int>>& keys,
+                           double& insert, double& lookup, long& hits) {
+    bench_clock::time_point start = bench_clock::now();
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        map[keys[i]] += 1;
+    }
+    insert = seconds_since(start);
+    start = bench_clock::now();
+    hits = 0;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        vec3<int> k = keys[i];
+        k.x += (int)(i & 1); // half the probes miss or hit a neighbour
+        hits += has(map, k);
+    }
+    lookup = seconds_since(start);
+}
+
+void voxel_hash() {
+    const std::size_t count = std::size_t(1) << 22;
+    std::vector<vec3<int>> keys = shell_voxels(count);
+    double insert[2], lookup[2];
+    long hits[2];
+    std::unordered_map<vec3<int>, int> standard;
+    time_voxel_map(standard, keys, insert[0], lookup[0], hits[0]);
+    vec_hash_map<int, 3, int> open;
+    time_voxel_map(open, keys, insert[1], lookup[1], hits[1]);
+    // nodes hold the pair, a next pointer and the cached hash
+    double standard_bytes = standard.size() * (sizeof(vec3<int>) + 24.0) +
+                            standard.bucket_count() * sizeof(void*);
+    double open_bytes = open.capacity() * (sizeof(vec3<int>) + 5.0);
+    const char* names[2] = {"std::unordered_map", "vec_hash_map"};
+    double bytes[2] = {standard_bytes, open_bytes};
+    std::cout << open.size() << " voxels" << std::endl;
+    for (int m = 0; m < 2; m++) {
+        std::cout << names[m] << ": insert " << count / insert[m] / 1e6
+                  << " M/s, find " << count / lookup[m] / 1e6 << " M/s ("
+                  << hits[m] << " hits), ~" << bytes[m] / open.size()
+                  << " bytes/entry" << std::endl;
+    }
+}
+
+void octree_queries() {
+    const std::size_t count = std::size_t(1) << 21, queries = 1 << 16;
+    const std::size_t k = 8;
+    std::vector<vec3<float>> points = random_points<3>(count, 37);
+    std::vector<vec3<float>> q = random_points<3>(queries, 38);
+    bench_clock::time_point start = bench_clock::now();
+    octree<float> tree(points.data(), count);
+    double build = seconds_since(start);
+    std::vector<neighbor<float>> out(queries * k);
+    start = bench_clock::now();
+    tree.knn(q.data(), queries, k, out.data());
+    double knn = seconds_since(start);
+    kd_tree<float, 3> kd(points.data(), count);
+    start = bench_clock::now();
+    kd.knn(q.data(), queries, k, out.data());
+    double kd_knn = seconds_since(start);
+    // small boxes and a camera frustum over the unit cube
+    std::vector<std::uint32_t> found;
+    const vec3<float> edge(0.05f, 0.05f, 0.05f);
+    start = bench_clock::now();
+    for (std::size_t i = 0; i < 4096; i++) {
+        found.clear();
+        tree.range(aabb<float, 3>(q[i], q[i] + edge), found);
+    }
+    double boxes = seconds_since(start) / 4096;
+    const float view[16] = {2, 0, 0, -1, 0, 2, 0, -1, 0, 0, -1.1f, 0.9f,
+                            0, 0, -1, 1.5f};
+    start = bench_clock::now();
+    found.clear();
+    tree.range(frustum<float>::from_matrix(view), found);
+    double visible = seconds_since(start);
+    std::cout << "build " << build << " s (" << tree.nodes().size()
+              << " nodes, depth " << tree.depth() << "), knn "
+              << queries / knn / 1e6 << " M/s (k-d tree "
+              << queries / kd_knn / 1e6 << " M/s), box " << boxes * 1e6
+              << " us, frustum " << found.size() << " points in "
+              << visible * 1e3 << " ms" << std::endl;
+}
+
+void barnes_hut_gravity() {
+    const std::size_t count = std::size_t(1) << 18, samples = 256;
+    const double eps = 1e-3;
+    std::vector<vec3<float>> unit = random_points<3>(count, 41);
+    std::vector<vec3<double>> points(count);
+    std::vector<double> masses(count, 1.0 / count);
+    for (std::size_t i = 0; i < count; i++) {
+        // half the particles in a small clump
+        double scale = (i & 1) ? 1.0 : 0.05;
+        for (int k = 0; k < 3; k++) {
+            points[i][k] = scale * unit[i][k];
+        }
+    }
+    // direct summation for a sample of targets, the usual O(N^2) loop
+    std::vector<vec3<double>> exact(samples, vec3<double>(0, 0, 0));
+    bench_clock::time_point start = bench_clock::now();
+    for (std::size_t s = 0; s < samples; s++) {
+        const vec3<double>& p = points[s * (count / samples)];
+        for (std::size_t j = 0; j < count; j++) {
+            double d2 = p.distance2(points[j]) + eps * eps;
+            exact[s] = exact[s] +
+                       (points[j] - p) * (masses[j] / (d2 * std::sqrt(d2)));
+        }
+    }
+    double direct = seconds_since(start) / samples * count;
+    start = bench_clock::now();
+    barnes_hut<double> solver(points.data(), masses.data(), count);
+    double build = seconds_since(start);
+    std::cout << "direct (extrapolated) " << direct << " s, build " << build
+              << " s" << std::endl;
+    std::vector<vec3<double>> a(count);
+    for (int quad = 0; quad < 2; quad++) {
+        for (double theta = 0.4; theta < 0.8; theta += 0.3) {
+            start = bench_clock::now();
+            solver.accelerations(a.data(), theta, eps, quad != 0);
+            double t = seconds_since(start);
+            double error = 0, norm = 0;
+            for (std::size_t s = 0; s < samples; s++) {
+                error += (a[s * (count / samples)] - exact[s]).length2();
+                norm += exact[s].length2();
+            }
+            std::cout << (quad ? "quadrupole" : "monopole") << " theta "
+                      << theta << ": " << t << " s, rms error "
+                      << std::sqrt(error / norm) << std::endl;
+        }
+    }
+}
+
+// prints all-pairs interactions per second, and GFLOP/s counting the
+// customary 20 flops per interaction
+void report_interactions(const char* name, std::size_t count, double t) {
+    double rate = (double)count * (double)count / t;
+    std::cout << name << ": " << t << " s, " << rate * 1e-9
+              << " G interactions/s, " << rate * 20e-9 << " GFLOP/s"
+              << std::endl;
+}
+
+template <typename T> void time_direct(const char* type, std::size_t count) {
+    std::vector<vec3<float>> unit = random_points<3>(count, 43);
+    std::vector<vec3<T>> points(count);
+    std::vector<T> masses(count, (T)1 / (T)count);
+    for (std::size_t i = 0; i < count; i++) {
+        points[i] = vec3<T>((T)unit[i].x, (T)unit[i].y, (T)unit[i].z);
+    }
+    const T eps2 = (T)1e-6;
+    // the textbook double loop over vec3 particles
+    std::vector<vec3<T>> naive(count, vec3<T>(0, 0, 0)), tiled(count);
+    bench_clock::time_point start = bench_clock::now();
+    for (std::size_t i = 0; i < count; i++) {
+        for (std::size_t j = 0; j < count; j++) {
+            T s = points[i].distance2(points[j]) + eps2;
+            naive[i] = naive[i] + (points[j] - points[i]) *
+                                      (masses[j] / (s * std::sqrt(s)));
+        }
+    }
+    std::cout << type << " ";
+    report_interactions("naive", count, seconds_since(start));
+    start = bench_clock::now();
+    direct_accelerations(points.data(), masses.data(), count, tiled.data(),
+                         std::sqrt(eps2));
+    std::cout << type << " ";
+    report_interactions("tiled", count, seconds_since(start));
+    double error = 0, norm = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        error += (double)(tiled[i] - naive[i]).length2();
+        norm += (double)naive[i].length2();
+    }
+    std::cout << type << " rms difference " << std::sqrt(error / norm)
+              << std::endl;
+}
+
+void direct_nbody() {
+    time_direct<float>("float", std::size_t(1) << 13);
+    time_direct<double>("double", std::size_t(1) << 13);
+}
+
+void mesh_deposit() {
+    const int n = 512;
+    const std::size_t count = std::size_t(1) << 24;
+    std::vector<vec3<float>> points = random_points<3>(count, 45);
+    std::vector<float> masses(count, 1.0f);
+    std::vector<float> values(count);
+    mesh<float> grid(n, n, n, vec3<float>(1, 1, 1));
+    const char* names[] = {"ngp", "cic", "tsc"};
+    for (int s = 0; s < 3; s++) {
+        mass_assignment scheme = (mass_assignment)s;
+        // particles in index order straight into the grid, one thread
+        grid.fill(0);
+        bench_clock::time_point start = bench_clock::now();
+        for (std::size_t i = 0; i < count; i++) {
+            detail::cloud<float> c(grid, scheme,
+                                   grid.cell_coordinates(points[i]));
+            detail::deposit_one(grid, c, masses[i]);
+        }
+        double naive = seconds_since(start);
+        grid.fill(0);
+        start = bench_clock::now();
+        deposit(grid, points.data(), masses.data(), count, scheme);
+        double slabs = seconds_since(start);
+        start = bench_clock::now();
+        gather(grid, points.data(), count, scheme, values.data());
+        double gathered = seconds_since(start);
+        std::cout << names[s] << " " << n << "^3: serial deposit "
+                  << count / naive * 1e-6 << " M/s, slab deposit "
+                  << count / slabs * 1e-6 << " M/s, gather "
+                  << count / gathered * 1e-6 << " M/s" << std::endl;
+    }
+}
+
+// the textbook iterative radix-2 FFT on std::complex, as a baseline
+void radix2_fft(std::vector<std::complex<float>>& a) {
+    std::size_t n = a.size();
+    for (std::size_t i = 1, j = 0; i < n; i++) {
+        std::size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j)
+            std::swap(a[i], a[j]);
+    }
+    for (std::size_t len = 2; len <= n; len <<= 1) {
+        double angle = -6.283185307179586 / len;
+        std::complex<float> step((float)std::cos(angle),
+                                 (float)std::sin(angle));
+        for (std::size_t i = 0; i < n; i += len) {
+            std::complex<float> w(1, 0);
+            for (std::size_t k = 0; k < len / 2; k++) {
+                std::complex<float> u = a[i + k], v = a[i + k + len / 2] * w;
+                a[i + k] = u + v;
+                a[i + k + len / 2] = u - v;
+                w *= step;
+            }
+        }
+    }
+}
+
+// GFLOP/s by the usual 5 n log2(n) count of a complex transform
+static double fft_gflops(double n, double transforms, double t) {
+    return 5 * n * std::log2(n) * transforms / t * 1e-9;
+}
+
+void fft_transforms() {
+    const std::size_t n = std::size_t(1) << 20;
+    std::vector<std::complex<float>> a(n), b;
+    for (std::size_t i = 0; i < n; i++) {
+        a[i] = std::complex<float>((float)std::sin(0.01 * i), 0);
+    }
+    b = a;
+    bench_clock::time_point start = bench_clock::now();
+    radix2_fft(b);
+    double t = seconds_since(start);
+    std::cout << "1D 2^20 radix-2 baseline: " << t << " s, "
+              << fft_gflops(n, 1, t) << " GFLOP/s" << std::endl;
+    fft_plan<float> plan(n);
+    start = bench_clock::now();
+    plan.transform(a.data(), fft_direction::forward);
+    t = seconds_since(start);
+    std::cout << "1D 2^20 plan: " << t << " s, " << fft_gflops(n, 1, t)
+              << " GFLOP/s" << std::endl;
+
+    // 4096 transforms of 1024 points, one at a time and 16 lanes at a time
+    const std::size_t m = 1024, count = 4096, lanes = 16;
+    fft_plan<float> small(m);
+    std::vector<std::complex<float>> many(m * count);
+    for (std::size_t i = 0; i < many.size(); i++) {
+        many[i] = std::complex<float>((float)std::cos(0.3 * i), 0);
+    }
+    start = bench_clock::now();
+    for (std::size_t c = 0; c < count; c++) {
+        small.transform(&many[c * m], fft_direction::forward);
+    }
+    t = seconds_since(start);
+    std::cout << "4096 x 1024 one by one: " << t << " s, "
+              << fft_gflops(m, count, t) << " GFLOP/s" << std::endl;
+    std::vector<float> re(m * lanes), im(m * lanes), work(2 * m * lanes);
+    start = bench_clock::now();
+    for (std::size_t c = 0; c < count; c += lanes) {
+        for (std::size_t b = 0; b < lanes; b++) {
+            for (std::size_t j = 0; j < m; j++) {
+                re[j * lanes + b] = many[(c + b) * m + j].real();
+                im[j * lanes + b] = many[(c + b) * m + j].imag();
+            }
+        }
+        small.transform_lanes(re.data(), im.data(), lanes,
+                              fft_direction::forward, work.data());
+        for (std::size_t b = 0; b < lanes; b++) {
+            for (std::size_t j = 0; j < m; j++) {
+                many[(c + b) * m + j] = std::complex<float>(
+                    re[j * lanes + b], im[j * lanes + b]);
+            }
+        }
+    }
+    t = seconds_since(start);
+    std::cout << "4096 x 1024 in lanes: " << t << " s, "
+              << fft_gflops(m, count, t) << " GFLOP/s" << std::endl;
+
+    const int g = 256;
+    fft3d<float> fft(g, g, g);
+    std::vector<float> grid((std::size_t)g * g * g);
+    for (std::size_t i = 0; i < grid.size(); i++) {
+        grid[i] = (float)std::sin(0.001 * i);
+    }
+    std::vector<std::complex<float>> spectrum(fft.spectrum_size());
+    start = bench_clock::now();
+    fft.forward(grid.data(), spectrum.data());
+    double forward = seconds_since(start);
+    start = bench_clock::now();
+    fft.inverse(spectrum.data(), grid.data());
+    double inverse = seconds_since(start);
+    // a real transform counts half the flops of a complex one
+    double points = (double)grid.size();
+    std::cout << "3D 256^3 real: forward " << forward << " s ("
+              << fft_gflops(points, 0.5, forward) << " GFLOP/s), inverse "
+              << inverse << " s" << std::endl;
+    const int c3 = 128;
+    fft3d<float> complex_fft(c3, c3, c3);
+    std::vector<std::complex<float>> cube((std::size_t)c3 * c3 * c3);
+    for (std::size_t i = 0; i < cube.size(); i++) {
+        cube[i] = std::complex<float>((float)std::cos(0.002 * i), 0);
+    }
+    start = bench_clock::now();
+    complex_fft.transform(cube.data(), fft_direction::forward);
+    t = seconds_since(start);
+    std::cout << "3D 128^3 complex: " << t << " s, "
+              << fft_gflops((double)cube.size(), 1, t) << " GFLOP/s"
+              << std::endl;
+}
+
+// clumps of points on a uniform background, in a periodic unit box; the
+// baseline labels every point, friends_of_friends keeps groups of 8 or more
+void fof_groups() {
+    const std::size_t count = std::size_t(1) << 20, clumps = 4096;
+    const float b = 0.0015f;
+    const vec3<float> box(1, 1, 1);
+    std::vector<vec3<float>> points = random_points<3>(count, 47);
+    std::vector<vec3<float>> centres = random_points<3>(clumps, 53);
+    for (std::size_t i = 0; i < count / 2; i++) {
+        vec3<float> offset = points[i] - vec3<float>(0.5f, 0.5f, 0.5f);
+        points[i] = wrap(centres[i % clumps] + offset * 0.01f, box);
+    }
+    // breadth-first search over cell_list queries, one thread
+    bench_clock::time_point start = bench_clock::now();
+    cell_list<float> cells(points.data(), count, b, box);
+    std::vector<std::uint32_t> label(count, ~0u), queue;
+    std::size_t bfs_groups = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        if (label[i] != ~0u)
+            continue;
+        label[i] = (std::uint32_t)bfs_groups;
+        queue.assign(1, (std::uint32_t)i);
+        while (!queue.empty()) {
+            std::uint32_t p = queue.back();
+            queue.pop_back();
+            cells.query(points[p], [&](std::uint32_t j, float) {
+                if (label[j] == ~0u) {
+                    label[j] = (std::uint32_t)bfs_groups;
+                    queue.push_back(j);
+                }
+            });
+        }
+        bfs_groups++;
+    }
+    double bfs = seconds_since(start);
+    start = bench_clock::now();
+    friends_of_friends<float> fof;
+    fof.build(points.data(), count, b, box, 8);
+    double found = seconds_since(start);
+    std::cout << count << " points: serial bfs " << bfs << " s ("
+              << bfs_groups << " groups), union-find " << found << " s ("
+              << fof.group_count() << " of 8+, largest "
+              << fof.groups()[0].size << ")" << std::endl;
+}
+
+// the scalar Lloyd step: every point against every centroid
+template <std::size_t n>
+static std::size_t lloyd_step(const std::vector<vec<float, n>>& points,
+                              std::vector<vec<float, n>>& centroids,
+                              std::vector<std::uint32_t>& labels) {
+    std::size_t k = centroids.size(), changed = 0;
+    std::vector<vec<float, n>> sums(k);
+    std::vector<std::size_t> sizes(k, 0);
+    for (std::size_t i = 0; i < points.size(); i++) {
+        std::uint32_t best = 0;
+        float best_d2 = std::numeric_limits<float>::max();
+        for (std::size_t j = 0; j < k; j++) {
+            float d2 = points[i].distance2(centroids[j]);
+            if (d2 < best_d2) {
+                best_d2 = d2;
+                best = (std::uint32_t)j;
+            }
+        }
+        changed += labels[i] != best;
+        labels[i] = best;
+        sums[best] = sums[best] + points[i];
+        sizes[best]++;
+    }
+    for (std::size_t j = 0; j < k; j++) {
+        if (sizes[j] > 0)
+            centroids[j] = sums[j] / (float)sizes[j];
+    }
+    return changed;
+}
+
+// 64-dimensional descriptors scattered around 256 centres
+void kmeans_descriptors() {
+    const std::size_t count = std::size_t(1) << 18, k = 256;
+    std::vector<vec<float, 64>> points = random_points<64>(count, 67);
+    std::vector<vec<float, 64>> centres = random_points<64>(k, 71);
+    for (std::size_t i = 0; i < count; i++) {
+        points[i] = centres[(i * 7919) % k] + points[i] * 0.4f;
+    }
+    std::vector<vec<float, 64>> centroids(points.begin(), points.begin() + k);
+    std::vector<std::uint32_t> labels(count, 0);
+    const int steps = 3;
+    bench_clock::time_point start = bench_clock::now();
+    for (int s = 0; s < steps; s++) {
+        lloyd_step(points, centroids, labels);
+    }
+    double naive = seconds_since(start) / steps;
+    kmeans<float, 64> km;
+    start = bench_clock::now();
+    km.fit(points.data(), count, k, 100);
+    double total = seconds_since(start);
+    const kmeans_stats& stats = km.stats();
+    std::cout << count << " x 64 floats, k = " << k
+              << ": scalar lloyd step " << naive << " s" << std::endl;
+    for (std::size_t it = 0; it < stats.iterations.size(); it++) {
+        const kmeans_iteration& i = stats.iterations[it];
+        if ((it < 3) || (it + 1 == stats.iterations.size()))
+            std::cout << "  iteration " << it << ": " << i.seconds << " s, "
+                      << (double)i.distances / count
+                      << " distances per point, " << i.reassigned
+                      << " reassigned" << std::endl;
+    }
+    std::cout << "seeding " << stats.seeding_seconds << " s, "
+              << stats.iterations.size() << " iterations in " << total
+              << " s, converged " << stats.converged << ", inertia "
+              << stats.inertia << std::endl;
+}
+
+int main(int argc, char** argv) {
+    BENCH(numa_bandwidth)
+    BENCH(streaming_stores)
+    BENCH(gather_prefetch)
+    BENCH(kd_tree_knn)
+    BENCH(bvh_rays)
+    BENCH(cell_list_pairs)
+    BENCH(periodic_wrap)
+    BENCH(curve_encoding)
+    BENCH(spatial_sort_neighbours)
+    BENCH(radix_sort_vec)
+    BENCH(voxel_hash)
+    BENCH(octree_queries)
+    BENCH(barnes_hut_gravity)
+    BENCH(direct_nbody)
+    BENCH(mesh_deposit)
+    BENCH(fft_transforms)
+    BENCH(fof_groups)
+    BENCH(kmeans_descriptors)
+    return 0;
+}
@@ -2,4 +2,31 @@
 
 clang-format -i example.cpp
 clang-format -i test.cpp
-clang-format -i hqvec.hpp
\ No newline at end of file
+clang-format -i hqvec.hpp
+clang-format -i hqbounds.hpp
+clang-format -i hqquant.hpp
+clang-format -i hqdelta.hpp
+clang-format -i hqasync.hpp
+clang-format -i hqparallel.hpp
+clang-format -i hqstream.hpp
+clang-format -i hqply.hpp
+clang-format -i hqalloc.hpp
+clang-format -i hqnuma.hpp
+clang-format -i bench.cpp
+clang-format -i hqbatch.hpp
+clang-format -i hqkdtree.hpp
+clang-format -i hqbvh.hpp
+clang-format -i hqcells.hpp
+clang-format -i hqperiodic.hpp
+clang-format -i hqcurve.hpp
+clang-format -i hqspatial.hpp
+clang-format -i hqradix.hpp
+clang-format -i hqhash.hpp
+clang-format -i hqoctree.hpp
+clang-format -i hqsimd.hpp
+clang-format -i hqbarneshut.hpp
+clang-format -i hqnbody.hpp
+clang-format -i hqmesh.hpp
+clang-format -i hqfft.hpp
+clang-format -i hqfof.hpp
+clang-format -i hqkmeans.hpp
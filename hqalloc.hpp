@@ -0,0 +1,829 @@
+/**
+ * @file hqalloc.hpp
+ * @brief This file defines aligned allocation, an aligned, padded container
+ * for arrays of vectors, and per-thread arenas for scratch buffers.
+ */
+
+#ifndef _HQALLOC_HPP_
+#define _HQALLOC_HPP_
+
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace HQ {
+
+/** @brief Cache line size assumed for alignment defaults. */
+static const std::size_t cache_line_size = 64;
+
+/** @brief Transparent huge page size assumed on Linux. */
+static const std::size_t huge_page_size = std::size_t(2) << 20;
+
+/**
+ * @brief Whether large allocations should be backed by huge pages.
+ */
+enum class page_policy {
+    /** @brief Ordinary pages. */
+    normal,
+    /** @brief Transparent huge pages for allocations of 2 MiB or more. */
+    huge
+};
+
+namespace detail {
+
+/**
+ * @brief Allocates `bytes` aligned to `align` (a power of two), optionally
+ * from huge-page-advised anonymous memory.
+ */
+static inline void* aligned_alloc_bytes(std::size_t bytes, std::size_t align,
+                                        page_policy pages) {
+    if (bytes == 0)
+        bytes = 1;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if ((pages == page_policy::huge) && (bytes >= huge_page_size)) {
+        std::size_t len =
+            (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        madvise(p, len, MADV_HUGEPAGE);
+        return p;
+    }
+#endif
+    void* p = nullptr;
+    if (align < sizeof(void*))
+        align = sizeof(void*);
+    if (posix_memalign(&p, align, bytes) != 0)
+        throw std::bad_alloc();
+    return p;
+}
+
+/**
+ * @brief Frees memory from aligned_alloc_bytes; the arguments must match.
+ */
+static inline void aligned_free_bytes(void* p, std::size_t bytes,
+                                      page_policy pages) {
+    if (!p)
+        return;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if ((pages == page_policy::huge) && (bytes >= huge_page_size)) {
+        munmap(p, (bytes + huge_page_size - 1) / huge_page_size *
+                      huge_page_size);
+        return;
+    }
+#endif
+    (void)bytes;
+    (void)pages;
+    std::free(p);
+}
+
+} // namespace detail
+
+/**
+ * @brief A standard allocator returning memory aligned to `Align` bytes.
+ *
+ * @tparam T The allocated type.
+ * @tparam Align The alignment in bytes (a power of two, at least alignof(T)).
+ */
+template <typename T, std::size_t Align = cache_line_size>
+class aligned_allocator {
+    static_assert((Align & (Align - 1)) == 0, "alignment must be a power of 2");
+    static_assert(Align >= alignof(T), "alignment weaker than the type's");
+
+  private:
+    page_policy m_pages;
+
+  public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U> struct rebind {
+        typedef aligned_allocator<U, Align> other;
+    };
+
+    /**
+     * @brief Constructs an allocator.
+     *
+     * @param pages Whether large blocks should use huge pages.
+     */
+    aligned_allocator(page_policy pages = page_policy::normal)
+        : m_pages(pages) {}
+
+    /**
+     * @brief Converts from an allocator for another type.
+     */
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Align>& other)
+        : m_pages(other.pages()) {}
+
+    /**
+     * @brief Returns the page policy.
+     *
+     * @return page_policy The policy this allocator was built with.
+     */
+    page_policy pages() const { return m_pages; }
+
+    /**
+     * @brief Allocates storage for `count` objects.
+     *
+     * @param count The number of objects.
+     * @return T* Storage aligned to Align bytes.
+     */
+    T* allocate(std::size_t count) {
+        if (count > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_alloc();
+        return (T*)detail::aligned_alloc_bytes(count * sizeof(T), Align,
+                                               m_pages);
+    }
+
+    /**
+     * @brief Frees storage from allocate().
+     *
+     * @param p The storage.
+     * @param count The count passed to allocate().
+     */
+    void deallocate(T* p, std::size_t count) {
+        detail::aligned_free_bytes(p, count * sizeof(T), m_pages);
+    }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U, Align>& other) const {
+        return m_pages == other.pages();
+    }
+
+    template <typename U>
+    bool operator!=(const aligned_allocator<U, Align>& other) const {
+        return m_pages != other.pages();
+    }
+};
+
+/**
+ * @brief A contiguous array of vectors with aligned, padded storage.
+ *
+ * Storage starts on the allocator's alignment (a cache line by default) and
+ * is always allocated, and kept zero past size(), up to a whole number of
+ * cache lines, so kernels walking the scalars in full-width vector registers
+ * may process the tail without a scalar remainder loop. padded_scalars()
+ * gives the number of scalars that may be touched this way.
+ *
+ * @tparam T The data type of the vectors.
+ * @tparam n The dimension of the vectors.
+ * @tparam Alloc Allocator for vec<T, n>.
+ */
+template <typename T, std::size_t n,
+          typename Alloc = aligned_allocator<vec<T, n>, cache_line_size>>
+class vec_array {
+    static_assert(std::is_trivially_copyable<vec<T, n>>::value,
+                  "vec_array relocates elements with memcpy");
+
+  public:
+    typedef vec<T, n> value_type;
+    typedef vec<T, n>* iterator;
+    typedef const vec<T, n>* const_iterator;
+    typedef Alloc allocator_type;
+
+  private:
+    Alloc m_alloc;
+    vec<T, n>* m_data = nullptr;
+    std::size_t m_size = 0;
+    /** @brief Allocated elements, including padding. */
+    std::size_t m_capacity = 0;
+
+    /** @brief Alignment used to size the padding. */
+    static std::size_t pad_bytes() { return cache_line_size; }
+
+    static std::size_t padded_count(std::size_t count) {
+        std::size_t bytes = count * sizeof(vec<T, n>);
+        bytes = (bytes + pad_bytes() - 1) / pad_bytes() * pad_bytes();
+        return (bytes + sizeof(vec<T, n>) - 1) / sizeof(vec<T, n>);
+    }
+
+    void reallocate(std::size_t count) {
+        std::size_t cap = padded_count(count);
+        vec<T, n>* data = std::allocator_traits<Alloc>::allocate(m_alloc, cap);
+        std::size_t keep = m_size < count ? m_size : count;
+        if (keep)
+            std::memcpy((void*)data, (const void*)m_data,
+                        keep * sizeof(vec<T, n>));
+        zero(data, keep, cap);
+        release();
+        m_data = data;
+        m_capacity = cap;
+        m_size = keep;
+    }
+
+    /**
+     * @brief Zeroes [lo, hi); large ranges are zeroed across threads on the
+     * same static partitions as parallel_for, so first-touch placement
+     * matches later batch kernels.
+     */
+    static void zero(vec<T, n>* data, std::size_t lo, std::size_t hi) {
+        const std::size_t parallel_bytes = std::size_t(4) << 20;
+        if ((hi - lo) * sizeof(vec<T, n>) < parallel_bytes) {
+            std::memset((void*)(data + lo), 0, (hi - lo) * sizeof(vec<T, n>));
+            return;
+        }
+        parallel_for_ranges(
+            lo, hi,
+            [data](std::size_t a, std::size_t b, unsigned) {
+                std::memset((void*)(data + a), 0, (b - a) * sizeof(vec<T, n>));
+            },
+            4096);
+    }
+
+    void release() {
+        if (m_data)
+            std::allocator_traits<Alloc>::deallocate(m_alloc, m_data,
+                                                     m_capacity);
+        m_data = nullptr;
+        m_capacity = 0;
+        m_size = 0;
+    }
+
+  public:
+    /**
+     * @brief Constructs an empty array.
+     *
+     * @param alloc The allocator to use.
+     */
+    vec_array(const Alloc& alloc = Alloc()) : m_alloc(alloc) {}
+
+    /**
+     * @brief Constructs an array of zero vectors.
+     *
+     * @param count The number of vectors.
+     * @param alloc The allocator to use.
+     */
+    vec_array(std::size_t count, const Alloc& alloc = Alloc())
+        : m_alloc(alloc) {
+        resize(count);
+    }
+
+    /**
+     * @brief Constructs an array by copying vectors.
+     *
+     * @param in The vectors to copy.
+     * @param count The number of vectors.
+     * @param alloc The allocator to use.
+     */
+    vec_array(const vec<T, n>* in, std::size_t count,
+              const Alloc& alloc = Alloc())
+        : m_alloc(alloc) {
+        resize(count);
+        if (count)
+            std::memcpy((void*)m_data, (const void*)in,
+                        count * sizeof(vec<T, n>));
+    }
+
+    vec_array(const vec_array& other)
+        : vec_array(other.data(), other.size(), other.m_alloc) {}
+
+    vec_array(vec_array&& other)
+        : m_alloc(other.m_alloc), m_data(other.m_data), m_size(other.m_size),
+          m_capacity(other.m_capacity) {
+        other.m_data = nullptr;
+        other.m_size = 0;
+        other.m_capacity = 0;
+    }
+
+    vec_array& operator=(const vec_array& other) {
+        if (this != &other) {
+            clear();
+            resize(other.size());
+            if (m_size)
+                std::memcpy((void*)m_data, (const void*)other.m_data,
+                            m_size * sizeof(vec<T, n>));
+        }
+        return *this;
+    }
+
+    vec_array& operator=(vec_array&& other) {
+        if (this != &other) {
+            release();
+            m_alloc = other.m_alloc;
+            m_data = other.m_data;
+            m_size = other.m_size;
+            m_capacity = other.m_capacity;
+            other.m_data = nullptr;
+            other.m_size = 0;
+            other.m_capacity = 0;
+        }
+        return *this;
+    }
+
+    ~vec_array() { release(); }
+
+    /**
+     * @brief Accesses a vector.
+     *
+     * @param i The index of the vector.
+     * @return vec<T, n>& Reference to the vector.
+     */
+    vec<T, n>& operator[](std::size_t i) { return m_data[i]; }
+
+    /**
+     * @brief Accesses a vector (const version).
+     *
+     * @param i The index of the vector.
+     * @return const vec<T, n>& Reference to the vector.
+     */
+    const vec<T, n>& operator[](std::size_t i) const { return m_data[i]; }
+
+    vec<T, n>* data() { return m_data; }
+    const vec<T, n>* data() const { return m_data; }
+    iterator begin() { return m_data; }
+    iterator end() { return m_data + m_size; }
+    const_iterator begin() const { return m_data; }
+    const_iterator end() const { return m_data + m_size; }
+
+    /**
+     * @brief Returns the number of vectors.
+     *
+     * @return std::size_t The size of the array.
+     */
+    std::size_t size() const { return m_size; }
+
+    /**
+     * @brief Checks whether the array is empty.
+     *
+     * @return bool True if size() is 0.
+     */
+    bool empty() const { return m_size == 0; }
+
+    /**
+     * @brief Returns the number of vectors that fit without reallocating.
+     *
+     * @return std::size_t The allocated capacity, including padding.
+     */
+    std::size_t capacity() const { return m_capacity; }
+
+    /**
+     * @brief Returns the array as a flat scalar pointer.
+     *
+     * @return T* Pointer to the first component of the first vector.
+     */
+    T* scalars() { return reinterpret_cast<T*>(m_data); }
+    const T* scalars() const { return reinterpret_cast<const T*>(m_data); }
+
+    /**
+     * @brief Returns how many scalars may be read or written from scalars(),
+     * rounded up to whole cache lines. Scalars past size() * n are zero
+     * unless a kernel wrote to them.
+     *
+     * @return std::size_t The padded scalar count.
+     */
+    std::size_t padded_scalars() const {
+        std::size_t bytes = m_size * sizeof(vec<T, n>);
+        bytes = (bytes + pad_bytes() - 1) / pad_bytes() * pad_bytes();
+        return bytes / sizeof(T);
+    }
+
+    /**
+     * @brief Ensures capacity for at least `count` vectors.
+     *
+     * @param count The number of vectors.
+     */
+    void reserve(std::size_t count) {
+        if (count > m_capacity)
+            reallocate(count);
+    }
+
+    /**
+     * @brief Changes the number of vectors; new vectors are zero.
+     *
+     * @param count The new size.
+     */
+    void resize(std::size_t count) {
+        if (count > m_capacity) {
+            std::size_t grow = m_capacity + m_capacity / 2;
+            reallocate(count > grow ? count : grow); // fresh storage is zero
+            m_size = count;
+            return;
+        }
+        // keep everything past size() zero, whatever kernels left there
+        std::size_t lo = count < m_size ? count : m_size;
+        std::size_t hi = padded_count(count > m_size ? count : m_size);
+        hi = hi < m_capacity ? hi : m_capacity;
+        if (hi > lo)
+            zero(m_data, lo, hi);
+        m_size = count;
+    }
+
+    /**
+     * @brief Appends a vector.
+     *
+     * @param v The vector to append.
+     */
+    void push_back(const vec<T, n>& v) {
+        resize(m_size + 1);
+        m_data[m_size - 1] = v;
+    }
+
+    /**
+     * @brief Removes every vector, keeping the storage.
+     */
+    void clear() { resize(0); }
+
+    /**
+     * @brief Returns the allocator.
+     *
+     * @return Alloc A copy of the allocator.
+     */
+    Alloc get_allocator() const { return m_alloc; }
+};
+
+/**
+ * @brief Usage statistics for an arena.
+ */
+struct arena_stats {
+    /** @brief Bytes currently handed out. */
+    std::size_t in_use = 0;
+    /** @brief Largest in_use seen since construction or reset_stats(). */
+    std::size_t high_water = 0;
+    /** @brief Bytes held in blocks. */
+    std::size_t capacity = 0;
+    /** @brief Number of blocks held. */
+    std::size_t blocks = 0;
+    /** @brief Allocations served since construction or reset_stats(). */
+    std::size_t allocations = 0;
+};
+
+/**
+ * @brief A bump allocator over a list of cache-line-aligned blocks.
+ *
+ * Allocation is a pointer bump; memory is reclaimed all at once by reset()
+ * (typically at the end of a frame) or back to a marker by rewind(). After
+ * a reset, blocks are merged into one sized to the high-water mark, so a
+ * steady-state frame allocates from a single block and never calls malloc.
+ */
+class arena {
+  public:
+    /**
+     * @brief A position in the arena that can be rewound to.
+     */
+    struct marker {
+        std::size_t block;
+        std::size_t offset;
+    };
+
+  private:
+    struct block {
+        char* data;
+        std::size_t size;
+    };
+
+    std::vector<block> m_blocks;
+    std::size_t m_current = 0;
+    std::size_t m_offset = 0;
+    /** @brief Bytes in blocks before m_current. */
+    std::size_t m_below = 0;
+    std::size_t m_min_block;
+    arena_stats m_stats;
+
+    void add_block(std::size_t bytes) {
+        block b;
+        b.size = bytes;
+        b.data = (char*)detail::aligned_alloc_bytes(bytes, cache_line_size,
+                                                    page_policy::normal);
+        m_blocks.push_back(b);
+        m_stats.capacity += bytes;
+        m_stats.blocks++;
+    }
+
+    void free_blocks() {
+        for (std::size_t i = 0; i < m_blocks.size(); i++) {
+            detail::aligned_free_bytes(m_blocks[i].data, m_blocks[i].size,
+                                       page_policy::normal);
+        }
+        m_blocks.clear();
+        m_stats.capacity = 0;
+        m_stats.blocks = 0;
+    }
+
+  public:
+    /**
+     * @brief Constructs an empty arena; no memory is taken until first use.
+     *
+     * @param min_block Smallest block to allocate.
+     */
+    arena(std::size_t min_block = std::size_t(1) << 20)
+        : m_min_block(min_block) {}
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    ~arena() { free_blocks(); }
+
+    /**
+     * @brief Allocates bytes from the arena.
+     *
+     * @param bytes The number of bytes.
+     * @param align The alignment (a power of two, at most a cache line).
+     * @return void* The memory; valid until reset() or a rewind past it.
+     */
+    void* allocate(std::size_t bytes, std::size_t align = alignof(double)) {
+        for (;;) {
+            if (m_current < m_blocks.size()) {
+                block& b = m_blocks[m_current];
+                std::size_t start = (m_offset + align - 1) & ~(align - 1);
+                if (start + bytes <= b.size) {
+                    m_offset = start + bytes;
+                    m_stats.in_use = m_below + m_offset;
+                    if (m_stats.in_use > m_stats.high_water)
+                        m_stats.high_water = m_stats.in_use;
+                    m_stats.allocations++;
+                    return b.data + start;
+                }
+                // move on to the next block, reusing it if one is held
+                m_below += b.size;
+                m_current++;
+                m_offset = 0;
+                if (m_current < m_blocks.size())
+                    continue;
+            }
+            std::size_t last = m_blocks.empty() ? 0 : m_blocks.back().size;
+            std::size_t size = last * 2 > m_min_block ? last * 2 : m_min_block;
+            add_block(size > bytes + align ? size : bytes + align);
+        }
+    }
+
+    /**
+     * @brief Gives back the most recent allocation if `p` is it; otherwise
+     * does nothing.
+     *
+     * @param p The allocation.
+     * @param bytes Its size.
+     */
+    void deallocate(void* p, std::size_t bytes) {
+        if ((m_current < m_blocks.size()) &&
+            ((char*)p + bytes == m_blocks[m_current].data + m_offset) &&
+            ((char*)p >= m_blocks[m_current].data)) {
+            m_offset = (char*)p - m_blocks[m_current].data;
+            m_stats.in_use = m_below + m_offset;
+        }
+    }
+
+    /**
+     * @brief Returns the current position.
+     *
+     * @return marker A marker for rewind().
+     */
+    marker mark() const {
+        marker m = {m_current, m_offset};
+        return m;
+    }
+
+    /**
+     * @brief Frees everything allocated since a marker.
+     *
+     * @param m A marker from mark() taken since the last reset().
+     */
+    void rewind(const marker& m) {
+        m_current = m.block;
+        m_offset = m.offset;
+        m_below = 0;
+        for (std::size_t i = 0; (i < m_current) && (i < m_blocks.size());
+             i++) {
+            m_below += m_blocks[i].size;
+        }
+        m_stats.in_use = m_below + m_offset;
+    }
+
+    /**
+     * @brief Frees every allocation, keeping (and merging) the blocks.
+     */
+    void reset() {
+        if (m_blocks.size() > 1) {
+            std::size_t want = m_stats.high_water;
+            free_blocks();
+            add_block(want > m_min_block ? want : m_min_block);
+        }
+        m_current = 0;
+        m_offset = 0;
+        m_below = 0;
+        m_stats.in_use = 0;
+    }
+
+    /**
+     * @brief Frees every allocation and every block.
+     */
+    void release() {
+        free_blocks();
+        m_current = 0;
+        m_offset = 0;
+        m_below = 0;
+        m_stats.in_use = 0;
+    }
+
+    /**
+     * @brief Returns usage statistics.
+     *
+     * @return arena_stats The current statistics.
+     */
+    arena_stats stats() const { return m_stats; }
+
+    /**
+     * @brief Restarts the high-water and allocation counters.
+     */
+    void reset_stats() {
+        m_stats.high_water = m_stats.in_use;
+        m_stats.allocations = 0;
+    }
+};
+
+/**
+ * @brief Returns the calling thread's arena.
+ *
+ * The library's batch and parallel kernels take their per-call scratch from
+ * the calling thread's arena (see detail::kernel_scratch): the radix sorts
+ * and permute, spatial_order, cell_list construction,
+ * bounding_box_periodic, mesh deposit, direct_accelerations on vec3 and
+ * PLY loading. Their scratch is given back before they return, so the
+ * arena's blocks settle at the largest kernel's needs and later calls do
+ * not touch malloc; release() returns the memory. Structures that outlive
+ * the call (trees, grids, plans) still own their storage.
+ *
+ * @return arena& The thread-local arena.
+ */
+inline arena& thread_arena() {
+    static thread_local arena a;
+    return a;
+}
+
+/**
+ * @brief Rewinds an arena to where it was when the scope was entered.
+ */
+class arena_scope {
+  private:
+    arena& m_arena;
+    arena::marker m_mark;
+
+  public:
+    /**
+     * @brief Marks the arena.
+     *
+     * @param a The arena; defaults to the calling thread's.
+     */
+    arena_scope(arena& a = thread_arena()) : m_arena(a), m_mark(a.mark()) {}
+
+    arena_scope(const arena_scope&) = delete;
+    arena_scope& operator=(const arena_scope&) = delete;
+
+    ~arena_scope() { m_arena.rewind(m_mark); }
+};
+
+/**
+ * @brief A standard allocator drawing from an arena.
+ *
+ * Deallocation only reclaims the most recent allocation; everything else is
+ * reclaimed when the arena is reset. Usable with vec_array and the standard
+ * containers.
+ *
+ * @tparam T The allocated type.
+ */
+template <typename T> class arena_allocator {
+  private:
+    arena* m_arena;
+
+  public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U> struct rebind {
+        typedef arena_allocator<U> other;
+    };
+
+    /**
+     * @brief Constructs an allocator.
+     *
+     * @param a The arena; defaults to the calling thread's.
+     */
+    arena_allocator(arena& a = thread_arena()) : m_arena(&a) {}
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& other)
+        : m_arena(&other.source()) {}
+
+    /**
+     * @brief Returns the arena this allocator draws from.
+     *
+     * @return arena& The arena.
+     */
+    arena& source() const { return *m_arena; }
+
+    T* allocate(std::size_t count) {
+        std::size_t align =
+            alignof(T) > alignof(double) ? alignof(T) : alignof(double);
+        return (T*)m_arena->allocate(count * sizeof(T), align);
+    }
+
+    void deallocate(T* p, std::size_t count) {
+        m_arena->deallocate(p, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const arena_allocator<U>& other) const {
+        return m_arena == &other.source();
+    }
+
+    template <typename U>
+    bool operator!=(const arena_allocator<U>& other) const {
+        return m_arena != &other.source();
+    }
+};
+
+/**
+ * @brief A fixed-size scratch array taken from the calling thread's arena
+ * and given back when it goes out of scope.
+ *
+ * Scratch buffers must be destroyed in reverse order of construction, which
+ * holds for ordinary block-scoped use.
+ *
+ * @tparam T A trivially copyable element type.
+ */
+template <typename T> class scratch_buffer {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "scratch buffers are not constructed or destroyed");
+
+  private:
+    arena& m_arena;
+    arena::marker m_mark;
+    T* m_data;
+    std::size_t m_size;
+
+  public:
+    /**
+     * @brief Takes uninitialised scratch space.
+     *
+     * @param count The number of elements.
+     */
+    scratch_buffer(std::size_t count)
+        : m_arena(thread_arena()), m_mark(m_arena.mark()),
+          m_data((T*)m_arena.allocate(count * sizeof(T),
+                                      alignof(T) > alignof(double)
+                                          ? alignof(T)
+                                          : alignof(double))),
+          m_size(count) {}
+
+    /**
+     * @brief Takes scratch space filled with a value.
+     *
+     * @param count The number of elements.
+     * @param value The fill value.
+     */
+    scratch_buffer(std::size_t count, const T& value) : scratch_buffer(count) {
+        for (std::size_t i = 0; i < count; i++) {
+            m_data[i] = value;
+        }
+    }
+
+    scratch_buffer(const scratch_buffer&) = delete;
+    scratch_buffer& operator=(const scratch_buffer&) = delete;
+
+    ~scratch_buffer() { m_arena.rewind(m_mark); }
+
+    T& operator[](std::size_t i) { return m_data[i]; }
+    const T& operator[](std::size_t i) const { return m_data[i]; }
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+};
+
+namespace detail {
+
+/**
+ * @brief Per-call kernel scratch: a scratch_buffer from the calling thread's
+ * arena for trivially copyable elements, else a std::vector.
+ *
+ * Either way it is constructed from a count and offers data(), size() and
+ * operator[]; arena scratch is uninitialised, so kernels write every
+ * element before reading it.
+ */
+template <typename T>
+using kernel_scratch =
+    typename std::conditional<std::is_trivially_copyable<T>::value,
+                              scratch_buffer<T>, std::vector<T>>::type;
+
+} // namespace detail
+
+} // namespace HQ
+
+#endif // _HQALLOC_HPP_
@@ -0,0 +1,686 @@
+/**
+ * @file hqasync.hpp
+ * @brief This file defines asynchronous file I/O for vec arrays, backed by
+ * io_uring on Linux and by a worker thread elsewhere.
+ *
+ * Define HQ_NO_IO_URING to always use the worker thread backend.
+ */
+
+#ifndef _HQASYNC_HPP_
+#define _HQASYNC_HPP_
+
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+#if !defined(HQ_NO_IO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HQ_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace HQ {
+
+namespace detail {
+
+/**
+ * @brief One outstanding read or write.
+ */
+struct async_request {
+    /** @brief True for writes, false for reads. */
+    bool is_write;
+    /** @brief Next byte to transfer. */
+    char* buf;
+    /** @brief Bytes still to transfer. */
+    std::size_t remaining;
+    /** @brief File offset of buf. */
+    std::uint64_t offset;
+    /** @brief Bytes transferred so far. */
+    std::size_t done = 0;
+    /** @brief Called with the byte count before the future is satisfied. */
+    std::function<void(std::size_t)> on_complete;
+    /** @brief Fulfilled with the byte count once the request finishes. */
+    std::promise<std::size_t> promise;
+
+    /**
+     * @brief Finishes the request, successfully or with an errno value.
+     */
+    void finish(int err) {
+        if (err) {
+            promise.set_exception(std::make_exception_ptr(
+                std::system_error(err, std::generic_category())));
+            return;
+        }
+        if (on_complete)
+            on_complete(done);
+        promise.set_value(done);
+    }
+};
+
+/**
+ * @brief Interface shared by the async backends.
+ */
+class async_backend {
+  public:
+    virtual ~async_backend() {}
+
+    /**
+     * @brief Queues a request; the backend takes ownership.
+     */
+    virtual void submit(async_request* req) = 0;
+};
+
+/**
+ * @brief Performs requests in order on a dedicated worker thread.
+ */
+class thread_backend : public async_backend {
+  private:
+    int m_fd;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<async_request*> m_queue;
+    bool m_stop = false;
+    std::thread m_worker;
+
+    void run() {
+        for (;;) {
+            async_request* req;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                if (m_queue.empty())
+                    return;
+                req = m_queue.front();
+                m_queue.pop_front();
+            }
+            int err = 0;
+            while (req->remaining) {
+                ssize_t r =
+                    req->is_write
+                        ? ::pwrite(m_fd, req->buf, req->remaining, req->offset)
+                        : ::pread(m_fd, req->buf, req->remaining, req->offset);
+                if ((r < 0) && (errno == EINTR))
+                    continue;
+                if (r < 0) {
+                    err = errno;
+                    break;
+                }
+                if (r == 0)
+                    break; // end of file on read
+                req->buf += r;
+                req->remaining -= r;
+                req->offset += r;
+                req->done += r;
+            }
+            req->finish(err);
+            delete req;
+        }
+    }
+
+  public:
+    thread_backend(int fd) : m_fd(fd), m_worker(&thread_backend::run, this) {}
+
+    ~thread_backend() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        m_worker.join();
+    }
+
+    void submit(async_request* req) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.push_back(req);
+        }
+        m_cv.notify_one();
+    }
+};
+
+#if defined(HQ_HAVE_IO_URING)
+
+/**
+ * @brief Submits requests to an io_uring instance and reaps completions on a
+ * dedicated thread, using raw syscalls so no liburing is needed.
+ */
+class uring_backend : public async_backend {
+  private:
+    /** @brief Largest single transfer; longer requests are resubmitted. */
+    static const std::size_t max_transfer = std::size_t(1) << 30;
+
+    int m_fd;
+    int m_ring = -1;
+    unsigned m_entries = 0;
+    void* m_sq_ptr = nullptr;
+    std::size_t m_sq_size = 0;
+    void* m_cq_ptr = nullptr;
+    std::size_t m_cq_size = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned* m_sq_mask;
+    unsigned* m_sq_array;
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned* m_cq_mask;
+    io_uring_cqe* m_cqes;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    unsigned m_inflight = 0;
+    std::unordered_set<async_request*> m_live;
+    int m_error = 0;
+    std::thread m_reaper;
+
+    /**
+     * @brief Pushes one SQE and enters the kernel; caller holds m_mutex.
+     *
+     * @return int 0, or the errno of a failed submission, in which case the
+     * SQE has been taken back off the ring.
+     */
+    int push(unsigned char opcode, async_request* req) {
+        unsigned tail = *m_sq_tail;
+        unsigned idx = tail & *m_sq_mask;
+        io_uring_sqe* sqe = &m_sqes[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        if (req) {
+            std::size_t len =
+                req->remaining < max_transfer ? req->remaining : max_transfer;
+            sqe->fd = m_fd;
+            sqe->addr = (std::uint64_t)(std::uintptr_t)req->buf;
+            sqe->len = (unsigned)len;
+            sqe->off = req->offset;
+        } else {
+            sqe->fd = -1;
+        }
+        sqe->user_data = (std::uint64_t)(std::uintptr_t)req;
+        m_sq_array[idx] = idx;
+        __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        for (;;) {
+            if (syscall(__NR_io_uring_enter, m_ring, 1, 0, 0, nullptr, 0) >= 0)
+                return 0;
+            if (errno != EINTR)
+                break;
+        }
+        // without SQPOLL the kernel only reads the ring inside
+        // io_uring_enter, and a failed call consumed nothing
+        int err = errno;
+        __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+        return err;
+    }
+
+    int push(async_request* req) {
+        return push(req->is_write ? IORING_OP_WRITE : IORING_OP_READ, req);
+    }
+
+    /**
+     * @brief Fails every outstanding request once completions can no longer
+     * be reaped, and every later one on submission.
+     */
+    void fail(int err) {
+        std::vector<async_request*> live;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_error = err;
+            live.assign(m_live.begin(), m_live.end());
+            m_live.clear();
+            m_inflight = 0;
+        }
+        m_cv.notify_all();
+        for (async_request* req : live) {
+            req->finish(err);
+            delete req;
+        }
+    }
+
+    void run() {
+        bool stop = false;
+        while (!stop) {
+            long r = syscall(__NR_io_uring_enter, m_ring, 0, 1,
+                             IORING_ENTER_GETEVENTS, nullptr, 0);
+            if ((r < 0) && (errno != EINTR)) {
+                fail(errno);
+                return;
+            }
+            unsigned head = *m_cq_head;
+            unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                io_uring_cqe* cqe = &m_cqes[head & *m_cq_mask];
+                async_request* req =
+                    (async_request*)(std::uintptr_t)cqe->user_data;
+                int res = cqe->res;
+                if (!req) {
+                    stop = true;
+                    continue;
+                }
+                if ((res > 0) && ((std::size_t)res < req->remaining)) {
+                    // short transfer: continue where the kernel stopped
+                    req->buf += res;
+                    req->remaining -= res;
+                    req->offset += res;
+                    req->done += res;
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    int err = push(req);
+                    if (!err)
+                        continue;
+                    res = -err;
+                }
+                if (res > 0) {
+                    req->done += res;
+                    req->remaining = 0;
+                }
+                {
+                    // before the delete, as a new request may reuse the
+                    // address
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_live.erase(req);
+                }
+                req->finish(res < 0 ? -res : 0);
+                delete req;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_inflight--;
+                }
+                m_cv.notify_all();
+            }
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+  public:
+    /**
+     * @brief Sets up the ring; check ok() before use.
+     */
+    uring_backend(int fd, unsigned entries = 64) : m_fd(fd) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        m_ring = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (m_ring < 0)
+            return;
+        // IORING_OP_READ/WRITE arrived alongside RW_CUR_POS
+        if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+            ::close(m_ring);
+            m_ring = -1;
+            return;
+        }
+        m_entries = p.sq_entries;
+        m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+        }
+        m_sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+        m_cq_ptr = single ? m_sq_ptr
+                          : mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, m_ring,
+                                 IORING_OFF_CQ_RING);
+        void* sqes = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe),
+                          PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          m_ring, IORING_OFF_SQES);
+        if ((m_sq_ptr == MAP_FAILED) || (m_cq_ptr == MAP_FAILED) ||
+            (sqes == MAP_FAILED)) {
+            if (sqes != MAP_FAILED)
+                munmap(sqes, p.sq_entries * sizeof(io_uring_sqe));
+            if ((m_cq_ptr != MAP_FAILED) && (m_cq_ptr != m_sq_ptr))
+                munmap(m_cq_ptr, m_cq_size);
+            if (m_sq_ptr != MAP_FAILED)
+                munmap(m_sq_ptr, m_sq_size);
+            m_sq_ptr = m_cq_ptr = nullptr;
+            ::close(m_ring);
+            m_ring = -1;
+            return;
+        }
+        m_sqes = (io_uring_sqe*)sqes;
+        char* sq = (char*)m_sq_ptr;
+        char* cq = (char*)m_cq_ptr;
+        m_sq_head = (unsigned*)(sq + p.sq_off.head);
+        m_sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        m_sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+        m_sq_array = (unsigned*)(sq + p.sq_off.array);
+        m_cq_head = (unsigned*)(cq + p.cq_off.head);
+        m_cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        m_cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+        m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        m_reaper = std::thread(&uring_backend::run, this);
+    }
+
+    ~uring_backend() {
+        if (m_ring < 0)
+            return;
+        for (;;) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return m_inflight == 0; });
+            // a failed reaper has already exited
+            int err = m_error ? 0 : push(IORING_OP_NOP, nullptr);
+            if ((err != EAGAIN) && (err != EBUSY))
+                break;
+            // a busy ring clears as the kernel catches up
+            lock.unlock();
+            std::this_thread::yield();
+        }
+        m_reaper.join();
+        munmap(m_sqes, m_entries * sizeof(io_uring_sqe));
+        if (m_cq_ptr != m_sq_ptr)
+            munmap(m_cq_ptr, m_cq_size);
+        munmap(m_sq_ptr, m_sq_size);
+        ::close(m_ring);
+    }
+
+    /**
+     * @brief Checks whether the kernel accepted the ring.
+     */
+    bool ok() const { return m_ring >= 0; }
+
+    void submit(async_request* req) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // leave one slot for the shutdown NOP
+        m_cv.wait(lock,
+                  [this] { return m_error || (m_inflight + 1 < m_entries); });
+        if (m_error) {
+            int err = m_error;
+            lock.unlock();
+            req->finish(err);
+            delete req;
+            return;
+        }
+        m_inflight++;
+        m_live.insert(req);
+        int err = push(req);
+        if (!err)
+            return;
+        m_inflight--;
+        m_live.erase(req);
+        lock.unlock();
+        m_cv.notify_all();
+        req->finish(err);
+        delete req;
+    }
+};
+
+#endif // HQ_HAVE_IO_URING
+
+} // namespace detail
+
+/**
+ * @brief A file accepting asynchronous positional reads and writes.
+ *
+ * Buffers passed to read() and write() must stay alive and unmodified until
+ * the returned future is ready. The destructor waits for outstanding
+ * requests.
+ */
+class async_file {
+  private:
+    int m_fd = -1;
+    bool m_uring = false;
+    std::unique_ptr<detail::async_backend> m_backend;
+
+    std::future<std::size_t>
+    submit(bool is_write, char* buf, std::size_t bytes, std::uint64_t offset,
+           std::function<void(std::size_t)> on_complete) {
+        detail::async_request* req = new detail::async_request;
+        req->is_write = is_write;
+        req->buf = buf;
+        req->remaining = bytes;
+        req->offset = offset;
+        req->on_complete = on_complete;
+        std::future<std::size_t> out = req->promise.get_future();
+        if (bytes == 0) {
+            req->finish(0);
+            delete req;
+            return out;
+        }
+        m_backend->submit(req);
+        return out;
+    }
+
+  public:
+    /**
+     * @brief Opens a file for asynchronous I/O.
+     *
+     * @param path Path of the file.
+     * @param writable Open for writing (created and truncated) instead of
+     * reading.
+     * @param use_io_uring Try io_uring before falling back to a worker thread.
+     */
+    async_file(const std::string& path, bool writable,
+               bool use_io_uring = true) {
+        m_fd = writable ? ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                                 0644)
+                        : ::open(path.c_str(), O_RDONLY);
+        if (m_fd < 0)
+            return;
+#if defined(HQ_HAVE_IO_URING)
+        if (use_io_uring) {
+            detail::uring_backend* uring = new detail::uring_backend(m_fd);
+            if (uring->ok()) {
+                m_backend.reset(uring);
+                m_uring = true;
+                return;
+            }
+            delete uring;
+        }
+#endif
+        m_backend.reset(new detail::thread_backend(m_fd));
+    }
+
+    async_file(const async_file&) = delete;
+    async_file& operator=(const async_file&) = delete;
+
+    ~async_file() {
+        m_backend.reset();
+        if (m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    /**
+     * @brief Checks whether the file opened successfully.
+     *
+     * @return bool True if the file is usable.
+     */
+    bool is_open() const { return m_fd >= 0; }
+
+    /**
+     * @brief Returns the current size of the file.
+     *
+     * @return std::uint64_t The size in bytes, or 0 if it cannot be queried.
+     */
+    std::uint64_t size() const {
+        struct stat st;
+        if ((m_fd < 0) || (::fstat(m_fd, &st) != 0))
+            return 0;
+        return (std::uint64_t)st.st_size;
+    }
+
+    /**
+     * @brief Reports which backend is in use.
+     *
+     * @return bool True for io_uring, false for the worker thread.
+     */
+    bool uses_io_uring() const { return m_uring; }
+
+    /**
+     * @brief Queues a write.
+     *
+     * @param data The bytes to write.
+     * @param bytes The number of bytes.
+     * @param offset File offset to write at.
+     * @param on_complete Optional callback run on the completion thread.
+     * @return std::future<std::size_t> Bytes written, or a std::system_error.
+     */
+    std::future<std::size_t>
+    write(const void* data, std::size_t bytes, std::uint64_t offset,
+          std::function<void(std::size_t)> on_complete = nullptr) {
+        return submit(true, (char*)data, bytes, offset, on_complete);
+    }
+
+    /**
+     * @brief Queues a read.
+     *
+     * @param data The destination buffer.
+     * @param bytes The number of bytes.
+     * @param offset File offset to read from.
+     * @param on_complete Optional callback run on the completion thread.
+     * @return std::future<std::size_t> Bytes read (short at end of file), or
+     * a std::system_error.
+     */
+    std::future<std::size_t>
+    read(void* data, std::size_t bytes, std::uint64_t offset,
+         std::function<void(std::size_t)> on_complete = nullptr) {
+        return submit(false, (char*)data, bytes, offset, on_complete);
+    }
+
+    /**
+     * @brief Queues a write of an array of vectors.
+     *
+     * @param data The vectors to write.
+     * @param count The number of vectors.
+     * @param offset File offset to write at.
+     * @return std::future<std::size_t> Bytes written.
+     */
+    template <typename T, std::size_t n>
+    std::future<std::size_t> write(const vec<T, n>* data, std::size_t count,
+                                   std::uint64_t offset) {
+        return write((const void*)data, count * sizeof(vec<T, n>), offset);
+    }
+
+    /**
+     * @brief Queues a read into an array of vectors.
+     *
+     * @param data The destination vectors.
+     * @param count The number of vectors.
+     * @param offset File offset to read from.
+     * @return std::future<std::size_t> Bytes read.
+     */
+    template <typename T, std::size_t n>
+    std::future<std::size_t> read(vec<T, n>* data, std::size_t count,
+                                  std::uint64_t offset) {
+        return read((void*)data, count * sizeof(vec<T, n>), offset);
+    }
+};
+
+/**
+ * @brief Streams vec arrays to an async_file through two staging buffers.
+ *
+ * Each chunk is encoded into a free buffer on the calling thread and then
+ * written asynchronously, so encoding chunk k + 1 overlaps with the write of
+ * chunk k. The default encoding is a raw copy; pass an encoder (for example
+ * one wrapping quantize()) to compress chunks before they are written.
+ *
+ * @tparam T The data type of the vectors.
+ * @tparam n The dimension of the vectors.
+ */
+template <typename T, std::size_t n> class async_vec_writer {
+  public:
+    /** @brief Serialises `count` vectors into `out`, replacing it. */
+    typedef std::function<void(const vec<T, n>*, std::size_t,
+                               std::vector<char>&)>
+        encoder;
+
+  private:
+    async_file& m_file;
+    std::size_t m_chunk;
+    encoder m_encode;
+    std::function<void(std::size_t)> m_on_complete;
+    std::vector<char> m_buf[2];
+    std::future<std::size_t> m_pending[2];
+    int m_next = 0;
+    std::uint64_t m_offset;
+
+    static void raw_encode(const vec<T, n>* data, std::size_t count,
+                           std::vector<char>& out) {
+        out.resize(count * sizeof(vec<T, n>));
+        std::memcpy(out.data(), data, out.size());
+    }
+
+  public:
+    /**
+     * @brief Starts writing at a file offset.
+     *
+     * @param file The destination file (must outlive the writer).
+     * @param chunk Vectors per chunk.
+     * @param offset File offset of the first chunk.
+     * @param encode Chunk encoder; raw copy if empty.
+     * @param on_complete Optional callback run with each chunk's size once
+     * it has been written.
+     */
+    async_vec_writer(async_file& file, std::size_t chunk = 1 << 16,
+                     std::uint64_t offset = 0, encoder encode = nullptr,
+                     std::function<void(std::size_t)> on_complete = nullptr)
+        : m_file(file), m_chunk(chunk ? chunk : 1),
+          m_encode(encode ? encode : encoder(raw_encode)),
+          m_on_complete(on_complete), m_offset(offset) {}
+
+    ~async_vec_writer() {
+        for (int i = 0; i < 2; i++) {
+            if (m_pending[i].valid())
+                m_pending[i].wait();
+        }
+    }
+
+    /**
+     * @brief Encodes and queues vectors, blocking only when both buffers are
+     * still being written.
+     *
+     * @param data The vectors to write.
+     * @param count The number of vectors.
+     */
+    void write(const vec<T, n>* data, std::size_t count) {
+        for (std::size_t start = 0; start < count; start += m_chunk) {
+            std::size_t len =
+                count - start < m_chunk ? count - start : m_chunk;
+            if (m_pending[m_next].valid())
+                m_pending[m_next].get();
+            m_encode(data + start, len, m_buf[m_next]);
+            m_pending[m_next] =
+                m_file.write(m_buf[m_next].data(), m_buf[m_next].size(),
+                             m_offset, m_on_complete);
+            m_offset += m_buf[m_next].size();
+            m_next ^= 1;
+        }
+    }
+
+    /**
+     * @brief Waits for every queued chunk, rethrowing any write error.
+     */
+    void flush() {
+        for (int i = 0; i < 2; i++) {
+            if (m_pending[i].valid())
+                m_pending[i].get();
+        }
+    }
+
+    /**
+     * @brief Returns the file offset the next chunk will be written at.
+     *
+     * @return std::uint64_t The end of the data queued so far.
+     */
+    std::uint64_t offset() const { return m_offset; }
+};
+
+} // namespace HQ
+
+#endif // _HQASYNC_HPP_
@@ -0,0 +1,389 @@
+/**
+ * @file hqbarneshut.hpp
+ * @brief This file defines a Barnes-Hut gravity solver over vec3 particles,
+ * with monopole and quadrupole node moments.
+ */
+
+#ifndef _HQBARNESHUT_HPP_
+#define _HQBARNESHUT_HPP_
+
+#include "hqbounds.hpp"
+#include "hqnbody.hpp"
+#include "hqoctree.hpp"
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief A symmetric traceless quadrupole tensor,
+ * sum of m (3 d d^T - |d|^2 I) over masses at offsets d.
+ *
+ * @tparam T The scalar type.
+ */
+template <typename T> struct quadrupole {
+    /** @brief Diagonal components. */
+    T xx, yy, zz;
+    /** @brief Off-diagonal components. */
+    T xy, xz, yz;
+
+    /**
+     * @brief Constructs a zero tensor.
+     */
+    quadrupole() : xx(0), yy(0), zz(0), xy(0), xz(0), yz(0) {}
+
+    /**
+     * @brief Adds the tensor of a point mass at offset d.
+     *
+     * @param m The mass.
+     * @param d The offset from the expansion centre.
+     */
+    void add(T m, const vec3<T>& d) {
+        T d2 = d.length2();
+        xx += m * (3 * d.x * d.x - d2);
+        yy += m * (3 * d.y * d.y - d2);
+        zz += m * (3 * d.z * d.z - d2);
+        xy += m * 3 * d.x * d.y;
+        xz += m * 3 * d.x * d.z;
+        yz += m * 3 * d.y * d.z;
+    }
+
+    /**
+     * @brief Adds another tensor about the same centre.
+     *
+     * @param q The tensor.
+     */
+    void add(const quadrupole& q) {
+        xx += q.xx;
+        yy += q.yy;
+        zz += q.zz;
+        xy += q.xy;
+        xz += q.xz;
+        yz += q.yz;
+    }
+
+    /**
+     * @brief Multiplies the tensor by a vector.
+     *
+     * @param r The vector.
+     * @return vec3<T> Q r.
+     */
+    vec3<T> operator*(const vec3<T>& r) const {
+        return vec3<T>(xx * r.x + xy * r.y + xz * r.z,
+                       xy * r.x + yy * r.y + yz * r.z,
+                       xz * r.x + yz * r.y + zz * r.z);
+    }
+};
+
+/**
+ * @brief A Barnes-Hut gravity solver (G = 1).
+ *
+ * The particles are put in an octree (see octree); every node gets its
+ * mass, centre of mass, quadrupole about it and the distance from the
+ * centre of mass to its farthest bounds corner (b_max). A node is accepted
+ * as a multipole when b_max / d < theta, d being its distance to the
+ * region being evaluated; otherwise it is opened, and leaves that are
+ * opened interact particle by particle.
+ *
+ * Walks are made once per leaf (the group), against the leaf's bounding
+ * box, and the resulting node and particle lists are shared by the leaf's
+ * particles; leaves are walked in parallel. Particle lists are summed for
+ * the whole leaf at once with the register-blocked kernel of hqnbody.hpp,
+ * over structure-of-arrays copies of the sorted particles.
+ *
+ * @tparam T The scalar type (float or double).
+ */
+template <typename T> class barnes_hut {
+    octree<T> m_tree;
+    std::vector<T> m_x, m_y, m_z, m_mass;
+    std::vector<vec3<T>> m_com;
+    std::vector<T> m_node_mass;
+    std::vector<T> m_bmax2;
+    std::vector<quadrupole<T>> m_quad;
+    std::vector<std::uint32_t> m_leaves;
+
+    // moments of one node, given those of its children
+    void moments(std::size_t i) {
+        const octree_node<T>& node = m_tree.nodes()[i];
+        T mass = 0;
+        vec3<T> weighted(0, 0, 0);
+        quadrupole<T> q;
+        if (node.leaf()) {
+            for (std::uint32_t p = node.begin; p < node.end; p++) {
+                mass += m_mass[p];
+                weighted = weighted + position(p) * m_mass[p];
+            }
+        } else {
+            for (int c = 0; c < node.child_count; c++) {
+                std::uint32_t child = node.first_child + c;
+                mass += m_node_mass[child];
+                weighted = weighted + m_com[child] * m_node_mass[child];
+            }
+        }
+        vec3<T> com = mass > 0 ? weighted / mass : node.bounds.center();
+        if (node.leaf()) {
+            for (std::uint32_t p = node.begin; p < node.end; p++) {
+                q.add(m_mass[p], position(p) - com);
+            }
+        } else {
+            for (int c = 0; c < node.child_count; c++) {
+                std::uint32_t child = node.first_child + c;
+                q.add(m_quad[child]);
+                q.add(m_node_mass[child], m_com[child] - com);
+            }
+        }
+        T bmax2 = 0;
+        for (int k = 0; k < 3; k++) {
+            T reach = std::max(com[k] - node.bounds.lo[k],
+                               node.bounds.hi[k] - com[k]);
+            bmax2 += reach * reach;
+        }
+        m_node_mass[i] = mass;
+        m_com[i] = com;
+        m_quad[i] = q;
+        m_bmax2[i] = bmax2;
+    }
+
+    vec3<T> position(std::size_t p) const {
+        return vec3<T>(m_x[p], m_y[p], m_z[p]);
+    }
+
+    // multipole attraction of node i on a target
+    vec3<T> multipole(std::size_t i, const vec3<T>& p, T eps2,
+                      bool use_quadrupole) const {
+        vec3<T> r = p - m_com[i];
+        T r2 = r.length2() + eps2;
+        T inv_r = 1 / std::sqrt(r2);
+        T inv_r2 = inv_r * inv_r;
+        T inv_r3 = inv_r * inv_r2;
+        vec3<T> out = r * (-m_node_mass[i] * inv_r3);
+        if (use_quadrupole) {
+            vec3<T> qr = m_quad[i] * r;
+            T inv_r5 = inv_r3 * inv_r2;
+            T rqr = r.dot(qr);
+            out = out + qr * inv_r5 - r * ((T)2.5 * rqr * inv_r5 * inv_r2);
+        }
+        return out;
+    }
+
+    // fills the interaction lists of a region: accepted nodes, and
+    // (merged) ranges of sorted particles to sum directly
+    void walk(const aabb<T, 3>& region, T theta2,
+              std::vector<std::uint32_t>& stack,
+              std::vector<std::uint32_t>& accepted,
+              std::vector<std::uint32_t>& ranges) const {
+        const std::vector<octree_node<T>>& nodes = m_tree.nodes();
+        accepted.clear();
+        ranges.clear();
+        if (nodes.empty())
+            return;
+        stack.assign(1, 0);
+        while (!stack.empty()) {
+            std::uint32_t i = stack.back();
+            stack.pop_back();
+            const octree_node<T>& node = nodes[i];
+            T d2 = region.distance2(m_com[i]);
+            if ((d2 > 0) && (m_bmax2[i] < theta2 * d2)) {
+                accepted.push_back(i);
+            } else if (node.leaf()) {
+                if (!ranges.empty() && (ranges.back() == node.begin))
+                    ranges.back() = node.end;
+                else {
+                    ranges.push_back(node.begin);
+                    ranges.push_back(node.end);
+                }
+            } else {
+                // reversed, so children pop in Morton order and adjacent
+                // leaves merge into longer runs
+                for (int c = node.child_count; c-- > 0;) {
+                    stack.push_back(node.first_child + c);
+                }
+            }
+        }
+    }
+
+  public:
+    /**
+     * @brief Constructs an empty solver.
+     */
+    barnes_hut() {}
+
+    /**
+     * @brief Builds the tree and moments for a set of particles.
+     *
+     * @param positions The particle positions.
+     * @param masses The particle masses.
+     * @param count The number of particles.
+     * @param leaf_capacity Largest number of particles in a leaf.
+     */
+    barnes_hut(const vec3<T>* positions, const T* masses, std::size_t count,
+               std::size_t leaf_capacity = 16) {
+        build(positions, masses, count, leaf_capacity);
+    }
+
+    /**
+     * @brief Rebuilds the tree and moments, across threads.
+     *
+     * Moments are accumulated bottom up, one octree level at a time.
+     *
+     * @param positions The particle positions.
+     * @param masses The particle masses.
+     * @param count The number of particles.
+     * @param leaf_capacity Largest number of particles in a leaf.
+     */
+    void build(const vec3<T>* positions, const T* masses, std::size_t count,
+               std::size_t leaf_capacity = 16) {
+        m_tree.build(positions, count, leaf_capacity);
+        const std::vector<std::uint32_t>& index = m_tree.sorted_indices();
+        const std::vector<vec3<T>>& sorted = m_tree.sorted_points();
+        m_x.resize(count);
+        m_y.resize(count);
+        m_z.resize(count);
+        m_mass.resize(count);
+        parallel_for(
+            0, count,
+            [&](std::size_t i) {
+                m_x[i] = sorted[i].x;
+                m_y[i] = sorted[i].y;
+                m_z[i] = sorted[i].z;
+                m_mass[i] = masses[index[i]];
+            },
+            4096);
+        std::size_t nodes = m_tree.nodes().size();
+        m_com.resize(nodes);
+        m_node_mass.resize(nodes);
+        m_bmax2.resize(nodes);
+        m_quad.resize(nodes);
+        for (std::size_t l = m_tree.depth(); l-- > 0;) {
+            parallel_for(
+                m_tree.level_begin(l), m_tree.level_begin(l + 1),
+                [&](std::size_t i) { moments(i); }, 64);
+        }
+        m_leaves.clear();
+        for (std::size_t i = 0; i < nodes; i++) {
+            if (m_tree.nodes()[i].leaf())
+                m_leaves.push_back((std::uint32_t)i);
+        }
+    }
+
+    /**
+     * @brief Returns the number of particles.
+     *
+     * @return std::size_t The particle count.
+     */
+    std::size_t size() const { return m_x.size(); }
+
+    /**
+     * @brief Returns the octree over the particles.
+     *
+     * @return const octree<T>& The tree.
+     */
+    const octree<T>& tree() const { return m_tree; }
+
+    /**
+     * @brief Returns the total mass of the particles.
+     *
+     * @return T The mass of the root node (0 if empty).
+     */
+    T total_mass() const {
+        return m_node_mass.empty() ? (T)0 : m_node_mass[0];
+    }
+
+    /**
+     * @brief Returns the centre of mass of the particles.
+     *
+     * @return vec3<T> The root node's centre of mass.
+     */
+    vec3<T> center_of_mass() const {
+        return m_com.empty() ? vec3<T>(0, 0, 0) : m_com[0];
+    }
+
+    /**
+     * @brief Computes the acceleration at an arbitrary point.
+     *
+     * @param p The point.
+     * @param theta The opening angle, below 1 (0 sums every particle
+     * directly).
+     * @param softening Plummer softening length.
+     * @param use_quadrupole Whether accepted nodes include the quadrupole
+     * term.
+     * @return vec3<T> The acceleration; particles exactly at p are skipped.
+     */
+    vec3<T> acceleration(const vec3<T>& p, T theta, T softening = 0,
+                         bool use_quadrupole = true) const {
+        std::vector<std::uint32_t> stack, accepted, ranges;
+        walk(aabb<T, 3>(p, p), theta * theta, stack, accepted, ranges);
+        T eps2 = softening * softening;
+        vec3<T> out(0, 0, 0);
+        for (std::size_t a = 0; a < accepted.size(); a++) {
+            out = out + multipole(accepted[a], p, eps2, use_quadrupole);
+        }
+        for (std::size_t r = 0; r < ranges.size(); r += 2) {
+            detail::direct_sum(m_x.data(), m_y.data(), m_z.data(),
+                               m_mass.data(), ranges[r], ranges[r + 1], p,
+                               eps2, out);
+        }
+        return out;
+    }
+
+    /**
+     * @brief Computes the acceleration of every particle, across threads.
+     *
+     * @param out size() accelerations, in the order of the particles given
+     * to build.
+     * @param theta The opening angle, below 1 (0 sums every particle
+     * directly).
+     * @param softening Plummer softening length.
+     * @param use_quadrupole Whether accepted nodes include the quadrupole
+     * term.
+     */
+    void accelerations(vec3<T>* out, T theta, T softening = 0,
+                       bool use_quadrupole = true) const {
+        const std::vector<octree_node<T>>& nodes = m_tree.nodes();
+        const std::vector<std::uint32_t>& index = m_tree.sorted_indices();
+        T eps2 = softening * softening;
+        T theta2 = theta * theta;
+        parallel_for_ranges(
+            0, m_leaves.size(),
+            [&](std::size_t lo, std::size_t hi, unsigned) {
+                std::vector<std::uint32_t> stack, accepted, ranges;
+                std::vector<T> gx, gy, gz;
+                for (std::size_t g = lo; g < hi; g++) {
+                    const octree_node<T>& leaf = nodes[m_leaves[g]];
+                    walk(leaf.bounds, theta2, stack, accepted, ranges);
+                    std::size_t count = leaf.end - leaf.begin;
+                    gx.assign(count, (T)0);
+                    gy.assign(count, (T)0);
+                    gz.assign(count, (T)0);
+                    for (std::size_t r = 0; r < ranges.size(); r += 2) {
+                        detail::accumulate_direct(
+                            &m_x[leaf.begin], &m_y[leaf.begin],
+                            &m_z[leaf.begin], count, m_x.data(), m_y.data(),
+                            m_z.data(), m_mass.data(), ranges[r],
+                            ranges[r + 1], eps2, gx.data(), gy.data(),
+                            gz.data());
+                    }
+                    for (std::size_t k = 0; k < count; k++) {
+                        std::uint32_t i = leaf.begin + (std::uint32_t)k;
+                        vec3<T> p = position(i), a(gx[k], gy[k], gz[k]);
+                        for (std::size_t c = 0; c < accepted.size(); c++) {
+                            a = a + multipole(accepted[c], p, eps2,
+                                              use_quadrupole);
+                        }
+                        out[index[i]] = a;
+                    }
+                }
+            },
+            16);
+    }
+};
+
+} // namespace HQ
+
+#endif // _HQBARNESHUT_HPP_
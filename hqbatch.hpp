@@ -0,0 +1,505 @@
+/**
+ * @file hqbatch.hpp
+ * @brief This file defines bulk kernels over arrays of vectors.
+ */
+
+#ifndef _HQBATCH_HPP_
+#define _HQBATCH_HPP_
+
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace HQ {
+
+/**
+ * @brief How bulk kernels write their output.
+ */
+enum class store_policy {
+    /** @brief Stream if the output is larger than streaming_threshold(). */
+    automatic,
+    /** @brief Ordinary stores through the cache. */
+    cached,
+    /** @brief Non-temporal stores that bypass the cache. */
+    streaming
+};
+
+namespace detail {
+
+/**
+ * @brief Reads a sysfs cache size such as "32768K".
+ */
+static inline std::size_t read_cache_size(const char* path) {
+    FILE* f = std::fopen(path, "r");
+    if (!f)
+        return 0;
+    unsigned long value = 0;
+    char unit = 0;
+    int got = std::fscanf(f, "%lu%c", &value, &unit);
+    std::fclose(f);
+    if (got < 1)
+        return 0;
+    if ((unit == 'K') || (unit == 'k'))
+        value <<= 10;
+    else if ((unit == 'M') || (unit == 'm'))
+        value <<= 20;
+    return value;
+}
+
+/**
+ * @brief Holds the streaming threshold (0 = not yet detected).
+ */
+inline std::size_t& streaming_threshold_setting() {
+    static std::size_t bytes = 0;
+    return bytes;
+}
+
+/**
+ * @brief Holds how many elements ahead indexed kernels prefetch.
+ */
+inline std::size_t& prefetch_distance_setting() {
+    static std::size_t distance = 16;
+    return distance;
+}
+
+} // namespace detail
+
+/**
+ * @brief Returns the size of the largest CPU cache.
+ *
+ * Uses sysconf where available, then sysfs, then assumes 8 MiB.
+ *
+ * @return std::size_t The last-level cache size in bytes.
+ */
+inline std::size_t last_level_cache_size() {
+    static std::size_t size = 0;
+    if (size)
+        return size;
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (l3 > 0)
+        size = (std::size_t)l3;
+#endif
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    if (!size) {
+        long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        if (l2 > 0)
+            size = (std::size_t)l2;
+    }
+#endif
+    for (int i = 0; (i < 8) && !size; i++) {
+        char path[96];
+        std::snprintf(path, sizeof(path),
+                      "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        std::size_t s = detail::read_cache_size(path);
+        size = s > size ? s : size;
+    }
+    if (!size)
+        size = std::size_t(8) << 20;
+    return size;
+}
+
+/**
+ * @brief Returns the output size above which automatic stores stream.
+ *
+ * @return std::size_t Bytes; defaults to last_level_cache_size().
+ */
+inline std::size_t streaming_threshold() {
+    std::size_t& bytes = detail::streaming_threshold_setting();
+    if (!bytes)
+        bytes = last_level_cache_size();
+    return bytes;
+}
+
+/**
+ * @brief Overrides the streaming threshold.
+ *
+ * @param bytes The new threshold; 0 restores cache-size detection.
+ */
+inline void set_streaming_threshold(std::size_t bytes) {
+    detail::streaming_threshold_setting() = bytes;
+}
+
+/**
+ * @brief Decides whether an output of `bytes` should use streaming stores.
+ *
+ * @param bytes Size of the output.
+ * @param policy The requested policy.
+ * @return bool True for non-temporal stores.
+ */
+static inline bool use_streaming_stores(std::size_t bytes,
+                                        store_policy policy) {
+    if (policy == store_policy::automatic)
+        return bytes > streaming_threshold();
+    return policy == store_policy::streaming;
+}
+
+/**
+ * @brief Copies bytes with non-temporal stores where supported.
+ *
+ * The caller must issue stream_fence() before other threads read `dst`.
+ *
+ * @param dst The destination.
+ * @param src The source.
+ * @param bytes The number of bytes.
+ */
+static inline void stream_copy(void* dst, const void* src, std::size_t bytes) {
+    char* d = (char*)dst;
+    const char* s = (const char*)src;
+#if defined(__SSE2__)
+    std::size_t head = (16 - ((std::uintptr_t)d & 15)) & 15;
+    head = head < bytes ? head : bytes;
+    std::memcpy(d, s, head);
+    d += head;
+    s += head;
+    bytes -= head;
+    for (; bytes >= 64; bytes -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)s);
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+        _mm_stream_si128((__m128i*)d, a);
+        _mm_stream_si128((__m128i*)(d + 16), b);
+        _mm_stream_si128((__m128i*)(d + 32), c);
+        _mm_stream_si128((__m128i*)(d + 48), e);
+    }
+    for (; bytes >= 16; bytes -= 16, d += 16, s += 16) {
+        _mm_stream_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+    }
+#endif
+    std::memcpy(d, s, bytes);
+}
+
+/**
+ * @brief Orders earlier non-temporal stores before later stores.
+ */
+static inline void stream_fence() {
+#if defined(__SSE2__)
+    _mm_sfence();
+#endif
+}
+
+namespace detail {
+
+/** @brief Bytes of output staged in cache before being streamed out. */
+static const std::size_t stream_block_bytes = 4096;
+
+/**
+ * @brief Runs `produce(lo, hi, out)` over [0, count) across threads,
+ * writing results either directly to `out` or through a small cached staging
+ * block copied out with non-temporal stores.
+ */
+template <typename V, typename F>
+void write_output(V* out, std::size_t count, store_policy policy, F produce) {
+    bool streaming = use_streaming_stores(count * sizeof(V), policy);
+    parallel_for_ranges(
+        0, count,
+        [&](std::size_t lo, std::size_t hi, unsigned) {
+            if (!streaming) {
+                produce(lo, hi, out + lo);
+                return;
+            }
+            const std::size_t block =
+                stream_block_bytes / sizeof(V) ? stream_block_bytes / sizeof(V)
+                                               : 1;
+            alignas(64) char staging[stream_block_bytes < sizeof(V)
+                                         ? sizeof(V)
+                                         : stream_block_bytes];
+            V* buf = reinterpret_cast<V*>(staging);
+            for (std::size_t start = lo; start < hi; start += block) {
+                std::size_t end = hi - start < block ? hi : start + block;
+                produce(start, end, buf);
+                stream_copy(out + start, buf, (end - start) * sizeof(V));
+            }
+            stream_fence();
+        },
+        4096);
+}
+
+} // namespace detail
+
+/**
+ * @brief Applies `f` to every vector: out[i] = f(in[i]).
+ *
+ * `in` and `out` may be the same array.
+ *
+ * @param in The input vectors.
+ * @param out The output vectors.
+ * @param count The number of vectors.
+ * @param f Callable taking and returning vec<T, n>.
+ * @param policy Store policy for the output.
+ */
+template <typename T, std::size_t n, typename F>
+void transform(const vec<T, n>* in, vec<T, n>* out, std::size_t count, F f,
+               store_policy policy = store_policy::automatic) {
+    detail::write_output(out, count, policy,
+                         [&](std::size_t lo, std::size_t hi, vec<T, n>* dst) {
+                             for (std::size_t i = lo; i < hi; i++) {
+                                 dst[i - lo] = f(in[i]);
+                             }
+                         });
+}
+
+/**
+ * @brief Combines two arrays: out[i] = f(a[i], b[i]).
+ *
+ * @param a The first input vectors.
+ * @param b The second input vectors.
+ * @param out The output vectors.
+ * @param count The number of vectors.
+ * @param f Callable taking two vec<T, n> and returning vec<T, n>.
+ * @param policy Store policy for the output.
+ */
+template <typename T, std::size_t n, typename F>
+void transform(const vec<T, n>* a, const vec<T, n>* b, vec<T, n>* out,
+               std::size_t count, F f,
+               store_policy policy = store_policy::automatic) {
+    detail::write_output(out, count, policy,
+                         [&](std::size_t lo, std::size_t hi, vec<T, n>* dst) {
+                             for (std::size_t i = lo; i < hi; i++) {
+                                 dst[i - lo] = f(a[i], b[i]);
+                             }
+                         });
+}
+
+/**
+ * @brief Sets every vector to a value.
+ *
+ * @param out The output vectors.
+ * @param count The number of vectors.
+ * @param value The value.
+ * @param policy Store policy for the output.
+ */
+template <typename T, std::size_t n>
+void fill(vec<T, n>* out, std::size_t count, const vec<T, n>& value,
+          store_policy policy = store_policy::automatic) {
+    detail::write_output(out, count, policy,
+                         [&](std::size_t lo, std::size_t hi, vec<T, n>* dst) {
+                             for (std::size_t i = lo; i < hi; i++) {
+                                 dst[i - lo] = value;
+                             }
+                         });
+}
+
+/**
+ * @brief Computes out[i] = a[i] * s + b[i].
+ *
+ * @param a The scaled input vectors.
+ * @param s The scale.
+ * @param b The added input vectors.
+ * @param out The output vectors.
+ * @param count The number of vectors.
+ * @param policy Store policy for the output.
+ */
+template <typename T, std::size_t n>
+void axpy(const vec<T, n>* a, T s, const vec<T, n>* b, vec<T, n>* out,
+          std::size_t count, store_policy policy = store_policy::automatic) {
+    transform(
+        a, b, out, count,
+        [s](const vec<T, n>& x, const vec<T, n>& y) { return x * s + y; },
+        policy);
+}
+
+/**
+ * @brief Returns how many elements ahead gather and scatter_add prefetch.
+ *
+ * @return std::size_t The distance in elements; 0 disables prefetching.
+ */
+inline std::size_t prefetch_distance() {
+    return detail::prefetch_distance_setting();
+}
+
+/**
+ * @brief Sets how many elements ahead gather and scatter_add prefetch.
+ *
+ * The best value is roughly memory latency divided by the time spent per
+ * element, so cheap loops want a larger distance than expensive ones.
+ *
+ * @param distance The distance in elements; 0 disables prefetching.
+ */
+inline void set_prefetch_distance(std::size_t distance) {
+    detail::prefetch_distance_setting() = distance;
+}
+
+namespace detail {
+
+/**
+ * @brief Prefetches every cache line of `*p` (for writing if `write`).
+ */
+template <typename V> inline void prefetch_element(const V* p, bool write) {
+#if defined(__GNUC__)
+    const char* first = (const char*)p;
+    const char* last = first + sizeof(V) - 1;
+    if (write) {
+        __builtin_prefetch(first, 1);
+        __builtin_prefetch(last, 1);
+    } else {
+        __builtin_prefetch(first, 0);
+        __builtin_prefetch(last, 0);
+    }
+#else
+    (void)p;
+    (void)write;
+#endif
+}
+
+/**
+ * @brief Gathers dst[i] = src[idx[i]] for i in [lo, hi), prefetching the
+ * source `distance` elements ahead.
+ */
+template <typename T, std::size_t n>
+void gather_scalar(const vec<T, n>* src, const std::uint32_t* idx,
+                   vec<T, n>* dst, std::size_t lo, std::size_t hi,
+                   std::size_t distance) {
+    std::size_t i = lo;
+    if (distance) {
+        std::size_t ahead = hi - lo > distance ? hi - distance : lo;
+        for (; i < ahead; i++) {
+            prefetch_element(src + idx[i + distance], false);
+            dst[i] = src[idx[i]];
+        }
+    }
+    for (; i < hi; i++) {
+        dst[i] = src[idx[i]];
+    }
+}
+
+#if defined(__AVX2__)
+/**
+ * @brief Gathers 32-bit components eight vectors at a time with vpgatherdd.
+ *
+ * Eight vectors occupy n registers of output. Lane l of register q holds
+ * scalar 8q + l, i.e. component (8q + l) % n of vector (8q + l) / n, so its
+ * source offset is idx[(8q + l) / n] * n + (8q + l) % n. Each register's
+ * offsets come from one permute of the eight indices, a multiply and an add,
+ * and the gathered result is stored contiguously. Groups holding an index
+ * whose offsets would not fit the signed 32-bit lanes are copied one by one.
+ */
+template <std::size_t n>
+void gather_avx2(const std::int32_t* src, const std::uint32_t* idx,
+                 std::int32_t* dst, std::size_t lo, std::size_t hi,
+                 std::size_t distance) {
+    alignas(32) std::int32_t which[n][8];
+    alignas(32) std::int32_t component[n][8];
+    for (int q = 0; q < (int)n; q++) {
+        for (int l = 0; l < 8; l++) {
+            which[q][l] = (8 * q + l) / (int)n;
+            component[q][l] = (8 * q + l) % (int)n;
+        }
+    }
+    const __m256i stride = _mm256_set1_epi32((int)n);
+    const __m256i largest =
+        _mm256_set1_epi32((int)((0x7fffffffu - (n - 1)) / n));
+    std::size_t i = lo;
+    for (; i + 8 <= hi; i += 8) {
+        if (distance && (i + distance + 8 <= hi)) {
+            for (int l = 0; l < 8; l++) {
+                prefetch_element(src + idx[i + distance + l] * n, false);
+            }
+        }
+        __m256i index = _mm256_loadu_si256((const __m256i*)(idx + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(
+                _mm256_max_epu32(index, largest), largest)) != -1) {
+            for (std::size_t j = i; j < i + 8; j++) {
+                for (int k = 0; k < (int)n; k++) {
+                    dst[j * n + k] = src[idx[j] * n + k];
+                }
+            }
+            continue;
+        }
+        __m256i base = _mm256_mullo_epi32(index, stride);
+        for (int q = 0; q < (int)n; q++) {
+            __m256i offsets = _mm256_add_epi32(
+                _mm256_permutevar8x32_epi32(
+                    base, _mm256_load_si256((const __m256i*)which[q])),
+                _mm256_load_si256((const __m256i*)component[q]));
+            _mm256_storeu_si256(
+                (__m256i*)(dst + i * n + 8 * q),
+                _mm256_i32gather_epi32((const int*)src, offsets, 4));
+        }
+    }
+    for (; i < hi; i++) {
+        for (int k = 0; k < (int)n; k++) {
+            dst[i * n + k] = src[idx[i] * n + k];
+        }
+    }
+}
+#endif
+
+} // namespace detail
+
+/**
+ * @brief Gathers vectors by index: dst[i] = src[idx[i]].
+ *
+ * Runs across threads. With AVX2, vectors of 4-byte scalars are gathered
+ * eight at a time with hardware gathers (falling back to plain copies where
+ * idx[i] * n overflows their signed 32-bit offsets); otherwise, and in
+ * addition, the source is prefetched prefetch_distance() elements ahead,
+ * which hides most of the latency of random access.
+ *
+ * @param src The source vectors.
+ * @param idx The indices into `src`.
+ * @param dst The output vectors (must not overlap `src`).
+ * @param count The number of indices.
+ */
+template <typename T, std::size_t n>
+void gather(const vec<T, n>* src, const std::uint32_t* idx, vec<T, n>* dst,
+            std::size_t count) {
+    std::size_t distance = prefetch_distance();
+    parallel_for_ranges(
+        0, count,
+        [=](std::size_t lo, std::size_t hi, unsigned) {
+#if defined(__AVX2__)
+            if ((sizeof(T) == 4) && (sizeof(vec<T, n>) == 4 * n)) {
+                detail::gather_avx2<n>((const std::int32_t*)src, idx,
+                                       (std::int32_t*)dst, lo, hi, distance);
+                return;
+            }
+#endif
+            detail::gather_scalar(src, idx, dst, lo, hi, distance);
+        },
+        4096);
+}
+
+/**
+ * @brief Accumulates vectors by index: dst[idx[i]] += src[i].
+ *
+ * Indices may repeat, so this runs on the calling thread; partition the
+ * indices by destination to parallelise. The destination is prefetched for
+ * writing prefetch_distance() elements ahead.
+ *
+ * @param src The source vectors.
+ * @param idx The indices into `dst`.
+ * @param dst The accumulated vectors.
+ * @param count The number of indices.
+ */
+template <typename T, std::size_t n>
+void scatter_add(const vec<T, n>* src, const std::uint32_t* idx,
+                 vec<T, n>* dst, std::size_t count) {
+    std::size_t distance = prefetch_distance();
+    std::size_t i = 0;
+    if (distance) {
+        std::size_t ahead = count > distance ? count - distance : 0;
+        for (; i < ahead; i++) {
+            detail::prefetch_element(dst + idx[i + distance], true);
+            dst[idx[i]] = dst[idx[i]] + src[i];
+        }
+    }
+    for (; i < count; i++) {
+        dst[idx[i]] = dst[idx[i]] + src[i];
+    }
+}
+
+} // namespace HQ
+
+#endif // _HQBATCH_HPP_
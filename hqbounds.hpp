@@ -0,0 +1,163 @@
+/**
+ * @file hqbounds.hpp
+ * @brief This file defines axis-aligned bounding boxes over arrays of vectors.
+ */
+
+#ifndef _HQBOUNDS_HPP_
+#define _HQBOUNDS_HPP_
+
+#include "hqvec.hpp"
+#include <cstddef>
+#include <limits>
+
+namespace HQ {
+
+/**
+ * @brief An axis-aligned bounding box.
+ *
+ * @tparam T The data type of the box corners.
+ * @tparam n The dimension of the box.
+ */
+template <typename T, std::size_t n> struct aabb {
+    /** @brief Lower corner of the box. */
+    vec<T, n> lo;
+    /** @brief Upper corner of the box. */
+    vec<T, n> hi;
+
+    /**
+     * @brief Constructs an empty box (lo = +max, hi = lowest).
+     */
+    aabb() {
+        for (int i = 0; i < (int)n; i++) {
+            lo[i] = std::numeric_limits<T>::max();
+            hi[i] = std::numeric_limits<T>::lowest();
+        }
+    }
+
+    /**
+     * @brief Constructs a box from two corners.
+     *
+     * @param lo_ Lower corner.
+     * @param hi_ Upper corner.
+     */
+    aabb(const vec<T, n>& lo_, const vec<T, n>& hi_) : lo(lo_), hi(hi_) {}
+
+    /**
+     * @brief Checks whether the box contains no points.
+     *
+     * @return bool True if any lower bound exceeds its upper bound.
+     */
+    bool empty() const {
+        for (int i = 0; i < (int)n; i++) {
+            if (lo[i] > hi[i])
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Grows the box to contain a point.
+     *
+     * @param p The point to include.
+     */
+    void expand(const vec<T, n>& p) {
+        for (int i = 0; i < (int)n; i++) {
+            lo[i] = p[i] < lo[i] ? p[i] : lo[i];
+            hi[i] = p[i] > hi[i] ? p[i] : hi[i];
+        }
+    }
+
+    /**
+     * @brief Grows the box to contain another box.
+     *
+     * @param other The box to include.
+     */
+    void expand(const aabb<T, n>& other) {
+        expand(other.lo);
+        expand(other.hi);
+    }
+
+    /**
+     * @brief Returns the edge lengths of the box.
+     *
+     * @return vec<T, n> hi - lo.
+     */
+    vec<T, n> extent() const { return hi - lo; }
+
+    /**
+     * @brief Returns the centre of the box.
+     *
+     * @return vec<T, n> (lo + hi) / 2.
+     */
+    vec<T, n> center() const { return (lo + hi) / static_cast<T>(2); }
+
+    /**
+     * @brief Checks whether a point lies inside the box (inclusive).
+     *
+     * @param p The point to test.
+     * @return bool True if lo <= p <= hi on every axis.
+     */
+    bool contains(const vec<T, n>& p) const {
+        for (int i = 0; i < (int)n; i++) {
+            if ((p[i] < lo[i]) || (p[i] > hi[i]))
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Checks whether two boxes overlap (inclusive).
+     *
+     * @param other The other box.
+     * @return bool True if the boxes share at least one point.
+     */
+    bool overlaps(const aabb<T, n>& other) const {
+        for (int i = 0; i < (int)n; i++) {
+            if ((other.hi[i] < lo[i]) || (other.lo[i] > hi[i]))
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Computes the squared distance from a point to the box.
+     *
+     * @param p The point.
+     * @return T Zero if the point is inside, else the squared gap.
+     */
+    T distance2(const vec<T, n>& p) const {
+        T out = 0;
+        for (int i = 0; i < (int)n; i++) {
+            T d = 0;
+            if (p[i] < lo[i])
+                d = lo[i] - p[i];
+            else if (p[i] > hi[i])
+                d = p[i] - hi[i];
+            out += d * d;
+        }
+        return out;
+    }
+};
+
+/**
+ * @brief Computes the bounding box of an array of points.
+ *
+ * @tparam T The data type of the points.
+ * @tparam n The dimension of the points.
+ * @param points The input points.
+ * @param count The number of points.
+ * @return aabb<T, n> The tightest box containing every point (empty if count
+ * is 0).
+ */
+template <typename T, std::size_t n>
+aabb<T, n> bounding_box(const vec<T, n>* points, std::size_t count) {
+    aabb<T, n> out;
+    for (std::size_t i = 0; i < count; i++) {
+        out.expand(points[i]);
+    }
+    return out;
+}
+
+} // namespace HQ
+
+#endif // _HQBOUNDS_HPP_
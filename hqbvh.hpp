@@ -0,0 +1,668 @@
+/**
+ * @file hqbvh.hpp
+ * @brief This file defines a wide bounding volume hierarchy over vec3<float>
+ * boxes for ray, segment and point queries.
+ */
+
+#ifndef _HQBVH_HPP_
+#define _HQBVH_HPP_
+
+#include "hqalloc.hpp"
+#include "hqbounds.hpp"
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace HQ {
+
+/**
+ * @brief A ray (or segment) with a parametric interval [tmin, tmax].
+ */
+struct ray {
+    /** @brief Start point. */
+    vec3<float> origin;
+    /** @brief Direction (need not be normalised). */
+    vec3<float> direction;
+    /** @brief Nearest accepted parameter. */
+    float tmin;
+    /** @brief Farthest accepted parameter. */
+    float tmax;
+
+    /**
+     * @brief Constructs an unbounded ray.
+     *
+     * @param origin_ Start point.
+     * @param direction_ Direction.
+     */
+    ray(const vec3<float>& origin_, const vec3<float>& direction_)
+        : origin(origin_), direction(direction_), tmin(0),
+          tmax(std::numeric_limits<float>::infinity()) {}
+
+    /**
+     * @brief Constructs the segment from a to b (t in [0, 1]).
+     *
+     * @param a Start point.
+     * @param b End point.
+     * @return ray The segment.
+     */
+    static ray segment(const vec3<float>& a, const vec3<float>& b) {
+        ray out(a, b - a);
+        out.tmax = 1;
+        return out;
+    }
+};
+
+/**
+ * @brief The result of a closest-hit query.
+ */
+struct ray_hit {
+    /** @brief The primitive hit, or bvh<W>::npos for a miss. */
+    std::uint32_t primitive;
+    /** @brief Ray parameter of the hit (the ray's tmax for a miss). */
+    float t;
+};
+
+/**
+ * @brief A BVH node holding the boxes of up to W children in SoA layout, so
+ * one SIMD slab test covers all of them.
+ *
+ * @tparam W The branching factor (4 or 8).
+ */
+template <std::size_t W> struct bvh_node {
+    /** @brief Lower corners of the child boxes, per axis. */
+    alignas(32) float lo[3][W];
+    /** @brief Upper corners of the child boxes, per axis. */
+    alignas(32) float hi[3][W];
+    /** @brief Node index, first leaf slot, or -1 for an unused child. */
+    std::int32_t child[W];
+    /** @brief Primitive count of a leaf child; 0 for inner or unused. */
+    std::uint32_t count[W];
+    /** @brief Number of used children (they come first). */
+    std::uint32_t children;
+
+    /**
+     * @brief Returns a mask with one bit per used child.
+     *
+     * @return unsigned Bits [0, children) set.
+     */
+    unsigned used_mask() const { return (1u << children) - 1; }
+};
+
+namespace detail {
+
+/**
+ * @brief Ray data precomputed once per traversal.
+ */
+struct ray_setup {
+    float origin[3];
+    float inverse[3];
+
+    explicit ray_setup(const ray& r) {
+        for (int k = 0; k < 3; k++) {
+            origin[k] = r.origin[k];
+            inverse[k] = 1.0f / r.direction[k];
+        }
+    }
+};
+
+/**
+ * @brief Slab-tests the ray against every child box of a node.
+ *
+ * An axis the ray does not move along, with the origin exactly on one of
+ * the box's faces, gives 0 * inf = NaN; the origin is then inside that slab
+ * for every t, so the axis is skipped rather than culling the box.
+ *
+ * @return unsigned Bit i set if child i is hit within [tmin, tmax]; the
+ * entry distances are written to tnear.
+ */
+template <std::size_t W>
+inline unsigned slab_test(const bvh_node<W>& node, const ray_setup& r,
+                          float tmin, float tmax, float* tnear) {
+    unsigned mask = 0;
+#if defined(__AVX__)
+    if (W % 8 == 0) {
+        for (int g = 0; g < (int)W; g += 8) {
+            __m256 near = _mm256_set1_ps(tmin), far = _mm256_set1_ps(tmax);
+            for (int k = 0; k < 3; k++) {
+                __m256 o = _mm256_set1_ps(r.origin[k]);
+                __m256 inv = _mm256_set1_ps(r.inverse[k]);
+                __m256 t1 = _mm256_mul_ps(
+                    _mm256_sub_ps(_mm256_load_ps(node.lo[k] + g), o), inv);
+                __m256 t2 = _mm256_mul_ps(
+                    _mm256_sub_ps(_mm256_load_ps(node.hi[k] + g), o), inv);
+                // all-ones lanes are NaN, and max/min return their second
+                // operand for a NaN, so those lanes keep near and far
+                __m256 nan = _mm256_cmp_ps(t1, t2, _CMP_UNORD_Q);
+                near = _mm256_max_ps(
+                    _mm256_or_ps(_mm256_min_ps(t1, t2), nan), near);
+                far = _mm256_min_ps(
+                    _mm256_or_ps(_mm256_max_ps(t1, t2), nan), far);
+            }
+            _mm256_storeu_ps(tnear + g, near);
+            mask |= (unsigned)_mm256_movemask_ps(
+                        _mm256_cmp_ps(near, far, _CMP_LE_OQ))
+                    << g;
+        }
+        return mask;
+    }
+#endif
+#if defined(__SSE2__)
+    if (W % 4 == 0) {
+        for (int g = 0; g < (int)W; g += 4) {
+            __m128 near = _mm_set1_ps(tmin), far = _mm_set1_ps(tmax);
+            for (int k = 0; k < 3; k++) {
+                __m128 o = _mm_set1_ps(r.origin[k]);
+                __m128 inv = _mm_set1_ps(r.inverse[k]);
+                __m128 t1 =
+                    _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.lo[k] + g), o), inv);
+                __m128 t2 =
+                    _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.hi[k] + g), o), inv);
+                // all-ones lanes are NaN, and max/min return their second
+                // operand for a NaN, so those lanes keep near and far
+                __m128 nan = _mm_cmpunord_ps(t1, t2);
+                near = _mm_max_ps(_mm_or_ps(_mm_min_ps(t1, t2), nan), near);
+                far = _mm_min_ps(_mm_or_ps(_mm_max_ps(t1, t2), nan), far);
+            }
+            _mm_storeu_ps(tnear + g, near);
+            mask |= (unsigned)_mm_movemask_ps(_mm_cmple_ps(near, far)) << g;
+        }
+        return mask;
+    }
+#endif
+    for (int i = 0; i < (int)W; i++) {
+        float near = tmin, far = tmax;
+        for (int k = 0; k < 3; k++) {
+            float t1 = (node.lo[k][i] - r.origin[k]) * r.inverse[k];
+            float t2 = (node.hi[k][i] - r.origin[k]) * r.inverse[k];
+            if ((t1 != t1) || (t2 != t2))
+                continue;
+            near = std::max(near, std::min(t1, t2));
+            far = std::min(far, std::max(t1, t2));
+        }
+        tnear[i] = near;
+        mask |= near <= far ? 1u << i : 0u;
+    }
+    return mask;
+}
+
+/**
+ * @brief Tests which child boxes of a node contain a point.
+ *
+ * @return unsigned Bit i set if child i contains p (inclusive).
+ */
+template <std::size_t W>
+inline unsigned contains_test(const bvh_node<W>& node, const vec3<float>& p) {
+    unsigned mask = 0;
+#if defined(__SSE2__)
+    if (W % 4 == 0) {
+        for (int g = 0; g < (int)W; g += 4) {
+            __m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int k = 0; k < 3; k++) {
+                __m128 v = _mm_set1_ps(p[k]);
+                __m128 lo = _mm_load_ps(node.lo[k] + g);
+                __m128 hi = _mm_load_ps(node.hi[k] + g);
+                in = _mm_and_ps(in, _mm_and_ps(_mm_cmple_ps(lo, v),
+                                               _mm_cmple_ps(v, hi)));
+            }
+            mask |= (unsigned)_mm_movemask_ps(in) << g;
+        }
+        return mask;
+    }
+#endif
+    for (int i = 0; i < (int)W; i++) {
+        bool in = true;
+        for (int k = 0; k < 3; k++) {
+            in = in && (node.lo[k][i] <= p[k]) && (p[k] <= node.hi[k][i]);
+        }
+        mask |= in ? 1u << i : 0u;
+    }
+    return mask;
+}
+
+/**
+ * @brief Returns the index of the lowest set bit of a non-zero mask.
+ */
+inline int lowest_bit(unsigned mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+/**
+ * @brief Returns the surface area of a box (0 if empty).
+ */
+inline float surface_area(const aabb<float, 3>& box) {
+    if (box.empty())
+        return 0;
+    vec3<float> e = box.extent();
+    return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+} // namespace detail
+
+/**
+ * @brief A bounding volume hierarchy with W-wide nodes.
+ *
+ * Built top-down with binned SAH splits into a binary tree, which is then
+ * collapsed so every node holds up to W children; each traversal step slab-
+ * tests all W child boxes at once (SSE for 4 lanes, AVX for 8 where
+ * available, scalar otherwise). Primitives are only known by their boxes;
+ * queries take a callback that performs the exact primitive test.
+ *
+ * @tparam W The branching factor (4 or 8).
+ */
+template <std::size_t W = 4> class bvh {
+    static_assert((W == 4) || (W == 8), "bvh width must be 4 or 8");
+
+  public:
+    /** @brief Marks a miss in ray_hit::primitive. */
+    static const std::uint32_t npos = 0xffffffffu;
+
+  private:
+    // binary tree produced by the SAH build, collapsed afterwards
+    struct build_node {
+        aabb<float, 3> box;
+        std::unique_ptr<build_node> left, right;
+        std::size_t first, count, depth;
+    };
+
+    static const int bins = 16;
+    static const std::size_t max_depth = 1024;
+    // a traversal holds at most W - 1 siblings per level plus the node
+    // being opened, and collapsing never deepens the tree, so capping the
+    // binary depth keeps every query within the max_depth stack
+    static const std::size_t max_build_depth = (max_depth - 1) / (W - 1);
+
+    std::vector<bvh_node<W>, aligned_allocator<bvh_node<W>, 64>> m_nodes;
+    std::vector<std::uint32_t> m_order;
+    std::vector<vec3<float>> m_centroids;
+    const aabb<float, 3>* m_boxes;
+    std::size_t m_leaf_size;
+
+    // chooses and applies the split of a node; false if it stays a leaf
+    bool split(build_node& node) {
+        std::uint32_t* order = m_order.data() + node.first;
+        aabb<float, 3> centroids;
+        node.box = aabb<float, 3>();
+        for (std::size_t i = 0; i < node.count; i++) {
+            node.box.expand(m_boxes[order[i]]);
+            centroids.expand(m_centroids[order[i]]);
+        }
+        if ((node.count <= m_leaf_size) || (node.depth >= max_build_depth))
+            return false;
+
+        int best_axis = -1, best_bin = 0;
+        float best_cost = std::numeric_limits<float>::max();
+        vec3<float> extent = centroids.extent();
+        for (int k = 0; k < 3; k++) {
+            if (!(extent[k] > 0))
+                continue;
+            aabb<float, 3> box[bins];
+            std::size_t count[bins] = {0};
+            float scale = bins / extent[k];
+            for (std::size_t i = 0; i < node.count; i++) {
+                int b = bin_of(m_centroids[order[i]][k], centroids.lo[k],
+                               scale);
+                box[b].expand(m_boxes[order[i]]);
+                count[b]++;
+            }
+            // sweep from the right, then from the left
+            float right_cost[bins];
+            aabb<float, 3> acc;
+            std::size_t acc_count = 0;
+            for (int b = bins - 1; b > 0; b--) {
+                acc.expand(box[b]);
+                acc_count += count[b];
+                right_cost[b] = detail::surface_area(acc) * acc_count;
+            }
+            acc = aabb<float, 3>();
+            acc_count = 0;
+            for (int b = 1; b < bins; b++) {
+                acc.expand(box[b - 1]);
+                acc_count += count[b - 1];
+                float cost = detail::surface_area(acc) * acc_count +
+                             right_cost[b];
+                if ((acc_count > 0) && (acc_count < node.count) &&
+                    (cost < best_cost)) {
+                    best_cost = cost;
+                    best_axis = k;
+                    best_bin = b;
+                }
+            }
+        }
+
+        std::size_t mid;
+        if (best_axis < 0) {
+            // every centroid coincides: halve the range
+            mid = node.count / 2;
+        } else {
+            float leaf_cost = detail::surface_area(node.box) * node.count;
+            if ((best_cost >= leaf_cost) && (node.count <= 4 * m_leaf_size))
+                return false;
+            float lo = centroids.lo[best_axis];
+            float scale = bins / extent[best_axis];
+            int axis = best_axis, split_bin = best_bin;
+            const std::vector<vec3<float>>& c = m_centroids;
+            mid = std::partition(order, order + node.count,
+                                 [&](std::uint32_t p) {
+                                     return bin_of(c[p][axis], lo, scale) <
+                                            split_bin;
+                                 }) -
+                  order;
+        }
+        node.left.reset(new build_node());
+        node.left->first = node.first;
+        node.left->count = mid;
+        node.left->depth = node.depth + 1;
+        node.right.reset(new build_node());
+        node.right->first = node.first + mid;
+        node.right->count = node.count - mid;
+        node.right->depth = node.depth + 1;
+        return true;
+    }
+
+    static int bin_of(float c, float lo, float scale) {
+        int b = (int)((c - lo) * scale);
+        return b < 0 ? 0 : (b >= bins ? bins - 1 : b);
+    }
+
+    void build_recursive(build_node& node) {
+        if (!split(node))
+            return;
+        build_recursive(*node.left);
+        build_recursive(*node.right);
+    }
+
+    // writes the wide node for `root`'s subtree and returns its index
+    std::int32_t flatten(const build_node& root) {
+        const build_node* kids[W];
+        std::size_t used = 1;
+        kids[0] = &root;
+        // open the largest inner child until the node is full
+        while (used < W) {
+            int open = -1;
+            float area = -1;
+            for (int i = 0; i < (int)used; i++) {
+                float a = detail::surface_area(kids[i]->box);
+                if (kids[i]->left && (a > area)) {
+                    open = i;
+                    area = a;
+                }
+            }
+            if (open < 0)
+                break;
+            const build_node* opened = kids[open];
+            kids[open] = opened->left.get();
+            kids[used++] = opened->right.get();
+        }
+        std::int32_t index = (std::int32_t)m_nodes.size();
+        m_nodes.push_back(bvh_node<W>());
+        std::int32_t child[W];
+        std::uint32_t count[W];
+        for (int i = 0; i < (int)W; i++) {
+            child[i] = -1;
+            count[i] = 0;
+            if (i >= (int)used)
+                continue;
+            if (kids[i]->left) {
+                child[i] = flatten(*kids[i]);
+            } else {
+                child[i] = (std::int32_t)kids[i]->first;
+                count[i] = (std::uint32_t)kids[i]->count;
+            }
+        }
+        // m_nodes has grown, so look the node up again
+        const float inf = std::numeric_limits<float>::infinity();
+        bvh_node<W>& node = m_nodes[index];
+        for (int i = 0; i < (int)W; i++) {
+            for (int k = 0; k < 3; k++) {
+                node.lo[k][i] = i < (int)used ? kids[i]->box.lo[k] : inf;
+                node.hi[k][i] = i < (int)used ? kids[i]->box.hi[k] : inf;
+            }
+            node.child[i] = child[i];
+            node.count[i] = count[i];
+        }
+        node.children = (std::uint32_t)used;
+        return index;
+    }
+
+  public:
+    /**
+     * @brief Constructs an empty hierarchy.
+     */
+    bvh() : m_boxes(nullptr), m_leaf_size(4) {}
+
+    /**
+     * @brief Builds a hierarchy over primitive boxes.
+     *
+     * @param boxes Bounds of each primitive (only read during the build).
+     * @param count The number of primitives.
+     * @param leaf_size Primitives below which a node is never split.
+     */
+    bvh(const aabb<float, 3>* boxes, std::size_t count,
+        std::size_t leaf_size = 4)
+        : m_boxes(nullptr), m_leaf_size(4) {
+        build(boxes, count, leaf_size);
+    }
+
+    /**
+     * @brief Rebuilds the hierarchy over primitive boxes.
+     *
+     * The top levels are split on the calling thread until there is one
+     * subtree per thread; the subtrees are then built in parallel.
+     * Splitting stops at a depth the fixed traversal stack can hold,
+     * leaving larger leaves there instead.
+     *
+     * @param boxes Bounds of each primitive (only read during the build).
+     * @param count The number of primitives (less than 2^31).
+     * @param leaf_size Primitives below which a node is never split.
+     */
+    void build(const aabb<float, 3>* boxes, std::size_t count,
+               std::size_t leaf_size = 4) {
+        m_nodes.clear();
+        m_order.resize(count);
+        m_centroids.resize(count);
+        m_boxes = boxes;
+        m_leaf_size = leaf_size ? leaf_size : 1;
+        if (!count)
+            return;
+        parallel_for(0, count, [&](std::size_t i) {
+            m_order[i] = (std::uint32_t)i;
+            m_centroids[i] = boxes[i].center();
+        });
+
+        build_node root;
+        root.first = 0;
+        root.count = count;
+        root.depth = 0;
+        std::vector<build_node*> frontier(1, &root), next;
+        while (frontier.size() < num_threads()) {
+            next.clear();
+            for (std::size_t i = 0; i < frontier.size(); i++) {
+                if (split(*frontier[i])) {
+                    next.push_back(frontier[i]->left.get());
+                    next.push_back(frontier[i]->right.get());
+                }
+            }
+            if (next.empty())
+                break;
+            frontier.swap(next);
+        }
+        parallel_for(
+            0, frontier.size(),
+            [&](std::size_t i) { build_recursive(*frontier[i]); },
+            1);
+        flatten(root);
+        m_centroids.clear();
+        m_centroids.shrink_to_fit();
+        m_boxes = nullptr;
+    }
+
+    /**
+     * @brief Returns the number of wide nodes.
+     *
+     * @return std::size_t The node count (0 if empty).
+     */
+    std::size_t node_count() const { return m_nodes.size(); }
+
+    /**
+     * @brief Returns the number of primitives.
+     *
+     * @return std::size_t The primitive count.
+     */
+    std::size_t size() const { return m_order.size(); }
+
+    /**
+     * @brief Finds the nearest primitive hit by a ray.
+     *
+     * @tparam F Callable `float(std::uint32_t primitive, const ray&)`
+     * returning the hit parameter, or any value outside [tmin, tmax] (such
+     * as infinity) for a miss.
+     * @param r The ray.
+     * @param intersect The exact primitive test.
+     * @return ray_hit The nearest hit, or {npos, r.tmax}.
+     */
+    template <typename F>
+    ray_hit closest_hit(const ray& r, F intersect) const {
+        ray_hit out = {npos, r.tmax};
+        if (m_nodes.empty())
+            return out;
+        detail::ray_setup setup(r);
+        std::int32_t stack[max_depth];
+        std::size_t top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const bvh_node<W>& node = m_nodes[stack[--top]];
+            float tnear[W];
+            unsigned mask =
+                detail::slab_test(node, setup, r.tmin, out.t, tnear) &
+                node.used_mask();
+            // push inner children far to near so the nearest pops first
+            int inner[W];
+            int inner_count = 0;
+            for (; mask; mask &= mask - 1) {
+                int i = detail::lowest_bit(mask);
+                if (node.count[i]) {
+                    const std::uint32_t* p = m_order.data() + node.child[i];
+                    for (std::uint32_t j = 0; j < node.count[i]; j++) {
+                        float t = intersect(p[j], r);
+                        if ((t >= r.tmin) && (t < out.t)) {
+                            out.t = t;
+                            out.primitive = p[j];
+                        }
+                    }
+                } else {
+                    int at = inner_count++;
+                    while ((at > 0) && (tnear[inner[at - 1]] < tnear[i])) {
+                        inner[at] = inner[at - 1];
+                        at--;
+                    }
+                    inner[at] = i;
+                }
+            }
+            assert(top + inner_count <= max_depth);
+            for (int j = 0; j < inner_count; j++) {
+                stack[top++] = node.child[inner[j]];
+            }
+        }
+        return out;
+    }
+
+    /**
+     * @brief Checks whether a ray hits any primitive (e.g. for shadow rays
+     * or segment visibility), stopping at the first hit found.
+     *
+     * @tparam F Callable `float(std::uint32_t primitive, const ray&)` as for
+     * closest_hit.
+     * @param r The ray; use ray::segment for a segment query.
+     * @param intersect The exact primitive test.
+     * @return bool True if some primitive is hit within [tmin, tmax].
+     */
+    template <typename F> bool any_hit(const ray& r, F intersect) const {
+        if (m_nodes.empty())
+            return false;
+        detail::ray_setup setup(r);
+        std::int32_t stack[max_depth];
+        std::size_t top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const bvh_node<W>& node = m_nodes[stack[--top]];
+            float tnear[W];
+            unsigned mask =
+                detail::slab_test(node, setup, r.tmin, r.tmax, tnear) &
+                node.used_mask();
+            for (; mask; mask &= mask - 1) {
+                int i = detail::lowest_bit(mask);
+                if (node.count[i]) {
+                    const std::uint32_t* p = m_order.data() + node.child[i];
+                    for (std::uint32_t j = 0; j < node.count[i]; j++) {
+                        float t = intersect(p[j], r);
+                        if ((t >= r.tmin) && (t <= r.tmax))
+                            return true;
+                    }
+                } else {
+                    assert(top < max_depth);
+                    stack[top++] = node.child[i];
+                }
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Calls `f(primitive)` for every primitive whose box contains a
+     * point.
+     *
+     * @tparam F Callable taking (std::uint32_t primitive).
+     * @param p The query point.
+     * @param f The callback; it performs any exact test itself.
+     */
+    template <typename F> void contains(const vec3<float>& p, F f) const {
+        if (m_nodes.empty())
+            return;
+        std::int32_t stack[max_depth];
+        std::size_t top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const bvh_node<W>& node = m_nodes[stack[--top]];
+            unsigned mask = detail::contains_test(node, p) & node.used_mask();
+            for (; mask; mask &= mask - 1) {
+                int i = detail::lowest_bit(mask);
+                if (node.count[i]) {
+                    const std::uint32_t* q = m_order.data() + node.child[i];
+                    for (std::uint32_t j = 0; j < node.count[i]; j++) {
+                        f(q[j]);
+                    }
+                } else {
+                    assert(top < max_depth);
+                    stack[top++] = node.child[i];
+                }
+            }
+        }
+    }
+};
+
+template <std::size_t W> const std::uint32_t bvh<W>::npos;
+
+} // namespace HQ
+
+#endif // _HQBVH_HPP_
@@ -0,0 +1,417 @@
+/**
+ * @file hqcells.hpp
+ * @brief This file defines a uniform grid (cell-linked list) for
+ * fixed-radius neighbour search over vec3 points.
+ */
+
+#ifndef _HQCELLS_HPP_
+#define _HQCELLS_HPP_
+
+#include "hqalloc.hpp"
+#include "hqbounds.hpp"
+#include "hqparallel.hpp"
+#include "hqperiodic.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief A uniform grid of cells at least `radius` wide, with the points of
+ * each cell stored contiguously.
+ *
+ * Points are counting-sorted by cell, so every cell is a range of the
+ * sorted arrays and all pairs within `radius` lie in the 27 cells around
+ * each point's own. Grids built with a box are periodic: neighbour cells
+ * wrap around and distances use the minimum image.
+ *
+ * @tparam T The scalar type of the points.
+ */
+template <typename T> class cell_list {
+  private:
+    T m_radius;
+    bool m_periodic;
+    vec3<T> m_box;
+    vec3<T> m_origin;
+    vec3<T> m_inverse_cell;
+    int m_dims[3];
+    std::vector<std::uint32_t> m_start;
+    std::vector<vec3<T>> m_points;
+    std::vector<std::uint32_t> m_index;
+
+    int coord(T x, int k) const {
+        int c = (int)((x - m_origin[k]) * m_inverse_cell[k]);
+        return c < 0 ? 0 : (c >= m_dims[k] ? m_dims[k] - 1 : c);
+    }
+
+    std::size_t cell_id(int x, int y, int z) const {
+        return ((std::size_t)z * m_dims[1] + y) * m_dims[0] + x;
+    }
+
+    // the distinct cells along axis k covering raw coordinates [lo, hi]
+    // (at most 3), clamped or wrapped
+    int axis_cells(int lo, int hi, int k, int* out) const {
+        int count = 0;
+        if (!m_periodic) {
+            lo = lo < 0 ? 0 : lo;
+            hi = hi >= m_dims[k] ? m_dims[k] - 1 : hi;
+            for (int c = lo; c <= hi; c++) {
+                out[count++] = c;
+            }
+            return count;
+        }
+        for (int c = lo; (c <= hi) && (count < m_dims[k]); c++) {
+            out[count++] = ((c % m_dims[k]) + m_dims[k]) % m_dims[k];
+        }
+        return count;
+    }
+
+    T distance2_between(const vec3<T>& a, const vec3<T>& b) const {
+        return m_periodic ? distance2_periodic(a, b, m_box) : a.distance2(b);
+    }
+
+    // counting-sorts the points into the cells set up by build()
+    void sort_into_cells(const vec3<T>* points, std::size_t count) {
+        std::size_t cells = cell_count();
+        detail::kernel_scratch<std::uint32_t> ids(count);
+        std::vector<std::atomic<std::uint32_t>> fill(cells);
+        parallel_for(0, cells, [&](std::size_t c) { fill[c] = 0; });
+        parallel_for(0, count, [&](std::size_t i) {
+            ids[i] = (std::uint32_t)cell_of(points[i]);
+            fill[ids[i]].fetch_add(1, std::memory_order_relaxed);
+        });
+        m_start.resize(cells + 1);
+        std::uint32_t sum = 0;
+        for (std::size_t c = 0; c < cells; c++) {
+            m_start[c] = sum;
+            sum += fill[c].load(std::memory_order_relaxed);
+            fill[c] = m_start[c];
+        }
+        m_start[cells] = sum;
+        m_index.resize(count);
+        parallel_for(0, count, [&](std::size_t i) {
+            std::uint32_t at =
+                fill[ids[i]].fetch_add(1, std::memory_order_relaxed);
+            m_index[at] = (std::uint32_t)i;
+        });
+        m_points.resize(count);
+        parallel_for(
+            0, cells,
+            [&](std::size_t c) {
+                std::sort(m_index.begin() + m_start[c],
+                          m_index.begin() + m_start[c + 1]);
+                for (std::uint32_t i = m_start[c]; i < m_start[c + 1]; i++) {
+                    m_points[i] = m_periodic ? wrap(points[m_index[i]], m_box)
+                                             : points[m_index[i]];
+                }
+            },
+            256);
+    }
+
+  public:
+    /**
+     * @brief Constructs an empty grid.
+     */
+    cell_list() : m_radius(0), m_periodic(false) {
+        m_dims[0] = m_dims[1] = m_dims[2] = 0;
+    }
+
+    /**
+     * @brief Builds a grid over a copy of the points.
+     *
+     * @param points The points.
+     * @param count The number of points (less than 2^32).
+     * @param radius The search radius.
+     */
+    cell_list(const vec3<T>* points, std::size_t count, T radius)
+        : m_radius(0), m_periodic(false) {
+        build(points, count, radius);
+    }
+
+    /**
+     * @brief Builds a grid over a copy of the points in a periodic box.
+     *
+     * @param points The points (wrapped into [0, box) when stored).
+     * @param count The number of points (less than 2^32).
+     * @param radius The search radius (at most half the smallest edge).
+     * @param box The periodic box edge lengths.
+     */
+    cell_list(const vec3<T>* points, std::size_t count, T radius,
+              const vec3<T>& box)
+        : m_radius(0), m_periodic(false) {
+        build(points, count, radius, box);
+    }
+
+    /**
+     * @brief Rebuilds the grid over a copy of the points.
+     *
+     * Cells are `radius` wide, widened where needed so there are at most
+     * about 8 cells per point. The counting sort runs in parallel, using
+     * atomic per-cell counters; each cell is then ordered by original index
+     * so the layout does not depend on thread timing.
+     *
+     * @param points The points.
+     * @param count The number of points (less than 2^32).
+     * @param radius The search radius (greater than 0).
+     */
+    void build(const vec3<T>* points, std::size_t count, T radius) {
+        assert(radius > 0);
+        m_radius = radius;
+        aabb<T, 3> box = bounding_box(points, count);
+        if (box.empty())
+            box = aabb<T, 3>(vec3<T>(), vec3<T>());
+        m_origin = box.lo;
+        T cell = radius;
+        std::size_t limit = 8 * count + 1;
+        for (;;) {
+            double cells = 1;
+            for (int k = 0; k < 3; k++) {
+                cells *= std::floor((double)(box.hi[k] - box.lo[k]) / cell) + 1;
+            }
+            if (cells <= (double)limit)
+                break;
+            cell *= (T)1.25;
+        }
+        for (int k = 0; k < 3; k++) {
+            m_dims[k] = (int)((box.hi[k] - box.lo[k]) / cell) + 1;
+            m_inverse_cell[k] = (T)1 / cell;
+        }
+        m_periodic = false;
+
+        sort_into_cells(points, count);
+    }
+
+    /**
+     * @brief Rebuilds the grid over a copy of the points in a periodic box.
+     *
+     * Each axis is divided into a whole number of cells at least `radius`
+     * wide, and neighbour cells and distances wrap around the box using the
+     * minimum image.
+     *
+     * @param points The points (wrapped into [0, box) when stored).
+     * @param count The number of points (less than 2^32).
+     * @param radius The search radius (at most half the smallest edge).
+     * @param box The periodic box edge lengths.
+     */
+    void build(const vec3<T>* points, std::size_t count, T radius,
+               const vec3<T>& box) {
+        assert((radius > 0) && (2 * radius <= box.x) &&
+               (2 * radius <= box.y) && (2 * radius <= box.z));
+        m_radius = radius;
+        m_periodic = true;
+        m_box = box;
+        m_origin = vec3<T>();
+        T cell = radius;
+        std::size_t limit = 8 * count + 1;
+        for (;;) {
+            std::size_t cells = 1;
+            for (int k = 0; k < 3; k++) {
+                m_dims[k] = std::max((int)(box[k] / cell), 1);
+                cells *= (std::size_t)m_dims[k];
+            }
+            if (cells <= limit)
+                break;
+            cell *= (T)1.25;
+        }
+        for (int k = 0; k < 3; k++) {
+            m_inverse_cell[k] = (T)m_dims[k] / box[k];
+        }
+        sort_into_cells(points, count);
+    }
+
+    /**
+     * @brief Returns the number of points.
+     *
+     * @return std::size_t The point count.
+     */
+    std::size_t size() const { return m_points.size(); }
+
+    /**
+     * @brief Returns the search radius the grid was built for.
+     *
+     * @return T The radius.
+     */
+    T radius() const { return m_radius; }
+
+    /**
+     * @brief Returns the number of cells.
+     *
+     * @return std::size_t The cell count.
+     */
+    std::size_t cell_count() const {
+        return (std::size_t)m_dims[0] * m_dims[1] * m_dims[2];
+    }
+
+    /**
+     * @brief Returns the cell a point falls in (points outside the grid are
+     * clamped to the nearest cell).
+     *
+     * @param p The point.
+     * @return std::size_t The cell id.
+     */
+    std::size_t cell_of(const vec3<T>& p) const {
+        vec3<T> q = m_periodic ? wrap(p, m_box) : p;
+        return cell_id(coord(q.x, 0), coord(q.y, 1), coord(q.z, 2));
+    }
+
+    /**
+     * @brief Checks whether the grid wraps around a periodic box.
+     *
+     * @return bool True if built with a box.
+     */
+    bool periodic() const { return m_periodic; }
+
+    /**
+     * @brief Returns the points sorted by cell.
+     *
+     * @return const vec3<T>* size() points.
+     */
+    const vec3<T>* sorted_points() const { return m_points.data(); }
+
+    /**
+     * @brief Returns the original index of each sorted point.
+     *
+     * @return const std::uint32_t* size() indices.
+     */
+    const std::uint32_t* sorted_indices() const { return m_index.data(); }
+
+    /**
+     * @brief Returns where a cell starts in the sorted arrays.
+     *
+     * @param cell The cell id.
+     * @return std::uint32_t Offset of the cell's first point; cell + 1 gives
+     * its end.
+     */
+    std::uint32_t cell_start(std::size_t cell) const { return m_start[cell]; }
+
+    /**
+     * @brief Lists a cell and its distinct neighbours, wrapped around a
+     * periodic box or clamped to the grid.
+     *
+     * @param cell The cell id.
+     * @param out Room for 27 cell ids.
+     * @return int The number of ids written.
+     */
+    int neighbour_cells(std::size_t cell, std::size_t* out) const {
+        int at[3] = {(int)(cell % m_dims[0]),
+                     (int)(cell / m_dims[0] % m_dims[1]),
+                     (int)(cell / m_dims[0] / m_dims[1])};
+        int cells[3][3], count[3];
+        for (int k = 0; k < 3; k++) {
+            count[k] = axis_cells(at[k] - 1, at[k] + 1, k, cells[k]);
+        }
+        int written = 0;
+        for (int z = 0; z < count[2]; z++) {
+            for (int y = 0; y < count[1]; y++) {
+                for (int x = 0; x < count[0]; x++) {
+                    out[written++] =
+                        cell_id(cells[0][x], cells[1][y], cells[2][z]);
+                }
+            }
+        }
+        return written;
+    }
+
+    /**
+     * @brief Calls `f(index, distance2)` for every point within radius() of
+     * a query point.
+     *
+     * @tparam F Callable taking (std::uint32_t index, T distance2).
+     * @param p The query point.
+     * @param f The callback.
+     */
+    template <typename F> void query(const vec3<T>& p, F f) const {
+        if (m_points.empty())
+            return;
+        vec3<T> q = m_periodic ? wrap(p, m_box) : p;
+        T r2 = m_radius * m_radius;
+        // cells are at least radius() wide, so the query's own cell and
+        // its neighbours cover the ball (q +- radius can round one cell
+        // further and overflow the three slots)
+        int cells[3][3], count[3];
+        for (int k = 0; k < 3; k++) {
+            int at = coord(q[k], k);
+            count[k] = axis_cells(at - 1, at + 1, k, cells[k]);
+        }
+        for (int z = 0; z < count[2]; z++) {
+            for (int y = 0; y < count[1]; y++) {
+                for (int x = 0; x < count[0]; x++) {
+                    std::size_t c =
+                        cell_id(cells[0][x], cells[1][y], cells[2][z]);
+                    for (std::uint32_t j = m_start[c]; j < m_start[c + 1];
+                         j++) {
+                        T d2 = distance2_between(m_points[j], q);
+                        if (d2 <= r2)
+                            f(m_index[j], d2);
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Calls `f(i, j, distance2)` for every ordered pair of distinct
+     * points within radius() of each other, across threads.
+     *
+     * Each pair is visited twice, as (i, j) and (j, i). Threads own whole
+     * cells, so every call for a given i comes from the same thread and f
+     * may update per-i state without synchronisation.
+     *
+     * @tparam F Callable taking (std::uint32_t i, std::uint32_t j, T d2),
+     * with original point indices.
+     * @param f The callback.
+     */
+    template <typename F> void for_each_pair(F f) const {
+        T r2 = m_radius * m_radius;
+        parallel_for(
+            0, cell_count(),
+            [&](std::size_t c) {
+                std::uint32_t begin = m_start[c], end = m_start[c + 1];
+                if (begin == end)
+                    return;
+                int at[3] = {(int)(c % m_dims[0]),
+                             (int)(c / m_dims[0] % m_dims[1]),
+                             (int)(c / m_dims[0] / m_dims[1])};
+                int cells[3][3], count[3];
+                for (int k = 0; k < 3; k++) {
+                    count[k] = axis_cells(at[k] - 1, at[k] + 1, k, cells[k]);
+                }
+                for (int z = 0; z < count[2]; z++) {
+                    for (int y = 0; y < count[1]; y++) {
+                        // adjacent cells along x form one contiguous range
+                        for (int x = 0; x < count[0];) {
+                            int run = x + 1;
+                            while ((run < count[0]) &&
+                                   (cells[0][run] == cells[0][run - 1] + 1))
+                                run++;
+                            int cy = cells[1][y], cz = cells[2][z];
+                            std::uint32_t first =
+                                m_start[cell_id(cells[0][x], cy, cz)];
+                            std::uint32_t last =
+                                m_start[cell_id(cells[0][run - 1], cy, cz) + 1];
+                            x = run;
+                            for (std::uint32_t i = begin; i < end; i++) {
+                                const vec3<T>& p = m_points[i];
+                                for (std::uint32_t j = first; j < last; j++) {
+                                    T d2 = distance2_between(m_points[j], p);
+                                    if ((d2 <= r2) && (j != i))
+                                        f(m_index[i], m_index[j], d2);
+                                }
+                            }
+                        }
+                    }
+                }
+            },
+            64);
+    }
+};
+
+} // namespace HQ
+
+#endif // _HQCELLS_HPP_
@@ -0,0 +1,464 @@
+/**
+ * @file hqcurve.hpp
+ * @brief This file defines Morton (Z-order) and Hilbert space-filling curve
+ * encoding for integer and quantized vec coordinates.
+ */
+
+#ifndef _HQCURVE_HPP_
+#define _HQCURVE_HPP_
+
+#include "hqbounds.hpp"
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__BMI2__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace HQ {
+
+/** @brief Bits per axis of a 2D curve code (64-bit codes). */
+static const int curve_bits2 = 32;
+/** @brief Bits per axis of a 3D curve code (63-bit codes). */
+static const int curve_bits3 = 21;
+
+namespace detail {
+
+/**
+ * @brief Spreads the 32 bits of x to the even bits of a 64-bit word.
+ */
+inline std::uint64_t spread2(std::uint64_t x) {
+    x &= 0xffffffffull;
+    x = (x | (x << 16)) & 0x0000ffff0000ffffull;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ffull;
+    x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    return (x | (x << 1)) & 0x5555555555555555ull;
+}
+
+/**
+ * @brief Gathers the even bits of a 64-bit word (inverse of spread2).
+ */
+inline std::uint32_t compact2(std::uint64_t x) {
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0full;
+    x = (x | (x >> 4)) & 0x00ff00ff00ff00ffull;
+    x = (x | (x >> 8)) & 0x0000ffff0000ffffull;
+    return (std::uint32_t)((x | (x >> 16)) & 0xffffffffull);
+}
+
+/**
+ * @brief Spreads the low 21 bits of x to every third bit of a 64-bit word.
+ */
+inline std::uint64_t spread3(std::uint64_t x) {
+    x &= 0x1fffffull;
+    x = (x | (x << 32)) & 0x001f00000000ffffull;
+    x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+    x = (x | (x << 8)) & 0x100f00f00f00f00full;
+    x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+    return (x | (x << 2)) & 0x1249249249249249ull;
+}
+
+/**
+ * @brief Gathers every third bit of a 64-bit word (inverse of spread3).
+ */
+inline std::uint32_t compact3(std::uint64_t x) {
+    x &= 0x1249249249249249ull;
+    x = (x | (x >> 2)) & 0x10c30c30c30c30c3ull;
+    x = (x | (x >> 4)) & 0x100f00f00f00f00full;
+    x = (x | (x >> 8)) & 0x001f0000ff0000ffull;
+    x = (x | (x >> 16)) & 0x001f00000000ffffull;
+    return (std::uint32_t)((x | (x >> 32)) & 0x1fffffull);
+}
+
+#if defined(__SSE2__)
+/**
+ * @brief spread3 on both 64-bit lanes.
+ */
+inline __m128i spread3(__m128i x) {
+    x = _mm_and_si128(x, _mm_set1_epi64x(0x1fffffll));
+    x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi64(x, 32)),
+                      _mm_set1_epi64x(0x001f00000000ffffll));
+    x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi64(x, 16)),
+                      _mm_set1_epi64x(0x001f0000ff0000ffll));
+    x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi64(x, 8)),
+                      _mm_set1_epi64x(0x100f00f00f00f00fll));
+    x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi64(x, 4)),
+                      _mm_set1_epi64x(0x10c30c30c30c30c3ll));
+    return _mm_and_si128(_mm_or_si128(x, _mm_slli_epi64(x, 2)),
+                         _mm_set1_epi64x(0x1249249249249249ll));
+}
+#endif
+
+/**
+ * @brief Skilling's in-place transform from axes to the "transposed"
+ * Hilbert index (branch free), `bits` bits per axis.
+ */
+template <std::size_t n>
+inline void axes_to_transpose(std::uint32_t* x, int bits) {
+    for (int b = bits - 1; b > 0; b--) {
+        std::uint32_t p = (1u << b) - 1;
+        for (int i = 0; i < (int)n; i++) {
+            // invert the low bits of x[0], or exchange them with x[i]
+            std::uint32_t set = 0u - ((x[i] >> b) & 1u);
+            std::uint32_t t = (x[0] ^ x[i]) & p & ~set;
+            x[0] ^= (p & set) | t;
+            x[i] ^= t;
+        }
+    }
+    for (int i = 1; i < (int)n; i++) {
+        x[i] ^= x[i - 1];
+    }
+    // bit j of t is the parity of the bits of x[n - 1] above j
+    std::uint32_t t = x[n - 1] >> 1;
+    for (int s = 1; s < 32; s <<= 1) {
+        t ^= t >> s;
+    }
+    for (int i = 0; i < (int)n; i++) {
+        x[i] ^= t;
+    }
+}
+
+#if defined(__SSE2__)
+/**
+ * @brief axes_to_transpose<3> on four coordinates at once, one per lane.
+ */
+inline void axes_to_transpose3(__m128i* x, int bits) {
+    const __m128i one = _mm_set1_epi32(1);
+    for (int b = bits - 1; b > 0; b--) {
+        __m128i q = _mm_set1_epi32(1 << b);
+        __m128i p = _mm_sub_epi32(q, one);
+        for (int i = 0; i < 3; i++) {
+            __m128i set = _mm_cmpeq_epi32(_mm_and_si128(x[i], q), q);
+            __m128i t = _mm_andnot_si128(
+                set, _mm_and_si128(_mm_xor_si128(x[0], x[i]), p));
+            x[0] = _mm_xor_si128(x[0], _mm_or_si128(_mm_and_si128(p, set), t));
+            x[i] = _mm_xor_si128(x[i], t);
+        }
+    }
+    x[1] = _mm_xor_si128(x[1], x[0]);
+    x[2] = _mm_xor_si128(x[2], x[1]);
+    __m128i t = _mm_srli_epi32(x[2], 1);
+    t = _mm_xor_si128(t, _mm_srli_epi32(t, 1));
+    t = _mm_xor_si128(t, _mm_srli_epi32(t, 2));
+    t = _mm_xor_si128(t, _mm_srli_epi32(t, 4));
+    t = _mm_xor_si128(t, _mm_srli_epi32(t, 8));
+    t = _mm_xor_si128(t, _mm_srli_epi32(t, 16));
+    for (int i = 0; i < 3; i++) {
+        x[i] = _mm_xor_si128(x[i], t);
+    }
+}
+#endif
+
+/**
+ * @brief Inverse of axes_to_transpose.
+ */
+template <std::size_t n>
+inline void transpose_to_axes(std::uint32_t* x, int bits) {
+    std::uint32_t t = x[n - 1] >> 1;
+    for (int i = (int)n - 1; i > 0; i--) {
+        x[i] ^= x[i - 1];
+    }
+    x[0] ^= t;
+    for (std::uint32_t q = 2; q != (2u << (bits - 1)); q <<= 1) {
+        std::uint32_t p = q - 1;
+        for (int i = (int)n - 1; i >= 0; i--) {
+            std::uint32_t set = 0u - ((x[i] & q) != 0);
+            std::uint32_t t2 = (x[0] ^ x[i]) & p & ~set;
+            x[0] ^= (p & set) | t2;
+            x[i] ^= t2;
+        }
+    }
+}
+
+/**
+ * @brief Maps points in a box to integer grid coordinates.
+ */
+template <typename T> struct grid_quantizer {
+    vec3<T> lo;
+    vec3<T> scale;
+    T top;
+
+    grid_quantizer(const aabb<T, 3>& box, int bits)
+        : lo(box.lo), top((T)((1u << bits) - 1)) {
+        for (int k = 0; k < 3; k++) {
+            T extent = box.hi[k] - box.lo[k];
+            scale[k] = extent > 0 ? top / extent : (T)0;
+        }
+    }
+
+    vec3<std::uint32_t> operator()(const vec3<T>& p) const {
+        vec3<std::uint32_t> out;
+        for (int k = 0; k < 3; k++) {
+            T q = (p[k] - lo[k]) * scale[k];
+            q = q < 0 ? 0 : (q > top ? top : q);
+            out[k] = (std::uint32_t)q;
+        }
+        return out;
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief Interleaves the bits of a 2D coordinate (x in the lowest bit).
+ *
+ * Uses BMI2 pdep when compiled with it.
+ *
+ * @param p The coordinate.
+ * @return std::uint64_t The Morton code.
+ */
+inline std::uint64_t morton_encode(const vec2<std::uint32_t>& p) {
+#if defined(__BMI2__)
+    return _pdep_u64(p.x, 0x5555555555555555ull) |
+           _pdep_u64(p.y, 0xaaaaaaaaaaaaaaaaull);
+#else
+    return detail::spread2(p.x) | (detail::spread2(p.y) << 1);
+#endif
+}
+
+/**
+ * @brief Interleaves the low 21 bits of each axis of a 3D coordinate (x in
+ * the lowest bit).
+ *
+ * Uses BMI2 pdep when compiled with it.
+ *
+ * @param p The coordinate (only the low curve_bits3 bits are used).
+ * @return std::uint64_t The Morton code.
+ */
+inline std::uint64_t morton_encode(const vec3<std::uint32_t>& p) {
+#if defined(__BMI2__)
+    return _pdep_u64(p.x, 0x1249249249249249ull) |
+           _pdep_u64(p.y, 0x2492492492492492ull) |
+           _pdep_u64(p.z, 0x4924924924924924ull);
+#else
+    return detail::spread3(p.x) | (detail::spread3(p.y) << 1) |
+           (detail::spread3(p.z) << 2);
+#endif
+}
+
+/**
+ * @brief Recovers a 2D coordinate from its Morton code.
+ *
+ * @param code The Morton code.
+ * @return vec2<std::uint32_t> The coordinate.
+ */
+inline vec2<std::uint32_t> morton_decode2(std::uint64_t code) {
+#if defined(__BMI2__)
+    return vec2<std::uint32_t>(
+        (std::uint32_t)_pext_u64(code, 0x5555555555555555ull),
+        (std::uint32_t)_pext_u64(code, 0xaaaaaaaaaaaaaaaaull));
+#else
+    return vec2<std::uint32_t>(detail::compact2(code),
+                               detail::compact2(code >> 1));
+#endif
+}
+
+/**
+ * @brief Recovers a 3D coordinate from its Morton code.
+ *
+ * @param code The Morton code.
+ * @return vec3<std::uint32_t> The coordinate.
+ */
+inline vec3<std::uint32_t> morton_decode3(std::uint64_t code) {
+#if defined(__BMI2__)
+    return vec3<std::uint32_t>(
+        (std::uint32_t)_pext_u64(code, 0x1249249249249249ull),
+        (std::uint32_t)_pext_u64(code, 0x2492492492492492ull),
+        (std::uint32_t)_pext_u64(code, 0x4924924924924924ull));
+#else
+    return vec3<std::uint32_t>(detail::compact3(code),
+                               detail::compact3(code >> 1),
+                               detail::compact3(code >> 2));
+#endif
+}
+
+/**
+ * @brief Computes the index of a 2D coordinate along the Hilbert curve.
+ *
+ * Unlike Morton order, consecutive indices are always adjacent cells.
+ *
+ * @param p The coordinate.
+ * @return std::uint64_t The Hilbert index.
+ */
+inline std::uint64_t hilbert_encode(const vec2<std::uint32_t>& p) {
+    std::uint32_t x[2] = {p.x, p.y};
+    detail::axes_to_transpose<2>(x, curve_bits2);
+    // the transposed form reads most significant axis first
+    return morton_encode(vec2<std::uint32_t>(x[1], x[0]));
+}
+
+/**
+ * @brief Computes the index of a 3D coordinate along the Hilbert curve.
+ *
+ * @param p The coordinate (only the low curve_bits3 bits are used).
+ * @return std::uint64_t The Hilbert index.
+ */
+inline std::uint64_t hilbert_encode(const vec3<std::uint32_t>& p) {
+    const std::uint32_t mask = (1u << curve_bits3) - 1;
+    std::uint32_t x[3] = {p.x & mask, p.y & mask, p.z & mask};
+    detail::axes_to_transpose<3>(x, curve_bits3);
+    return morton_encode(vec3<std::uint32_t>(x[2], x[1], x[0]));
+}
+
+/**
+ * @brief Recovers a 2D coordinate from its Hilbert index.
+ *
+ * @param index The Hilbert index.
+ * @return vec2<std::uint32_t> The coordinate.
+ */
+inline vec2<std::uint32_t> hilbert_decode2(std::uint64_t index) {
+    vec2<std::uint32_t> t = morton_decode2(index);
+    std::uint32_t x[2] = {t.y, t.x};
+    detail::transpose_to_axes<2>(x, curve_bits2);
+    return vec2<std::uint32_t>(x[0], x[1]);
+}
+
+/**
+ * @brief Recovers a 3D coordinate from its Hilbert index.
+ *
+ * @param index The Hilbert index.
+ * @return vec3<std::uint32_t> The coordinate.
+ */
+inline vec3<std::uint32_t> hilbert_decode3(std::uint64_t index) {
+    vec3<std::uint32_t> t = morton_decode3(index);
+    std::uint32_t x[3] = {t.z, t.y, t.x};
+    detail::transpose_to_axes<3>(x, curve_bits3);
+    return vec3<std::uint32_t>(x[0], x[1], x[2]);
+}
+
+/**
+ * @brief Quantizes a point to the 2^21 grid spanning a box.
+ *
+ * @param p The point (clamped to the box).
+ * @param box The box.
+ * @return vec3<std::uint32_t> Grid coordinates in [0, 2^21).
+ */
+template <typename T>
+vec3<std::uint32_t> grid_coordinates(const vec3<T>& p, const aabb<T, 3>& box) {
+    return detail::grid_quantizer<T>(box, curve_bits3)(p);
+}
+
+/**
+ * @brief Computes the Morton code of a point quantized within a box.
+ *
+ * @param p The point.
+ * @param box The box.
+ * @return std::uint64_t The Morton code of grid_coordinates(p, box).
+ */
+template <typename T>
+std::uint64_t morton_encode(const vec3<T>& p, const aabb<T, 3>& box) {
+    return morton_encode(grid_coordinates(p, box));
+}
+
+/**
+ * @brief Computes the Hilbert index of a point quantized within a box.
+ *
+ * @param p The point.
+ * @param box The box.
+ * @return std::uint64_t The Hilbert index of grid_coordinates(p, box).
+ */
+template <typename T>
+std::uint64_t hilbert_encode(const vec3<T>& p, const aabb<T, 3>& box) {
+    return hilbert_encode(grid_coordinates(p, box));
+}
+
+/**
+ * @brief Computes Morton codes for an array of points within a box, across
+ * threads.
+ *
+ * Without BMI2, SSE2 spreads the bits of two points per register.
+ *
+ * @param points The points.
+ * @param count The number of points.
+ * @param box The quantization box (e.g. bounding_box(points, count)).
+ * @param codes count output codes.
+ */
+template <typename T>
+void morton_encode(const vec3<T>* points, std::size_t count,
+                   const aabb<T, 3>& box, std::uint64_t* codes) {
+    detail::grid_quantizer<T> quantize(box, curve_bits3);
+    parallel_for_ranges(
+        0, count,
+        [&](std::size_t lo, std::size_t hi, unsigned) {
+            std::size_t i = lo;
+#if defined(__SSE2__) && !defined(__BMI2__)
+            for (; i + 2 <= hi; i += 2) {
+                vec3<std::uint32_t> a = quantize(points[i]);
+                vec3<std::uint32_t> b = quantize(points[i + 1]);
+                __m128i x = detail::spread3(_mm_set_epi64x(b.x, a.x));
+                __m128i y = detail::spread3(_mm_set_epi64x(b.y, a.y));
+                __m128i z = detail::spread3(_mm_set_epi64x(b.z, a.z));
+                __m128i yz =
+                    _mm_or_si128(_mm_slli_epi64(y, 1), _mm_slli_epi64(z, 2));
+                __m128i code = _mm_or_si128(x, yz);
+                _mm_storeu_si128((__m128i*)(codes + i), code);
+            }
+#endif
+            for (; i < hi; i++) {
+                codes[i] = morton_encode(quantize(points[i]));
+            }
+        },
+        4096);
+}
+
+/**
+ * @brief Computes Hilbert indices for an array of points within a box,
+ * across threads.
+ *
+ * With SSE2 the transform runs on four points per register; it is a long
+ * dependent chain per point, so this mostly buys instruction-level
+ * parallelism.
+ *
+ * @param points The points.
+ * @param count The number of points.
+ * @param box The quantization box (e.g. bounding_box(points, count)).
+ * @param codes count output indices.
+ */
+template <typename T>
+void hilbert_encode(const vec3<T>* points, std::size_t count,
+                    const aabb<T, 3>& box, std::uint64_t* codes) {
+    detail::grid_quantizer<T> quantize(box, curve_bits3);
+    parallel_for_ranges(
+        0, count,
+        [&](std::size_t lo, std::size_t hi, unsigned) {
+            std::size_t i = lo;
+#if defined(__SSE2__)
+            for (; i + 4 <= hi; i += 4) {
+                alignas(16) std::uint32_t axes[3][4];
+                for (int l = 0; l < 4; l++) {
+                    vec3<std::uint32_t> g = quantize(points[i + l]);
+                    for (int k = 0; k < 3; k++) {
+                        axes[k][l] = g[k];
+                    }
+                }
+                __m128i x[3];
+                for (int k = 0; k < 3; k++) {
+                    x[k] = _mm_load_si128(
+                        reinterpret_cast<const __m128i*>(axes[k]));
+                }
+                detail::axes_to_transpose3(x, curve_bits3);
+                for (int k = 0; k < 3; k++) {
+                    _mm_store_si128(reinterpret_cast<__m128i*>(axes[k]), x[k]);
+                }
+                for (int l = 0; l < 4; l++) {
+                    codes[i + l] = morton_encode(vec3<std::uint32_t>(
+                        axes[2][l], axes[1][l], axes[0][l]));
+                }
+            }
+#endif
+            for (; i < hi; i++) {
+                codes[i] = hilbert_encode(quantize(points[i]));
+            }
+        },
+        4096);
+}
+
+} // namespace HQ
+
+#endif // _HQCURVE_HPP_
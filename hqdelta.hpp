@@ -0,0 +1,406 @@
+/**
+ * @file hqdelta.hpp
+ * @brief This file defines a lossless frame-to-frame delta encoder for
+ * trajectories of vec3<float> arrays.
+ */
+
+#ifndef _HQDELTA_HPP_
+#define _HQDELTA_HPP_
+
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief How a frame is predicted from the frames before it.
+ */
+enum class delta_predictor : std::uint32_t {
+    /** @brief Predict each value as its value in the previous frame. */
+    previous = 0,
+    /** @brief Extrapolate linearly from the two previous frames. */
+    linear = 1
+};
+
+namespace detail {
+
+/**
+ * @brief Maps float bits to an unsigned integer whose ordering matches the
+ * float ordering, so nearby floats map to nearby integers.
+ */
+static inline std::uint32_t float_to_ordered(float f) {
+    std::uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+/**
+ * @brief Inverse of float_to_ordered.
+ */
+static inline float ordered_to_float(std::uint32_t u) {
+    u = (u & 0x80000000u) ? (u & 0x7fffffffu) : ~u;
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/**
+ * @brief Appends a zigzag-encoded signed residual as a LEB128 varint.
+ */
+static inline void put_residual(std::vector<std::uint8_t>& out,
+                                std::uint32_t cur, std::uint32_t pred) {
+    std::int32_t d = (std::int32_t)(cur - pred);
+    std::uint32_t z = ((std::uint32_t)d << 1) ^ (std::uint32_t)(d >> 31);
+    while (z >= 0x80) {
+        out.push_back((std::uint8_t)(z | 0x80));
+        z >>= 7;
+    }
+    out.push_back((std::uint8_t)z);
+}
+
+/**
+ * @brief Reads a residual written by put_residual and applies it.
+ */
+static inline std::uint32_t get_residual(const std::uint8_t*& in,
+                                         std::uint32_t pred) {
+    std::uint32_t z = 0;
+    unsigned shift = 0;
+    std::uint8_t b;
+    do {
+        b = *in++;
+        z |= (std::uint32_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    std::int32_t d = (std::int32_t)((z >> 1) ^ (~(z & 1) + 1));
+    return pred + (std::uint32_t)d;
+}
+
+/**
+ * @brief Computes the ordered-integer prediction for one component.
+ */
+static inline std::uint32_t predict(delta_predictor p, std::size_t history,
+                                    float prev, float prev2) {
+    if ((p == delta_predictor::linear) && (history >= 2))
+        return float_to_ordered(prev + (prev - prev2));
+    return float_to_ordered(prev);
+}
+
+/**
+ * @brief Reads `count` elements, growing the vector a chunk at a time, so a
+ * corrupt count allocates no more than the stream actually holds.
+ */
+template <typename T>
+bool read_chunked(std::istream& is, std::vector<T>& out, std::uint64_t count) {
+    const std::uint64_t chunk = (std::uint64_t(1) << 20) / sizeof(T);
+    out.clear();
+    while (out.size() < count) {
+        std::size_t at = out.size();
+        std::size_t take = (std::size_t)std::min(chunk, count - at);
+        out.resize(at + take);
+        is.read((char*)(out.data() + at), take * sizeof(T));
+        if (!is)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Checks that offsets split payload into frames the decoder can
+ * replay: offsets rise from 0, keyframes hold exactly 3 * count raw
+ * values, and other frames exactly 3 * count complete residuals.
+ */
+inline bool valid_frames(const std::vector<std::uint64_t>& offsets,
+                         const std::vector<std::uint8_t>& payload,
+                         std::uint64_t count, std::uint32_t interval) {
+    const std::uint64_t values = 3 * count;
+    for (std::size_t f = 0; f < offsets.size(); f++) {
+        std::uint64_t begin = offsets[f];
+        std::uint64_t end =
+            f + 1 < offsets.size() ? offsets[f + 1] : payload.size();
+        if (((f == 0) && (begin != 0)) || (begin > end) ||
+            (end > payload.size()))
+            return false;
+        if ((f % interval) == 0) {
+            if (end - begin != values * sizeof(std::uint32_t))
+                return false;
+            continue;
+        }
+        // a 32-bit residual takes at most 5 varint bytes
+        std::uint64_t at = begin;
+        for (std::uint64_t i = 0; i < values; i++) {
+            for (int bytes = 1;; bytes++) {
+                if ((at == end) || (bytes > 5))
+                    return false;
+                if (!(payload[at++] & 0x80))
+                    break;
+            }
+        }
+        if (at != end)
+            return false;
+    }
+    return true;
+}
+
+} // namespace detail
+
+/**
+ * @brief An encoded trajectory: a sequence of frames of `count` vec3<float>
+ * points, stored as periodic raw keyframes followed by predicted residuals.
+ */
+struct delta_trajectory {
+    /** @brief Points per frame. */
+    std::uint64_t count = 0;
+    /** @brief A raw keyframe is stored every this many frames. */
+    std::uint32_t keyframe_interval = 32;
+    /** @brief Predictor used for non-key frames. */
+    delta_predictor predictor = delta_predictor::linear;
+    /** @brief Byte offset of every frame into payload. */
+    std::vector<std::uint64_t> offsets;
+    /** @brief Encoded frame data. */
+    std::vector<std::uint8_t> payload;
+
+    /**
+     * @brief Returns the number of frames stored.
+     *
+     * @return std::size_t The number of frames.
+     */
+    std::size_t frames() const { return offsets.size(); }
+
+    /**
+     * @brief Returns the achieved compression ratio.
+     *
+     * @return double Raw frame bytes divided by encoded payload bytes.
+     */
+    double compression_ratio() const {
+        if (payload.empty())
+            return 0;
+        return (double)(frames() * count * sizeof(vec3<float>)) /
+               (double)payload.size();
+    }
+
+    /**
+     * @brief Writes the trajectory to a binary stream.
+     *
+     * @param os The output stream.
+     * @return bool True if the stream is still good afterwards.
+     */
+    bool write(std::ostream& os) const {
+        const char magic[4] = {'H', 'Q', 'D', 'T'};
+        std::uint32_t pred = (std::uint32_t)predictor;
+        std::uint64_t nframes = offsets.size();
+        std::uint64_t nbytes = payload.size();
+        os.write(magic, 4);
+        os.write((const char*)&count, sizeof(count));
+        os.write((const char*)&keyframe_interval, sizeof(keyframe_interval));
+        os.write((const char*)&pred, sizeof(pred));
+        os.write((const char*)&nframes, sizeof(nframes));
+        os.write((const char*)&nbytes, sizeof(nbytes));
+        os.write((const char*)offsets.data(), nframes * sizeof(std::uint64_t));
+        os.write((const char*)payload.data(), nbytes);
+        return (bool)os;
+    }
+
+    /**
+     * @brief Reads a trajectory written by write().
+     *
+     * @param is The input stream.
+     * @return bool True on success, false on a malformed or truncated stream.
+     */
+    bool read(std::istream& is) {
+        char magic[4];
+        std::uint64_t points = 0;
+        std::uint32_t interval = 0;
+        std::uint32_t pred = 0;
+        std::uint64_t nframes = 0;
+        std::uint64_t nbytes = 0;
+        is.read(magic, 4);
+        if (!is || std::memcmp(magic, "HQDT", 4) != 0)
+            return false;
+        is.read((char*)&points, sizeof(points));
+        is.read((char*)&interval, sizeof(interval));
+        is.read((char*)&pred, sizeof(pred));
+        is.read((char*)&nframes, sizeof(nframes));
+        is.read((char*)&nbytes, sizeof(nbytes));
+        const std::uint64_t most = std::numeric_limits<std::size_t>::max();
+        if (!is || (interval == 0) || (pred > 1) ||
+            (points > most / (3 * sizeof(std::uint32_t))) ||
+            (nframes > most / sizeof(std::uint64_t)) || (nbytes > most))
+            return false;
+        // sizes come from the stream, so nothing is trusted until the data
+        // behind them has been read and every frame checked
+        std::vector<std::uint64_t> frame_offsets;
+        std::vector<std::uint8_t> data;
+        if (!detail::read_chunked(is, frame_offsets, nframes) ||
+            !detail::read_chunked(is, data, nbytes) ||
+            !detail::valid_frames(frame_offsets, data, points, interval))
+            return false;
+        count = points;
+        keyframe_interval = interval;
+        predictor = (delta_predictor)pred;
+        offsets.swap(frame_offsets);
+        payload.swap(data);
+        return true;
+    }
+};
+
+/**
+ * @brief Appends frames to a delta_trajectory.
+ */
+class delta_encoder {
+  private:
+    delta_trajectory& m_out;
+    std::vector<float> m_prev;
+    std::vector<float> m_prev2;
+    std::size_t m_history = 0;
+
+  public:
+    /**
+     * @brief Starts encoding into a trajectory.
+     *
+     * @param out The trajectory to append to. Its count, keyframe_interval
+     * and predictor must be set and it must be empty.
+     */
+    delta_encoder(delta_trajectory& out)
+        : m_out(out), m_prev(out.count * 3), m_prev2(out.count * 3) {
+        assert((out.keyframe_interval > 0) && "keyframe interval must be > 0");
+        assert(out.offsets.empty() && "trajectory is not empty");
+    }
+
+    /**
+     * @brief Encodes the next frame.
+     *
+     * @param frame The frame's points (m_out.count of them).
+     */
+    void add_frame(const vec3<float>* frame) {
+        const float* in = reinterpret_cast<const float*>(frame);
+        std::size_t nf = m_out.count * 3;
+        bool key = (m_out.offsets.size() % m_out.keyframe_interval) == 0;
+        m_out.offsets.push_back(m_out.payload.size());
+        if (key) {
+            std::size_t start = m_out.payload.size();
+            m_out.payload.resize(start + nf * sizeof(std::uint32_t));
+            std::uint8_t* dst = m_out.payload.data() + start;
+            for (std::size_t i = 0; i < nf; i++) {
+                std::uint32_t u = detail::float_to_ordered(in[i]);
+                std::memcpy(dst + i * sizeof(u), &u, sizeof(u));
+            }
+            m_history = 0;
+        } else {
+            for (std::size_t i = 0; i < nf; i++) {
+                detail::put_residual(
+                    m_out.payload, detail::float_to_ordered(in[i]),
+                    detail::predict(m_out.predictor, m_history, m_prev[i],
+                                    m_prev2[i]));
+            }
+        }
+        m_prev.swap(m_prev2);
+        std::memcpy(m_prev.data(), in, nf * sizeof(float));
+        m_history++;
+    }
+
+    /**
+     * @brief Encodes the next frame.
+     *
+     * @param frame The frame's points (m_out.count of them).
+     */
+    void add_frame(const std::vector<vec3<float>>& frame) {
+        assert((frame.size() == m_out.count) && "frame size mismatch");
+        add_frame(frame.data());
+    }
+};
+
+/**
+ * @brief Replays frames from a delta_trajectory with random access.
+ *
+ * Seeking jumps to the nearest keyframe at or before the requested frame
+ * and replays forward from there; sequential access decodes one frame per
+ * call.
+ */
+class delta_decoder {
+  private:
+    const delta_trajectory& m_in;
+    std::vector<float> m_prev;
+    std::vector<float> m_prev2;
+    std::size_t m_history = 0;
+    /** @brief Index of the frame held in m_prev, or frames() if none. */
+    std::size_t m_current;
+
+    void decode_next(std::size_t frame) {
+        std::size_t nf = m_in.count * 3;
+        const std::uint8_t* src = m_in.payload.data() + m_in.offsets[frame];
+        m_prev.swap(m_prev2);
+        if ((frame % m_in.keyframe_interval) == 0) {
+            for (std::size_t i = 0; i < nf; i++) {
+                std::uint32_t u;
+                std::memcpy(&u, src + i * sizeof(u), sizeof(u));
+                m_prev[i] = detail::ordered_to_float(u);
+            }
+            m_history = 0;
+        } else {
+            for (std::size_t i = 0; i < nf; i++) {
+                // after the swap m_prev2 holds frame - 1, m_prev frame - 2
+                std::uint32_t pred = detail::predict(m_in.predictor, m_history,
+                                                     m_prev2[i], m_prev[i]);
+                m_prev[i] =
+                    detail::ordered_to_float(detail::get_residual(src, pred));
+            }
+        }
+        m_history++;
+        m_current = frame;
+    }
+
+  public:
+    /**
+     * @brief Starts decoding a trajectory.
+     *
+     * @param in The trajectory to decode.
+     */
+    delta_decoder(const delta_trajectory& in)
+        : m_in(in), m_prev(in.count * 3), m_prev2(in.count * 3),
+          m_current(in.frames()) {}
+
+    /**
+     * @brief Decodes one frame.
+     *
+     * @param frame The frame index (< frames()).
+     * @param out Output array of m_in.count points.
+     */
+    void decode(std::size_t frame, vec3<float>* out) {
+        assert((frame < m_in.frames()) && "frame out of range");
+        std::size_t key = frame - (frame % m_in.keyframe_interval);
+        std::size_t next;
+        if ((m_current < m_in.frames()) && (m_current >= key) &&
+            (m_current <= frame))
+            next = m_current + 1;
+        else
+            next = key;
+        for (; next <= frame; next++) {
+            decode_next(next);
+        }
+        std::memcpy(reinterpret_cast<float*>(out), m_prev.data(),
+                    m_in.count * 3 * sizeof(float));
+    }
+
+    /**
+     * @brief Decodes one frame.
+     *
+     * @param frame The frame index (< frames()).
+     * @return std::vector<vec3<float>> The frame's points.
+     */
+    std::vector<vec3<float>> decode(std::size_t frame) {
+        std::vector<vec3<float>> out(m_in.count);
+        decode(frame, out.data());
+        return out;
+    }
+};
+
+} // namespace HQ
+
+#endif // _HQDELTA_HPP_
@@ -0,0 +1,764 @@
+/**
+ * @file hqfft.hpp
+ * @brief This file defines self-contained mixed-radix FFTs: batched 1D
+ * complex and real transforms, and threaded 3D transforms of complex and
+ * real grids.
+ */
+
+#ifndef _HQFFT_HPP_
+#define _HQFFT_HPP_
+
+#include "hqparallel.hpp"
+#include "hqsimd.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief The sign of the exponent of a transform.
+ */
+enum class fft_direction {
+    forward, ///< X_k = sum of x_j e^(-2 pi i j k / n).
+    inverse  ///< x_j = sum of X_k e^(+2 pi i j k / n), without 1 / n.
+};
+
+namespace detail {
+
+/** @brief Transforms run side by side (SIMD lanes) by the 3D passes. */
+static const std::size_t fft_lanes = 16;
+
+/**
+ * @brief One Stockham stage: `m` butterflies of `radix` points per group
+ * of `stride` interleaved sub-transforms.
+ */
+struct fft_stage {
+    int radix;
+    std::size_t m;
+    std::size_t stride;
+    std::size_t twiddles; // m * (radix - 1) entries of the tables
+    std::size_t roots;    // radix entries, for radices above 4
+};
+
+/**
+ * @brief The operands of one stage over split-complex lane blocks.
+ */
+template <typename T> struct fft_pass {
+    const T *xr, *xi;
+    T *yr, *yi;
+    std::size_t m, e; // butterflies; T values per element (stride * lanes)
+    int p;
+    const T *tc, *ts; // stage twiddles, cos and sin of +angle
+    const T *rc, *rs; // roots of unity of order p
+    T sign;           // -1 forward, +1 inverse
+};
+
+/**
+ * @brief (ar + i ai) (br + i bi).
+ */
+template <typename S>
+inline void complex_mul(typename S::type ar, typename S::type ai,
+                        typename S::type br, typename S::type bi,
+                        typename S::type& cr, typename S::type& ci) {
+    cr = S::sub(S::mul(ar, br), S::mul(ai, bi));
+    ci = S::add(S::mul(ar, bi), S::mul(ai, br));
+}
+
+/**
+ * @brief Stores X_t times the stage twiddle of butterfly j (none for t =
+ * 0) at output t.
+ */
+template <typename S, typename T>
+inline void fft_store(const fft_pass<T>& a, T* yr, T* yi, std::size_t j,
+                      int t, typename S::type xr, typename S::type xi) {
+    if (t > 0) {
+        std::size_t w = j * (a.p - 1) + (t - 1);
+        complex_mul<S>(xr, xi, S::set1(a.tc[w]), S::set1(a.sign * a.ts[w]),
+                       xr, xi);
+    }
+    S::store(yr + t * a.e, xr);
+    S::store(yi + t * a.e, xi);
+}
+
+/**
+ * @brief Runs butterfly j of a stage over block offsets [u, end), S::width
+ * at a time, and returns where it stopped.
+ *
+ * Inputs are elements j + m r, outputs p j + t (Stockham autosort); P is
+ * the radix, or 0 for a generic odd radix (O(p^2) per butterfly).
+ */
+template <int P, typename S, typename T>
+std::size_t fft_columns(const fft_pass<T>& a, std::size_t j, std::size_t u,
+                        std::size_t end) {
+    typedef typename S::type V;
+    const int p = P ? P : a.p;
+    const std::size_t in = a.m * a.e;
+    const T* xr = a.xr + j * a.e;
+    const T* xi = a.xi + j * a.e;
+    T* yr = a.yr + p * j * a.e;
+    T* yi = a.yi + p * j * a.e;
+    for (; u + S::width <= end; u += S::width) {
+        if (P == 2) {
+            V ar = S::load(xr + u), ai = S::load(xi + u);
+            V br = S::load(xr + in + u), bi = S::load(xi + in + u);
+            fft_store<S>(a, yr + u, yi + u, j, 0, S::add(ar, br),
+                         S::add(ai, bi));
+            fft_store<S>(a, yr + u, yi + u, j, 1, S::sub(ar, br),
+                         S::sub(ai, bi));
+        } else if (P == 3) {
+            const V half = S::set1((T)0.5);
+            const V h = S::set1(a.sign * (T)0.86602540378443864676);
+            V ar = S::load(xr + u), ai = S::load(xi + u);
+            V br = S::load(xr + in + u), bi = S::load(xi + in + u);
+            V cr = S::load(xr + 2 * in + u), ci = S::load(xi + 2 * in + u);
+            V sr = S::add(br, cr), si = S::add(bi, ci);
+            V dr = S::mul(h, S::sub(br, cr)), di = S::mul(h, S::sub(bi, ci));
+            V mr = S::sub(ar, S::mul(half, sr));
+            V mi = S::sub(ai, S::mul(half, si));
+            fft_store<S>(a, yr + u, yi + u, j, 0, S::add(ar, sr),
+                         S::add(ai, si));
+            // m +- i h d
+            fft_store<S>(a, yr + u, yi + u, j, 1, S::sub(mr, di),
+                         S::add(mi, dr));
+            fft_store<S>(a, yr + u, yi + u, j, 2, S::add(mr, di),
+                         S::sub(mi, dr));
+        } else if (P == 4) {
+            const V sign = S::set1(a.sign);
+            V x0r = S::load(xr + u), x0i = S::load(xi + u);
+            V x1r = S::load(xr + in + u), x1i = S::load(xi + in + u);
+            V x2r = S::load(xr + 2 * in + u), x2i = S::load(xi + 2 * in + u);
+            V x3r = S::load(xr + 3 * in + u), x3i = S::load(xi + 3 * in + u);
+            V b0r = S::add(x0r, x2r), b0i = S::add(x0i, x2i);
+            V b1r = S::sub(x0r, x2r), b1i = S::sub(x0i, x2i);
+            V b2r = S::add(x1r, x3r), b2i = S::add(x1i, x3i);
+            // (x1 - x3) times the quarter root, +-i
+            V b3r = S::mul(sign, S::sub(x3i, x1i));
+            V b3i = S::mul(sign, S::sub(x1r, x3r));
+            fft_store<S>(a, yr + u, yi + u, j, 0, S::add(b0r, b2r),
+                         S::add(b0i, b2i));
+            fft_store<S>(a, yr + u, yi + u, j, 1, S::add(b1r, b3r),
+                         S::add(b1i, b3i));
+            fft_store<S>(a, yr + u, yi + u, j, 2, S::sub(b0r, b2r),
+                         S::sub(b0i, b2i));
+            fft_store<S>(a, yr + u, yi + u, j, 3, S::sub(b1r, b3r),
+                         S::sub(b1i, b3i));
+        } else {
+            for (int t = 0; t < p; t++) {
+                V sr = S::load(xr + u), si = S::load(xi + u);
+                for (int r = 1, k = t; r < p; r++) {
+                    V wr = S::set1(a.rc[k]), wi = S::set1(a.sign * a.rs[k]);
+                    V pr, pi;
+                    complex_mul<S>(S::load(xr + r * in + u),
+                                   S::load(xi + r * in + u), wr, wi, pr, pi);
+                    sr = S::add(sr, pr);
+                    si = S::add(si, pi);
+                    k = (k + t) % p;
+                }
+                fft_store<S>(a, yr + u, yi + u, j, t, sr, si);
+            }
+        }
+    }
+    return u;
+}
+
+/**
+ * @brief Runs every butterfly of a stage, SIMD across block offsets.
+ */
+template <int P, typename T> void fft_run(const fft_pass<T>& a) {
+    for (std::size_t j = 0; j < a.m; j++) {
+        std::size_t u = fft_columns<P, simd<T>>(a, j, 0, a.e);
+        fft_columns<P, simd_scalar<T>>(a, j, u, a.e);
+    }
+}
+
+/**
+ * @brief cos and sin of 2 pi k / n, computed in double.
+ */
+template <typename T>
+inline void unit_root(std::size_t k, std::size_t n, T& c, T& s) {
+    const double angle = 6.283185307179586477 * (double)k / (double)n;
+    c = (T)std::cos(angle);
+    s = (T)std::sin(angle);
+}
+
+} // namespace detail
+
+/**
+ * @brief A complex FFT of one length, for any length.
+ *
+ * The length is factored into radices 4, then 2, then odd factors; radices
+ * 2, 3 and 4 have dedicated butterflies, other factors a generic O(p^2)
+ * one, so lengths with large prime factors are slow. Stages follow the
+ * Stockham autosort scheme, ping-ponging between the data and a work
+ * buffer with no bit reversal.
+ *
+ * The kernel works on batches of `lanes` transforms in split-complex
+ * layout, element j of transform b at index j * lanes + b of separate real
+ * and imaginary arrays: every butterfly then runs SIMD across lanes (and,
+ * in later stages, across interleaved sub-transforms).
+ *
+ * @tparam T float or double.
+ */
+template <typename T> class fft_plan {
+    std::size_t m_size;
+    std::vector<detail::fft_stage> m_stages;
+    std::vector<T> m_cos, m_sin;
+
+  public:
+    /**
+     * @brief Constructs an empty plan.
+     */
+    fft_plan() : m_size(0) {}
+
+    /**
+     * @brief Factors the length and tabulates twiddles.
+     *
+     * @param n The transform length (positive).
+     */
+    explicit fft_plan(std::size_t n) : m_size(n) {
+        assert(n > 0);
+        std::vector<int> radices;
+        std::size_t rest = n;
+        while (rest % 4 == 0) {
+            radices.push_back(4);
+            rest /= 4;
+        }
+        if (rest % 2 == 0) {
+            radices.push_back(2);
+            rest /= 2;
+        }
+        for (std::size_t f = 3; f * f <= rest; f += 2) {
+            while (rest % f == 0) {
+                radices.push_back((int)f);
+                rest /= f;
+            }
+        }
+        if (rest > 1)
+            radices.push_back((int)rest);
+        std::size_t length = n, stride = 1;
+        for (std::size_t r = 0; r < radices.size(); r++) {
+            detail::fft_stage stage;
+            stage.radix = radices[r];
+            stage.m = length / stage.radix;
+            stage.stride = stride;
+            stage.twiddles = m_cos.size();
+            for (std::size_t j = 0; j < stage.m; j++) {
+                for (int t = 1; t < stage.radix; t++) {
+                    T c, s;
+                    detail::unit_root(j * t, length, c, s);
+                    m_cos.push_back(c);
+                    m_sin.push_back(s);
+                }
+            }
+            stage.roots = m_cos.size();
+            if (stage.radix > 4) {
+                for (int k = 0; k < stage.radix; k++) {
+                    T c, s;
+                    detail::unit_root(k, stage.radix, c, s);
+                    m_cos.push_back(c);
+                    m_sin.push_back(s);
+                }
+            }
+            m_stages.push_back(stage);
+            length = stage.m;
+            stride *= stage.radix;
+        }
+    }
+
+    /**
+     * @brief Returns the transform length.
+     *
+     * @return std::size_t The length.
+     */
+    std::size_t size() const { return m_size; }
+
+    /**
+     * @brief Transforms a batch of split-complex sequences in place.
+     *
+     * @param re, im size() * lanes values; element j of transform b at
+     * j * lanes + b.
+     * @param lanes The number of transforms.
+     * @param direction The sign of the exponent.
+     * @param work 2 * size() * lanes values of scratch.
+     */
+    void transform_lanes(T* re, T* im, std::size_t lanes,
+                         fft_direction direction, T* work) const {
+        // stages alternate between the data and the work buffer
+        T *xr = re, *xi = im;
+        T *yr = work, *yi = work + m_size * lanes;
+        detail::fft_pass<T> a;
+        a.sign = direction == fft_direction::forward ? (T)-1 : (T)1;
+        for (std::size_t s = 0; s < m_stages.size(); s++) {
+            const detail::fft_stage& stage = m_stages[s];
+            a.xr = xr;
+            a.xi = xi;
+            a.yr = yr;
+            a.yi = yi;
+            a.m = stage.m;
+            a.e = stage.stride * lanes;
+            a.p = stage.radix;
+            a.tc = m_cos.data() + stage.twiddles;
+            a.ts = m_sin.data() + stage.twiddles;
+            a.rc = m_cos.data() + stage.roots;
+            a.rs = m_sin.data() + stage.roots;
+            switch (stage.radix) {
+            case 2:
+                detail::fft_run<2>(a);
+                break;
+            case 3:
+                detail::fft_run<3>(a);
+                break;
+            case 4:
+                detail::fft_run<4>(a);
+                break;
+            default:
+                detail::fft_run<0>(a);
+            }
+            std::swap(xr, yr);
+            std::swap(xi, yi);
+        }
+        if (xr != re) {
+            std::copy(xr, xr + m_size * lanes, re);
+            std::copy(xi, xi + m_size * lanes, im);
+        }
+    }
+
+    /**
+     * @brief Transforms one sequence in place.
+     *
+     * @param data size() values.
+     * @param direction The sign of the exponent.
+     */
+    void transform(std::complex<T>* data, fft_direction direction) const {
+        std::vector<T> buffer(4 * m_size);
+        T* re = buffer.data();
+        T* im = re + m_size;
+        for (std::size_t j = 0; j < m_size; j++) {
+            re[j] = data[j].real();
+            im[j] = data[j].imag();
+        }
+        transform_lanes(re, im, 1, direction, im + m_size);
+        for (std::size_t j = 0; j < m_size; j++) {
+            data[j] = std::complex<T>(re[j], im[j]);
+        }
+    }
+};
+
+/**
+ * @brief A real-to-complex FFT of one length and its inverse.
+ *
+ * For even n the n reals are packed as n / 2 complex values (even samples
+ * real, odd samples imaginary), transformed at half length, and untangled
+ * with one twiddle pass; odd lengths run a full complex transform. Only
+ * the n / 2 + 1 non-redundant coefficients X_0 .. X_(n/2) are stored.
+ *
+ * @tparam T float or double.
+ */
+template <typename T> class real_fft_plan {
+    std::size_t m_size;
+    fft_plan<T> m_complex;
+    std::vector<T> m_cos, m_sin;
+
+  public:
+    /**
+     * @brief Constructs an empty plan.
+     */
+    real_fft_plan() : m_size(0) {}
+
+    /**
+     * @brief Plans transforms of n reals.
+     *
+     * @param n The transform length (positive).
+     */
+    explicit real_fft_plan(std::size_t n)
+        : m_size(n), m_complex(n % 2 ? n : n / 2) {
+        if (n % 2 == 0) {
+            m_cos.resize(n / 2 + 1);
+            m_sin.resize(n / 2 + 1);
+            for (std::size_t k = 0; k <= n / 2; k++) {
+                detail::unit_root(k, n, m_cos[k], m_sin[k]);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the number of reals transformed.
+     *
+     * @return std::size_t The length.
+     */
+    std::size_t size() const { return m_size; }
+
+    /**
+     * @brief Returns the number of complex coefficients stored.
+     *
+     * @return std::size_t size() / 2 + 1.
+     */
+    std::size_t spectrum_size() const { return m_size / 2 + 1; }
+
+    /**
+     * @brief Returns the scratch needed by the lane transforms.
+     *
+     * @param lanes The number of transforms in a batch.
+     * @return std::size_t The number of T values.
+     */
+    std::size_t work_size(std::size_t lanes) const {
+        return 4 * m_size * lanes;
+    }
+
+    /**
+     * @brief Transforms a batch of real sequences (forward).
+     *
+     * @param in size() * lanes reals; sample j of transform b at
+     * j * lanes + b.
+     * @param re, im spectrum_size() * lanes values, in the same layout.
+     * @param lanes The number of transforms.
+     * @param work work_size(lanes) values of scratch.
+     */
+    void forward_lanes(const T* in, T* re, T* im, std::size_t lanes,
+                       T* work) const {
+        const std::size_t n = m_size, l = lanes;
+        if (n % 2) {
+            T* zr = work;
+            T* zi = work + n * l;
+            std::copy(in, in + n * l, zr);
+            std::fill(zi, zi + n * l, (T)0);
+            m_complex.transform_lanes(zr, zi, l, fft_direction::forward,
+                                      zi + n * l);
+            std::copy(zr, zr + spectrum_size() * l, re);
+            std::copy(zi, zi + spectrum_size() * l, im);
+            return;
+        }
+        const std::size_t h = n / 2;
+        T* zr = work;
+        T* zi = work + h * l;
+        for (std::size_t j = 0; j < h; j++) {
+            std::copy(in + 2 * j * l, in + (2 * j + 1) * l, zr + j * l);
+            std::copy(in + (2 * j + 1) * l, in + (2 * j + 2) * l, zi + j * l);
+        }
+        m_complex.transform_lanes(zr, zi, l, fft_direction::forward,
+                                  zi + h * l);
+        for (std::size_t k = 0; k <= h; k++) {
+            // evens E = (Z_k + conj Z_(h-k)) / 2, odds
+            // O = (Z_k - conj Z_(h-k)) / 2i, X_k = E + e^(-2 pi i k/n) O
+            const T* ar = zr + (k % h) * l;
+            const T* ai = zi + (k % h) * l;
+            const T* br = zr + ((h - k) % h) * l;
+            const T* bi = zi + ((h - k) % h) * l;
+            const T c = m_cos[k], s = m_sin[k];
+            for (std::size_t b = 0; b < l; b++) {
+                T er = (ar[b] + br[b]) / 2, ei = (ai[b] - bi[b]) / 2;
+                T orr = (ai[b] + bi[b]) / 2, oi = (br[b] - ar[b]) / 2;
+                re[k * l + b] = er + c * orr + s * oi;
+                im[k * l + b] = ei + c * oi - s * orr;
+            }
+        }
+    }
+
+    /**
+     * @brief Transforms a batch of half spectra back to reals (inverse,
+     * unnormalised: a forward then inverse transform scales by size()).
+     *
+     * @param re, im spectrum_size() * lanes values; coefficient k of
+     * transform b at k * lanes + b.
+     * @param out size() * lanes reals, in the same layout.
+     * @param lanes The number of transforms.
+     * @param work work_size(lanes) values of scratch.
+     */
+    void inverse_lanes(const T* re, const T* im, T* out, std::size_t lanes,
+                       T* work) const {
+        const std::size_t n = m_size, l = lanes;
+        if (n % 2) {
+            T* zr = work;
+            T* zi = work + n * l;
+            std::copy(re, re + spectrum_size() * l, zr);
+            std::copy(im, im + spectrum_size() * l, zi);
+            for (std::size_t k = spectrum_size(); k < n; k++) {
+                for (std::size_t b = 0; b < l; b++) {
+                    zr[k * l + b] = re[(n - k) * l + b];
+                    zi[k * l + b] = -im[(n - k) * l + b];
+                }
+            }
+            m_complex.transform_lanes(zr, zi, l, fft_direction::inverse,
+                                      zi + n * l);
+            std::copy(zr, zr + n * l, out);
+            return;
+        }
+        const std::size_t h = n / 2;
+        T* zr = work;
+        T* zi = work + h * l;
+        for (std::size_t k = 0; k < h; k++) {
+            // E = X_k + conj X_(h-k), O = (X_k - conj X_(h-k)) e^(2 pi i k/n)
+            // and Z = E + i O, whose inverse is 2 (evens + i odds)
+            const T* ar = re + k * l;
+            const T* ai = im + k * l;
+            const T* br = re + (h - k) * l;
+            const T* bi = im + (h - k) * l;
+            const T c = m_cos[k], s = m_sin[k];
+            for (std::size_t b = 0; b < l; b++) {
+                T er = ar[b] + br[b], ei = ai[b] - bi[b];
+                T dr = ar[b] - br[b], di = ai[b] + bi[b];
+                T orr = dr * c - di * s, oi = dr * s + di * c;
+                zr[k * l + b] = er - oi;
+                zi[k * l + b] = ei + orr;
+            }
+        }
+        m_complex.transform_lanes(zr, zi, l, fft_direction::inverse,
+                                  zi + h * l);
+        for (std::size_t j = 0; j < h; j++) {
+            std::copy(zr + j * l, zr + (j + 1) * l, out + 2 * j * l);
+            std::copy(zi + j * l, zi + (j + 1) * l, out + (2 * j + 1) * l);
+        }
+    }
+
+    /**
+     * @brief Transforms one real sequence.
+     *
+     * @param in size() reals.
+     * @param out spectrum_size() coefficients.
+     */
+    void forward(const T* in, std::complex<T>* out) const {
+        std::size_t k = spectrum_size();
+        std::vector<T> buffer(2 * k + work_size(1));
+        forward_lanes(in, buffer.data(), buffer.data() + k, 1,
+                      buffer.data() + 2 * k);
+        for (std::size_t i = 0; i < k; i++) {
+            out[i] = std::complex<T>(buffer[i], buffer[k + i]);
+        }
+    }
+
+    /**
+     * @brief Transforms one half spectrum back to reals (unnormalised).
+     *
+     * @param in spectrum_size() coefficients.
+     * @param out size() reals.
+     */
+    void inverse(const std::complex<T>* in, T* out) const {
+        std::size_t k = spectrum_size();
+        std::vector<T> buffer(2 * k + work_size(1));
+        for (std::size_t i = 0; i < k; i++) {
+            buffer[i] = in[i].real();
+            buffer[k + i] = in[i].imag();
+        }
+        inverse_lanes(buffer.data(), buffer.data() + k, out, 1,
+                      buffer.data() + 2 * k);
+    }
+};
+
+/**
+ * @brief Threaded 3D FFTs of complex grids, and of real grids to half
+ * spectra and back.
+ *
+ * Grids are stored x fastest, value (x, y, z) at (z * ny + y) * nx + x
+ * (the layout of mesh); half spectra keep nx / 2 + 1 coefficients along
+ * x, at (z * ny + y) * (nx / 2 + 1) + kx.
+ *
+ * Each axis is a pass over pencils: blocks of detail::fft_lanes pencils
+ * are transposed into split-complex lanes, transformed together with the
+ * SIMD kernel of fft_plan and scattered back, blocks spread across
+ * threads. Along y and z a block is a run of neighbouring x, so both the
+ * gather and the scatter read whole cache lines. Transforms are
+ * unnormalised: forward then inverse scales by nx * ny * nz.
+ *
+ * @tparam T float or double.
+ */
+template <typename T> class fft3d {
+    int m_dims[3];
+    fft_plan<T> m_plans[3];
+    real_fft_plan<T> m_real;
+
+    // pencils of `count` elements `step` apart; the lanes of a block are
+    // `inner` neighbouring values, `outer` blocks of them `skip` apart
+    void column_pass(std::complex<T>* data, const fft_plan<T>& plan,
+                     std::size_t outer, std::size_t skip, std::size_t inner,
+                     std::size_t step, fft_direction direction) const {
+        const std::size_t n = plan.size(), lanes = detail::fft_lanes;
+        std::size_t per_outer = (inner + lanes - 1) / lanes;
+        parallel_for_ranges(
+            0, outer * per_outer,
+            [&](std::size_t lo, std::size_t hi, unsigned) {
+                std::vector<T> buffer(4 * n * lanes);
+                T* re = buffer.data();
+                T* im = re + n * lanes;
+                for (std::size_t block = lo; block < hi; block++) {
+                    std::size_t x0 = (block % per_outer) * lanes;
+                    std::size_t l = std::min(lanes, inner - x0);
+                    std::complex<T>* base =
+                        data + (block / per_outer) * skip + x0;
+                    for (std::size_t e = 0; e < n; e++) {
+                        const std::complex<T>* p = base + e * step;
+                        for (std::size_t b = 0; b < l; b++) {
+                            re[e * l + b] = p[b].real();
+                            im[e * l + b] = p[b].imag();
+                        }
+                    }
+                    plan.transform_lanes(re, im, l, direction, im + n * l);
+                    for (std::size_t e = 0; e < n; e++) {
+                        std::complex<T>* p = base + e * step;
+                        for (std::size_t b = 0; b < l; b++) {
+                            p[b] = std::complex<T>(re[e * l + b],
+                                                   im[e * l + b]);
+                        }
+                    }
+                }
+            },
+            1);
+    }
+
+    // the y then z passes over a grid `width` complex values wide
+    void yz_passes(std::complex<T>* data, std::size_t width,
+                   fft_direction direction) const {
+        std::size_t ny = m_dims[1], nz = m_dims[2];
+        column_pass(data, m_plans[1], nz, ny * width, width, width,
+                    direction);
+        column_pass(data, m_plans[2], ny, width, width, ny * width,
+                    direction);
+    }
+
+    // calls f(first row, rows, lane buffer) for blocks of x rows
+    template <typename F> void row_blocks(std::size_t extra, F f) const {
+        const std::size_t lanes = detail::fft_lanes;
+        std::size_t rows = (std::size_t)m_dims[1] * m_dims[2];
+        parallel_for_ranges(
+            0, (rows + lanes - 1) / lanes,
+            [&](std::size_t lo, std::size_t hi, unsigned) {
+                std::vector<T> buffer(extra * lanes);
+                for (std::size_t block = lo; block < hi; block++) {
+                    std::size_t r0 = block * lanes;
+                    f(r0, std::min(lanes, rows - r0), buffer.data());
+                }
+            },
+            1);
+    }
+
+  public:
+    /**
+     * @brief Plans transforms of an nx * ny * nz grid.
+     *
+     * @param nx, ny, nz The grid dimensions (positive).
+     */
+    fft3d(int nx, int ny, int nz) : m_real(nx) {
+        m_dims[0] = nx;
+        m_dims[1] = ny;
+        m_dims[2] = nz;
+        for (int k = 0; k < 3; k++) {
+            m_plans[k] = fft_plan<T>(m_dims[k]);
+        }
+    }
+
+    /**
+     * @brief Returns a grid dimension.
+     *
+     * @param k The axis.
+     * @return int The number of points along it.
+     */
+    int dim(int k) const { return m_dims[k]; }
+
+    /**
+     * @brief Returns the number of coefficients of a half spectrum.
+     *
+     * @return std::size_t (nx / 2 + 1) * ny * nz.
+     */
+    std::size_t spectrum_size() const {
+        return m_real.spectrum_size() * m_dims[1] * m_dims[2];
+    }
+
+    /**
+     * @brief Transforms a complex grid in place, across threads.
+     *
+     * @param data nx * ny * nz values.
+     * @param direction The sign of the exponent.
+     */
+    void transform(std::complex<T>* data, fft_direction direction) const {
+        const std::size_t nx = m_dims[0];
+        row_blocks(4 * nx, [&](std::size_t r0, std::size_t l, T* re) {
+            T* im = re + nx * l;
+            for (std::size_t b = 0; b < l; b++) {
+                const std::complex<T>* row = data + (r0 + b) * nx;
+                for (std::size_t e = 0; e < nx; e++) {
+                    re[e * l + b] = row[e].real();
+                    im[e * l + b] = row[e].imag();
+                }
+            }
+            m_plans[0].transform_lanes(re, im, l, direction, im + nx * l);
+            for (std::size_t b = 0; b < l; b++) {
+                std::complex<T>* row = data + (r0 + b) * nx;
+                for (std::size_t e = 0; e < nx; e++) {
+                    row[e] = std::complex<T>(re[e * l + b], im[e * l + b]);
+                }
+            }
+        });
+        yz_passes(data, nx, direction);
+    }
+
+    /**
+     * @brief Transforms a real grid to its half spectrum, across threads.
+     *
+     * @param in nx * ny * nz reals.
+     * @param out spectrum_size() coefficients.
+     */
+    void forward(const T* in, std::complex<T>* out) const {
+        const std::size_t nx = m_dims[0], hx = m_real.spectrum_size();
+        const std::size_t work = m_real.work_size(1);
+        row_blocks(nx + 2 * hx + work,
+                   [&](std::size_t r0, std::size_t l, T* real) {
+                       T* re = real + nx * l;
+                       T* im = re + hx * l;
+                       for (std::size_t b = 0; b < l; b++) {
+                           const T* row = in + (r0 + b) * nx;
+                           for (std::size_t e = 0; e < nx; e++) {
+                               real[e * l + b] = row[e];
+                           }
+                       }
+                       m_real.forward_lanes(real, re, im, l, im + hx * l);
+                       for (std::size_t b = 0; b < l; b++) {
+                           std::complex<T>* row = out + (r0 + b) * hx;
+                           for (std::size_t k = 0; k < hx; k++) {
+                               row[k] = std::complex<T>(re[k * l + b],
+                                                        im[k * l + b]);
+                           }
+                       }
+                   });
+        yz_passes(out, hx, fft_direction::forward);
+    }
+
+    /**
+     * @brief Transforms a half spectrum back to a real grid, across threads
+     * (unnormalised).
+     *
+     * @param in spectrum_size() coefficients; overwritten (the y and z
+     * passes run in place).
+     * @param out nx * ny * nz reals.
+     */
+    void inverse(std::complex<T>* in, T* out) const {
+        const std::size_t nx = m_dims[0], hx = m_real.spectrum_size();
+        const std::size_t work = m_real.work_size(1);
+        yz_passes(in, hx, fft_direction::inverse);
+        row_blocks(nx + 2 * hx + work,
+                   [&](std::size_t r0, std::size_t l, T* real) {
+                       T* re = real + nx * l;
+                       T* im = re + hx * l;
+                       for (std::size_t b = 0; b < l; b++) {
+                           const std::complex<T>* row = in + (r0 + b) * hx;
+                           for (std::size_t k = 0; k < hx; k++) {
+                               re[k * l + b] = row[k].real();
+                               im[k * l + b] = row[k].imag();
+                           }
+                       }
+                       m_real.inverse_lanes(re, im, real, l, im + hx * l);
+                       for (std::size_t b = 0; b < l; b++) {
+                           T* row = out + (r0 + b) * nx;
+                           for (std::size_t e = 0; e < nx; e++) {
+                               row[e] = real[e * l + b];
+                           }
+                       }
+                   });
+    }
+};
+
+} // namespace HQ
+
+#endif // _HQFFT_HPP_
@@ -0,0 +1,304 @@
+/**
+ * @file hqfof.hpp
+ * @brief This file defines parallel friends-of-friends clustering of vec3
+ * points, with optional periodic boundaries.
+ */
+
+#ifndef _HQFOF_HPP_
+#define _HQFOF_HPP_
+
+#include "hqbounds.hpp"
+#include "hqcells.hpp"
+#include "hqparallel.hpp"
+#include "hqperiodic.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief The summary of one friends-of-friends group.
+ *
+ * @tparam T The scalar type.
+ */
+template <typename T> struct fof_group {
+    /** @brief The number of members. */
+    std::uint32_t size;
+    /** @brief The mean member position (wrapped into the box if
+     * periodic). */
+    vec3<T> centroid;
+    /** @brief The bounds of the members; in a periodic box they are
+     * unwrapped around the group, so they may cross the box faces. */
+    aabb<T, 3> bounds;
+};
+
+namespace detail {
+
+/**
+ * @brief The root of x in a concurrent union-find forest, halving the path
+ * on the way (every node points to a smaller index or to itself).
+ */
+inline std::uint32_t find_root(std::vector<std::atomic<std::uint32_t>>& parent,
+                               std::uint32_t x) {
+    for (;;) {
+        std::uint32_t p = parent[x].load(std::memory_order_relaxed);
+        if (p == x)
+            return x;
+        std::uint32_t g = parent[p].load(std::memory_order_relaxed);
+        if (g == p)
+            return p;
+        // losing this race only means another thread shortened it first
+        parent[x].compare_exchange_weak(p, g, std::memory_order_relaxed);
+        x = g;
+    }
+}
+
+/**
+ * @brief Merges the sets of a and b, lock free: the larger root is linked
+ * under the smaller one, so each set's root ends up being its smallest
+ * index whatever the order of the merges.
+ */
+inline void unite(std::vector<std::atomic<std::uint32_t>>& parent,
+                  std::uint32_t a, std::uint32_t b) {
+    for (;;) {
+        a = find_root(parent, a);
+        b = find_root(parent, b);
+        if (a == b)
+            return;
+        if (a < b)
+            std::swap(a, b);
+        std::uint32_t expected = a;
+        if (parent[a].compare_exchange_strong(expected, b,
+                                              std::memory_order_relaxed))
+            return;
+    }
+}
+
+} // namespace detail
+
+/**
+ * @brief Friends-of-friends groups: the connected components of the graph
+ * linking every pair of points closer than a linking length.
+ *
+ * Points are bucketed in a cell_list one linking length wide. Cells are
+ * scanned in parallel, each against itself and its neighbours of larger
+ * id (so every pair of cells is visited once), and linked pairs are merged
+ * in a lock-free union-find over the cell-sorted points. As every set's
+ * root is its smallest member, the result does not depend on the thread
+ * count or timing.
+ *
+ * Groups with fewer than `min_size` members are dropped (their points get
+ * npos); the others are numbered by decreasing size, ties by smallest
+ * member index. Centroids and bounds are reduced per group in parallel
+ * over each group's member list. In a periodic box members are unwrapped
+ * with the minimum image around one member, which assumes groups span
+ * less than half the box.
+ *
+ * @tparam T The scalar type of the points.
+ */
+template <typename T> class friends_of_friends {
+    cell_list<T> m_cells;
+    std::vector<std::uint32_t> m_ids;
+    std::vector<fof_group<T>> m_groups;
+    std::vector<std::uint32_t> m_member_start;
+    std::vector<std::uint32_t> m_members;
+    vec3<T> m_box;
+
+    // groups the points already bucketed in m_cells
+    void link(T linking_length, std::size_t min_size) {
+        const std::size_t count = m_cells.size();
+        const vec3<T>* points = m_cells.sorted_points();
+        const std::uint32_t* index = m_cells.sorted_indices();
+        const bool periodic = m_cells.periodic();
+        const T b2 = linking_length * linking_length;
+        std::vector<std::atomic<std::uint32_t>> parent(count);
+        parallel_for(
+            0, count, [&](std::size_t i) { parent[i] = (std::uint32_t)i; },
+            4096);
+        parallel_for(
+            0, m_cells.cell_count(),
+            [&](std::size_t c) {
+                std::uint32_t begin = m_cells.cell_start(c);
+                std::uint32_t end = m_cells.cell_start(c + 1);
+                if (begin == end)
+                    return;
+                std::size_t neighbours[27];
+                int n = m_cells.neighbour_cells(c, neighbours);
+                for (int k = 0; k < n; k++) {
+                    std::size_t other = neighbours[k];
+                    if (other < c)
+                        continue;
+                    std::uint32_t last = m_cells.cell_start(other + 1);
+                    for (std::uint32_t i = begin; i < end; i++) {
+                        std::uint32_t first =
+                            other == c ? i + 1 : m_cells.cell_start(other);
+                        for (std::uint32_t j = first; j < last; j++) {
+                            T d2 = periodic ? distance2_periodic(
+                                                  points[i], points[j], m_box)
+                                            : points[i].distance2(points[j]);
+                            if (d2 <= b2)
+                                detail::unite(parent, i, j);
+                        }
+                    }
+                }
+            },
+            64);
+
+        // roots, sizes and the smallest original index of every set
+        std::vector<std::uint32_t> root(count);
+        parallel_for(
+            0, count,
+            [&](std::size_t i) {
+                root[i] = detail::find_root(parent, (std::uint32_t)i);
+            },
+            4096);
+        std::vector<std::uint32_t> size(count, 0), first(count, npos);
+        for (std::size_t i = 0; i < count; i++) {
+            size[root[i]]++;
+            first[root[i]] = std::min(first[root[i]], index[i]);
+        }
+        std::vector<std::uint32_t> roots;
+        for (std::size_t i = 0; i < count; i++) {
+            if ((root[i] == i) && (size[i] >= min_size))
+                roots.push_back((std::uint32_t)i);
+        }
+        std::sort(roots.begin(), roots.end(),
+                  [&](std::uint32_t a, std::uint32_t b) {
+                      return size[a] != size[b] ? size[a] > size[b]
+                                                : first[a] < first[b];
+                  });
+        // reuse `first` as the group of each root
+        std::fill(first.begin(), first.end(), npos);
+        m_member_start.assign(roots.size() + 1, 0);
+        for (std::size_t g = 0; g < roots.size(); g++) {
+            first[roots[g]] = (std::uint32_t)g;
+            m_member_start[g + 1] = m_member_start[g] + size[roots[g]];
+        }
+        m_ids.assign(count, npos);
+        m_members.resize(m_member_start.back());
+        std::vector<std::uint32_t> fill(m_member_start.begin(),
+                                        m_member_start.end() - 1);
+        for (std::size_t i = 0; i < count; i++) {
+            std::uint32_t g = first[root[i]];
+            m_ids[index[i]] = g;
+            if (g != npos)
+                m_members[fill[g]++] = (std::uint32_t)i;
+        }
+
+        m_groups.resize(roots.size());
+        parallel_for(
+            0, roots.size(),
+            [&](std::size_t g) {
+                const std::uint32_t* member = &m_members[m_member_start[g]];
+                std::uint32_t n = m_member_start[g + 1] - m_member_start[g];
+                const vec3<T>& reference = points[member[0]];
+                vec3<T> sum(0, 0, 0);
+                aabb<T, 3> bounds;
+                for (std::uint32_t k = 0; k < n; k++) {
+                    vec3<T> d = points[member[k]] - reference;
+                    if (periodic)
+                        d = minimum_image(d, m_box);
+                    sum = sum + d;
+                    bounds.expand(reference + d);
+                }
+                vec3<T> centroid = reference + sum / (T)n;
+                m_groups[g].size = n;
+                m_groups[g].centroid =
+                    periodic ? wrap(centroid, m_box) : centroid;
+                m_groups[g].bounds = bounds;
+                // members are listed by original index
+                std::uint32_t* list = &m_members[m_member_start[g]];
+                for (std::uint32_t k = 0; k < n; k++) {
+                    list[k] = index[list[k]];
+                }
+                std::sort(list, list + n);
+            },
+            16);
+    }
+
+  public:
+    /** @brief The group id of points in no (large enough) group. */
+    static const std::uint32_t npos = ~std::uint32_t(0);
+
+    /**
+     * @brief Constructs an empty grouping.
+     */
+    friends_of_friends() : m_member_start(1, 0), m_box(0, 0, 0) {}
+
+    /**
+     * @brief Groups points in open space.
+     *
+     * @param points The points.
+     * @param count The number of points (less than 2^32).
+     * @param linking_length The largest distance between friends (greater
+     * than 0).
+     * @param min_size The smallest group kept.
+     */
+    void build(const vec3<T>* points, std::size_t count, T linking_length,
+               std::size_t min_size = 1) {
+        m_box = vec3<T>(0, 0, 0);
+        m_cells.build(points, count, linking_length);
+        link(linking_length, min_size);
+    }
+
+    /**
+     * @brief Groups points in a periodic box.
+     *
+     * @param points The points (wrapped into [0, box)).
+     * @param count The number of points (less than 2^32).
+     * @param linking_length The largest distance between friends (at most
+     * half the smallest box edge).
+     * @param box The periodic box edge lengths.
+     * @param min_size The smallest group kept.
+     */
+    void build(const vec3<T>* points, std::size_t count, T linking_length,
+               const vec3<T>& box, std::size_t min_size = 1) {
+        m_box = box;
+        m_cells.build(points, count, linking_length, box);
+        link(linking_length, min_size);
+    }
+
+    /**
+     * @brief Returns the number of groups kept.
+     *
+     * @return std::size_t The group count.
+     */
+    std::size_t group_count() const { return m_groups.size(); }
+
+    /**
+     * @brief Returns the group of every point.
+     *
+     * @return const std::vector<std::uint32_t>& The group id of each point
+     * given to build, or npos.
+     */
+    const std::vector<std::uint32_t>& group_ids() const { return m_ids; }
+
+    /**
+     * @brief Returns the group summaries.
+     *
+     * @return const std::vector<fof_group<T>>& group_count() groups, by
+     * decreasing size.
+     */
+    const std::vector<fof_group<T>>& groups() const { return m_groups; }
+
+    /**
+     * @brief Returns the members of a group.
+     *
+     * @param group The group id.
+     * @return const std::uint32_t* groups()[group].size point indices, in
+     * ascending order.
+     */
+    const std::uint32_t* members(std::size_t group) const {
+        return m_members.data() + m_member_start[group];
+    }
+};
+
+template <typename T> const std::uint32_t friends_of_friends<T>::npos;
+
+} // namespace HQ
+
+#endif // _HQFOF_HPP_
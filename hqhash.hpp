@@ -0,0 +1,351 @@
+/**
+ * @file hqhash.hpp
+ * @brief This file defines an open-addressing hash map keyed by integer
+ * vectors, for sparse voxel and grid data.
+ */
+
+#ifndef _HQHASH_HPP_
+#define _HQHASH_HPP_
+
+#include "hqvec.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace HQ {
+
+namespace detail {
+
+/** @brief Control byte of a slot that never held an entry. */
+static const std::uint8_t slot_empty = 0x80;
+/** @brief Control byte of a slot whose entry was erased. */
+static const std::uint8_t slot_deleted = 0xfe;
+/** @brief Slots whose control bytes are probed together. */
+static const std::size_t slot_group = 16;
+
+/**
+ * @brief Returns a bit per control byte of a group equal to `tag`.
+ */
+inline std::uint32_t match_byte(const std::uint8_t* ctrl, std::uint8_t tag) {
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+    return (std::uint32_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+    std::uint32_t out = 0;
+    for (int i = 0; i < (int)slot_group; i++) {
+        out |= (std::uint32_t)(ctrl[i] == tag) << i;
+    }
+    return out;
+#endif
+}
+
+/**
+ * @brief Returns a bit per empty or deleted slot of a group (those with the
+ * top bit of the control byte set).
+ */
+inline std::uint32_t match_free(const std::uint8_t* ctrl) {
+#if defined(__SSE2__)
+    return (std::uint32_t)_mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl)));
+#else
+    std::uint32_t out = 0;
+    for (int i = 0; i < (int)slot_group; i++) {
+        out |= (std::uint32_t)(ctrl[i] >> 7) << i;
+    }
+    return out;
+#endif
+}
+
+/**
+ * @brief Returns the index of the lowest set bit (mask must be non-zero).
+ */
+inline int lowest_set(std::uint32_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+} // namespace detail
+
+/**
+ * @brief An open-addressing hash map keyed by integer vectors.
+ *
+ * Slots are probed in groups of 16: each slot has a control byte holding
+ * 7 bits of the key's hash (or an empty/deleted marker), and a group's 16
+ * control bytes are compared with one SSE2 instruction, so most lookups
+ * touch one group of metadata and one entry. Groups are visited in
+ * triangular order, which covers every group of a power-of-two table.
+ * Entries live in one flat array, without per-entry allocations.
+ *
+ * Pointers to values stay valid until an insertion or reserve() rehashes
+ * the table, or clear().
+ *
+ * @tparam T The integer type of the key components.
+ * @tparam n The dimension of the keys.
+ * @tparam V The mapped type (default-constructible and copyable).
+ */
+template <typename T, std::size_t n, typename V> class vec_hash_map {
+    static_assert(std::is_integral<T>::value,
+                  "vec_hash_map keys have integer components");
+
+  public:
+    /** @brief The key type. */
+    typedef vec<T, n> key_type;
+    /** @brief The mapped type. */
+    typedef V mapped_type;
+
+  private:
+    static const std::size_t npos = ~std::size_t(0);
+
+    std::vector<std::uint8_t> m_ctrl;
+    std::vector<std::pair<key_type, V>> m_slots;
+    std::size_t m_group_mask;
+    std::size_t m_size;
+    std::size_t m_deleted;
+
+    static std::uint64_t hash(const key_type& key) {
+        return (std::uint64_t)std::hash<key_type>()(key);
+    }
+
+    std::size_t find_slot(const key_type& key, std::uint64_t h) const {
+        if (m_slots.empty())
+            return npos;
+        std::uint8_t tag = (std::uint8_t)(h & 0x7f);
+        std::size_t g = (std::size_t)(h >> 7) & m_group_mask;
+        for (std::size_t step = 1;; step++) {
+            const std::uint8_t* ctrl = &m_ctrl[g * detail::slot_group];
+            std::uint32_t mask = detail::match_byte(ctrl, tag);
+            while (mask) {
+                std::size_t slot =
+                    g * detail::slot_group + detail::lowest_set(mask);
+                if (m_slots[slot].first == key)
+                    return slot;
+                mask &= mask - 1;
+            }
+            if (detail::match_byte(ctrl, detail::slot_empty))
+                return npos;
+            g = (g + step) & m_group_mask;
+        }
+    }
+
+    // the first empty or deleted slot along the probe sequence of h
+    std::size_t free_slot(std::uint64_t h) const {
+        std::size_t g = (std::size_t)(h >> 7) & m_group_mask;
+        for (std::size_t step = 1;; step++) {
+            std::uint32_t mask =
+                detail::match_free(&m_ctrl[g * detail::slot_group]);
+            if (mask)
+                return g * detail::slot_group + detail::lowest_set(mask);
+            g = (g + step) & m_group_mask;
+        }
+    }
+
+    void rehash_groups(std::size_t groups) {
+        std::vector<std::uint8_t> ctrl;
+        std::vector<std::pair<key_type, V>> slots;
+        ctrl.swap(m_ctrl);
+        slots.swap(m_slots);
+        m_ctrl.assign(groups * detail::slot_group, detail::slot_empty);
+        m_slots.resize(groups * detail::slot_group);
+        m_group_mask = groups - 1;
+        m_deleted = 0;
+        for (std::size_t i = 0; i < slots.size(); i++) {
+            if (ctrl[i] & 0x80)
+                continue;
+            std::uint64_t h = hash(slots[i].first);
+            std::size_t slot = free_slot(h);
+            m_ctrl[slot] = (std::uint8_t)(h & 0x7f);
+            m_slots[slot] = slots[i];
+        }
+    }
+
+    // keeps (size + deleted) at most 7/8 of the slots; a rehash drops
+    // the tombstones and leaves the table at most 7/16 full
+    void grow_for(std::size_t entries) {
+        if ((entries + m_deleted) * 8 <= m_slots.size() * 7)
+            return;
+        std::size_t groups = 1;
+        while (entries * 16 > groups * detail::slot_group * 7) {
+            groups *= 2;
+        }
+        rehash_groups(groups);
+    }
+
+  public:
+    /**
+     * @brief Constructs an empty map (no allocation until first insert).
+     */
+    vec_hash_map() : m_group_mask(0), m_size(0), m_deleted(0) {}
+
+    /**
+     * @brief Returns the number of entries.
+     *
+     * @return std::size_t The entry count.
+     */
+    std::size_t size() const { return m_size; }
+
+    /**
+     * @brief Returns whether the map has no entries.
+     *
+     * @return bool True if size() is 0.
+     */
+    bool empty() const { return m_size == 0; }
+
+    /**
+     * @brief Returns the number of slots allocated.
+     *
+     * @return std::size_t The slot count (a multiple of 16, or 0).
+     */
+    std::size_t capacity() const { return m_slots.size(); }
+
+    /**
+     * @brief Removes every entry and frees the table.
+     */
+    void clear() {
+        std::vector<std::uint8_t>().swap(m_ctrl);
+        std::vector<std::pair<key_type, V>>().swap(m_slots);
+        m_group_mask = 0;
+        m_size = 0;
+        m_deleted = 0;
+    }
+
+    /**
+     * @brief Grows the table so that `count` entries fit without rehashing.
+     *
+     * @param count The number of entries to make room for.
+     */
+    void reserve(std::size_t count) { grow_for(count); }
+
+    /**
+     * @brief Looks up a key.
+     *
+     * @param key The key.
+     * @return V* The value, or nullptr if the key is absent.
+     */
+    V* find(const key_type& key) {
+        std::size_t slot = find_slot(key, hash(key));
+        return slot == npos ? nullptr : &m_slots[slot].second;
+    }
+
+    /**
+     * @brief Looks up a key.
+     *
+     * @param key The key.
+     * @return const V* The value, or nullptr if the key is absent.
+     */
+    const V* find(const key_type& key) const {
+        std::size_t slot = find_slot(key, hash(key));
+        return slot == npos ? nullptr : &m_slots[slot].second;
+    }
+
+    /**
+     * @brief Returns whether a key is present.
+     *
+     * @param key The key.
+     * @return bool True if the map has an entry for key.
+     */
+    bool contains(const key_type& key) const { return find(key) != nullptr; }
+
+    /**
+     * @brief Inserts an entry unless the key is already present.
+     *
+     * @param key The key.
+     * @param value The value to insert.
+     * @return std::pair<V*, bool> The value for key, and whether it was
+     * inserted (false if the key was present; its value is unchanged).
+     */
+    std::pair<V*, bool> insert(const key_type& key, const V& value) {
+        std::uint64_t h = hash(key);
+        std::size_t slot = find_slot(key, h);
+        if (slot != npos)
+            return std::make_pair(&m_slots[slot].second, false);
+        grow_for(m_size + 1);
+        slot = free_slot(h);
+        if (m_ctrl[slot] == detail::slot_deleted)
+            m_deleted--;
+        m_ctrl[slot] = (std::uint8_t)(h & 0x7f);
+        m_slots[slot].first = key;
+        m_slots[slot].second = value;
+        m_size++;
+        return std::make_pair(&m_slots[slot].second, true);
+    }
+
+    /**
+     * @brief Returns the value for a key, inserting a default one if absent.
+     *
+     * @param key The key.
+     * @return V& The value.
+     */
+    V& operator[](const key_type& key) { return *insert(key, V()).first; }
+
+    /**
+     * @brief Removes the entry for a key.
+     *
+     * @param key The key.
+     * @return bool True if an entry was removed.
+     */
+    bool erase(const key_type& key) {
+        std::size_t slot = find_slot(key, hash(key));
+        if (slot == npos)
+            return false;
+        // probes stop at the first group with an empty slot, and a group
+        // never regains one between rehashes, so if this group has one no
+        // key lives beyond it and the slot can be emptied instead of
+        // leaving a tombstone
+        std::size_t group = slot - slot % detail::slot_group;
+        if (detail::match_byte(&m_ctrl[group], detail::slot_empty)) {
+            m_ctrl[slot] = detail::slot_empty;
+        } else {
+            m_ctrl[slot] = detail::slot_deleted;
+            m_deleted++;
+        }
+        m_slots[slot].second = V();
+        m_size--;
+        return true;
+    }
+
+    /**
+     * @brief Calls `f(key, value)` for every entry, in no particular order.
+     *
+     * @tparam F Callable taking (const vec<T, n>&, V&).
+     * @param f The callback; must not insert or erase.
+     */
+    template <typename F> void for_each(F f) {
+        for (std::size_t i = 0; i < m_slots.size(); i++) {
+            if (!(m_ctrl[i] & 0x80))
+                f(m_slots[i].first, m_slots[i].second);
+        }
+    }
+
+    /**
+     * @brief Calls `f(key, value)` for every entry, in no particular order.
+     *
+     * @tparam F Callable taking (const vec<T, n>&, const V&).
+     * @param f The callback.
+     */
+    template <typename F> void for_each(F f) const {
+        for (std::size_t i = 0; i < m_slots.size(); i++) {
+            if (!(m_ctrl[i] & 0x80))
+                f(m_slots[i].first, m_slots[i].second);
+        }
+    }
+};
+
+} // namespace HQ
+
+#endif // _HQHASH_HPP_
@@ -0,0 +1,341 @@
+/**
+ * @file hqkdtree.hpp
+ * @brief This file defines a k-d tree for nearest-neighbour and radius
+ * queries over arrays of vectors.
+ */
+
+#ifndef _HQKDTREE_HPP_
+#define _HQKDTREE_HPP_
+
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief A query result: the index of a point and its squared distance.
+ *
+ * @tparam T The scalar type of the points.
+ */
+template <typename T> struct neighbor {
+    /** @brief Index of the point in the array the tree was built from. */
+    std::uint32_t index;
+    /** @brief Squared distance from the query to the point. */
+    T distance2;
+};
+
+namespace detail {
+
+/**
+ * @brief Orders neighbours by distance (then index, for stable ties).
+ */
+template <typename T>
+inline bool neighbor_less(const neighbor<T>& a, const neighbor<T>& b) {
+    return (a.distance2 < b.distance2) ||
+           ((a.distance2 == b.distance2) && (a.index < b.index));
+}
+
+} // namespace detail
+
+/**
+ * @brief A static k-d tree over a point array.
+ *
+ * The tree has an implicit layout and no node pointers. Points are
+ * reordered so that every subtree is a contiguous range [lo, hi), with the
+ * splitting point at mid = lo + (hi - lo) / 2, the left child at [lo, mid)
+ * and the right child at [mid + 1, hi). Only the split axis of each node is
+ * stored. Ranges of at most leaf_size points are leaves and are scanned
+ * linearly.
+ *
+ * @tparam T The scalar type of the points.
+ * @tparam n The dimension of the points.
+ */
+template <typename T, std::size_t n> class kd_tree {
+  public:
+    /** @brief Marks an unused result slot. */
+    static const std::uint32_t npos = 0xffffffffu;
+
+  private:
+    struct entry {
+        vec<T, n> point;
+        std::uint32_t index;
+    };
+
+    std::vector<vec<T, n>> m_points;
+    std::vector<std::uint32_t> m_index;
+    std::vector<unsigned char> m_axis;
+    std::size_t m_leaf_size;
+
+    bool is_leaf(std::size_t lo, std::size_t hi) const {
+        return hi - lo <= m_leaf_size;
+    }
+
+    // splits [lo, hi) at its median along the axis of widest spread
+    void split(entry* e, std::size_t lo, std::size_t hi) {
+        vec<T, n> low = e[lo].point, high = e[lo].point;
+        for (std::size_t i = lo + 1; i < hi; i++) {
+            for (int k = 0; k < (int)n; k++) {
+                low[k] = std::min(low[k], e[i].point[k]);
+                high[k] = std::max(high[k], e[i].point[k]);
+            }
+        }
+        int axis = 0;
+        for (int k = 1; k < (int)n; k++) {
+            if (high[k] - low[k] > high[axis] - low[axis])
+                axis = k;
+        }
+        std::size_t mid = lo + (hi - lo) / 2;
+        std::nth_element(e + lo, e + mid, e + hi,
+                         [axis](const entry& a, const entry& b) {
+                             return a.point[axis] < b.point[axis];
+                         });
+        m_axis[mid] = (unsigned char)axis;
+    }
+
+    void build_range(entry* e, std::size_t lo, std::size_t hi) {
+        if (is_leaf(lo, hi))
+            return;
+        split(e, lo, hi);
+        std::size_t mid = lo + (hi - lo) / 2;
+        build_range(e, lo, mid);
+        build_range(e, mid + 1, hi);
+    }
+
+    // keeps the k best candidates as a max-heap in best[0, found)
+    void knn_range(const vec<T, n>& q, std::size_t lo, std::size_t hi,
+                   std::size_t k, neighbor<T>* best,
+                   std::size_t& found) const {
+        if (is_leaf(lo, hi)) {
+            for (std::size_t i = lo; i < hi; i++) {
+                offer(q, i, k, best, found);
+            }
+            return;
+        }
+        std::size_t mid = lo + (hi - lo) / 2;
+        int axis = m_axis[mid];
+        T diff = q[axis] - m_points[mid][axis];
+        offer(q, mid, k, best, found);
+        if (diff < 0) {
+            knn_range(q, lo, mid, k, best, found);
+            if ((found < k) || (diff * diff < best[0].distance2))
+                knn_range(q, mid + 1, hi, k, best, found);
+        } else {
+            knn_range(q, mid + 1, hi, k, best, found);
+            if ((found < k) || (diff * diff < best[0].distance2))
+                knn_range(q, lo, mid, k, best, found);
+        }
+    }
+
+    void offer(const vec<T, n>& q, std::size_t i, std::size_t k,
+               neighbor<T>* best, std::size_t& found) const {
+        neighbor<T> c = {m_index[i], m_points[i].distance2(q)};
+        if (found < k) {
+            best[found++] = c;
+            std::push_heap(best, best + found, detail::neighbor_less<T>);
+        } else if (detail::neighbor_less(c, best[0])) {
+            std::pop_heap(best, best + k, detail::neighbor_less<T>);
+            best[k - 1] = c;
+            std::push_heap(best, best + k, detail::neighbor_less<T>);
+        }
+    }
+
+    void radius_range(const vec<T, n>& q, T r2, std::size_t lo,
+                      std::size_t hi, std::vector<neighbor<T>>& out) const {
+        if (is_leaf(lo, hi)) {
+            for (std::size_t i = lo; i < hi; i++) {
+                T d2 = m_points[i].distance2(q);
+                if (d2 <= r2) {
+                    neighbor<T> c = {m_index[i], d2};
+                    out.push_back(c);
+                }
+            }
+            return;
+        }
+        std::size_t mid = lo + (hi - lo) / 2;
+        int axis = m_axis[mid];
+        T diff = q[axis] - m_points[mid][axis];
+        T d2 = m_points[mid].distance2(q);
+        if (d2 <= r2) {
+            neighbor<T> c = {m_index[mid], d2};
+            out.push_back(c);
+        }
+        if ((diff <= 0) || (diff * diff <= r2))
+            radius_range(q, r2, lo, mid, out);
+        if ((diff >= 0) || (diff * diff <= r2))
+            radius_range(q, r2, mid + 1, hi, out);
+    }
+
+  public:
+    /**
+     * @brief Constructs an empty tree.
+     */
+    kd_tree() : m_leaf_size(8) {}
+
+    /**
+     * @brief Builds a tree over a copy of the points.
+     *
+     * @param points The points.
+     * @param count The number of points (less than 2^32 - 1).
+     * @param leaf_size Largest range scanned linearly.
+     */
+    kd_tree(const vec<T, n>* points, std::size_t count,
+            std::size_t leaf_size = 8)
+        : m_leaf_size(8) {
+        build(points, count, leaf_size);
+    }
+
+    /**
+     * @brief Rebuilds the tree over a copy of the points.
+     *
+     * The top levels are split on the calling thread until there is one
+     * subtree per thread; the subtrees are then built in parallel.
+     *
+     * @param points The points.
+     * @param count The number of points (less than 2^32 - 1).
+     * @param leaf_size Largest range scanned linearly.
+     */
+    void build(const vec<T, n>* points, std::size_t count,
+               std::size_t leaf_size = 8) {
+        m_leaf_size = leaf_size ? leaf_size : 1;
+        std::vector<entry> e(count);
+        for (std::size_t i = 0; i < count; i++) {
+            e[i].point = points[i];
+            e[i].index = (std::uint32_t)i;
+        }
+        m_axis.assign(count, 0);
+
+        // breadth-first until there are enough independent subtrees
+        std::vector<std::size_t> ranges(1, 0), next;
+        ranges.push_back(count);
+        while (ranges.size() / 2 < num_threads()) {
+            next.clear();
+            for (std::size_t r = 0; r < ranges.size(); r += 2) {
+                std::size_t lo = ranges[r], hi = ranges[r + 1];
+                if (is_leaf(lo, hi))
+                    continue;
+                split(e.data(), lo, hi);
+                std::size_t mid = lo + (hi - lo) / 2;
+                next.push_back(lo);
+                next.push_back(mid);
+                next.push_back(mid + 1);
+                next.push_back(hi);
+            }
+            if (next.empty())
+                break;
+            ranges.swap(next);
+        }
+        entry* data = e.data();
+        parallel_for(
+            0, ranges.size() / 2,
+            [&](std::size_t r) {
+                build_range(data, ranges[2 * r], ranges[2 * r + 1]);
+            },
+            1);
+
+        m_points.resize(count);
+        m_index.resize(count);
+        for (std::size_t i = 0; i < count; i++) {
+            m_points[i] = e[i].point;
+            m_index[i] = e[i].index;
+        }
+    }
+
+    /**
+     * @brief Returns the number of points in the tree.
+     *
+     * @return std::size_t The point count.
+     */
+    std::size_t size() const { return m_points.size(); }
+
+    /**
+     * @brief Finds the k nearest points to a query.
+     *
+     * @param query The query point.
+     * @param k The number of neighbours wanted.
+     * @param out At least k slots; filled nearest first.
+     * @return std::size_t The number found (min(k, size())).
+     */
+    std::size_t knn(const vec<T, n>& query, std::size_t k,
+                    neighbor<T>* out) const {
+        std::size_t found = 0;
+        if (k && !m_points.empty())
+            knn_range(query, 0, m_points.size(), k, out, found);
+        std::sort_heap(out, out + found, detail::neighbor_less<T>);
+        return found;
+    }
+
+    /**
+     * @brief Finds the k nearest points to each of many queries, across
+     * threads.
+     *
+     * @param queries The query points.
+     * @param count The number of queries.
+     * @param k The number of neighbours per query.
+     * @param out count * k slots; row q holds the neighbours of query q,
+     * nearest first, padded with {npos, max()} if the tree has fewer than k
+     * points.
+     */
+    void knn(const vec<T, n>* queries, std::size_t count, std::size_t k,
+             neighbor<T>* out) const {
+        parallel_for(
+            0, count,
+            [&](std::size_t q) {
+                neighbor<T>* row = out + q * k;
+                std::size_t found = knn(queries[q], k, row);
+                for (std::size_t j = found; j < k; j++) {
+                    row[j].index = npos;
+                    row[j].distance2 = std::numeric_limits<T>::max();
+                }
+            },
+            64);
+    }
+
+    /**
+     * @brief Finds every point within a radius of a query.
+     *
+     * @param query The query point.
+     * @param r The search radius (inclusive).
+     * @param out Results are appended in no particular order.
+     * @return std::size_t The number of points appended.
+     */
+    std::size_t radius(const vec<T, n>& query, T r,
+                       std::vector<neighbor<T>>& out) const {
+        std::size_t before = out.size();
+        if (!m_points.empty())
+            radius_range(query, r * r, 0, m_points.size(), out);
+        return out.size() - before;
+    }
+
+    /**
+     * @brief Finds every point within a radius of each of many queries,
+     * across threads.
+     *
+     * @param queries The query points.
+     * @param count The number of queries.
+     * @param r The search radius (inclusive).
+     * @param out Resized to count; out[q] holds the results for query q in
+     * no particular order.
+     */
+    void radius(const vec<T, n>* queries, std::size_t count, T r,
+                std::vector<std::vector<neighbor<T>>>& out) const {
+        out.resize(count);
+        parallel_for(
+            0, count,
+            [&](std::size_t q) {
+                out[q].clear();
+                radius(queries[q], r, out[q]);
+            },
+            64);
+    }
+};
+
+template <typename T, std::size_t n> const std::uint32_t kd_tree<T, n>::npos;
+
+} // namespace HQ
+
+#endif // _HQKDTREE_HPP_
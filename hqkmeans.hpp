@@ -0,0 +1,434 @@
+/**
+ * @file hqkmeans.hpp
+ * @brief This file defines k-means clustering of vec datasets, with k-means++
+ * seeding and bound-based assignment.
+ */
+
+#ifndef _HQKMEANS_HPP_
+#define _HQKMEANS_HPP_
+
+#include "hqparallel.hpp"
+#include "hqsimd.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief Timing and progress of one k-means iteration.
+ */
+struct kmeans_iteration {
+    /** @brief Wall time of the iteration. */
+    double seconds = 0;
+    /** @brief Points whose cluster changed (all of them on the first). */
+    std::size_t reassigned = 0;
+    /** @brief Point-to-centroid distances computed. */
+    std::uint64_t distances = 0;
+    /** @brief The largest distance a centroid moved. */
+    double max_shift = 0;
+};
+
+/**
+ * @brief Statistics of a k-means run.
+ */
+struct kmeans_stats {
+    /** @brief Wall time of the k-means++ seeding. */
+    double seeding_seconds = 0;
+    /** @brief One entry per iteration, in order. */
+    std::vector<kmeans_iteration> iterations;
+    /** @brief Whether the centroids settled before the iteration limit. */
+    bool converged = false;
+    /** @brief Sum of squared distances from the points to their centroids. */
+    double inertia = 0;
+
+    /**
+     * @brief Returns the distances computed by all iterations.
+     *
+     * @return std::uint64_t The total (seeding excluded).
+     */
+    std::uint64_t distances() const {
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < iterations.size(); i++) {
+            total += iterations[i].distances;
+        }
+        return total;
+    }
+};
+
+namespace detail {
+
+/** @brief Points per block of the k-means reductions; sums are combined
+ * block by block in order, so results do not depend on the thread count. */
+static const std::size_t kmeans_block = 16384;
+
+/**
+ * @brief The squared distance between two vecs, SIMD across components.
+ */
+template <typename T, std::size_t n>
+inline T kmeans_distance2(const vec<T, n>& a, const vec<T, n>& b) {
+    typedef simd<T> S;
+    const T* pa = reinterpret_cast<const T*>(&a);
+    const T* pb = reinterpret_cast<const T*>(&b);
+    typename S::type s0 = S::zero(), s1 = S::zero();
+    int k = 0;
+    for (; k + 2 * S::width <= (int)n; k += 2 * S::width) {
+        typename S::type d0 = S::sub(S::load(pa + k), S::load(pb + k));
+        typename S::type d1 =
+            S::sub(S::load(pa + k + S::width), S::load(pb + k + S::width));
+        s0 = S::add(s0, S::mul(d0, d0));
+        s1 = S::add(s1, S::mul(d1, d1));
+    }
+    T sum = S::sum(S::add(s0, s1));
+    for (; k < (int)n; k++) {
+        T d = pa[k] - pb[k];
+        sum += d * d;
+    }
+    return sum;
+}
+
+/** @brief splitmix64, for seeding that is the same on every platform. */
+inline std::uint64_t kmeans_random(std::uint64_t& state) {
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/** @brief A uniform double in [0, 1). */
+inline double kmeans_uniform(std::uint64_t& state) {
+    return (double)(kmeans_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+} // namespace detail
+
+/**
+ * @brief Lloyd's k-means over a vec dataset, with k-means++ seeding and
+ * Hamerly's bounds.
+ *
+ * Every point keeps an upper bound on the distance to its centroid and a
+ * lower bound on the distance to every other centroid. After the centroids
+ * move the bounds are loosened by how far they moved, and a point is only
+ * compared against all k centroids when its upper bound exceeds both its
+ * lower bound and half the distance from its centroid to the nearest other
+ * one; late iterations typically compute about one distance per point.
+ * Hamerly's single lower bound (rather than Elkan's k per point) keeps the
+ * extra memory at two scalars per point for millions of points.
+ *
+ * Assignment runs across threads. Cluster sums are kept in double: they
+ * start as a blocked parallel reduction and are then updated only for the
+ * points that changed cluster, in index order, so the clustering does not
+ * depend on the thread count. A cluster that loses all its points keeps
+ * its last centroid.
+ *
+ * @tparam T The scalar type (float or double).
+ * @tparam n The dimension of the points.
+ */
+template <typename T, std::size_t n> class kmeans {
+    typedef vec<T, n> point;
+
+    std::vector<point> m_centroids;
+    std::vector<std::uint32_t> m_labels;
+    kmeans_stats m_stats;
+
+    static double seconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+            .count();
+    }
+
+    // k-means++: each further centre is a point drawn with probability
+    // proportional to its squared distance to the nearest centre so far
+    void seed(const point* points, std::size_t count, std::size_t k,
+              std::uint64_t state) {
+        const std::size_t blocks =
+            (count + detail::kmeans_block - 1) / detail::kmeans_block;
+        std::vector<T> nearest(count, std::numeric_limits<T>::max());
+        std::vector<double> block_sum(blocks);
+        m_centroids.assign(1, points[detail::kmeans_random(state) % count]);
+        for (;;) {
+            const point c = m_centroids.back();
+            parallel_for(
+                0, blocks,
+                [&](std::size_t b) {
+                    std::size_t lo = b * detail::kmeans_block;
+                    std::size_t hi = std::min(count, lo + detail::kmeans_block);
+                    double sum = 0;
+                    for (std::size_t i = lo; i < hi; i++) {
+                        T d2 = detail::kmeans_distance2(points[i], c);
+                        nearest[i] = std::min(nearest[i], d2);
+                        sum += nearest[i];
+                    }
+                    block_sum[b] = sum;
+                },
+                1);
+            if (m_centroids.size() == k)
+                return;
+            double total = 0;
+            for (std::size_t b = 0; b < blocks; b++) {
+                total += block_sum[b];
+            }
+            // fewer distinct points than k: duplicate centres stay empty
+            double target = detail::kmeans_uniform(state) * total;
+            std::size_t b = 0;
+            for (; (b + 1 < blocks) && (target >= block_sum[b]); b++) {
+                target -= block_sum[b];
+            }
+            std::size_t i = b * detail::kmeans_block;
+            std::size_t hi = std::min(count, i + detail::kmeans_block);
+            for (; (i + 1 < hi) && (target >= nearest[i]); i++) {
+                target -= nearest[i];
+            }
+            m_centroids.push_back(points[i]);
+        }
+    }
+
+  public:
+    /**
+     * @brief Constructs an empty clustering.
+     */
+    kmeans() {}
+
+    /**
+     * @brief Clusters a dataset.
+     *
+     * @param points The points.
+     * @param count The number of points (at least k, less than 2^32).
+     * @param k The number of clusters (at least 1).
+     * @param max_iterations The iteration limit.
+     * @param tolerance Stop once no centroid moves further than this.
+     * @param seed Seed of the k-means++ draws.
+     * @return bool Whether the clustering converged.
+     */
+    bool fit(const point* points, std::size_t count, std::size_t k,
+             std::size_t max_iterations = 100, T tolerance = 0,
+             std::uint64_t seed = 1) {
+        typedef std::chrono::steady_clock clock;
+        const std::size_t blocks =
+            (count + detail::kmeans_block - 1) / detail::kmeans_block;
+        m_stats = kmeans_stats();
+        clock::time_point start = clock::now();
+        this->seed(points, count, k, seed);
+        m_stats.seeding_seconds = seconds_since(start);
+
+        std::vector<T> upper(count), lower(count);
+        std::vector<T> shift(k), half_gap(k);
+        std::vector<vec<double, n>> sums(k);
+        std::vector<std::size_t> sizes(k, 0);
+        m_labels.assign(count, 0);
+        // (point, previous cluster) of every move, per thread range
+        std::vector<std::vector<std::uint32_t>> moved(num_threads());
+        std::vector<std::uint64_t> evaluated(num_threads());
+        for (std::size_t it = 0; it < max_iterations; it++) {
+            start = clock::now();
+            kmeans_iteration stats;
+            const bool first = it == 0;
+            if (!first) {
+                parallel_for(
+                    0, k,
+                    [&](std::size_t c) {
+                        T nearest = std::numeric_limits<T>::max();
+                        for (std::size_t j = 0; j < k; j++) {
+                            if (j != c)
+                                nearest = std::min(
+                                    nearest, detail::kmeans_distance2(
+                                                 m_centroids[c],
+                                                 m_centroids[j]));
+                        }
+                        half_gap[c] = std::sqrt(nearest) / 2;
+                    },
+                    16);
+                stats.distances += k * (k - 1);
+            }
+
+            for (std::size_t t = 0; t < moved.size(); t++) {
+                moved[t].clear();
+                evaluated[t] = 0;
+            }
+            parallel_for_ranges(
+                0, count,
+                [&](std::size_t lo, std::size_t hi, unsigned t) {
+                    std::uint64_t distances = 0;
+                    for (std::size_t i = lo; i < hi; i++) {
+                        std::uint32_t a = m_labels[i];
+                        if (!first) {
+                            T bound = std::max(lower[i], half_gap[a]);
+                            if (upper[i] <= bound)
+                                continue;
+                            upper[i] = std::sqrt(detail::kmeans_distance2(
+                                points[i], m_centroids[a]));
+                            distances++;
+                            if (upper[i] <= bound)
+                                continue;
+                        }
+                        T best = std::numeric_limits<T>::max(), second = best;
+                        std::uint32_t label = 0;
+                        for (std::size_t j = 0; j < k; j++) {
+                            T d2 = detail::kmeans_distance2(points[i],
+                                                            m_centroids[j]);
+                            if (d2 < best) {
+                                second = best;
+                                best = d2;
+                                label = (std::uint32_t)j;
+                            } else if (d2 < second) {
+                                second = d2;
+                            }
+                        }
+                        distances += k;
+                        upper[i] = std::sqrt(best);
+                        lower[i] = std::sqrt(second);
+                        if (first || (label != a)) {
+                            m_labels[i] = label;
+                            moved[t].push_back((std::uint32_t)i);
+                            moved[t].push_back(a);
+                        }
+                    }
+                    evaluated[t] = distances;
+                },
+                256);
+            for (std::size_t t = 0; t < moved.size(); t++) {
+                stats.distances += evaluated[t];
+                stats.reassigned += moved[t].size() / 2;
+            }
+
+            if (first) {
+                // blocked reduction of the cluster sums
+                std::vector<vec<double, n>> block_sums(blocks * k);
+                std::vector<std::size_t> block_sizes(blocks * k, 0);
+                parallel_for(
+                    0, blocks,
+                    [&](std::size_t b) {
+                        vec<double, n>* sum = &block_sums[b * k];
+                        std::size_t* size = &block_sizes[b * k];
+                        std::size_t lo = b * detail::kmeans_block;
+                        std::size_t hi =
+                            std::min(count, lo + detail::kmeans_block);
+                        for (std::size_t i = lo; i < hi; i++) {
+                            std::uint32_t c = m_labels[i];
+                            sum[c] = sum[c] + vec<double, n>(points[i]);
+                            size[c]++;
+                        }
+                    },
+                    1);
+                for (std::size_t b = 0; b < blocks; b++) {
+                    for (std::size_t c = 0; c < k; c++) {
+                        sums[c] = sums[c] + block_sums[b * k + c];
+                        sizes[c] += block_sizes[b * k + c];
+                    }
+                }
+            } else {
+                // thread ranges are in index order, so this is too
+                for (std::size_t t = 0; t < moved.size(); t++) {
+                    for (std::size_t m = 0; m < moved[t].size(); m += 2) {
+                        std::uint32_t i = moved[t][m], from = moved[t][m + 1];
+                        vec<double, n> p(points[i]);
+                        sums[from] = sums[from] - p;
+                        sizes[from]--;
+                        sums[m_labels[i]] = sums[m_labels[i]] + p;
+                        sizes[m_labels[i]]++;
+                    }
+                }
+            }
+
+            std::size_t far = 0;
+            for (std::size_t c = 0; c < k; c++) {
+                shift[c] = 0;
+                if (sizes[c] > 0) {
+                    point mean(sums[c] / (double)sizes[c]);
+                    shift[c] = std::sqrt(
+                        detail::kmeans_distance2(mean, m_centroids[c]));
+                    m_centroids[c] = mean;
+                }
+                far = shift[c] > shift[far] ? c : far;
+            }
+            T runner_up = 0;
+            for (std::size_t c = 0; c < k; c++) {
+                if (c != far)
+                    runner_up = std::max(runner_up, shift[c]);
+            }
+            parallel_for(
+                0, count,
+                [&](std::size_t i) {
+                    upper[i] += shift[m_labels[i]];
+                    lower[i] -= m_labels[i] == far ? runner_up : shift[far];
+                },
+                4096);
+            stats.max_shift = shift[far];
+            stats.seconds = seconds_since(start);
+            m_stats.iterations.push_back(stats);
+            if (shift[far] <= tolerance) {
+                m_stats.converged = true;
+                break;
+            }
+        }
+
+        std::vector<double> block_error(blocks);
+        parallel_for(
+            0, blocks,
+            [&](std::size_t b) {
+                std::size_t lo = b * detail::kmeans_block;
+                std::size_t hi = std::min(count, lo + detail::kmeans_block);
+                double sum = 0;
+                for (std::size_t i = lo; i < hi; i++) {
+                    sum += detail::kmeans_distance2(points[i],
+                                                    m_centroids[m_labels[i]]);
+                }
+                block_error[b] = sum;
+            },
+            1);
+        for (std::size_t b = 0; b < blocks; b++) {
+            m_stats.inertia += block_error[b];
+        }
+        return m_stats.converged;
+    }
+
+    /**
+     * @brief Returns the centroid nearest to a point.
+     *
+     * @param p The point.
+     * @return std::uint32_t The cluster of p.
+     */
+    std::uint32_t nearest(const point& p) const {
+        std::uint32_t label = 0;
+        T best = std::numeric_limits<T>::max();
+        for (std::size_t j = 0; j < m_centroids.size(); j++) {
+            T d2 = detail::kmeans_distance2(p, m_centroids[j]);
+            if (d2 < best) {
+                best = d2;
+                label = (std::uint32_t)j;
+            }
+        }
+        return label;
+    }
+
+    /**
+     * @brief Returns the cluster centroids.
+     *
+     * @return const std::vector<vec<T, n>>& k centroids.
+     */
+    const std::vector<point>& centroids() const { return m_centroids; }
+
+    /**
+     * @brief Returns the cluster of every point.
+     *
+     * @return const std::vector<std::uint32_t>& The cluster of each point
+     * given to fit.
+     */
+    const std::vector<std::uint32_t>& labels() const { return m_labels; }
+
+    /**
+     * @brief Returns the statistics of the last fit.
+     *
+     * @return const kmeans_stats& Per-iteration timing and convergence.
+     */
+    const kmeans_stats& stats() const { return m_stats; }
+};
+
+} // namespace HQ
+
+#endif // _HQKMEANS_HPP_
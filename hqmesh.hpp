@@ -0,0 +1,426 @@
+/**
+ * @file hqmesh.hpp
+ * @brief This file defines periodic 3D grids and nearest-grid-point,
+ * cloud-in-cell and triangular-shaped-cloud deposit and gather kernels for
+ * particle-mesh methods.
+ */
+
+#ifndef _HQMESH_HPP_
+#define _HQMESH_HPP_
+
+#include "hqalloc.hpp"
+#include "hqparallel.hpp"
+#include "hqperiodic.hpp"
+#include "hqradix.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief Shapes of the cloud a particle spreads over grid cells.
+ */
+enum class mass_assignment {
+    ngp, ///< Nearest grid point: the containing cell (1 cell per axis).
+    cic, ///< Cloud in cell: linear weights (2 cells per axis).
+    tsc  ///< Triangular-shaped cloud: quadratic weights (3 cells per axis).
+};
+
+/**
+ * @brief A periodic 3D grid of scalars over the box [0, box).
+ *
+ * Cell (x, y, z) covers [x, x + 1) * box.x / nx along x (likewise y and z)
+ * and is stored at index (z * ny + y) * nx + x.
+ *
+ * @tparam T The scalar type.
+ */
+template <typename T> class mesh {
+    int m_dims[3];
+    vec3<T> m_box;
+    vec3<T> m_scale;
+    vec3<T> m_inverse_dims;
+    std::vector<T> m_data;
+
+  public:
+    /**
+     * @brief Constructs an empty grid.
+     */
+    mesh() : m_box(0, 0, 0), m_scale(0, 0, 0), m_inverse_dims(0, 0, 0) {
+        m_dims[0] = m_dims[1] = m_dims[2] = 0;
+    }
+
+    /**
+     * @brief Constructs a zeroed grid.
+     *
+     * @param nx, ny, nz The number of cells along each axis.
+     * @param box The periodic box edge lengths.
+     */
+    mesh(int nx, int ny, int nz, const vec3<T>& box)
+        : m_box(box), m_scale(nx / box.x, ny / box.y, nz / box.z),
+          m_inverse_dims((T)1 / nx, (T)1 / ny, (T)1 / nz),
+          m_data((std::size_t)nx * ny * nz, (T)0) {
+        m_dims[0] = nx;
+        m_dims[1] = ny;
+        m_dims[2] = nz;
+    }
+
+    /**
+     * @brief Returns the number of cells along an axis.
+     *
+     * @param k The axis.
+     * @return int The cell count.
+     */
+    int dim(int k) const { return m_dims[k]; }
+
+    /**
+     * @brief Returns the periodic box.
+     *
+     * @return const vec3<T>& The box edge lengths.
+     */
+    const vec3<T>& box() const { return m_box; }
+
+    /**
+     * @brief Returns the edge lengths of a cell.
+     *
+     * @return vec3<T> box / dims.
+     */
+    vec3<T> cell_size() const {
+        return vec3<T>(m_box.x / m_dims[0], m_box.y / m_dims[1],
+                       m_box.z / m_dims[2]);
+    }
+
+    /**
+     * @brief Maps a position to continuous cell coordinates, wrapped into
+     * the box.
+     *
+     * Branch free; cell (x, y, z) spans [x, x + 1) and its centre is at
+     * x + 1/2.
+     *
+     * @param p The position.
+     * @return vec3<T> Coordinates in [0, dims] (dims only through
+     * rounding).
+     */
+    vec3<T> cell_coordinates(const vec3<T>& p) const {
+        vec3<T> u;
+        for (int k = 0; k < 3; k++) {
+            T n = (T)m_dims[k];
+            u[k] = p[k] * m_scale[k];
+            u[k] -= n * detail::floor_nearest(u[k] * m_inverse_dims[k]);
+            u[k] -= n * (T)(u[k] >= n);
+        }
+        return u;
+    }
+
+    /**
+     * @brief Returns the number of cells.
+     *
+     * @return std::size_t nx * ny * nz.
+     */
+    std::size_t size() const { return m_data.size(); }
+
+    /**
+     * @brief Returns the cell values.
+     *
+     * @return T* size() values, x fastest.
+     */
+    T* data() { return m_data.data(); }
+
+    /**
+     * @brief Returns the cell values.
+     *
+     * @return const T* size() values, x fastest.
+     */
+    const T* data() const { return m_data.data(); }
+
+    /**
+     * @brief Returns the storage index of a cell.
+     *
+     * @return std::size_t (z * ny + y) * nx + x.
+     */
+    std::size_t index(int x, int y, int z) const {
+        return ((std::size_t)z * m_dims[1] + y) * m_dims[0] + x;
+    }
+
+    /**
+     * @brief Returns a cell value.
+     *
+     * @return T& The value of cell (x, y, z).
+     */
+    T& operator()(int x, int y, int z) { return m_data[index(x, y, z)]; }
+
+    /**
+     * @brief Returns a cell value.
+     *
+     * @return const T& The value of cell (x, y, z).
+     */
+    const T& operator()(int x, int y, int z) const {
+        return m_data[index(x, y, z)];
+    }
+
+    /**
+     * @brief Sets every cell to a value, across threads.
+     *
+     * @param value The value.
+     */
+    void fill(T value) {
+        T* data = m_data.data();
+        parallel_for_ranges(
+            0, m_data.size(),
+            [=](std::size_t lo, std::size_t hi, unsigned) {
+                std::fill(data + lo, data + hi, value);
+            },
+            1 << 16);
+    }
+};
+
+namespace detail {
+
+/**
+ * @brief Returns the number of cells per axis a scheme spreads over.
+ */
+inline int assignment_support(mass_assignment scheme) {
+    return scheme == mass_assignment::ngp
+               ? 1
+               : (scheme == mass_assignment::cic ? 2 : 3);
+}
+
+/**
+ * @brief Fills the weights of a cloud along one axis, from the cell
+ * coordinate u, and returns the first cell it covers (before wrapping).
+ */
+template <typename T>
+inline int cloud_axis(mass_assignment scheme, T u, T* w) {
+    if (scheme == mass_assignment::ngp) {
+        w[0] = 1;
+        return (int)floor_nearest(u);
+    }
+    if (scheme == mass_assignment::cic) {
+        T s = u - (T)0.5;
+        T f = floor_nearest(s);
+        w[1] = s - f;
+        w[0] = 1 - w[1];
+        return (int)f;
+    }
+    T f = floor_nearest(u);
+    T d = u - f - (T)0.5;
+    w[0] = (T)0.5 * ((T)0.5 - d) * ((T)0.5 - d);
+    w[1] = (T)0.75 - d * d;
+    w[2] = (T)0.5 * ((T)0.5 + d) * ((T)0.5 + d);
+    return (int)f - 1;
+}
+
+/**
+ * @brief Wraps a cell index in [-n, 3n) into [0, n).
+ */
+inline int wrap_cell(int i, int n) {
+    i += (i < 0) ? n : 0;
+    while (i >= n) {
+        i -= n;
+    }
+    return i;
+}
+
+/**
+ * @brief The cells and weights of one particle's cloud, indices wrapped
+ * into the grid.
+ */
+template <typename T> struct cloud {
+    int support;
+    int cells[3][3];
+    T weights[3][3];
+
+    // from cell coordinates (see mesh::cell_coordinates)
+    cloud(const mesh<T>& grid, mass_assignment scheme, const vec3<T>& cell) {
+        support = assignment_support(scheme);
+        for (int k = 0; k < 3; k++) {
+            int first = cloud_axis(scheme, cell[k], weights[k]);
+            for (int c = 0; c < support; c++) {
+                cells[k][c] = wrap_cell(first + c, grid.dim(k));
+            }
+        }
+    }
+};
+
+/**
+ * @brief A particle's cell coordinates and mass, as bucketed into slabs.
+ */
+template <typename T> struct mesh_particle {
+    vec3<T> cell;
+    T mass;
+};
+
+/**
+ * @brief Adds one particle's mass to the grid.
+ */
+template <typename T>
+inline void deposit_one(mesh<T>& grid, const cloud<T>& c, T mass) {
+    T* data = grid.data();
+    for (int z = 0; z < c.support; z++) {
+        for (int y = 0; y < c.support; y++) {
+            T wyz = mass * c.weights[2][z] * c.weights[1][y];
+            std::size_t row = grid.index(0, c.cells[1][y], c.cells[2][z]);
+            for (int x = 0; x < c.support; x++) {
+                data[row + c.cells[0][x]] += wyz * c.weights[0][x];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Returns the weighted sum of grid values over one particle's cloud.
+ */
+template <typename T>
+inline T gather_one(const mesh<T>& grid, const cloud<T>& c) {
+    const T* data = grid.data();
+    T sum = 0;
+    for (int z = 0; z < c.support; z++) {
+        for (int y = 0; y < c.support; y++) {
+            T wyz = c.weights[2][z] * c.weights[1][y];
+            std::size_t row = grid.index(0, c.cells[1][y], c.cells[2][z]);
+            T line = 0;
+            for (int x = 0; x < c.support; x++) {
+                line += c.weights[0][x] * data[row + c.cells[0][x]];
+            }
+            sum += wyz * line;
+        }
+    }
+    return sum;
+}
+
+} // namespace detail
+
+/**
+ * @brief Adds particle masses to a periodic grid, across threads.
+ *
+ * Positions are wrapped into the box. The grid receives mass per cell;
+ * divide by the cell volume for a density.
+ *
+ * Writes never race and need no atomics or private grid copies: the grid
+ * is cut into an even number of z slabs at least as thick as a cloud's
+ * reach beyond its first plane, and particles (cell coordinates and mass)
+ * are radix sorted by the slab of their first plane, so each particle
+ * writes only its own slab and the next. All even slabs are then deposited
+ * in parallel, followed by all odd ones. Within a slab particles keep
+ * their order, so the result does not depend on the thread count, and
+ * each slab's writes stay within a few planes of the grid. Grids too thin
+ * for two slabs are deposited serially.
+ *
+ * @tparam T The scalar type.
+ * @param grid The grid, added to.
+ * @param positions The particle positions.
+ * @param masses The particle masses.
+ * @param count The number of particles.
+ * @param scheme The cloud shape.
+ */
+template <typename T>
+void deposit(mesh<T>& grid, const vec3<T>* positions, const T* masses,
+             std::size_t count, mass_assignment scheme) {
+    int nz = grid.dim(2);
+    int thickness = std::max(1, detail::assignment_support(scheme) - 1);
+    int slabs = nz / thickness;
+    slabs -= slabs % 2;
+    if (slabs < 2) {
+        for (std::size_t i = 0; i < count; i++) {
+            detail::cloud<T> c(grid, scheme,
+                               grid.cell_coordinates(positions[i]));
+            detail::deposit_one(grid, c, masses[i]);
+        }
+        return;
+    }
+    detail::kernel_scratch<std::uint32_t> slab(count);
+    detail::kernel_scratch<detail::mesh_particle<T>> sorted(count);
+    parallel_for(
+        0, count,
+        [&](std::size_t i) {
+            vec3<T> u = grid.cell_coordinates(positions[i]);
+            T w[3];
+            int first = detail::wrap_cell(
+                detail::cloud_axis(scheme, u.z, w), nz);
+            slab[i] = (std::uint32_t)std::min(first / thickness, slabs - 1);
+            sorted[i].cell = u;
+            sorted[i].mass = masses[i];
+        },
+        4096);
+    radix_sort(slab.data(), sorted.data(), count);
+    detail::kernel_scratch<std::size_t> start(slabs + 1);
+    for (int s = 0; s <= slabs; s++) {
+        start[s] = std::lower_bound(slab.data(), slab.data() + count,
+                                    (std::uint32_t)s) -
+                   slab.data();
+    }
+    for (int colour = 0; colour < 2; colour++) {
+        parallel_for(
+            0, slabs / 2,
+            [&](std::size_t h) {
+                int s = 2 * (int)h + colour;
+                for (std::size_t k = start[s]; k < start[s + 1]; k++) {
+                    detail::deposit_one(
+                        grid, detail::cloud<T>(grid, scheme, sorted[k].cell),
+                        sorted[k].mass);
+                }
+            },
+            1);
+    }
+}
+
+/**
+ * @brief Interpolates a periodic grid at particle positions, across
+ * threads.
+ *
+ * Using the scheme that deposited the sources makes the particle-mesh
+ * force momentum conserving (no self-force).
+ *
+ * @tparam T The scalar type.
+ * @param grid The grid.
+ * @param positions The particle positions.
+ * @param count The number of particles.
+ * @param scheme The cloud shape.
+ * @param out count interpolated values.
+ */
+template <typename T>
+void gather(const mesh<T>& grid, const vec3<T>* positions, std::size_t count,
+            mass_assignment scheme, T* out) {
+    parallel_for(
+        0, count,
+        [&](std::size_t i) {
+            detail::cloud<T> c(grid, scheme,
+                               grid.cell_coordinates(positions[i]));
+            out[i] = detail::gather_one(grid, c);
+        },
+        1024);
+}
+
+/**
+ * @brief Interpolates a vector field held as three periodic grids (e.g.
+ * the mesh force) at particle positions, across threads.
+ *
+ * @tparam T The scalar type.
+ * @param gx, gy, gz The component grids, of identical shape and box.
+ * @param positions The particle positions.
+ * @param count The number of particles.
+ * @param scheme The cloud shape.
+ * @param out count interpolated vectors.
+ */
+template <typename T>
+void gather(const mesh<T>& gx, const mesh<T>& gy, const mesh<T>& gz,
+            const vec3<T>* positions, std::size_t count,
+            mass_assignment scheme, vec3<T>* out) {
+    assert(gx.size() == gy.size() && gx.size() == gz.size());
+    parallel_for(
+        0, count,
+        [&](std::size_t i) {
+            detail::cloud<T> c(gx, scheme, gx.cell_coordinates(positions[i]));
+            out[i] = vec3<T>(detail::gather_one(gx, c),
+                             detail::gather_one(gy, c),
+                             detail::gather_one(gz, c));
+        },
+        1024);
+}
+
+} // namespace HQ
+
+#endif // _HQMESH_HPP_
@@ -0,0 +1,216 @@
+/**
+ * @file hqnbody.hpp
+ * @brief This file defines a tiled all-pairs gravity/Coulomb kernel over
+ * structure-of-arrays particles.
+ */
+
+#ifndef _HQNBODY_HPP_
+#define _HQNBODY_HPP_
+
+#include "hqalloc.hpp"
+#include "hqparallel.hpp"
+#include "hqsimd.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace HQ {
+
+namespace detail {
+
+/** @brief Sources per cache tile of the all-pairs kernel (16 KB of float
+ * positions and strengths, 32 KB of double). */
+static const std::size_t nbody_tile = 1024;
+
+/**
+ * @brief Adds the softened pull of one source (broadcast in every lane) on
+ * a register of targets; coincident pairs contribute nothing.
+ */
+template <typename S>
+inline void interact(typename S::type sx, typename S::type sy,
+                     typename S::type sz, typename S::type sm,
+                     typename S::type tx, typename S::type ty,
+                     typename S::type tz, typename S::type e2,
+                     typename S::type& ax, typename S::type& ay,
+                     typename S::type& az) {
+    typename S::type dx = S::sub(sx, tx);
+    typename S::type dy = S::sub(sy, ty);
+    typename S::type dz = S::sub(sz, tz);
+    typename S::type r2 =
+        S::add(S::mul(dx, dx), S::add(S::mul(dy, dy), S::mul(dz, dz)));
+    typename S::type inv = S::rsqrt(S::add(r2, e2));
+    typename S::type w =
+        S::positive_or_zero(r2, S::mul(sm, S::mul(inv, S::mul(inv, inv))));
+    ax = S::add(ax, S::mul(w, dx));
+    ay = S::add(ay, S::mul(w, dy));
+    az = S::add(az, S::mul(w, dz));
+}
+
+/**
+ * @brief Adds the softened pull of sources [begin, end) (SoA) on one
+ * target, SIMD across sources; sources at the target's exact position are
+ * skipped.
+ */
+template <typename T>
+void direct_sum(const T* x, const T* y, const T* z, const T* m,
+                std::size_t begin, std::size_t end, const vec3<T>& p,
+                T eps2, vec3<T>& acc) {
+    typedef simd<T> S;
+    typename S::type px = S::set1(p.x), py = S::set1(p.y), pz = S::set1(p.z);
+    typename S::type e2 = S::set1(eps2);
+    typename S::type ax = S::zero(), ay = S::zero(), az = S::zero();
+    std::size_t j = begin;
+    for (; j + S::width <= end; j += S::width) {
+        interact<S>(S::load(x + j), S::load(y + j), S::load(z + j),
+                    S::load(m + j), px, py, pz, e2, ax, ay, az);
+    }
+    vec3<T> sum(S::sum(ax), S::sum(ay), S::sum(az));
+    for (; j < end; j++) {
+        vec3<T> d(x[j] - p.x, y[j] - p.y, z[j] - p.z);
+        T r2 = d.length2();
+        if (r2 > 0) {
+            T inv = 1 / std::sqrt(r2 + eps2);
+            sum = sum + d * (m[j] * inv * inv * inv);
+        }
+    }
+    acc = acc + sum;
+}
+
+/**
+ * @brief Adds the softened pull of sources [begin, end) on `targets`
+ * consecutive targets, into (ax, ay, az).
+ *
+ * Targets are register-blocked two SIMD registers at a time, so each
+ * source is loaded (broadcast) once per 2 * width targets; targets left
+ * over are summed one at a time with direct_sum.
+ */
+template <typename T>
+void accumulate_direct(const T* tx, const T* ty, const T* tz,
+                       std::size_t targets, const T* x, const T* y,
+                       const T* z, const T* m, std::size_t begin,
+                       std::size_t end, T eps2, T* ax, T* ay, T* az) {
+    typedef simd<T> S;
+    typedef typename S::type V;
+    const std::size_t w = S::width;
+    V e2 = S::set1(eps2);
+    std::size_t i = 0;
+    for (; i + 2 * w <= targets; i += 2 * w) {
+        V x0 = S::load(tx + i), y0 = S::load(ty + i), z0 = S::load(tz + i);
+        V x1 = S::load(tx + i + w), y1 = S::load(ty + i + w);
+        V z1 = S::load(tz + i + w);
+        V ax0 = S::zero(), ay0 = S::zero(), az0 = S::zero();
+        V ax1 = S::zero(), ay1 = S::zero(), az1 = S::zero();
+        for (std::size_t j = begin; j < end; j++) {
+            V sx = S::set1(x[j]), sy = S::set1(y[j]), sz = S::set1(z[j]);
+            V sm = S::set1(m[j]);
+            interact<S>(sx, sy, sz, sm, x0, y0, z0, e2, ax0, ay0, az0);
+            interact<S>(sx, sy, sz, sm, x1, y1, z1, e2, ax1, ay1, az1);
+        }
+        S::store(ax + i, S::add(S::load(ax + i), ax0));
+        S::store(ay + i, S::add(S::load(ay + i), ay0));
+        S::store(az + i, S::add(S::load(az + i), az0));
+        S::store(ax + i + w, S::add(S::load(ax + i + w), ax1));
+        S::store(ay + i + w, S::add(S::load(ay + i + w), ay1));
+        S::store(az + i + w, S::add(S::load(az + i + w), az1));
+    }
+    for (; i < targets; i++) {
+        vec3<T> a(0, 0, 0);
+        direct_sum(x, y, z, m, begin, end, vec3<T>(tx[i], ty[i], tz[i]),
+                   eps2, a);
+        ax[i] += a.x;
+        ay[i] += a.y;
+        az[i] += a.z;
+    }
+}
+
+} // namespace detail
+
+/**
+ * @brief Computes softened all-pairs accelerations of structure-of-arrays
+ * particles, across threads.
+ *
+ * a_i = coupling * sum over j != i of s_j (p_j - p_i) / (|p_j - p_i|^2 +
+ * softening^2)^(3/2), where s_j is the strength of particle j. With masses
+ * as strengths and coupling G this is gravity; with charges and coupling
+ * -k it is the electric field (the force on i being q_i times it). Pairs
+ * at the same position contribute nothing.
+ *
+ * Targets are split into ranges across threads; each range walks the
+ * sources one cache tile (detail::nbody_tile) at a time, and every tile is
+ * swept by blocks of targets held in SIMD registers. 1 / r^3 uses the
+ * refined reciprocal square root estimate for float (see detail::simd).
+ *
+ * @tparam T The scalar type (float or double).
+ * @param x, y, z The particle positions.
+ * @param strength The particle masses or charges.
+ * @param count The number of particles.
+ * @param ax, ay, az The accelerations (overwritten).
+ * @param softening Plummer softening length.
+ * @param coupling The coupling constant.
+ */
+template <typename T>
+void direct_accelerations(const T* x, const T* y, const T* z,
+                          const T* strength, std::size_t count, T* ax,
+                          T* ay, T* az, T softening = 0, T coupling = 1) {
+    T eps2 = softening * softening;
+    parallel_for_ranges(
+        0, count,
+        [&](std::size_t lo, std::size_t hi, unsigned) {
+            std::fill(ax + lo, ax + hi, (T)0);
+            std::fill(ay + lo, ay + hi, (T)0);
+            std::fill(az + lo, az + hi, (T)0);
+            for (std::size_t t = 0; t < count; t += detail::nbody_tile) {
+                std::size_t tile_end = std::min(count, t + detail::nbody_tile);
+                detail::accumulate_direct(x + lo, y + lo, z + lo, hi - lo, x,
+                                          y, z, strength, t, tile_end, eps2,
+                                          ax + lo, ay + lo, az + lo);
+            }
+            for (std::size_t i = lo; i < hi; i++) {
+                ax[i] *= coupling;
+                ay[i] *= coupling;
+                az[i] *= coupling;
+            }
+        },
+        64);
+}
+
+/**
+ * @brief Computes softened all-pairs accelerations of vec3 particles,
+ * across threads (see the structure-of-arrays overload).
+ *
+ * @tparam T The scalar type (float or double).
+ * @param positions The particle positions.
+ * @param strength The particle masses or charges.
+ * @param count The number of particles.
+ * @param out The accelerations (overwritten).
+ * @param softening Plummer softening length.
+ * @param coupling The coupling constant.
+ */
+template <typename T>
+void direct_accelerations(const vec3<T>* positions, const T* strength,
+                          std::size_t count, vec3<T>* out, T softening = 0,
+                          T coupling = 1) {
+    detail::kernel_scratch<T> soa(6 * count);
+    T* x = soa.data();
+    T *y = x + count, *z = y + count;
+    T *ax = z + count, *ay = ax + count, *az = ay + count;
+    parallel_for(
+        0, count,
+        [&](std::size_t i) {
+            x[i] = positions[i].x;
+            y[i] = positions[i].y;
+            z[i] = positions[i].z;
+        },
+        4096);
+    direct_accelerations(x, y, z, strength, count, ax, ay, az, softening,
+                         coupling);
+    parallel_for(
+        0, count, [&](std::size_t i) { out[i] = vec3<T>(ax[i], ay[i], az[i]); },
+        4096);
+}
+
+} // namespace HQ
+
+#endif // _HQNBODY_HPP_
@@ -0,0 +1,248 @@
+/**
+ * @file hqnuma.hpp
+ * @brief This file defines NUMA-aware allocation and first-touch
+ * initialisation for vec arrays, using raw syscalls (no libnuma).
+ */
+
+#ifndef _HQNUMA_HPP_
+#define _HQNUMA_HPP_
+
+#include "hqalloc.hpp"
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace HQ {
+
+/**
+ * @brief Where the pages of an allocation should live.
+ */
+enum class numa_policy {
+    /** @brief The node of the thread that first writes each page. */
+    first_touch,
+    /** @brief Round-robin over every online node. */
+    interleave,
+    /** @brief A single chosen node. */
+    bind
+};
+
+namespace detail {
+
+/** @brief Kernel memory policy modes (see mbind(2)). */
+static const int mpol_bind = 2;
+static const int mpol_interleave = 3;
+
+/** @brief Largest node count handled by the node masks below. */
+static const int max_numa_nodes = 256;
+
+} // namespace detail
+
+/**
+ * @brief Returns the number of online NUMA nodes.
+ *
+ * @return int The highest online node id plus one (1 if unknown).
+ */
+static inline int numa_node_count() {
+    static int count = 0;
+    if (count)
+        return count;
+    count = 1;
+#if defined(__linux__)
+    FILE* f = std::fopen("/sys/devices/system/node/online", "r");
+    if (f) {
+        // a list like "0-1" or "0,2-3"; the last number is the highest id
+        char buf[256] = {0};
+        if (std::fgets(buf, sizeof(buf), f)) {
+            int highest = 0;
+            int value = 0;
+            bool in_number = false;
+            for (char* p = buf; *p; p++) {
+                if ((*p >= '0') && (*p <= '9')) {
+                    value = (in_number ? value * 10 : 0) + (*p - '0');
+                    in_number = true;
+                } else {
+                    if (in_number && (value > highest))
+                        highest = value;
+                    in_number = false;
+                }
+            }
+            if (in_number && (value > highest))
+                highest = value;
+            count = highest + 1 < detail::max_numa_nodes
+                        ? highest + 1
+                        : detail::max_numa_nodes;
+        }
+        std::fclose(f);
+    }
+#endif
+    return count;
+}
+
+/**
+ * @brief Applies a memory policy to a page-aligned range.
+ *
+ * Best effort: returns false (and leaves the default first-touch policy) if
+ * the kernel refuses, e.g. inside containers without the capability.
+ *
+ * @param addr Start of the range (page aligned).
+ * @param bytes Length of the range.
+ * @param policy The policy.
+ * @param node Target node for numa_policy::bind.
+ * @return bool True if the policy was applied.
+ */
+static inline bool numa_apply_policy(void* addr, std::size_t bytes,
+                                     numa_policy policy, int node = 0) {
+#if defined(__linux__) && defined(SYS_mbind)
+    if (policy == numa_policy::first_touch)
+        return true;
+    const int bits = 8 * sizeof(unsigned long);
+    unsigned long mask[detail::max_numa_nodes / bits] = {0};
+    int mode;
+    if (policy == numa_policy::interleave) {
+        for (int i = 0; i < numa_node_count(); i++) {
+            mask[i / bits] |= 1ul << (i % bits);
+        }
+        mode = detail::mpol_interleave;
+    } else {
+        if ((node < 0) || (node >= numa_node_count()))
+            return false;
+        mask[node / bits] |= 1ul << (node % bits);
+        mode = detail::mpol_bind;
+    }
+    return syscall(SYS_mbind, addr, bytes, mode, mask,
+                   (unsigned long)detail::max_numa_nodes + 1, 0) == 0;
+#else
+    (void)addr;
+    (void)bytes;
+    (void)node;
+    return policy == numa_policy::first_touch;
+#endif
+}
+
+/**
+ * @brief A standard allocator placing pages according to a NUMA policy.
+ *
+ * Memory comes from anonymous mmap, so no page is placed until it is
+ * touched (first_touch) or the kernel applies the interleave/bind policy on
+ * fault. Combine first_touch with vec_array, whose large allocations are
+ * zeroed by parallel_for_ranges over the same static partitions the batch
+ * kernels use, and with set_pin_threads(true) so each partition stays on
+ * one node.
+ *
+ * @tparam T The allocated type.
+ */
+template <typename T> class numa_allocator {
+  private:
+    numa_policy m_policy;
+    int m_node;
+
+    static std::size_t round_to_pages(std::size_t bytes) {
+        std::size_t page = 4096;
+#if defined(__linux__)
+        page = (std::size_t)sysconf(_SC_PAGESIZE);
+#endif
+        return (bytes + page - 1) / page * page;
+    }
+
+  public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U> struct rebind {
+        typedef numa_allocator<U> other;
+    };
+
+    /**
+     * @brief Constructs an allocator.
+     *
+     * @param policy The placement policy.
+     * @param node Target node for numa_policy::bind.
+     */
+    numa_allocator(numa_policy policy = numa_policy::first_touch, int node = 0)
+        : m_policy(policy), m_node(node) {}
+
+    template <typename U>
+    numa_allocator(const numa_allocator<U>& other)
+        : m_policy(other.policy()), m_node(other.node()) {}
+
+    numa_policy policy() const { return m_policy; }
+    int node() const { return m_node; }
+
+    T* allocate(std::size_t count) {
+#if defined(__linux__)
+        std::size_t bytes = round_to_pages(count * sizeof(T));
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        numa_apply_policy(p, bytes, m_policy, m_node);
+        return (T*)p;
+#else
+        return (T*)detail::aligned_alloc_bytes(count * sizeof(T),
+                                               cache_line_size,
+                                               page_policy::normal);
+#endif
+    }
+
+    void deallocate(T* p, std::size_t count) {
+#if defined(__linux__)
+        munmap(p, round_to_pages(count * sizeof(T)));
+#else
+        detail::aligned_free_bytes(p, count * sizeof(T), page_policy::normal);
+#endif
+    }
+
+    template <typename U>
+    bool operator==(const numa_allocator<U>& other) const {
+        return (m_policy == other.policy()) && (m_node == other.node());
+    }
+
+    template <typename U>
+    bool operator!=(const numa_allocator<U>& other) const {
+        return !(*this == other);
+    }
+};
+
+/**
+ * @brief A vec_array whose pages are placed by a NUMA policy.
+ */
+template <typename T, std::size_t n>
+using numa_vec_array = vec_array<T, n, numa_allocator<vec<T, n>>>;
+
+/**
+ * @brief Fills an array across threads with the same static partitioning as
+ * parallel_for, so under first-touch each page lands on the node of the
+ * thread that will later process it.
+ *
+ * @param data The array (typically freshly allocated and untouched).
+ * @param count The number of vectors.
+ * @param value The fill value.
+ */
+template <typename T, std::size_t n>
+void first_touch_fill(vec<T, n>* data, std::size_t count,
+                      const vec<T, n>& value = vec<T, n>()) {
+    parallel_for_ranges(
+        0, count,
+        [=](std::size_t lo, std::size_t hi, unsigned) {
+            for (std::size_t i = lo; i < hi; i++) {
+                data[i] = value;
+            }
+        },
+        4096);
+}
+
+} // namespace HQ
+
+#endif // _HQNUMA_HPP_
@@ -0,0 +1,577 @@
+/**
+ * @file hqoctree.hpp
+ * @brief This file defines a linear (Morton-ordered) octree over vec3 point
+ * sets, with range, frustum, radius and k-nearest-neighbour queries.
+ */
+
+#ifndef _HQOCTREE_HPP_
+#define _HQOCTREE_HPP_
+
+#include "hqbounds.hpp"
+#include "hqcurve.hpp"
+#include "hqkdtree.hpp"
+#include "hqparallel.hpp"
+#include "hqradix.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief A view frustum as six inward-facing planes.
+ *
+ * A point p is inside when dot(plane.xyz, p) + plane.w >= 0 for every
+ * plane.
+ *
+ * @tparam T The scalar type.
+ */
+template <typename T> struct frustum {
+    /** @brief Left, right, bottom, top, near and far planes. */
+    vec4<T> planes[6];
+
+    /**
+     * @brief Extracts the planes of a view-projection matrix
+     * (Gribb-Hartmann).
+     *
+     * @param m A row-major 4x4 matrix mapping world points (column vectors)
+     * to clip space with OpenGL conventions (-w <= x, y, z <= w).
+     * @return frustum<T> The frustum; planes are not normalized.
+     */
+    static frustum from_matrix(const T* m) {
+        frustum out;
+        for (int i = 0; i < 3; i++) {
+            for (int s = 0; s < 2; s++) {
+                T sign = s ? (T)-1 : (T)1;
+                vec4<T>& p = out.planes[2 * i + s];
+                p.x = m[12] + sign * m[4 * i + 0];
+                p.y = m[13] + sign * m[4 * i + 1];
+                p.z = m[14] + sign * m[4 * i + 2];
+                p.w = m[15] + sign * m[4 * i + 3];
+            }
+        }
+        return out;
+    }
+
+    /**
+     * @brief Checks whether a point is inside the frustum.
+     *
+     * @param p The point.
+     * @return bool True if p is on the inner side of every plane.
+     */
+    bool contains(const vec3<T>& p) const {
+        for (int i = 0; i < 6; i++) {
+            const vec4<T>& q = planes[i];
+            if (q.x * p.x + q.y * p.y + q.z * p.z + q.w < 0)
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Classifies a box against the frustum.
+     *
+     * Conservative: a box outside the frustum but straddling the planes'
+     * extensions near a corner may be reported as intersecting.
+     *
+     * @param b The box.
+     * @return int -1 if the box is outside, 1 if it is entirely inside,
+     * 0 if it may intersect the boundary.
+     */
+    int classify(const aabb<T, 3>& b) const {
+        int out = 1;
+        for (int i = 0; i < 6; i++) {
+            const vec4<T>& q = planes[i];
+            // the corners farthest along and against the plane normal
+            T ahead = q.w, behind = q.w;
+            for (int k = 0; k < 3; k++) {
+                T lo = q[k] * b.lo[k], hi = q[k] * b.hi[k];
+                ahead += std::max(lo, hi);
+                behind += std::min(lo, hi);
+            }
+            if (ahead < 0)
+                return -1;
+            if (behind < 0)
+                out = 0;
+        }
+        return out;
+    }
+};
+
+/**
+ * @brief A node of a linear octree.
+ *
+ * @tparam T The scalar type of the points.
+ */
+template <typename T> struct octree_node {
+    /** @brief Tight bounds of the points below the node. */
+    aabb<T, 3> bounds;
+    /** @brief First point of the node in octree::sorted_points(). */
+    std::uint32_t begin;
+    /** @brief One past the last point of the node. */
+    std::uint32_t end;
+    /** @brief Index of the first child; children are contiguous. */
+    std::uint32_t first_child;
+    /** @brief Number of non-empty children (0 for a leaf). */
+    std::uint8_t child_count;
+    /** @brief Depth of the node (the root is 0). */
+    std::uint8_t level;
+
+    /**
+     * @brief Checks whether the node is a leaf.
+     *
+     * @return bool True if the node has no children.
+     */
+    bool leaf() const { return child_count == 0; }
+};
+
+/**
+ * @brief A static linear octree over a point array.
+ *
+ * Points are sorted by the Morton code of their position in the cube
+ * around their bounding box, so every node is a contiguous range of the
+ * sorted array, identified by a code prefix. A node is split into its
+ * non-empty octants while it holds more than leaf_capacity points (up to
+ * the 21 levels of the code). Nodes are stored breadth first, so each
+ * level is a contiguous run of nodes and siblings are adjacent.
+ *
+ * @tparam T The scalar type of the points.
+ */
+template <typename T> class octree {
+  public:
+    /** @brief Marks an unused result slot. */
+    static const std::uint32_t npos = 0xffffffffu;
+
+  private:
+    // enough for a depth-first walk: at most 7 pending siblings per level
+    static const int max_stack = 8 * (curve_bits3 + 1);
+
+    std::vector<vec3<T>> m_points;
+    std::vector<std::uint32_t> m_index;
+    std::vector<std::uint64_t> m_codes;
+    std::vector<octree_node<T>> m_nodes;
+    std::vector<std::uint32_t> m_levels;
+    std::size_t m_leaf_capacity;
+
+    bool splits(const octree_node<T>& node) const {
+        return (node.end - node.begin > m_leaf_capacity) &&
+               (node.level < curve_bits3);
+    }
+
+    // child ranges of a node: the octant digit rises along its range
+    int child_ranges(const octree_node<T>& node,
+                     std::uint32_t* bounds) const {
+        int shift = 3 * (curve_bits3 - 1 - node.level);
+        const std::uint64_t* codes = m_codes.data();
+        int count = 0;
+        std::uint32_t lo = node.begin;
+        while (lo < node.end) {
+            std::uint64_t digit = (codes[lo] >> shift) & 7;
+            std::uint32_t hi = (std::uint32_t)(
+                std::upper_bound(codes + lo, codes + node.end, digit,
+                                 [shift](std::uint64_t d, std::uint64_t c) {
+                                     return d < ((c >> shift) & 7);
+                                 }) -
+                codes);
+            bounds[count++] = lo;
+            lo = hi;
+        }
+        bounds[count] = node.end;
+        return count;
+    }
+
+    void append_range(const octree_node<T>& node,
+                      std::vector<std::uint32_t>& out) const {
+        out.insert(out.end(), m_index.begin() + node.begin,
+                   m_index.begin() + node.end);
+    }
+
+    void offer(const vec3<T>& q, std::uint32_t i, std::size_t k,
+               neighbor<T>* best, std::size_t& found) const {
+        neighbor<T> c = {m_index[i], m_points[i].distance2(q)};
+        if (found < k) {
+            best[found++] = c;
+            std::push_heap(best, best + found, detail::neighbor_less<T>);
+        } else if (detail::neighbor_less(c, best[0])) {
+            std::pop_heap(best, best + k, detail::neighbor_less<T>);
+            best[k - 1] = c;
+            std::push_heap(best, best + k, detail::neighbor_less<T>);
+        }
+    }
+
+  public:
+    /**
+     * @brief Constructs an empty octree.
+     */
+    octree() : m_levels(1, 0), m_leaf_capacity(16) {}
+
+    /**
+     * @brief Builds an octree over a copy of the points.
+     *
+     * @param points The points.
+     * @param count The number of points (less than 2^32 - 1).
+     * @param leaf_capacity Largest number of points in a leaf (above the
+     * deepest level).
+     */
+    octree(const vec3<T>* points, std::size_t count,
+           std::size_t leaf_capacity = 16)
+        : m_levels(1, 0), m_leaf_capacity(16) {
+        build(points, count, leaf_capacity);
+    }
+
+    /**
+     * @brief Rebuilds the octree over a copy of the points.
+     *
+     * Codes are computed and radix sorted across threads. Levels are then
+     * generated one at a time, splitting all nodes of a level in parallel,
+     * and bounds are filled bottom up, one level at a time, also in
+     * parallel.
+     *
+     * @param points The points.
+     * @param count The number of points (less than 2^32 - 1).
+     * @param leaf_capacity Largest number of points in a leaf (above the
+     * deepest level).
+     */
+    void build(const vec3<T>* points, std::size_t count,
+               std::size_t leaf_capacity = 16) {
+        m_leaf_capacity = leaf_capacity ? leaf_capacity : 1;
+        m_nodes.clear();
+        m_levels.assign(1, 0);
+        m_codes.resize(count);
+        m_points.resize(count);
+        m_index.resize(count);
+        if (!count)
+            return;
+
+        // quantize within the cube around the points, so octants are cubes
+        aabb<T, 3> box = bounding_box(points, count);
+        vec3<T> extent = box.extent();
+        T side = std::max(extent.x, std::max(extent.y, extent.z));
+        box.hi = box.lo + vec3<T>(side, side, side);
+        morton_encode(points, count, box, m_codes.data());
+        parallel_for(0, count,
+                     [&](std::size_t i) { m_index[i] = (std::uint32_t)i; },
+                     4096);
+        radix_sort(m_codes.data(), m_index.data(), count);
+        parallel_for(
+            0, count, [&](std::size_t i) { m_points[i] = points[m_index[i]]; },
+            4096);
+
+        octree_node<T> root;
+        root.begin = 0;
+        root.end = (std::uint32_t)count;
+        root.first_child = 0;
+        root.child_count = 0;
+        root.level = 0;
+        m_nodes.push_back(root);
+        std::vector<std::uint32_t> splits_at;
+        std::vector<std::uint32_t> offsets;
+        for (std::size_t first = 0; first < m_nodes.size();) {
+            std::size_t last = m_nodes.size();
+            m_levels.push_back((std::uint32_t)last);
+            std::size_t width = last - first;
+            splits_at.assign(9 * width, 0);
+            offsets.assign(width + 1, 0);
+            parallel_for(
+                0, width,
+                [&](std::size_t j) {
+                    octree_node<T>& node = m_nodes[first + j];
+                    if (splits(node))
+                        node.child_count = (std::uint8_t)child_ranges(
+                            node, &splits_at[9 * j]);
+                },
+                64);
+            for (std::size_t j = 0; j < width; j++) {
+                offsets[j + 1] = offsets[j] + m_nodes[first + j].child_count;
+            }
+            m_nodes.resize(last + offsets[width]);
+            parallel_for(
+                0, width,
+                [&](std::size_t j) {
+                    octree_node<T>& node = m_nodes[first + j];
+                    node.first_child = (std::uint32_t)(last + offsets[j]);
+                    for (int c = 0; c < node.child_count; c++) {
+                        octree_node<T>& child =
+                            m_nodes[node.first_child + c];
+                        child.begin = splits_at[9 * j + c];
+                        child.end = splits_at[9 * j + c + 1];
+                        child.first_child = 0;
+                        child.child_count = 0;
+                        child.level = (std::uint8_t)(node.level + 1);
+                    }
+                },
+                64);
+            first = last;
+        }
+
+        // bounds, deepest level first
+        for (std::size_t l = m_levels.size() - 1; l-- > 0;) {
+            parallel_for(
+                m_levels[l], m_levels[l + 1],
+                [&](std::size_t i) {
+                    octree_node<T>& node = m_nodes[i];
+                    node.bounds = aabb<T, 3>();
+                    if (node.leaf()) {
+                        for (std::uint32_t p = node.begin; p < node.end; p++) {
+                            node.bounds.expand(m_points[p]);
+                        }
+                    } else {
+                        for (int c = 0; c < node.child_count; c++) {
+                            node.bounds.expand(
+                                m_nodes[node.first_child + c].bounds);
+                        }
+                    }
+                },
+                64);
+        }
+    }
+
+    /**
+     * @brief Returns the number of points in the tree.
+     *
+     * @return std::size_t The point count.
+     */
+    std::size_t size() const { return m_points.size(); }
+
+    /**
+     * @brief Returns the nodes, breadth first; node 0 is the root.
+     *
+     * @return const std::vector<octree_node<T>>& The nodes.
+     */
+    const std::vector<octree_node<T>>& nodes() const { return m_nodes; }
+
+    /**
+     * @brief Returns the number of levels.
+     *
+     * @return std::size_t One more than the deepest node level (0 if the
+     * tree is empty).
+     */
+    std::size_t depth() const { return m_levels.size() - 1; }
+
+    /**
+     * @brief Returns the first node of a level.
+     *
+     * Level l is the node range [level_begin(l), level_begin(l + 1)).
+     *
+     * @param l The level, up to depth().
+     * @return std::uint32_t The node index.
+     */
+    std::uint32_t level_begin(std::size_t l) const { return m_levels[l]; }
+
+    /**
+     * @brief Returns the points in Morton order.
+     *
+     * @return const std::vector<vec3<T>>& The sorted points.
+     */
+    const std::vector<vec3<T>>& sorted_points() const { return m_points; }
+
+    /**
+     * @brief Returns the original index of each sorted point.
+     *
+     * @return const std::vector<std::uint32_t>& The indices.
+     */
+    const std::vector<std::uint32_t>& sorted_indices() const {
+        return m_index;
+    }
+
+    /**
+     * @brief Finds every point inside a box.
+     *
+     * @param box The query box (inclusive).
+     * @param out Original indices are appended in Morton order.
+     * @return std::size_t The number of indices appended.
+     */
+    std::size_t range(const aabb<T, 3>& box,
+                      std::vector<std::uint32_t>& out) const {
+        std::size_t before = out.size();
+        if (m_nodes.empty())
+            return 0;
+        std::uint32_t stack[max_stack];
+        int top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const octree_node<T>& node = m_nodes[stack[--top]];
+            if (!box.overlaps(node.bounds))
+                continue;
+            if (box.contains(node.bounds.lo) && box.contains(node.bounds.hi)) {
+                append_range(node, out);
+            } else if (node.leaf()) {
+                for (std::uint32_t i = node.begin; i < node.end; i++) {
+                    if (box.contains(m_points[i]))
+                        out.push_back(m_index[i]);
+                }
+            } else {
+                for (int c = node.child_count; c-- > 0;) {
+                    assert(top < max_stack);
+                    stack[top++] = node.first_child + c;
+                }
+            }
+        }
+        return out.size() - before;
+    }
+
+    /**
+     * @brief Finds every point inside a view frustum.
+     *
+     * Nodes entirely inside are reported without testing their points.
+     *
+     * @param f The frustum.
+     * @param out Original indices are appended in Morton order.
+     * @return std::size_t The number of indices appended.
+     */
+    std::size_t range(const frustum<T>& f,
+                      std::vector<std::uint32_t>& out) const {
+        std::size_t before = out.size();
+        if (m_nodes.empty())
+            return 0;
+        std::uint32_t stack[max_stack];
+        int top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const octree_node<T>& node = m_nodes[stack[--top]];
+            int side = f.classify(node.bounds);
+            if (side < 0)
+                continue;
+            if (side > 0) {
+                append_range(node, out);
+            } else if (node.leaf()) {
+                for (std::uint32_t i = node.begin; i < node.end; i++) {
+                    if (f.contains(m_points[i]))
+                        out.push_back(m_index[i]);
+                }
+            } else {
+                for (int c = node.child_count; c-- > 0;) {
+                    assert(top < max_stack);
+                    stack[top++] = node.first_child + c;
+                }
+            }
+        }
+        return out.size() - before;
+    }
+
+    /**
+     * @brief Finds every point within a radius of a query.
+     *
+     * @param query The query point.
+     * @param r The search radius (inclusive).
+     * @param out Results are appended in Morton order.
+     * @return std::size_t The number of points appended.
+     */
+    std::size_t radius(const vec3<T>& query, T r,
+                       std::vector<neighbor<T>>& out) const {
+        std::size_t before = out.size();
+        if (m_nodes.empty())
+            return 0;
+        T r2 = r * r;
+        std::uint32_t stack[max_stack];
+        int top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const octree_node<T>& node = m_nodes[stack[--top]];
+            if (node.bounds.distance2(query) > r2)
+                continue;
+            if (node.leaf()) {
+                for (std::uint32_t i = node.begin; i < node.end; i++) {
+                    T d2 = m_points[i].distance2(query);
+                    if (d2 <= r2) {
+                        neighbor<T> c = {m_index[i], d2};
+                        out.push_back(c);
+                    }
+                }
+            } else {
+                for (int c = node.child_count; c-- > 0;) {
+                    assert(top < max_stack);
+                    stack[top++] = node.first_child + c;
+                }
+            }
+        }
+        return out.size() - before;
+    }
+
+    /**
+     * @brief Finds the k nearest points to a query.
+     *
+     * Depth first, visiting the children of a node nearest first and
+     * skipping nodes farther than the k-th best so far.
+     *
+     * @param query The query point.
+     * @param k The number of neighbours wanted.
+     * @param out At least k slots; filled nearest first.
+     * @return std::size_t The number found (min(k, size())).
+     */
+    std::size_t knn(const vec3<T>& query, std::size_t k,
+                    neighbor<T>* out) const {
+        std::size_t found = 0;
+        if (!k || m_nodes.empty())
+            return 0;
+        std::uint32_t stack[max_stack];
+        T gap[max_stack];
+        int top = 0;
+        stack[top] = 0;
+        gap[top++] = 0;
+        while (top) {
+            --top;
+            if ((found == k) && (gap[top] >= out[0].distance2))
+                continue;
+            const octree_node<T>& node = m_nodes[stack[top]];
+            if (node.leaf()) {
+                for (std::uint32_t i = node.begin; i < node.end; i++) {
+                    offer(query, i, k, out, found);
+                }
+                continue;
+            }
+            // push far to near, so the nearest child is popped first
+            int base = top;
+            for (int c = 0; c < node.child_count; c++) {
+                std::uint32_t child = node.first_child + c;
+                T d2 = m_nodes[child].bounds.distance2(query);
+                int j = top++;
+                assert(top <= max_stack);
+                for (; (j > base) && (gap[j - 1] < d2); j--) {
+                    stack[j] = stack[j - 1];
+                    gap[j] = gap[j - 1];
+                }
+                stack[j] = child;
+                gap[j] = d2;
+            }
+        }
+        std::sort_heap(out, out + found, detail::neighbor_less<T>);
+        return found;
+    }
+
+    /**
+     * @brief Finds the k nearest points to each of many queries, across
+     * threads.
+     *
+     * @param queries The query points.
+     * @param count The number of queries.
+     * @param k The number of neighbours per query.
+     * @param out count * k slots; row q holds the neighbours of query q,
+     * nearest first, padded with {npos, max()} if the tree has fewer than k
+     * points.
+     */
+    void knn(const vec3<T>* queries, std::size_t count, std::size_t k,
+             neighbor<T>* out) const {
+        parallel_for(
+            0, count,
+            [&](std::size_t q) {
+                neighbor<T>* row = out + q * k;
+                std::size_t found = knn(queries[q], k, row);
+                for (std::size_t j = found; j < k; j++) {
+                    row[j].index = npos;
+                    row[j].distance2 = std::numeric_limits<T>::max();
+                }
+            },
+            64);
+    }
+};
+
+template <typename T> const std::uint32_t octree<T>::npos;
+
+} // namespace HQ
+
+#endif // _HQOCTREE_HPP_
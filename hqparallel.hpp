@@ -0,0 +1,234 @@
+/**
+ * @file hqparallel.hpp
+ * @brief This file defines the static-partition parallel loops used by the
+ * batch kernels.
+ */
+
+#ifndef _HQPARALLEL_HPP_
+#define _HQPARALLEL_HPP_
+
+#include <cstddef>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace HQ {
+
+namespace detail {
+
+/**
+ * @brief Holds the thread count used by parallel_for (0 = not yet set).
+ */
+inline unsigned& thread_count_setting() {
+    static unsigned count = 0;
+    return count;
+}
+
+/**
+ * @brief Holds whether parallel_for pins partition t to a fixed CPU.
+ */
+inline bool& pin_threads_setting() {
+    static bool pin = false;
+    return pin;
+}
+
+#if defined(__linux__)
+/**
+ * @brief Returns the CPUs the process may run on, captured on first use
+ * (before any pinning narrows the calling thread's mask).
+ */
+inline const std::vector<int>& allowed_cpus() {
+    // a function-local static is initialised exactly once, even when
+    // several threads get here first at the same time
+    static const std::vector<int> cpus = [] {
+        std::vector<int> out;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int c = 0; c < CPU_SETSIZE; c++) {
+                if (CPU_ISSET(c, &set))
+                    out.push_back(c);
+            }
+        }
+        return out;
+    }();
+    return cpus;
+}
+#endif
+
+/**
+ * @brief Pins the calling thread to the CPU assigned to partition t.
+ */
+static inline void pin_to_partition(unsigned t) {
+#if defined(__linux__)
+    const std::vector<int>& cpus = allowed_cpus();
+    if (cpus.empty())
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[t % cpus.size()], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+#else
+    (void)t;
+#endif
+}
+
+} // namespace detail
+
+/**
+ * @brief Returns the number of threads parallel loops use.
+ *
+ * Defaults to the HQ_NUM_THREADS environment variable if set, else the
+ * hardware concurrency.
+ *
+ * @return unsigned The thread count (at least 1).
+ */
+inline unsigned num_threads() {
+    unsigned& count = detail::thread_count_setting();
+    if (count == 0) {
+        const char* env = std::getenv("HQ_NUM_THREADS");
+        int from_env = env ? std::atoi(env) : 0;
+        count = from_env > 0 ? (unsigned)from_env
+                             : std::thread::hardware_concurrency();
+        if (count == 0)
+            count = 1;
+    }
+    return count;
+}
+
+/**
+ * @brief Sets the number of threads parallel loops use.
+ *
+ * @param count The thread count; 0 restores the default.
+ */
+inline void set_num_threads(unsigned count) {
+    detail::thread_count_setting() = count;
+}
+
+/**
+ * @brief Makes parallel loops pin partition t to the t-th allowed CPU
+ * (Linux only; ignored elsewhere).
+ *
+ * With pinning, the thread that first touches a page in one loop runs on the
+ * same CPU, and so the same NUMA node, in every later loop over the same
+ * range. The calling thread is pinned too, as it runs partition 0, and is
+ * released again by set_pin_threads(false).
+ *
+ * @param pin Whether to pin.
+ */
+inline void set_pin_threads(bool pin) {
+#if defined(__linux__)
+    const std::vector<int>& cpus = detail::allowed_cpus();
+    if (!pin && detail::pin_threads_setting() && !cpus.empty()) {
+        // release the calling thread, which ran partition 0 pinned
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (std::size_t i = 0; i < cpus.size(); i++) {
+            CPU_SET(cpus[i], &set);
+        }
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+#endif
+    detail::pin_threads_setting() = pin;
+}
+
+/**
+ * @brief Returns the sub-range a thread owns under static partitioning.
+ *
+ * Every parallel_for over [begin, end) with `parts` threads gives thread `t`
+ * exactly this range, so data first touched by one loop is revisited by the
+ * same thread in later loops.
+ *
+ * @param begin Start of the range.
+ * @param end End of the range.
+ * @param parts Number of partitions.
+ * @param t The partition index.
+ * @param lo Output start of the partition.
+ * @param hi Output end of the partition.
+ */
+static inline void static_partition(std::size_t begin, std::size_t end,
+                                    unsigned parts, unsigned t,
+                                    std::size_t& lo, std::size_t& hi) {
+    std::size_t len = end - begin;
+    std::size_t base = len / parts;
+    std::size_t extra = len % parts;
+    lo = begin + t * base + (t < extra ? t : extra);
+    hi = lo + base + (t < extra ? 1 : 0);
+}
+
+/**
+ * @brief Runs `f(lo, hi, t)` over static partitions of [begin, end), one per
+ * thread, with the calling thread taking partition 0.
+ *
+ * @tparam F Callable taking (std::size_t lo, std::size_t hi, unsigned t).
+ * @param begin Start of the range.
+ * @param end End of the range.
+ * @param f The loop body.
+ * @param grain Ranges shorter than this per thread run on fewer threads.
+ */
+template <typename F>
+void parallel_for_ranges(std::size_t begin, std::size_t end, F f,
+                         std::size_t grain = 1) {
+    if (end <= begin)
+        return;
+    unsigned parts = num_threads();
+    std::size_t len = end - begin;
+    if (grain == 0)
+        grain = 1;
+    if (len / grain < parts)
+        parts = (unsigned)(len / grain) > 0 ? (unsigned)(len / grain) : 1;
+    if (parts == 1) {
+        f(begin, end, 0u);
+        return;
+    }
+    bool pin = detail::pin_threads_setting();
+    std::vector<std::thread> workers;
+    workers.reserve(parts - 1);
+    for (unsigned t = 1; t < parts; t++) {
+        std::size_t lo, hi;
+        static_partition(begin, end, parts, t, lo, hi);
+        workers.emplace_back([=, &f] {
+            if (pin)
+                detail::pin_to_partition(t);
+            f(lo, hi, t);
+        });
+    }
+    if (pin)
+        detail::pin_to_partition(0);
+    std::size_t lo, hi;
+    static_partition(begin, end, parts, 0, lo, hi);
+    f(lo, hi, 0u);
+    for (std::size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+/**
+ * @brief Runs `f(i)` for every i in [begin, end) across threads.
+ *
+ * @tparam F Callable taking (std::size_t i).
+ * @param begin Start of the range.
+ * @param end End of the range.
+ * @param f The loop body.
+ * @param grain Minimum iterations per thread.
+ */
+template <typename F>
+void parallel_for(std::size_t begin, std::size_t end, F f,
+                  std::size_t grain = 1024) {
+    parallel_for_ranges(
+        begin, end,
+        [&f](std::size_t lo, std::size_t hi, unsigned) {
+            for (std::size_t i = lo; i < hi; i++) {
+                f(i);
+            }
+        },
+        grain);
+}
+
+} // namespace HQ
+
+#endif // _HQPARALLEL_HPP_
@@ -0,0 +1,279 @@
+/**
+ * @file hqperiodic.hpp
+ * @brief This file defines periodic-boundary wrapping and minimum-image
+ * distances for vectors in a box [0, box).
+ */
+
+#ifndef _HQPERIODIC_HPP_
+#define _HQPERIODIC_HPP_
+
+#include "hqalloc.hpp"
+#include "hqbounds.hpp"
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace HQ {
+
+namespace detail {
+
+/**
+ * @brief Adding and subtracting this rounds to the nearest integer (ties to
+ * even) without a branch or a call, for |x| below half of it.
+ */
+template <typename T> struct round_magic;
+template <> struct round_magic<float> {
+    static float value() { return 12582912.0f; } // 1.5 * 2^23
+};
+template <> struct round_magic<double> {
+    static double value() { return 6755399441055744.0; } // 1.5 * 2^52
+};
+
+/**
+ * @brief Rounds to the nearest integer, branch free (|x| < 2^22 for float,
+ * 2^51 for double).
+ */
+template <typename T> inline T round_nearest(T x) {
+    // only -ffast-math would fold this away
+    return (x + round_magic<T>::value()) - round_magic<T>::value();
+}
+
+/**
+ * @brief Rounds down to an integer, branch free (same range as
+ * round_nearest).
+ */
+template <typename T> inline T floor_nearest(T x) {
+    T r = round_nearest(x);
+    return r - (T)(r > x);
+}
+
+#if defined(__SSE2__)
+inline __m128 round_nearest(__m128 x) {
+    const __m128 magic = _mm_set1_ps(round_magic<float>::value());
+    return _mm_sub_ps(_mm_add_ps(x, magic), magic);
+}
+
+inline __m128d round_nearest(__m128d x) {
+    const __m128d magic = _mm_set1_pd(round_magic<double>::value());
+    return _mm_sub_pd(_mm_add_pd(x, magic), magic);
+}
+
+inline __m128 floor_nearest(__m128 x) {
+    __m128 r = round_nearest(x);
+    return _mm_sub_ps(r, _mm_and_ps(_mm_cmpgt_ps(r, x), _mm_set1_ps(1.0f)));
+}
+
+inline __m128d floor_nearest(__m128d x) {
+    __m128d r = round_nearest(x);
+    return _mm_sub_pd(r, _mm_and_pd(_mm_cmpgt_pd(r, x), _mm_set1_pd(1.0)));
+}
+
+/**
+ * @brief Wraps lanes of p into [0, size), given 1 / size.
+ */
+inline void wrap_lanes(float* p, const float* size, const float* inverse) {
+    __m128 v = _mm_loadu_ps(p), b = _mm_loadu_ps(size);
+    __m128 r = _mm_sub_ps(
+        v, _mm_mul_ps(b, floor_nearest(_mm_mul_ps(v, _mm_loadu_ps(inverse)))));
+    r = _mm_add_ps(r, _mm_and_ps(_mm_cmplt_ps(r, _mm_setzero_ps()), b));
+    r = _mm_sub_ps(r, _mm_and_ps(_mm_cmpge_ps(r, b), b));
+    _mm_storeu_ps(p, r);
+}
+
+inline void wrap_lanes(double* p, const double* size, const double* inverse) {
+    __m128d v = _mm_loadu_pd(p), b = _mm_loadu_pd(size);
+    __m128d r = _mm_sub_pd(
+        v, _mm_mul_pd(b, floor_nearest(_mm_mul_pd(v, _mm_loadu_pd(inverse)))));
+    r = _mm_add_pd(r, _mm_and_pd(_mm_cmplt_pd(r, _mm_setzero_pd()), b));
+    r = _mm_sub_pd(r, _mm_and_pd(_mm_cmpge_pd(r, b), b));
+    _mm_storeu_pd(p, r);
+}
+
+#endif
+
+} // namespace detail
+
+/**
+ * @brief Wraps a position into the periodic box [0, box).
+ *
+ * Branch free; valid while |v / box| is below 2^22 (float) or 2^51
+ * (double).
+ *
+ * @param v The position.
+ * @param box The box edge lengths.
+ * @return vec<T, n> v - box * floor(v / box).
+ */
+template <typename T, std::size_t n>
+vec<T, n> wrap(const vec<T, n>& v, const vec<T, n>& box) {
+    static_assert(std::is_floating_point<T>::value,
+                  "periodic wrapping needs a floating-point type");
+    vec<T, n> out;
+    for (int k = 0; k < (int)n; k++) {
+        out[k] = v[k] - box[k] * detail::floor_nearest(v[k] / box[k]);
+        // v / box rounding to an integer can leave a tiny negative, and
+        // tiny negatives round up to exactly box
+        out[k] += box[k] * (T)(out[k] < 0);
+        out[k] -= box[k] * (T)(out[k] >= box[k]);
+    }
+    return out;
+}
+
+/**
+ * @brief Maps a difference vector to its nearest periodic image.
+ *
+ * @param d The difference.
+ * @param box The box edge lengths.
+ * @return vec<T, n> d - box * round(d / box), each component in
+ * [-box / 2, box / 2].
+ */
+template <typename T, std::size_t n>
+vec<T, n> minimum_image(const vec<T, n>& d, const vec<T, n>& box) {
+    static_assert(std::is_floating_point<T>::value,
+                  "periodic wrapping needs a floating-point type");
+    vec<T, n> out;
+    for (int k = 0; k < (int)n; k++) {
+        out[k] = d[k] - box[k] * detail::round_nearest(d[k] / box[k]);
+    }
+    return out;
+}
+
+/**
+ * @brief Computes the minimum-image difference a - b.
+ *
+ * @param a The first position.
+ * @param b The second position.
+ * @param box The box edge lengths.
+ * @return vec<T, n> The shortest periodic displacement from b to a.
+ */
+template <typename T, std::size_t n>
+vec<T, n> difference_periodic(const vec<T, n>& a, const vec<T, n>& b,
+                              const vec<T, n>& box) {
+    return minimum_image(a - b, box);
+}
+
+/**
+ * @brief Computes the squared minimum-image distance.
+ *
+ * @param a The first position.
+ * @param b The second position.
+ * @param box The box edge lengths.
+ * @return T The squared length of difference_periodic(a, b, box).
+ */
+template <typename T, std::size_t n>
+T distance2_periodic(const vec<T, n>& a, const vec<T, n>& b,
+                     const vec<T, n>& box) {
+    return minimum_image(a - b, box).length2();
+}
+
+/**
+ * @brief Wraps every position of an array into [0, box), across threads.
+ *
+ * With SSE2 the array is processed as flat scalars, n registers (4n floats
+ * or 2n doubles) at a time, against a box pattern repeating every n lanes.
+ *
+ * @param points The positions, updated in place.
+ * @param count The number of positions.
+ * @param box The box edge lengths.
+ */
+template <typename T, std::size_t n>
+void wrap(vec<T, n>* points, std::size_t count, const vec<T, n>& box) {
+    parallel_for_ranges(
+        0, count,
+        [&](std::size_t lo, std::size_t hi, unsigned) {
+            std::size_t i = lo;
+#if defined(__SSE2__)
+            const int width = 16 / sizeof(T);
+            if (sizeof(vec<T, n>) == n * sizeof(T)) {
+                // lane l of register q holds component (width * q + l) % n
+                T size[n * width], inverse[n * width];
+                for (int j = 0; j < (int)n * width; j++) {
+                    size[j] = box[j % (int)n];
+                    inverse[j] = (T)1 / size[j];
+                }
+                for (; i + width <= hi; i += width) {
+                    T* p = reinterpret_cast<T*>(points + i);
+                    for (int q = 0; q < (int)n; q++) {
+                        detail::wrap_lanes(p + q * width, size + q * width,
+                                           inverse + q * width);
+                    }
+                }
+            }
+#endif
+            for (; i < hi; i++) {
+                points[i] = wrap(points[i], box);
+            }
+        },
+        4096);
+}
+
+/**
+ * @brief Computes the smallest box enclosing points in a periodic domain.
+ *
+ * Along each axis the points are treated as lying on a circle, and the box
+ * starts just after the largest empty gap, so a cluster straddling the
+ * boundary gets a tight box rather than one spanning the domain.
+ *
+ * @param points Positions in [0, box).
+ * @param count The number of positions.
+ * @param box The box edge lengths.
+ * @return aabb<T, n> A box with lo in [0, box) and hi possibly beyond box
+ * (hi - lo is the periodic extent); empty if count is 0.
+ */
+template <typename T, std::size_t n>
+aabb<T, n> bounding_box_periodic(const vec<T, n>* points, std::size_t count,
+                                 const vec<T, n>& box) {
+    aabb<T, n> out;
+    if (!count)
+        return out;
+    detail::kernel_scratch<T> c(count);
+    for (int k = 0; k < (int)n; k++) {
+        for (std::size_t i = 0; i < count; i++) {
+            c[i] = points[i][k];
+        }
+        std::sort(c.data(), c.data() + count);
+        // the gap that wraps around the boundary
+        T gap = c[0] + box[k] - c[count - 1];
+        std::size_t after = 0;
+        for (std::size_t i = 1; i < count; i++) {
+            if (c[i] - c[i - 1] > gap) {
+                gap = c[i] - c[i - 1];
+                after = i;
+            }
+        }
+        out.lo[k] = c[after];
+        out.hi[k] = after ? c[after - 1] + box[k] : c[count - 1];
+    }
+    return out;
+}
+
+/**
+ * @brief Computes the squared minimum-image distance from a point to a box.
+ *
+ * @param b The box (e.g. from bounding_box_periodic).
+ * @param p The point.
+ * @param box The periodic domain edge lengths.
+ * @return T Zero if some image of p is inside b, else the squared gap.
+ */
+template <typename T, std::size_t n>
+T distance2_periodic(const aabb<T, n>& b, const vec<T, n>& p,
+                     const vec<T, n>& box) {
+    vec<T, n> d = minimum_image(p - b.center(), box);
+    T out = 0;
+    for (int k = 0; k < (int)n; k++) {
+        T half = (b.hi[k] - b.lo[k]) / 2;
+        T gap = std::max(d[k] < 0 ? -d[k] - half : d[k] - half, (T)0);
+        out += gap * gap;
+    }
+    return out;
+}
+
+} // namespace HQ
+
+#endif // _HQPERIODIC_HPP_
@@ -0,0 +1,820 @@
+/**
+ * @file hqply.hpp
+ * @brief This file defines PLY and XYZ point-cloud readers and writers that
+ * decode straight into vec containers.
+ *
+ * Files are memory mapped and decoded across threads, including ASCII files,
+ * whose lines are indexed in parallel before parsing.
+ */
+
+#ifndef _HQPLY_HPP_
+#define _HQPLY_HPP_
+
+#include "hqalloc.hpp"
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace HQ {
+
+namespace detail {
+
+/**
+ * @brief A read-only memory mapping of a whole file.
+ */
+class mapped_file {
+  private:
+    const char* m_data = nullptr;
+    std::size_t m_size = 0;
+    bool m_open = false;
+
+  public:
+    mapped_file(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0) {
+            // an empty file opens fine but has nothing to map
+            m_open = st.st_size == 0;
+            void* p = m_open ? MAP_FAILED
+                             : mmap(nullptr, st.st_size, PROT_READ,
+                                    MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m_data = (const char*)p;
+                m_size = st.st_size;
+                m_open = true;
+                madvise(p, m_size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~mapped_file() {
+        if (m_data)
+            munmap((void*)m_data, m_size);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    /** @brief True if the file was read, even if it was empty. */
+    bool is_open() const { return m_open; }
+    const char* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+};
+
+/**
+ * @brief Scalar types a PLY property can have.
+ */
+enum class ply_type { none, i8, u8, i16, u16, i32, u32, f32, f64 };
+
+static inline ply_type ply_type_from_name(const std::string& name) {
+    if ((name == "char") || (name == "int8"))
+        return ply_type::i8;
+    if ((name == "uchar") || (name == "uint8"))
+        return ply_type::u8;
+    if ((name == "short") || (name == "int16"))
+        return ply_type::i16;
+    if ((name == "ushort") || (name == "uint16"))
+        return ply_type::u16;
+    if ((name == "int") || (name == "int32"))
+        return ply_type::i32;
+    if ((name == "uint") || (name == "uint32"))
+        return ply_type::u32;
+    if ((name == "float") || (name == "float32"))
+        return ply_type::f32;
+    if ((name == "double") || (name == "float64"))
+        return ply_type::f64;
+    return ply_type::none;
+}
+
+static inline std::size_t ply_type_size(ply_type t) {
+    switch (t) {
+    case ply_type::i8:
+    case ply_type::u8:
+        return 1;
+    case ply_type::i16:
+    case ply_type::u16:
+        return 2;
+    case ply_type::i32:
+    case ply_type::u32:
+    case ply_type::f32:
+        return 4;
+    case ply_type::f64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Reads one binary PLY scalar as a double.
+ */
+static inline double ply_load(const char* p, ply_type t, bool swap) {
+    unsigned char b[8];
+    std::size_t size = ply_type_size(t);
+    for (std::size_t i = 0; i < size; i++) {
+        b[i] = (unsigned char)p[swap ? size - 1 - i : i];
+    }
+    switch (t) {
+    case ply_type::i8: {
+        std::int8_t v;
+        std::memcpy(&v, b, 1);
+        return v;
+    }
+    case ply_type::u8:
+        return b[0];
+    case ply_type::i16: {
+        std::int16_t v;
+        std::memcpy(&v, b, 2);
+        return v;
+    }
+    case ply_type::u16: {
+        std::uint16_t v;
+        std::memcpy(&v, b, 2);
+        return v;
+    }
+    case ply_type::i32: {
+        std::int32_t v;
+        std::memcpy(&v, b, 4);
+        return v;
+    }
+    case ply_type::u32: {
+        std::uint32_t v;
+        std::memcpy(&v, b, 4);
+        return v;
+    }
+    case ply_type::f32: {
+        float v;
+        std::memcpy(&v, b, 4);
+        return v;
+    }
+    case ply_type::f64: {
+        double v;
+        std::memcpy(&v, b, 8);
+        return v;
+    }
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Converts a colour channel to 8 bits; floats are taken as [0, 1].
+ */
+static inline std::uint8_t to_color_channel(double v, ply_type t) {
+    if ((t == ply_type::f32) || (t == ply_type::f64))
+        v *= 255.0;
+    v = v < 0 ? 0 : (v > 255 ? 255 : v);
+    return (std::uint8_t)(v + 0.5);
+}
+
+/**
+ * @brief Parsed PLY header, restricted to what the vertex reader needs.
+ */
+struct ply_header {
+    enum format_t { ascii, binary_le, binary_be } format = ascii;
+    /** @brief Number of vertices. */
+    std::size_t count = 0;
+    /** @brief Byte offset of the first data byte in the file. */
+    std::size_t data_offset = 0;
+    /** @brief Binary: bytes of elements stored before the vertex element. */
+    std::size_t skip_bytes = 0;
+    /** @brief ASCII: lines of elements stored before the vertex element. */
+    std::size_t skip_lines = 0;
+    /** @brief Binary: bytes per vertex. */
+    std::size_t stride = 0;
+    /** @brief Number of vertex properties (ASCII tokens per line). */
+    int nprops = 0;
+    /** @brief Property index of x, y, z, red, green, blue, alpha or -1. */
+    int index[7] = {-1, -1, -1, -1, -1, -1, -1};
+    /** @brief Binary: byte offset of each of those properties. */
+    std::size_t offset[7] = {0, 0, 0, 0, 0, 0, 0};
+    /** @brief Type of each of those properties. */
+    ply_type type[7] = {ply_type::none, ply_type::none, ply_type::none,
+                        ply_type::none, ply_type::none, ply_type::none,
+                        ply_type::none};
+
+    bool has_color() const { return index[3] >= 0; }
+
+    /**
+     * @brief Parses the header at the start of a mapped file.
+     *
+     * @return bool False if the header is malformed or unsupported.
+     */
+    bool parse(const char* data, std::size_t size) {
+        const char* end_tag = "end_header";
+        const char* p = data;
+        const char* end = data + size;
+        bool in_vertex = false;
+        bool seen_vertex = false;
+        bool prior_fixed = true;
+        std::size_t prior_count = 0;
+        std::size_t prior_stride = 0;
+        bool first = true;
+        while (p < end) {
+            const char* eol = (const char*)std::memchr(p, '\n', end - p);
+            if (!eol)
+                return false;
+            std::string line(p, eol);
+            if (!line.empty() && (line.back() == '\r'))
+                line.pop_back();
+            p = eol + 1;
+            std::istringstream words(line);
+            std::string word;
+            words >> word;
+            if (first) {
+                if (word != "ply")
+                    return false;
+                first = false;
+                continue;
+            }
+            if (word == "format") {
+                std::string f;
+                words >> f;
+                if (f == "ascii")
+                    format = ascii;
+                else if (f == "binary_little_endian")
+                    format = binary_le;
+                else if (f == "binary_big_endian")
+                    format = binary_be;
+                else
+                    return false;
+            } else if (word == "element") {
+                std::string name;
+                std::size_t c = 0;
+                words >> name >> c;
+                if (in_vertex)
+                    seen_vertex = true;
+                if (!seen_vertex) {
+                    // accumulate the element before this one
+                    const std::size_t most =
+                        std::numeric_limits<std::size_t>::max();
+                    if ((prior_count > most - skip_lines) ||
+                        (prior_stride &&
+                         (prior_count > (most - skip_bytes) / prior_stride)))
+                        return false;
+                    skip_bytes += prior_count * prior_stride;
+                    skip_lines += prior_count;
+                }
+                in_vertex = (name == "vertex") && !seen_vertex;
+                if (in_vertex) {
+                    if (!prior_fixed && (format != ascii))
+                        return false;
+                    count = c;
+                } else if (!seen_vertex) {
+                    prior_count = c;
+                    prior_stride = 0;
+                }
+            } else if (word == "property") {
+                std::string type_name, name;
+                words >> type_name;
+                if (type_name == "list") {
+                    if (in_vertex)
+                        return false;
+                    if (!seen_vertex)
+                        prior_fixed = false;
+                    continue;
+                }
+                words >> name;
+                ply_type t = ply_type_from_name(type_name);
+                if (t == ply_type::none)
+                    return false;
+                if (in_vertex) {
+                    const char* names[7] = {"x",     "y",    "z",    "red",
+                                            "green", "blue", "alpha"};
+                    for (int k = 0; k < 7; k++) {
+                        if (name == names[k]) {
+                            index[k] = nprops;
+                            offset[k] = stride;
+                            type[k] = t;
+                        }
+                    }
+                    stride += ply_type_size(t);
+                    nprops++;
+                } else if (!seen_vertex) {
+                    prior_stride += ply_type_size(t);
+                }
+            } else if (word == end_tag) {
+                data_offset = p - data;
+                if ((index[0] < 0) || (index[1] < 0) || (index[2] < 0))
+                    return false;
+                // colour needs all three channels
+                if ((index[3] < 0) || (index[4] < 0) || (index[5] < 0))
+                    index[3] = -1;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * @brief Copies a whitespace-delimited number into a bounded buffer and
+ * parses it, so parsing never runs off the end of a mapping.
+ *
+ * @return const char* Pointer past the token, or nullptr if none remained on
+ * the line.
+ */
+static inline const char* parse_token(const char* p, const char* end,
+                                      double& out) {
+    while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\r')))
+        p++;
+    if ((p >= end) || (*p == '\n'))
+        return nullptr;
+    char buf[64];
+    std::size_t len = 0;
+    while ((p < end) && (*p != ' ') && (*p != '\t') && (*p != '\r') &&
+           (*p != '\n')) {
+        if (len < sizeof(buf) - 1)
+            buf[len++] = *p;
+        p++;
+    }
+    buf[len] = 0;
+    out = std::strtod(buf, nullptr);
+    return p;
+}
+
+/**
+ * @brief Checks whether a line holds data (not blank, not a # comment).
+ */
+static inline bool is_record_line(const char* p, const char* eol) {
+    while ((p < eol) && ((*p == ' ') || (*p == '\t') || (*p == '\r')))
+        p++;
+    return (p < eol) && (*p != '#');
+}
+
+/**
+ * @brief Calls `f(record_index, line_begin, line_end)` for every record line
+ * of [begin, end), splitting the bytes across threads.
+ *
+ * Lines are counted per partition first, then `on_count(total)` is called,
+ * then every partition parses its lines knowing their global indices.
+ *
+ * @return std::size_t The total number of record lines.
+ */
+template <typename C, typename F>
+std::size_t for_each_record_line(const char* begin, const char* end,
+                                 C on_count, F f) {
+    std::size_t bytes = end - begin;
+    unsigned parts = num_threads();
+    if (bytes < (std::size_t)parts * 65536)
+        parts = 1;
+    // a line belongs to the partition containing its first byte
+    scratch_buffer<const char*> starts(parts + 1);
+    for (unsigned t = 0; t < parts; t++) {
+        std::size_t lo, hi;
+        static_partition(0, bytes, parts, t, lo, hi);
+        const char* s = begin + lo;
+        if ((t > 0) && (s[-1] != '\n')) {
+            const char* nl = (const char*)std::memchr(s, '\n', end - s);
+            s = nl ? nl + 1 : end;
+        }
+        starts[t] = s;
+    }
+    starts[parts] = end;
+    for (unsigned t = 1; t <= parts; t++) {
+        if (starts[t] < starts[t - 1])
+            starts[t] = starts[t - 1];
+    }
+
+    // parts <= num_threads(), so each partition gets its own thread
+    scratch_buffer<std::size_t> counts(parts + 1, 0);
+    parallel_for_ranges(
+        0, parts,
+        [&](std::size_t lo, std::size_t hi, unsigned) {
+            for (std::size_t t = lo; t < hi; t++) {
+                std::size_t c = 0;
+                const char* p = starts[t];
+                while (p < starts[t + 1]) {
+                    const char* eol = (const char*)std::memchr(
+                        p, '\n', starts[t + 1] - p);
+                    if (!eol)
+                        eol = starts[t + 1];
+                    c += is_record_line(p, eol);
+                    p = eol + 1;
+                }
+                counts[t + 1] = c;
+            }
+        },
+        1);
+    for (unsigned t = 0; t < parts; t++) {
+        counts[t + 1] += counts[t];
+    }
+    on_count(counts[parts]);
+    parallel_for_ranges(
+        0, parts,
+        [&](std::size_t lo, std::size_t hi, unsigned) {
+            for (std::size_t t = lo; t < hi; t++) {
+                std::size_t idx = counts[t];
+                const char* p = starts[t];
+                while (p < starts[t + 1]) {
+                    const char* eol = (const char*)std::memchr(
+                        p, '\n', starts[t + 1] - p);
+                    if (!eol)
+                        eol = starts[t + 1];
+                    if (is_record_line(p, eol))
+                        f(idx++, p, eol);
+                    p = eol + 1;
+                }
+            }
+        },
+        1);
+    return counts[parts];
+}
+
+/**
+ * @brief Writes decoded points into AoS vec3 storage.
+ */
+template <typename T> struct aos_points {
+    std::vector<vec3<T>>& positions;
+    std::vector<vec4<std::uint8_t>>* colors;
+
+    void resize(std::size_t count, bool with_color) {
+        positions.resize(count);
+        if (colors)
+            colors->assign(with_color ? count : 0, vec4<std::uint8_t>());
+    }
+    void set(std::size_t i, double x, double y, double z) {
+        positions[i] = vec3<T>((T)x, (T)y, (T)z);
+    }
+    void set_color(std::size_t i, const vec4<std::uint8_t>& c) {
+        if (colors)
+            (*colors)[i] = c;
+    }
+};
+
+/**
+ * @brief Writes decoded points into SoA component arrays.
+ */
+template <typename T> struct soa_points {
+    std::vector<T>& x;
+    std::vector<T>& y;
+    std::vector<T>& z;
+    std::vector<vec4<std::uint8_t>>* colors;
+
+    void resize(std::size_t count, bool with_color) {
+        x.resize(count);
+        y.resize(count);
+        z.resize(count);
+        if (colors)
+            colors->assign(with_color ? count : 0, vec4<std::uint8_t>());
+    }
+    void set(std::size_t i, double x_, double y_, double z_) {
+        x[i] = (T)x_;
+        y[i] = (T)y_;
+        z[i] = (T)z_;
+    }
+    void set_color(std::size_t i, const vec4<std::uint8_t>& c) {
+        if (colors)
+            (*colors)[i] = c;
+    }
+};
+
+template <typename Out>
+bool read_ply_into(const std::string& path, Out out) {
+    mapped_file file(path);
+    if (!file.data())
+        return false;
+    ply_header h;
+    if (!h.parse(file.data(), file.size()))
+        return false;
+    const char* begin = file.data() + h.data_offset;
+    const char* end = file.data() + file.size();
+    bool color = h.has_color();
+
+    if (h.format != ply_header::ascii) {
+        bool swap = h.format == ply_header::binary_be;
+        // check the count fits the file before allocating for it
+        std::size_t size = end - begin;
+        if ((h.skip_bytes > size) ||
+            (h.count > (size - h.skip_bytes) / h.stride))
+            return false;
+        out.resize(h.count, color);
+        begin += h.skip_bytes;
+        parallel_for(0, h.count, [&](std::size_t i) {
+            const char* v = begin + i * h.stride;
+            out.set(i, ply_load(v + h.offset[0], h.type[0], swap),
+                    ply_load(v + h.offset[1], h.type[1], swap),
+                    ply_load(v + h.offset[2], h.type[2], swap));
+            if (color) {
+                vec4<std::uint8_t> c(0, 0, 0, 255);
+                for (int k = 0; k < 4; k++) {
+                    if (h.index[3 + k] >= 0)
+                        c[k] = to_color_channel(
+                            ply_load(v + h.offset[3 + k], h.type[3 + k], swap),
+                            h.type[3 + k]);
+                }
+                out.set_color(i, c);
+            }
+        });
+        return true;
+    }
+
+    if (h.count > std::numeric_limits<std::size_t>::max() - h.skip_lines)
+        return false;
+    std::atomic<bool> ok(true);
+    std::size_t first = h.skip_lines;
+    std::size_t last = h.skip_lines + h.count;
+    // the line count bounds the vertex count before anything is allocated
+    for_each_record_line(
+        begin, end,
+        [&](std::size_t lines) {
+            if (lines < last)
+                ok = false;
+            else
+                out.resize(h.count, color);
+        },
+        [&](std::size_t idx, const char* p, const char* eol) {
+            if ((idx < first) || (idx >= last) || !ok)
+                return;
+            double values[7] = {0, 0, 0, 0, 0, 0, 255};
+            for (int prop = 0; prop < h.nprops; prop++) {
+                double v;
+                p = parse_token(p, eol, v);
+                if (!p) {
+                    ok = false;
+                    return;
+                }
+                for (int k = 0; k < 7; k++) {
+                    if (h.index[k] == prop)
+                        values[k] = k < 3 ? v
+                                          : (double)to_color_channel(
+                                                v, h.type[k]);
+                }
+            }
+            out.set(idx - first, values[0], values[1], values[2]);
+            if (color)
+                out.set_color(idx - first,
+                              vec4<std::uint8_t>(values[3], values[4],
+                                                 values[5], values[6]));
+        });
+    return ok;
+}
+
+template <typename Out>
+bool read_xyz_into(const std::string& path, Out out) {
+    mapped_file file(path);
+    if (!file.is_open())
+        return false;
+    if (!file.size()) {
+        out.resize(0, false);
+        return true;
+    }
+    const char* begin = file.data();
+    const char* end = begin + file.size();
+
+    // colour columns are present if the first record line has 6+ values
+    bool color = false;
+    for (const char* p = begin; p < end;) {
+        const char* eol = (const char*)std::memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        if (is_record_line(p, eol)) {
+            int tokens = 0;
+            double v;
+            while ((p = parse_token(p, eol, v)) != nullptr)
+                tokens++;
+            color = tokens >= 6;
+            break;
+        }
+        p = eol + 1;
+    }
+
+    std::atomic<bool> ok(true);
+    for_each_record_line(
+        begin, end,
+        [&](std::size_t lines) { out.resize(lines, color); },
+        [&](std::size_t idx, const char* p, const char* eol) {
+            double v[7] = {0, 0, 0, 0, 0, 0, 255};
+            int want = color ? 7 : 3;
+            int k = 0;
+            for (; k < want; k++) {
+                const char* next = parse_token(p, eol, v[k]);
+                if (!next)
+                    break;
+                p = next;
+            }
+            if (k < (color ? 6 : 3)) {
+                ok = false;
+                return;
+            }
+            out.set(idx, v[0], v[1], v[2]);
+            if (color)
+                out.set_color(
+                    idx, vec4<std::uint8_t>(
+                             to_color_channel(v[3], ply_type::u8),
+                             to_color_channel(v[4], ply_type::u8),
+                             to_color_channel(v[5], ply_type::u8),
+                             to_color_channel(v[6], ply_type::u8)));
+        });
+    return ok;
+}
+
+/**
+ * @brief Checks the host byte order; folds to a constant.
+ */
+static inline bool host_is_big_endian() {
+    const std::uint16_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 0;
+}
+
+/**
+ * @brief printf format that round-trips T.
+ */
+template <typename T> static inline const char* exact_format() {
+    return sizeof(T) > sizeof(float) ? "%.17g" : "%.9g";
+}
+
+} // namespace detail
+
+/**
+ * @brief Reads the vertices of a PLY file (ASCII or binary) into AoS
+ * storage.
+ *
+ * @tparam T float or double.
+ * @param path Path of the file.
+ * @param positions Output positions.
+ * @param colors Optional output colours (left empty if the file has none;
+ * alpha defaults to 255).
+ * @return bool False if the file cannot be read or is malformed.
+ */
+template <typename T>
+bool read_ply(const std::string& path, std::vector<vec3<T>>& positions,
+              std::vector<vec4<std::uint8_t>>* colors = nullptr) {
+    detail::aos_points<T> out = {positions, colors};
+    return detail::read_ply_into(path, out);
+}
+
+/**
+ * @brief Reads the vertices of a PLY file (ASCII or binary) into SoA
+ * component arrays.
+ *
+ * @tparam T float or double.
+ * @param path Path of the file.
+ * @param x Output x components.
+ * @param y Output y components.
+ * @param z Output z components.
+ * @param colors Optional output colours.
+ * @return bool False if the file cannot be read or is malformed.
+ */
+template <typename T>
+bool read_ply(const std::string& path, std::vector<T>& x, std::vector<T>& y,
+              std::vector<T>& z,
+              std::vector<vec4<std::uint8_t>>* colors = nullptr) {
+    detail::soa_points<T> out = {x, y, z, colors};
+    return detail::read_ply_into(path, out);
+}
+
+/**
+ * @brief Reads an XYZ file ("x y z [r g b [a]]" per line, # comments
+ * allowed) into AoS storage.
+ *
+ * @tparam T float or double.
+ * @param path Path of the file.
+ * @param positions Output positions.
+ * @param colors Optional output colours (0-255 integers in the file).
+ * @return bool False if the file cannot be read or is malformed.
+ */
+template <typename T>
+bool read_xyz(const std::string& path, std::vector<vec3<T>>& positions,
+              std::vector<vec4<std::uint8_t>>* colors = nullptr) {
+    detail::aos_points<T> out = {positions, colors};
+    return detail::read_xyz_into(path, out);
+}
+
+/**
+ * @brief Reads an XYZ file into SoA component arrays.
+ *
+ * @tparam T float or double.
+ * @param path Path of the file.
+ * @param x Output x components.
+ * @param y Output y components.
+ * @param z Output z components.
+ * @param colors Optional output colours.
+ * @return bool False if the file cannot be read or is malformed.
+ */
+template <typename T>
+bool read_xyz(const std::string& path, std::vector<T>& x, std::vector<T>& y,
+              std::vector<T>& z,
+              std::vector<vec4<std::uint8_t>>* colors = nullptr) {
+    detail::soa_points<T> out = {x, y, z, colors};
+    return detail::read_xyz_into(path, out);
+}
+
+/**
+ * @brief Writes points (and optionally RGBA colours) as a PLY file.
+ *
+ * @tparam T float or double.
+ * @param path Path of the file.
+ * @param positions The points.
+ * @param count The number of points.
+ * @param colors Optional colours, one per point.
+ * @param binary Write binary_little_endian instead of ASCII.
+ * @return bool False if the file cannot be written.
+ */
+template <typename T>
+bool write_ply(const std::string& path, const vec3<T>* positions,
+               std::size_t count, const vec4<std::uint8_t>* colors = nullptr,
+               bool binary = true) {
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    const char* type = sizeof(T) > sizeof(float) ? "double" : "float";
+    std::fprintf(f, "ply\nformat %s 1.0\nelement vertex %zu\n",
+                 binary ? "binary_little_endian" : "ascii", count);
+    std::fprintf(f, "property %s x\nproperty %s y\nproperty %s z\n", type,
+                 type, type);
+    if (colors)
+        std::fprintf(f, "property uchar red\nproperty uchar green\n"
+                        "property uchar blue\nproperty uchar alpha\n");
+    std::fprintf(f, "end_header\n");
+
+    if (binary) {
+        // the header promises little endian whatever the host order
+        const bool swap = detail::host_is_big_endian();
+        std::size_t stride = 3 * sizeof(T) + (colors ? 4 : 0);
+        const std::size_t block = 4096;
+        std::vector<char> buf(block * stride);
+        for (std::size_t start = 0; start < count; start += block) {
+            std::size_t len = count - start < block ? count - start : block;
+            for (std::size_t i = 0; i < len; i++) {
+                char* dst = buf.data() + i * stride;
+                std::memcpy(dst, &positions[start + i], 3 * sizeof(T));
+                for (int k = 0; swap && (k < 3); k++) {
+                    std::reverse(dst + k * sizeof(T),
+                                 dst + (k + 1) * sizeof(T));
+                }
+                if (colors)
+                    std::memcpy(dst + 3 * sizeof(T), &colors[start + i], 4);
+            }
+            std::fwrite(buf.data(), stride, len, f);
+        }
+    } else {
+        std::string fmt = std::string(detail::exact_format<T>()) + " " +
+                          detail::exact_format<T>() + " " +
+                          detail::exact_format<T>();
+        for (std::size_t i = 0; i < count; i++) {
+            std::fprintf(f, fmt.c_str(), (double)positions[i].x,
+                         (double)positions[i].y, (double)positions[i].z);
+            if (colors)
+                std::fprintf(f, " %u %u %u %u", colors[i].x, colors[i].y,
+                             colors[i].z, colors[i].w);
+            std::fputc('\n', f);
+        }
+    }
+    bool ok = !std::ferror(f);
+    return (std::fclose(f) == 0) && ok;
+}
+
+/**
+ * @brief Writes points (and optionally RGB colours) as an XYZ file.
+ *
+ * @tparam T float or double.
+ * @param path Path of the file.
+ * @param positions The points.
+ * @param count The number of points.
+ * @param colors Optional colours, one per point (alpha is not written).
+ * @return bool False if the file cannot be written.
+ */
+template <typename T>
+bool write_xyz(const std::string& path, const vec3<T>* positions,
+               std::size_t count, const vec4<std::uint8_t>* colors = nullptr) {
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    std::string fmt = std::string(detail::exact_format<T>()) + " " +
+                      detail::exact_format<T>() + " " +
+                      detail::exact_format<T>();
+    for (std::size_t i = 0; i < count; i++) {
+        std::fprintf(f, fmt.c_str(), (double)positions[i].x,
+                     (double)positions[i].y, (double)positions[i].z);
+        if (colors)
+            std::fprintf(f, " %u %u %u", colors[i].x, colors[i].y,
+                         colors[i].z);
+        std::fputc('\n', f);
+    }
+    bool ok = !std::ferror(f);
+    return (std::fclose(f) == 0) && ok;
+}
+
+} // namespace HQ
+
+#endif // _HQPLY_HPP_
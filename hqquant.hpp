@@ -0,0 +1,396 @@
+/**
+ * @file hqquant.hpp
+ * @brief This file defines an error-bounded lossy quantizer for arrays of
+ * vec3<float> positions.
+ */
+
+#ifndef _HQQUANT_HPP_
+#define _HQQUANT_HPP_
+
+#include "hqbounds.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace HQ {
+
+/**
+ * @brief A bit-packed, error-bounded representation of an array of
+ * vec3<float> positions.
+ *
+ * Each point is stored as three unsigned grid coordinates relative to the
+ * array's bounding box, using just enough bits per axis to cover that axis'
+ * extent.
+ */
+struct quantized_vec3 {
+    /** @brief Number of points encoded. */
+    std::size_t count = 0;
+    /** @brief Lower corner of the grid. */
+    vec3<float> origin;
+    /** @brief Grid spacing on every axis. */
+    float step = 0;
+    /** @brief The requested absolute error bound. */
+    float error_bound = 0;
+    /** @brief Largest absolute per-component error measured while encoding. */
+    float max_error = 0;
+    /** @brief Bits used per point on each axis. */
+    unsigned bits[3] = {0, 0, 0};
+    /** @brief Packed grid coordinates, x/y/z interleaved per point. */
+    std::vector<std::uint64_t> packed;
+
+    /**
+     * @brief Returns the size of the encoded representation.
+     *
+     * @return std::size_t Payload plus header size in bytes.
+     */
+    std::size_t encoded_bytes() const {
+        return packed.size() * sizeof(std::uint64_t) + sizeof(origin) +
+               sizeof(step) + sizeof(bits) + sizeof(count);
+    }
+
+    /**
+     * @brief Returns the achieved compression ratio.
+     *
+     * @return double Raw vec3<float> bytes divided by encoded bytes.
+     */
+    double compression_ratio() const {
+        return (double)(count * sizeof(vec3<float>)) / (double)encoded_bytes();
+    }
+};
+
+namespace detail {
+
+/** @brief Points converted per block between the SIMD and packing stages. */
+static const std::size_t quant_block = 256;
+
+#if defined(__SSE2__)
+/**
+ * @brief Clamps lanes to hi as unsigned values, so the 0x80000000 that
+ * out-of-range conversions give is clamped too.
+ */
+inline __m128i clamp_codes(__m128i v, __m128i hi) {
+    // SSE2 only compares signed lanes; flipping the sign bit orders unsigned
+    const __m128i sign = _mm_set1_epi32((int)0x80000000u);
+    __m128i over =
+        _mm_cmpgt_epi32(_mm_xor_si128(v, sign), _mm_xor_si128(hi, sign));
+    return _mm_or_si128(_mm_andnot_si128(over, v), _mm_and_si128(over, hi));
+}
+#endif
+
+/**
+ * @brief Converts a block of interleaved xyz floats to grid coordinates.
+ *
+ * @param in Interleaved xyz floats, 3 * npoints values.
+ * @param npoints Number of points in the block.
+ * @param lo Grid origin.
+ * @param inv_step Reciprocal of the grid spacing.
+ * @param max_code Largest code on each axis; every code, NaN included, is
+ * clamped to [0, max_code].
+ * @param out Output grid coordinates, 3 * npoints values.
+ */
+static inline void quantize_block(const float* in, std::size_t npoints,
+                                  const vec3<float>& lo, float inv_step,
+                                  const std::uint32_t* max_code,
+                                  std::uint32_t* out) {
+    std::size_t nf = npoints * 3;
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    // 4 lanes against a period-3 pattern: three phase registers cover 12
+    // floats (4 points) per iteration.
+    const __m128 lo0 = _mm_setr_ps(lo.x, lo.y, lo.z, lo.x);
+    const __m128 lo1 = _mm_setr_ps(lo.y, lo.z, lo.x, lo.y);
+    const __m128 lo2 = _mm_setr_ps(lo.z, lo.x, lo.y, lo.z);
+    const __m128 inv = _mm_set1_ps(inv_step);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128i max0 =
+        _mm_setr_epi32(max_code[0], max_code[1], max_code[2], max_code[0]);
+    const __m128i max1 =
+        _mm_setr_epi32(max_code[1], max_code[2], max_code[0], max_code[1]);
+    const __m128i max2 =
+        _mm_setr_epi32(max_code[2], max_code[0], max_code[1], max_code[2]);
+    for (; i + 12 <= nf; i += 12) {
+        __m128 a = _mm_loadu_ps(in + i);
+        __m128 b = _mm_loadu_ps(in + i + 4);
+        __m128 c = _mm_loadu_ps(in + i + 8);
+        a = _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(a, lo0), inv), half),
+                       zero);
+        b = _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(b, lo1), inv), half),
+                       zero);
+        c = _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(c, lo2), inv), half),
+                       zero);
+        _mm_storeu_si128((__m128i*)(out + i),
+                         clamp_codes(_mm_cvttps_epi32(a), max0));
+        _mm_storeu_si128((__m128i*)(out + i + 4),
+                         clamp_codes(_mm_cvttps_epi32(b), max1));
+        _mm_storeu_si128((__m128i*)(out + i + 8),
+                         clamp_codes(_mm_cvttps_epi32(c), max2));
+    }
+#endif
+    for (; i < nf; i++) {
+        std::uint32_t hi = max_code[i % 3];
+        float q = (in[i] - lo[(int)(i % 3)]) * inv_step + 0.5f;
+        if (!(q > 0))
+            out[i] = 0;
+        else
+            out[i] = q < (float)hi ? (std::uint32_t)q : hi;
+    }
+}
+
+/**
+ * @brief Converts a block of grid coordinates back to interleaved xyz floats.
+ *
+ * @param in Grid coordinates, 3 * npoints values.
+ * @param npoints Number of points in the block.
+ * @param lo Grid origin.
+ * @param step Grid spacing.
+ * @param out Output interleaved xyz floats, 3 * npoints values.
+ */
+static inline void dequantize_block(const std::uint32_t* in,
+                                    std::size_t npoints, const vec3<float>& lo,
+                                    float step, float* out) {
+    std::size_t nf = npoints * 3;
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 lo0 = _mm_setr_ps(lo.x, lo.y, lo.z, lo.x);
+    const __m128 lo1 = _mm_setr_ps(lo.y, lo.z, lo.x, lo.y);
+    const __m128 lo2 = _mm_setr_ps(lo.z, lo.x, lo.y, lo.z);
+    const __m128 s = _mm_set1_ps(step);
+    for (; i + 12 <= nf; i += 12) {
+        // grid coordinates are < 2^31, so the signed conversion is exact
+        __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in + i)));
+        __m128 b =
+            _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in + i + 4)));
+        __m128 c =
+            _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in + i + 8)));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(a, s), lo0));
+        _mm_storeu_ps(out + i + 4, _mm_add_ps(_mm_mul_ps(b, s), lo1));
+        _mm_storeu_ps(out + i + 8, _mm_add_ps(_mm_mul_ps(c, s), lo2));
+    }
+#endif
+    for (; i < nf; i++) {
+        out[i] = (float)(std::int32_t)in[i] * step + lo[(int)(i % 3)];
+    }
+}
+
+/**
+ * @brief Appends fixed-width fields to a stream of 64-bit words.
+ */
+class bit_writer {
+  private:
+    std::vector<std::uint64_t>& m_out;
+    std::uint64_t m_word = 0;
+    unsigned m_used = 0;
+
+  public:
+    bit_writer(std::vector<std::uint64_t>& out) : m_out(out) {}
+
+    /**
+     * @brief Writes the low `bits` bits of `value` (bits <= 32).
+     */
+    void put(std::uint64_t value, unsigned bits) {
+        if (bits == 0)
+            return;
+        value &= (((std::uint64_t)1) << bits) - 1;
+        m_word |= value << m_used;
+        m_used += bits;
+        if (m_used >= 64) {
+            m_out.push_back(m_word);
+            m_used -= 64;
+            m_word = m_used ? (value >> (bits - m_used)) : 0;
+        }
+    }
+
+    /**
+     * @brief Flushes any partially filled word.
+     */
+    void flush() {
+        if (m_used) {
+            m_out.push_back(m_word);
+            m_word = 0;
+            m_used = 0;
+        }
+    }
+};
+
+/**
+ * @brief Reads fixed-width fields from a stream of 64-bit words.
+ */
+class bit_reader {
+  private:
+    const std::uint64_t* m_in;
+    std::uint64_t m_word = 0;
+    unsigned m_left = 0;
+
+  public:
+    bit_reader(const std::uint64_t* in) : m_in(in) {}
+
+    /**
+     * @brief Reads a field of `bits` bits (bits <= 32).
+     */
+    std::uint64_t get(unsigned bits) {
+        if (bits == 0)
+            return 0;
+        std::uint64_t mask = (((std::uint64_t)1) << bits) - 1;
+        if (m_left >= bits) {
+            std::uint64_t out = m_word & mask;
+            m_word >>= bits;
+            m_left -= bits;
+            return out;
+        }
+        std::uint64_t out = m_word;
+        unsigned have = m_left;
+        m_word = *m_in++;
+        out |= m_word << have;
+        m_word = m_word >> (bits - have);
+        m_left = 64 - (bits - have);
+        return out & mask;
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief Quantizes an array of positions onto a grid with an absolute
+ * per-component error of at most about error_bound.
+ *
+ * The error is measured on the decoded values rather than assumed, and
+ * reported in max_error; float rounding at the top of an axis can leave it
+ * slightly above error_bound.
+ *
+ * @param points The input positions.
+ * @param count The number of positions.
+ * @param error_bound Maximum absolute error allowed on each component (> 0).
+ * @return quantized_vec3 The packed representation, including the achieved
+ * max_error.
+ */
+static inline quantized_vec3 quantize(const vec3<float>* points,
+                                      std::size_t count, float error_bound) {
+    assert((error_bound > 0) && "error bound must be positive");
+    quantized_vec3 out;
+    out.count = count;
+    out.error_bound = error_bound;
+    if (count == 0)
+        return out;
+
+    aabb<float, 3> box = bounding_box(points, count);
+    // slightly under 2 * bound so float rounding in decode stays in bounds
+    out.step = 2.0f * error_bound * 0.999f;
+    out.origin = box.lo;
+    float inv_step = 1.0f / out.step;
+    std::uint32_t max_code[3];
+    for (int k = 0; k < 3; k++) {
+        double levels =
+            std::floor((double)(box.hi[k] - box.lo[k]) * inv_step + 0.5) + 1;
+        // the encoder rounds in float, which can land one level higher
+        float top = (box.hi[k] - box.lo[k]) * inv_step + 0.5f;
+        levels = std::max(levels, std::floor((double)top) + 1);
+        assert((levels < 2147483648.0) &&
+               "error bound too small for the extent of the data");
+        unsigned b = 0;
+        while (((double)(((std::uint64_t)1) << b)) < levels)
+            b++;
+        out.bits[k] = b;
+        max_code[k] = (std::uint32_t)((((std::uint64_t)1) << b) - 1);
+    }
+
+    std::size_t total_bits =
+        count * (out.bits[0] + out.bits[1] + out.bits[2]);
+    out.packed.reserve((total_bits + 63) / 64);
+    detail::bit_writer writer(out.packed);
+
+    const float* in = reinterpret_cast<const float*>(points);
+    std::uint32_t codes[detail::quant_block * 3];
+    float decoded[detail::quant_block * 3];
+    float max_error = 0;
+    for (std::size_t start = 0; start < count; start += detail::quant_block) {
+        std::size_t npoints = count - start < detail::quant_block
+                                  ? count - start
+                                  : detail::quant_block;
+        const float* block = in + start * 3;
+        detail::quantize_block(block, npoints, out.origin, inv_step,
+                               max_code, codes);
+        detail::dequantize_block(codes, npoints, out.origin, out.step,
+                                 decoded);
+        bool nudged = false;
+        for (std::size_t i = 0; i < npoints * 3; i++) {
+            if (std::fabs(decoded[i] - block[i]) > error_bound) {
+                // rounding put us one cell off; nudge toward the input
+                if ((decoded[i] < block[i]) && (codes[i] < max_code[i % 3]))
+                    codes[i]++;
+                else if ((decoded[i] > block[i]) && (codes[i] > 0))
+                    codes[i]--;
+                nudged = true;
+            }
+        }
+        // measure what dequantize will actually produce
+        if (nudged)
+            detail::dequantize_block(codes, npoints, out.origin, out.step,
+                                     decoded);
+        for (std::size_t i = 0; i < npoints * 3; i++) {
+            float err = std::fabs(decoded[i] - block[i]);
+            // a NaN (from a NaN input) sticks, so it is reported
+            if ((err > max_error) || (err != err))
+                max_error = err;
+        }
+        for (std::size_t i = 0; i < npoints; i++) {
+            writer.put(codes[i * 3 + 0], out.bits[0]);
+            writer.put(codes[i * 3 + 1], out.bits[1]);
+            writer.put(codes[i * 3 + 2], out.bits[2]);
+        }
+    }
+    writer.flush();
+    out.max_error = max_error;
+    return out;
+}
+
+/**
+ * @brief Decodes a quantized array back to positions.
+ *
+ * @param q The packed representation.
+ * @param out Output array of at least q.count positions.
+ */
+static inline void dequantize(const quantized_vec3& q, vec3<float>* out) {
+    if (q.count == 0)
+        return;
+    detail::bit_reader reader(q.packed.data());
+    std::uint32_t codes[detail::quant_block * 3];
+    float* dst = reinterpret_cast<float*>(out);
+    for (std::size_t start = 0; start < q.count;
+         start += detail::quant_block) {
+        std::size_t npoints = q.count - start < detail::quant_block
+                                  ? q.count - start
+                                  : detail::quant_block;
+        for (std::size_t i = 0; i < npoints; i++) {
+            codes[i * 3 + 0] = (std::uint32_t)reader.get(q.bits[0]);
+            codes[i * 3 + 1] = (std::uint32_t)reader.get(q.bits[1]);
+            codes[i * 3 + 2] = (std::uint32_t)reader.get(q.bits[2]);
+        }
+        detail::dequantize_block(codes, npoints, q.origin, q.step,
+                                 dst + start * 3);
+    }
+}
+
+/**
+ * @brief Decodes a quantized array back to positions.
+ *
+ * @param q The packed representation.
+ * @return std::vector<vec3<float>> The decoded positions.
+ */
+static inline std::vector<vec3<float>> dequantize(const quantized_vec3& q) {
+    std::vector<vec3<float>> out(q.count);
+    dequantize(q, out.data());
+    return out;
+}
+
+} // namespace HQ
+
+#endif // _HQQUANT_HPP_
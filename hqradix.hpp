@@ -0,0 +1,316 @@
+/**
+ * @file hqradix.hpp
+ * @brief This file defines a parallel least-significant-digit radix sort
+ * for scalar keys, key/payload pairs, and vec arrays keyed by a component
+ * or a key function.
+ */
+
+#ifndef _HQRADIX_HPP_
+#define _HQRADIX_HPP_
+
+#include "hqalloc.hpp"
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace HQ {
+
+namespace detail {
+
+/**
+ * @brief Maps a scalar key to an unsigned integer with the same order.
+ */
+template <typename T, typename Enable = void> struct radix_traits;
+
+/**
+ * @brief Unsigned integers sort as they are; signed ones with the sign bit
+ * flipped.
+ */
+template <typename T>
+struct radix_traits<T, typename std::enable_if<
+                           std::is_integral<T>::value>::type> {
+    typedef typename std::make_unsigned<T>::type type;
+    static type encode(T x) {
+        const type sign = std::is_signed<T>::value
+                              ? (type)((type)1 << (8 * sizeof(T) - 1))
+                              : (type)0;
+        return (type)x ^ sign;
+    }
+    static T decode(type u) { return (T)encode((T)u); }
+};
+
+/**
+ * @brief IEEE floats sort as integers once negative values have all bits
+ * flipped and positive values only the sign bit (the sign-flip trick).
+ */
+template <typename T>
+struct radix_traits<T, typename std::enable_if<
+                           std::is_floating_point<T>::value>::type> {
+    typedef typename std::conditional<sizeof(T) == 4, std::uint32_t,
+                                      std::uint64_t>::type type;
+    static_assert(sizeof(T) == sizeof(type), "unsupported floating type");
+    static type encode(T x) {
+        type bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        const int top = 8 * sizeof(type) - 1;
+        type mask = (type)(0 - (bits >> top)) | ((type)1 << top);
+        return bits ^ mask;
+    }
+    static T decode(type u) {
+        const int top = 8 * sizeof(type) - 1;
+        type mask = (u >> top) ? ((type)1 << top) : (type)~(type)0;
+        u ^= mask;
+        T x;
+        std::memcpy(&x, &u, sizeof(x));
+        return x;
+    }
+};
+
+/**
+ * @brief Stable LSD radix sort of unsigned keys on 8-bit digits, across
+ * threads, with an optional payload moved alongside.
+ *
+ * Each pass splits the array into one block per thread; every block counts
+ * its digits, an exclusive scan in (digit, block) order gives each block
+ * its output offsets, and the blocks scatter in parallel. Passes where all
+ * keys share a digit are skipped.
+ *
+ * @tparam with_values Whether `values` is moved with the keys.
+ * @param keys The keys, sorted in place.
+ * @param values The payload (unused unless with_values).
+ * @param count The number of elements.
+ */
+template <bool with_values, typename K, typename V>
+void radix_sort_core(K* keys, V* values, std::size_t count) {
+    static_assert(std::is_unsigned<K>::value, "radix keys are unsigned");
+    const std::size_t grain = 1 << 14;
+    unsigned blocks = num_threads();
+    if (count / grain < blocks)
+        blocks = count / grain > 0 ? (unsigned)(count / grain) : 1;
+    kernel_scratch<K> key_buffer(count);
+    kernel_scratch<V> value_buffer(with_values ? count : 0);
+    K* key_in = keys;
+    K* key_out = key_buffer.data();
+    V* value_in = values;
+    V* value_out = value_buffer.data();
+    kernel_scratch<std::size_t> offsets(256 * blocks);
+    std::size_t* offset = offsets.data();
+
+    for (int shift = 0; shift < 8 * (int)sizeof(K); shift += 8) {
+        parallel_for_ranges(
+            0, blocks,
+            [&](std::size_t first, std::size_t last, unsigned) {
+                for (std::size_t b = first; b < last; b++) {
+                    std::size_t lo, hi;
+                    static_partition(0, count, blocks, (unsigned)b, lo, hi);
+                    std::size_t* histogram = offset + 256 * b;
+                    std::fill(histogram, histogram + 256, std::size_t(0));
+                    for (std::size_t i = lo; i < hi; i++) {
+                        histogram[(key_in[i] >> shift) & 0xff]++;
+                    }
+                }
+            },
+            1);
+        bool trivial = false;
+        std::size_t total = 0;
+        for (int d = 0; d < 256; d++) {
+            std::size_t digit_count = 0;
+            for (unsigned b = 0; b < blocks; b++) {
+                std::size_t c = offset[256 * b + d];
+                offset[256 * b + d] = total;
+                total += c;
+                digit_count += c;
+            }
+            trivial = trivial || (digit_count == count);
+        }
+        if (trivial)
+            continue;
+        parallel_for_ranges(
+            0, blocks,
+            [&](std::size_t first, std::size_t last, unsigned) {
+                for (std::size_t b = first; b < last; b++) {
+                    std::size_t lo, hi;
+                    static_partition(0, count, blocks, (unsigned)b, lo, hi);
+                    std::size_t* next = offset + 256 * b;
+                    for (std::size_t i = lo; i < hi; i++) {
+                        std::size_t to = next[(key_in[i] >> shift) & 0xff]++;
+                        key_out[to] = key_in[i];
+                        if (with_values)
+                            value_out[to] = value_in[i];
+                    }
+                }
+            },
+            1);
+        std::swap(key_in, key_out);
+        if (with_values)
+            std::swap(value_in, value_out);
+    }
+    if (key_in != keys) {
+        std::copy(key_in, key_in + count, keys);
+        if (with_values)
+            std::copy(value_in, value_in + count, values);
+    }
+}
+
+} // namespace detail
+
+/**
+ * @brief Reorders an array so that element i becomes data[order[i]],
+ * across threads.
+ *
+ * @tparam U The element type (copyable).
+ * @param order A permutation of [0, count).
+ * @param data The array, reordered in place.
+ * @param count The number of elements.
+ */
+template <typename U>
+void permute(const std::uint32_t* order, U* data, std::size_t count) {
+    detail::kernel_scratch<U> gathered(count);
+    parallel_for(0, count, [&](std::size_t i) { gathered[i] = data[order[i]]; },
+                 4096);
+    parallel_for(0, count, [&](std::size_t i) { data[i] = gathered[i]; },
+                 4096);
+}
+
+namespace detail {
+
+/**
+ * @brief Encodes every key of an array with radix_traits, across threads.
+ */
+template <typename K>
+void encode_keys(const K* keys, std::size_t count,
+                 typename radix_traits<K>::type* out) {
+    parallel_for(
+        0, count,
+        [&](std::size_t i) { out[i] = radix_traits<K>::encode(keys[i]); },
+        4096);
+}
+
+/**
+ * @brief Writes decoded keys back over the original array, across threads.
+ */
+template <typename K>
+void decode_keys(const typename radix_traits<K>::type* encoded,
+                 std::size_t count, K* keys) {
+    parallel_for(
+        0, count,
+        [&](std::size_t i) { keys[i] = radix_traits<K>::decode(encoded[i]); },
+        4096);
+}
+
+/**
+ * @brief Sorts a vec array (and a payload array, unless null) by
+ * precomputed unsigned keys, via a sorted index permutation.
+ */
+template <typename T, std::size_t n, typename U, typename V>
+void sort_by_encoded(vec<T, n>* points, std::size_t count,
+                     U* keys, V* payload) {
+    kernel_scratch<std::uint32_t> order(count);
+    parallel_for(
+        0, count, [&](std::size_t i) { order[i] = (std::uint32_t)i; }, 4096);
+    radix_sort_core<true>(keys, order.data(), count);
+    permute(order.data(), points, count);
+    if (payload)
+        permute(order.data(), payload, count);
+}
+
+} // namespace detail
+
+/**
+ * @brief Sorts scalar keys ascending, across threads.
+ *
+ * Floating-point keys order -0 before +0 and NaNs beyond the infinity of
+ * their sign.
+ *
+ * @tparam K An integral or floating-point type.
+ * @param keys The keys, sorted in place.
+ * @param count The number of keys.
+ */
+template <typename K> void radix_sort(K* keys, std::size_t count) {
+    detail::kernel_scratch<typename detail::radix_traits<K>::type> encoded(
+        count);
+    detail::encode_keys(keys, count, encoded.data());
+    detail::radix_sort_core<false>(encoded.data(), (char*)0, count);
+    detail::decode_keys(encoded.data(), count, keys);
+}
+
+/**
+ * @brief Sorts scalar keys ascending and moves a payload with them,
+ * stably, across threads.
+ *
+ * @tparam K An integral or floating-point type.
+ * @tparam V The payload type (copyable).
+ * @param keys The keys, sorted in place.
+ * @param values The payload, permuted alongside the keys.
+ * @param count The number of elements.
+ */
+template <typename K, typename V>
+void radix_sort(K* keys, V* values, std::size_t count) {
+    detail::kernel_scratch<typename detail::radix_traits<K>::type> encoded(
+        count);
+    detail::encode_keys(keys, count, encoded.data());
+    detail::radix_sort_core<true>(encoded.data(), values, count);
+    detail::decode_keys(encoded.data(), count, keys);
+}
+
+/**
+ * @brief Sorts a vec array by one component, stably, across threads.
+ *
+ * A replacement for std::sort with a component comparator, e.g. for
+ * sweep-and-prune or slab decomposition.
+ *
+ * @tparam V The payload type.
+ * @param points The vectors, sorted in place.
+ * @param count The number of vectors (less than 2^32).
+ * @param component The component to sort by.
+ * @param payload Optional array of count elements permuted alongside.
+ */
+template <typename T, std::size_t n, typename V = std::uint32_t>
+void radix_sort_by_component(vec<T, n>* points, std::size_t count,
+                             int component, V* payload = nullptr) {
+    typedef typename detail::radix_traits<T>::type U;
+    detail::kernel_scratch<U> keys(count);
+    parallel_for(
+        0, count,
+        [&](std::size_t i) {
+            keys[i] = detail::radix_traits<T>::encode(points[i][component]);
+        },
+        4096);
+    detail::sort_by_encoded(points, count, keys.data(), payload);
+}
+
+/**
+ * @brief Sorts a vec array by a key function, stably, across threads.
+ *
+ * @tparam F Callable taking const vec<T, n>& and returning an integral or
+ * floating-point key; called once per vector.
+ * @tparam V The payload type.
+ * @param points The vectors, sorted in place.
+ * @param count The number of vectors (less than 2^32).
+ * @param key The key function.
+ * @param payload Optional array of count elements permuted alongside.
+ */
+template <typename T, std::size_t n, typename F, typename V = std::uint32_t>
+void radix_sort_by_key(vec<T, n>* points, std::size_t count, F key,
+                       V* payload = nullptr) {
+    typedef typename std::decay<decltype(key(*points))>::type K;
+    typedef typename detail::radix_traits<K>::type U;
+    detail::kernel_scratch<U> keys(count);
+    parallel_for(
+        0, count,
+        [&](std::size_t i) {
+            keys[i] = detail::radix_traits<K>::encode(key(points[i]));
+        },
+        4096);
+    detail::sort_by_encoded(points, count, keys.data(), payload);
+}
+
+} // namespace HQ
+
+#endif // _HQRADIX_HPP_
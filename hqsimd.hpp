@@ -0,0 +1,171 @@
+/**
+ * @file hqsimd.hpp
+ * @brief This file defines thin wrappers over the widest float and double
+ * SIMD registers the build targets, for kernels written once for both
+ * types.
+ */
+
+#ifndef _HQSIMD_HPP_
+#define _HQSIMD_HPP_
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace HQ {
+
+namespace detail {
+
+/**
+ * @brief One lane of T, with the interface of simd (for remainders of
+ * SIMD loops).
+ *
+ * @tparam T float or double.
+ */
+template <typename T> struct simd_scalar {
+    typedef T type;
+    static const int width = 1;
+    static type load(const T* p) { return *p; }
+    static void store(T* p, type a) { *p = a; }
+    static type set1(T x) { return x; }
+    static type zero() { return 0; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    static type div(type a, type b) { return a / b; }
+    static type sqrt(type a) { return std::sqrt(a); }
+    static type rsqrt(type a) { return 1 / std::sqrt(a); }
+    static type positive_or_zero(type c, type x) { return c > 0 ? x : 0; }
+    static T sum(type a) { return a; }
+};
+
+/**
+ * @brief Lanes of T processed together: one scalar (simd_scalar) when no
+ * SIMD is available.
+ *
+ * Every specialisation has a register type `type`, a lane count `width`,
+ * and static load/store (unaligned), set1, zero, add, sub, mul, div, sqrt,
+ * rsqrt, positive_or_zero(c, x) (x where c > 0, else 0) and sum
+ * (horizontal). For float, rsqrt is the hardware estimate refined by one
+ * Newton-Raphson step (about 1 ulp short of 1 / sqrt); for double it is
+ * exact, since only AVX-512 has a double estimate.
+ *
+ * @tparam T float or double.
+ */
+template <typename T> struct simd : simd_scalar<T> {};
+
+#if defined(__AVX__)
+
+template <> struct simd<float> {
+    typedef __m256 type;
+    static const int width = 8;
+    static type load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, type a) { _mm256_storeu_ps(p, a); }
+    static type set1(float x) { return _mm256_set1_ps(x); }
+    static type zero() { return _mm256_setzero_ps(); }
+    static type add(type a, type b) { return _mm256_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm256_div_ps(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_ps(a); }
+    static type rsqrt(type a) {
+        type y = _mm256_rsqrt_ps(a);
+        type ayy = mul(mul(a, y), y);
+        return mul(mul(set1(0.5f), y), sub(set1(3.0f), ayy));
+    }
+    static type positive_or_zero(type c, type x) {
+        return _mm256_and_ps(_mm256_cmp_ps(c, zero(), _CMP_GT_OQ), x);
+    }
+    static float sum(type a) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a),
+                              _mm256_extractf128_ps(a, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+};
+
+template <> struct simd<double> {
+    typedef __m256d type;
+    static const int width = 4;
+    static type load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, type a) { _mm256_storeu_pd(p, a); }
+    static type set1(double x) { return _mm256_set1_pd(x); }
+    static type zero() { return _mm256_setzero_pd(); }
+    static type add(type a, type b) { return _mm256_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm256_div_pd(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_pd(a); }
+    static type rsqrt(type a) { return div(set1(1.0), sqrt(a)); }
+    static type positive_or_zero(type c, type x) {
+        return _mm256_and_pd(_mm256_cmp_pd(c, zero(), _CMP_GT_OQ), x);
+    }
+    static double sum(type a) {
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a),
+                               _mm256_extractf128_pd(a, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+};
+
+#elif defined(__SSE2__)
+
+template <> struct simd<float> {
+    typedef __m128 type;
+    static const int width = 4;
+    static type load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, type a) { _mm_storeu_ps(p, a); }
+    static type set1(float x) { return _mm_set1_ps(x); }
+    static type zero() { return _mm_setzero_ps(); }
+    static type add(type a, type b) { return _mm_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm_div_ps(a, b); }
+    static type sqrt(type a) { return _mm_sqrt_ps(a); }
+    static type rsqrt(type a) {
+        type y = _mm_rsqrt_ps(a);
+        type ayy = mul(mul(a, y), y);
+        return mul(mul(set1(0.5f), y), sub(set1(3.0f), ayy));
+    }
+    static type positive_or_zero(type c, type x) {
+        return _mm_and_ps(_mm_cmpgt_ps(c, zero()), x);
+    }
+    static float sum(type a) {
+        __m128 s = _mm_add_ps(a, _mm_movehl_ps(a, a));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+};
+
+template <> struct simd<double> {
+    typedef __m128d type;
+    static const int width = 2;
+    static type load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, type a) { _mm_storeu_pd(p, a); }
+    static type set1(double x) { return _mm_set1_pd(x); }
+    static type zero() { return _mm_setzero_pd(); }
+    static type add(type a, type b) { return _mm_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm_div_pd(a, b); }
+    static type sqrt(type a) { return _mm_sqrt_pd(a); }
+    static type rsqrt(type a) { return div(set1(1.0), sqrt(a)); }
+    static type positive_or_zero(type c, type x) {
+        return _mm_and_pd(_mm_cmpgt_pd(c, zero()), x);
+    }
+    static double sum(type a) {
+        return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a)));
+    }
+};
+
+#endif
+
+} // namespace detail
+
+} // namespace HQ
+
+#endif // _HQSIMD_HPP_
@@ -0,0 +1,103 @@
+/**
+ * @file hqspatial.hpp
+ * @brief This file defines spatial sorting: reordering point arrays (and
+ * any companion arrays) along a space-filling curve.
+ */
+
+#ifndef _HQSPATIAL_HPP_
+#define _HQSPATIAL_HPP_
+
+#include "hqalloc.hpp"
+#include "hqbounds.hpp"
+#include "hqcurve.hpp"
+#include "hqparallel.hpp"
+#include "hqradix.hpp"
+#include "hqvec.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief The space-filling curve a spatial sort follows.
+ */
+enum class curve_order {
+    /** @brief Z-order; cheapest keys, with jumps between octants. */
+    morton,
+    /** @brief Hilbert order; consecutive cells are always adjacent. */
+    hilbert
+};
+
+namespace detail {
+
+inline void permute_each(const std::uint32_t*, std::size_t) {}
+
+/**
+ * @brief Applies permute to each array of a pack.
+ */
+template <typename U, typename... Rest>
+void permute_each(const std::uint32_t* order, std::size_t count, U* data,
+                  Rest*... rest) {
+    permute(order, data, count);
+    permute_each(order, count, rest...);
+}
+
+} // namespace detail
+
+/**
+ * @brief Computes the order of points along a space-filling curve over
+ * their bounding box, without moving anything.
+ *
+ * @param points The points.
+ * @param count The number of points (less than 2^32).
+ * @param order The curve to follow.
+ * @return std::vector<std::uint32_t> The permutation: position i of the
+ * sorted order holds original index result[i]. Ties keep their original
+ * relative order.
+ */
+template <typename T>
+std::vector<std::uint32_t> spatial_order(const vec3<T>* points,
+                                         std::size_t count,
+                                         curve_order order) {
+    detail::kernel_scratch<std::uint64_t> keys(count);
+    std::vector<std::uint32_t> out(count);
+    aabb<T, 3> box = bounding_box(points, count);
+    if (order == curve_order::morton)
+        morton_encode(points, count, box, keys.data());
+    else
+        hilbert_encode(points, count, box, keys.data());
+    parallel_for(0, count,
+                 [&](std::size_t i) { out[i] = (std::uint32_t)i; }, 4096);
+    radix_sort(keys.data(), out.data(), count);
+    return out;
+}
+
+/**
+ * @brief Sorts points along a space-filling curve and applies the same
+ * reordering to any number of companion arrays, across threads.
+ *
+ * Points close along the curve are close in space, so after sorting,
+ * neighbour loops touch nearby memory.
+ *
+ * @tparam Companions Element types of the companion arrays.
+ * @param points The points, reordered in place.
+ * @param count The number of points (less than 2^32).
+ * @param order The curve to follow.
+ * @param companions Arrays of count elements each (e.g. velocities,
+ * masses), reordered in place.
+ * @return std::vector<std::uint32_t> The permutation applied, as from
+ * spatial_order; pass it to permute to reorder further arrays later.
+ */
+template <typename T, typename... Companions>
+std::vector<std::uint32_t> spatial_sort(vec3<T>* points, std::size_t count,
+                                        curve_order order,
+                                        Companions*... companions) {
+    std::vector<std::uint32_t> out = spatial_order(points, count, order);
+    detail::permute_each(out.data(), count, points, companions...);
+    return out;
+}
+
+} // namespace HQ
+
+#endif // _HQSPATIAL_HPP_
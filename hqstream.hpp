@@ -0,0 +1,275 @@
+/**
+ * @file hqstream.hpp
+ * @brief This file defines a chunked, out-of-core pipeline for processing vec
+ * arrays stored in files.
+ */
+
+#ifndef _HQSTREAM_HPP_
+#define _HQSTREAM_HPP_
+
+#include "hqasync.hpp"
+#include "hqparallel.hpp"
+#include "hqvec.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace HQ {
+
+/**
+ * @brief Timing for one stage of a pipeline run.
+ */
+struct stage_stats {
+    /** @brief The stage name. */
+    std::string name;
+    /** @brief Wall time spent in the stage. */
+    double seconds = 0;
+    /** @brief Vectors that passed through the stage. */
+    std::uint64_t items = 0;
+
+    /**
+     * @brief Returns the stage's throughput.
+     *
+     * @return double Vectors per second (0 if the stage took no time).
+     */
+    double throughput() const { return seconds > 0 ? items / seconds : 0; }
+};
+
+/**
+ * @brief Timing for a whole pipeline run.
+ */
+struct pipeline_stats {
+    /** @brief "read", each user stage in order, then the sink. */
+    std::vector<stage_stats> stages;
+    /** @brief Number of chunks processed. */
+    std::size_t chunks = 0;
+    /** @brief Bytes of chunk buffers held at once (input plus output). */
+    std::size_t buffer_bytes = 0;
+    /** @brief Wall time of the whole run. */
+    double total_seconds = 0;
+    /** @brief False if the input or output file could not be opened. */
+    bool ok = true;
+
+    /**
+     * @brief Outputs the statistics as a table.
+     *
+     * @param os The output stream.
+     * @param s The statistics to output.
+     * @return std::ostream& The output stream.
+     */
+    friend std::ostream& operator<<(std::ostream& os, const pipeline_stats& s) {
+        for (std::size_t i = 0; i < s.stages.size(); i++) {
+            os << s.stages[i].name << ": " << s.stages[i].seconds << " s, "
+               << s.stages[i].throughput() << " vec/s" << std::endl;
+        }
+        os << "total: " << s.total_seconds << " s over " << s.chunks
+           << " chunks, " << s.buffer_bytes << " bytes buffered" << std::endl;
+        return os;
+    }
+};
+
+/**
+ * @brief Streams fixed-size chunks of a raw vec<T, n> file through a chain of
+ * batch operations.
+ *
+ * Memory is bounded to two input chunks (the one being processed and the
+ * one being prefetched) plus two output chunks when writing to a file. Each
+ * stage is run across threads on static partitions of the chunk.
+ *
+ * @tparam T The data type of the vectors.
+ * @tparam n The dimension of the vectors.
+ */
+template <typename T, std::size_t n> class vec_pipeline {
+  public:
+    /**
+     * @brief A batch operation on `count` vectors, the first of which is
+     * vector `first` of the file. Called concurrently on disjoint ranges.
+     */
+    typedef std::function<void(vec<T, n>*, std::size_t, std::uint64_t)> stage;
+
+    /**
+     * @brief Receives each processed chunk in file order on the calling
+     * thread, e.g. to reduce it.
+     */
+    typedef std::function<void(const vec<T, n>*, std::size_t, std::uint64_t)>
+        sink;
+
+  private:
+    std::size_t m_chunk;
+    std::vector<std::string> m_names;
+    std::vector<stage> m_stages;
+
+    static double seconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+            .count();
+    }
+
+    // waits for reads still in flight, so a throwing stage cannot free a
+    // buffer the file is still filling
+    struct read_guard {
+        std::future<std::size_t>* pending;
+
+        ~read_guard() {
+            for (int i = 0; i < 2; i++) {
+                if (pending[i].valid())
+                    pending[i].wait();
+            }
+        }
+    };
+
+    pipeline_stats empty_stats(const std::string& sink_name) const {
+        pipeline_stats stats;
+        stats.stages.resize(m_stages.size() + 2);
+        stats.stages[0].name = "read";
+        for (std::size_t i = 0; i < m_stages.size(); i++) {
+            stats.stages[i + 1].name = m_names[i];
+        }
+        stats.stages.back().name = sink_name;
+        return stats;
+    }
+
+    pipeline_stats run_impl(async_file& file, const sink& consume,
+                            const std::string& sink_name,
+                            std::size_t extra_bytes) {
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start_run = clock::now();
+        pipeline_stats stats = empty_stats(sink_name);
+        std::uint64_t total = file.size() / sizeof(vec<T, n>);
+        std::vector<vec<T, n>> buf[2];
+        std::future<std::size_t> pending[2];
+        read_guard guard = {pending};
+        std::size_t chunk =
+            total < (std::uint64_t)m_chunk ? (std::size_t)total : m_chunk;
+        buf[0].resize(chunk);
+        buf[1].resize(chunk);
+        stats.buffer_bytes = 2 * chunk * sizeof(vec<T, n>) + extra_bytes;
+        if (total == 0)
+            return stats;
+
+        pending[0] = file.read(buf[0].data(), chunk, 0);
+        int cur = 0;
+        for (std::uint64_t first = 0; first < total; first += chunk) {
+            std::size_t len = total - first < (std::uint64_t)chunk
+                                  ? (std::size_t)(total - first)
+                                  : chunk;
+            clock::time_point t0 = clock::now();
+            pending[cur].get();
+            stats.stages[0].seconds += seconds_since(t0);
+            stats.stages[0].items += len;
+
+            // prefetch the next chunk while this one is processed
+            std::uint64_t next = first + chunk;
+            if (next < total) {
+                std::size_t next_len = total - next < (std::uint64_t)chunk
+                                           ? (std::size_t)(total - next)
+                                           : chunk;
+                pending[cur ^ 1] =
+                    file.read(buf[cur ^ 1].data(), next_len,
+                              next * sizeof(vec<T, n>));
+            }
+
+            vec<T, n>* data = buf[cur].data();
+            for (std::size_t s = 0; s < m_stages.size(); s++) {
+                t0 = clock::now();
+                const stage& op = m_stages[s];
+                parallel_for_ranges(
+                    0, len,
+                    [&](std::size_t lo, std::size_t hi, unsigned) {
+                        op(data + lo, hi - lo, first + lo);
+                    },
+                    4096);
+                stats.stages[s + 1].seconds += seconds_since(t0);
+                stats.stages[s + 1].items += len;
+            }
+
+            t0 = clock::now();
+            consume(data, len, first);
+            stats.stages.back().seconds += seconds_since(t0);
+            stats.stages.back().items += len;
+            stats.chunks++;
+            cur ^= 1;
+        }
+        stats.total_seconds = seconds_since(start_run);
+        return stats;
+    }
+
+  public:
+    /**
+     * @brief Creates an empty pipeline.
+     *
+     * @param chunk Vectors per chunk.
+     */
+    vec_pipeline(std::size_t chunk = 1 << 20) : m_chunk(chunk ? chunk : 1) {}
+
+    /**
+     * @brief Appends a stage to the chain.
+     *
+     * @param name Name reported in the statistics.
+     * @param op The batch operation.
+     * @return vec_pipeline& This pipeline, for chaining.
+     */
+    vec_pipeline& then(const std::string& name, stage op) {
+        m_names.push_back(name);
+        m_stages.push_back(op);
+        return *this;
+    }
+
+    /**
+     * @brief Runs the pipeline, handing each processed chunk to a sink.
+     *
+     * @param input Path of a raw vec<T, n> array.
+     * @param consume The sink.
+     * @return pipeline_stats Per-stage timing; ok is false if the input
+     * could not be opened.
+     */
+    pipeline_stats run(const std::string& input, const sink& consume) {
+        async_file file(input, false);
+        if (!file.is_open()) {
+            pipeline_stats stats = empty_stats("sink");
+            stats.ok = false;
+            return stats;
+        }
+        return run_impl(file, consume, "sink", 0);
+    }
+
+    /**
+     * @brief Runs the pipeline, writing the processed vectors to a file.
+     *
+     * @param input Path of a raw vec<T, n> array.
+     * @param output Path of the raw vec<T, n> array to create.
+     * @return pipeline_stats Per-stage timing; the last stage is the time
+     * spent queueing writes. ok is false if either file could not be opened,
+     * and the output is left untouched if the input could not.
+     */
+    pipeline_stats run(const std::string& input, const std::string& output) {
+        async_file in(input, false);
+        if (!in.is_open()) {
+            pipeline_stats stats = empty_stats("write");
+            stats.ok = false;
+            return stats;
+        }
+        async_file out(output, true);
+        if (!out.is_open()) {
+            pipeline_stats stats = empty_stats("write");
+            stats.ok = false;
+            return stats;
+        }
+        async_vec_writer<T, n> writer(out, m_chunk);
+        pipeline_stats stats = run_impl(
+            in,
+            [&writer](const vec<T, n>* data, std::size_t count,
+                      std::uint64_t) { writer.write(data, count); },
+            "write", 2 * m_chunk * sizeof(vec<T, n>));
+        writer.flush();
+        return stats;
+    }
+};
+
+} // namespace HQ
+
+#endif // _HQSTREAM_HPP_
@@ -9,7 +9,9 @@
 
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <iostream>
 #include <string>
 
@@ -777,7 +779,7 @@ template <typename T> class vec<T, 4> {
      * @param v The other vector.
      * @return T The squared distance between the two vectors.
      */
-    T distance2(const vec<T, 4> v) { return ((*this) - v).length2(); }
+    T distance2(const vec<T, 4> v) const { return ((*this) - v).length2(); }
 
     /**
      * @brief Computes the distance between two vectors.
@@ -785,7 +787,7 @@ template <typename T> class vec<T, 4> {
      * @param v The other vector.
      * @return T The distance between the two vectors.
      */
-    T distance(const vec<T, 4> v) { return ((*this) - v).length(); }
+    T distance(const vec<T, 4> v) const { return ((*this) - v).length(); }
 
     /**
      * @brief Computes the dot product of two vectors
@@ -1164,7 +1166,7 @@ template <typename T> class vec<T, 3> {
      * @param v The other vector.
      * @return T The squared distance between the two vectors.
      */
-    T distance2(const vec<T, 3> v) { return ((*this) - v).length2(); }
+    T distance2(const vec<T, 3> v) const { return ((*this) - v).length2(); }
 
     /**
      * @brief Computes the distance between two vectors.
@@ -1172,7 +1174,7 @@ template <typename T> class vec<T, 3> {
      * @param v The other vector.
      * @return T The distance between the two vectors.
      */
-    T distance(const vec<T, 3> v) { return ((*this) - v).length(); }
+    T distance(const vec<T, 3> v) const { return ((*this) - v).length(); }
 
     /**
      * @brief Computes the dot product of two vectors
@@ -1531,7 +1533,7 @@ template <typename T> class vec<T, 2> {
      * @param v The other vector.
      * @return T The squared distance between the two vectors.
      */
-    T distance2(const vec<T, 2> v) { return ((*this) - v).length2(); }
+    T distance2(const vec<T, 2> v) const { return ((*this) - v).length2(); }
 
     /**
      * @brief Computes the distance between two vectors.
@@ -1539,7 +1541,7 @@ template <typename T> class vec<T, 2> {
      * @param v The other vector.
      * @return T The distance between the two vectors.
      */
-    T distance(const vec<T, 2> v) { return ((*this) - v).length(); }
+    T distance(const vec<T, 2> v) const { return ((*this) - v).length(); }
 
     /**
      * @brief Computes the dot product of two vectors
@@ -1672,4 +1674,35 @@ HQ_MATH_FUNC_2(fmod)
 
 } // namespace HQ
 
+namespace std {
+
+/**
+ * @brief Hashes vectors, so they can key standard unordered containers.
+ *
+ * Component hashes are combined with distinct odd multipliers and the
+ * result goes through a 64-bit finalizer, so every output bit depends on
+ * every input bit (std::hash of an integer is often the identity).
+ *
+ * @tparam T The data type of the vector elements.
+ * @tparam n The dimension of the vector.
+ */
+template <typename T, std::size_t n> struct hash<HQ::vec<T, n>> {
+    std::size_t operator()(const HQ::vec<T, n>& v) const {
+        std::uint64_t h = 0x9e3779b97f4a7c15ull;
+        for (int i = 0; i < (int)n; i++) {
+            std::uint64_t c = (std::uint64_t)std::hash<T>()(v[i]);
+            h = (h ^ c) * (0xff51afd7ed558ccdull + 2 * (std::uint64_t)i);
+        }
+        // the MurmurHash3 finalizer
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return (std::size_t)h;
+    }
+};
+
+} // namespace std
+
 #endif // _HQVEC_HPP_
\ No newline at end of file
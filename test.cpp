@@ -1,5 +1,42 @@
+#include "hqalloc.hpp"
+#include "hqasync.hpp"
+#include "hqbarneshut.hpp"
+#include "hqbatch.hpp"
+#include "hqbvh.hpp"
+#include "hqcells.hpp"
+#include "hqcurve.hpp"
+#include "hqdelta.hpp"
+#include "hqfft.hpp"
+#include "hqfof.hpp"
+#include "hqhash.hpp"
+#include "hqkdtree.hpp"
+#include "hqkmeans.hpp"
+#include "hqmesh.hpp"
+#include "hqnbody.hpp"
+#include "hqnuma.hpp"
+#include "hqoctree.hpp"
+#include "hqparallel.hpp"
+#include "hqperiodic.hpp"
+#include "hqply.hpp"
+#include "hqquant.hpp"
+#include "hqradix.hpp"
+#include "hqspatial.hpp"
+#include "hqstream.hpp"
 #include "hqvec.hpp"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 using namespace HQ;
 
@@ -189,6 +226,1648 @@ template <typename T> bool test_special_reassign() {
 #define SPECIAL_REASSIGN_TEST(type)                                            \
     { TEST((test_special_reassign<type>())) }
 
+bool test_quantize_roundtrip(float error_bound) {
+    std::vector<vec3<float>> points(1001);
+    for (int i = 0; i < (int)points.size(); i++) {
+        points[i] = vec3<float>((float)(i % 17) * 0.37f - 3.0f,
+                                (float)(i % 101) * 1.13f,
+                                (float)i * 0.011f + 100.0f);
+    }
+    quantized_vec3 q = quantize(points.data(), points.size(), error_bound);
+    std::vector<vec3<float>> decoded = dequantize(q);
+    if ((q.max_error > error_bound) || (q.compression_ratio() <= 1))
+        return false;
+    for (int i = 0; i < (int)points.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+            if (std::fabs(decoded[i][k] - points[i][k]) > error_bound)
+                return false;
+        }
+    }
+    return true;
+}
+
+// codes at the top of an axis must stay within the field width, in the SSE
+// lanes and the scalar tail alike, and a NaN must not spill into its
+// neighbours
+bool test_quantize_top_code() {
+    const float error_bound = 0.001f;
+    for (int top = 0; top < 13; top++) {
+        std::vector<vec3<float>> points(13);
+        for (int i = 0; i < 13; i++) {
+            points[i] = vec3<float>(16.3666172f * (float)((i + top) % 13) / 12,
+                                    0.5f, (float)i * 0.01f);
+        }
+        if (top == 5)
+            points[7].y = std::numeric_limits<float>::quiet_NaN();
+        quantized_vec3 q = quantize(points.data(), points.size(), error_bound);
+        std::vector<vec3<float>> decoded = dequantize(q);
+        float worst = 0;
+        for (int i = 0; i < 13; i++) {
+            for (int k = 0; k < 3; k++) {
+                if ((top == 5) && (i == 7) && (k == 1))
+                    continue;
+                worst = std::max(worst,
+                                 std::fabs(decoded[i][k] - points[i][k]));
+            }
+        }
+        if ((worst > error_bound) || (worst > q.max_error) ||
+            ((top == 5) != std::isnan(q.max_error)))
+            return false;
+    }
+    return true;
+}
+
+bool test_delta_roundtrip(delta_predictor predictor) {
+    const int count = 257;
+    const int nframes = 23;
+    delta_trajectory traj;
+    traj.count = count;
+    traj.keyframe_interval = 8;
+    traj.predictor = predictor;
+    std::vector<std::vector<vec3<float>>> frames(nframes);
+    delta_encoder encoder(traj);
+    for (int f = 0; f < nframes; f++) {
+        frames[f].resize(count);
+        for (int i = 0; i < count; i++) {
+            float t = (float)f * 0.01f;
+            frames[f][i] = vec3<float>((float)i + t, -(float)i * 0.5f + t * t,
+                                       std::sin((float)i + t));
+        }
+        encoder.add_frame(frames[f]);
+    }
+
+    std::stringstream stream;
+    traj.write(stream);
+    delta_trajectory loaded;
+    if (!loaded.read(stream) || (loaded.frames() != (std::size_t)nframes))
+        return false;
+
+    // out-of-order access exercises keyframe seeking
+    delta_decoder decoder(loaded);
+    const int order[] = {0, 1, 2, 3, 22, 9, 10, 5, 16, 17, 18};
+    for (int f : order) {
+        if (decoder.decode(f) != frames[f])
+            return false;
+    }
+    return traj.compression_ratio() > 1;
+}
+
+// corrupt headers, offsets and payloads are rejected without allocating
+// what the header claims or reading past the payload
+bool test_delta_malformed() {
+    delta_trajectory traj;
+    traj.count = 40;
+    traj.keyframe_interval = 4;
+    std::vector<vec3<float>> frame(40);
+    delta_encoder encoder(traj);
+    for (int f = 0; f < 7; f++) {
+        for (int i = 0; i < 40; i++) {
+            frame[i] = vec3<float>((float)i, (float)f * 0.1f, (float)(i * f));
+        }
+        encoder.add_frame(frame);
+    }
+    std::stringstream out;
+    traj.write(out);
+    const std::string good = out.str();
+    const std::size_t offsets_at = 36;
+    auto rejects = [](const std::string& bytes) {
+        std::stringstream in(bytes);
+        delta_trajectory loaded;
+        return !loaded.read(in) && (loaded.frames() == 0);
+    };
+    auto patch = [&](std::size_t at, std::uint64_t value, std::size_t size) {
+        std::string bytes = good;
+        std::memcpy(&bytes[at], &value, size);
+        return bytes;
+    };
+    std::uint64_t third, fourth;
+    std::memcpy(&third, &good[offsets_at + 2 * 8], 8);
+    std::memcpy(&fourth, &good[offsets_at + 3 * 8], 8);
+    std::string dangling = good;
+    dangling[dangling.size() - 1] |= (char)0x80;
+    std::stringstream in(good);
+    delta_trajectory loaded;
+    return loaded.read(in) && (loaded.frames() == 7) &&
+           rejects(good.substr(0, good.size() - 1)) &&
+           rejects(patch(4, 41, 8)) &&                      // count
+           rejects(patch(20, std::uint64_t(1) << 60, 8)) && // frames
+           rejects(patch(28, std::uint64_t(1) << 40, 8)) && // payload bytes
+           rejects(patch(offsets_at, 1, 8)) &&
+           rejects(patch(offsets_at + 2 * 8, fourth, 8)) &&
+           rejects(patch(offsets_at + 3 * 8, third, 8)) &&
+           rejects(patch(offsets_at + 6 * 8, good.size(), 8)) &&
+           rejects(dangling);
+}
+
+bool test_async_roundtrip(bool use_io_uring) {
+    const char* path = "test_async.bin";
+    std::vector<vec3<float>> points(10000);
+    for (int i = 0; i < (int)points.size(); i++) {
+        points[i] = vec3<float>((float)i, (float)i * 2, (float)i * 3);
+    }
+    std::size_t completed = 0;
+    {
+        async_file file(path, true, use_io_uring);
+        if (!file.is_open())
+            return false;
+        async_vec_writer<float, 3> writer(
+            file, 3000, 0, nullptr,
+            [&completed](std::size_t bytes) { completed += bytes; });
+        writer.write(points.data(), points.size());
+        writer.flush();
+    }
+    std::vector<vec3<float>> loaded(points.size());
+    {
+        async_file file(path, false, use_io_uring);
+        std::future<std::size_t> done =
+            file.read(loaded.data(), loaded.size(), 0);
+        if (done.get() != points.size() * sizeof(vec3<float>))
+            return false;
+    }
+    std::remove(path);
+    return (completed == points.size() * sizeof(vec3<float>)) &&
+           (loaded == points);
+}
+
+bool test_pipeline() {
+    const char* in_path = "test_pipeline_in.bin";
+    const char* out_path = "test_pipeline_out.bin";
+    const int count = 10007;
+    std::vector<vec3<float>> points(count);
+    for (int i = 0; i < count; i++) {
+        points[i] = vec3<float>((float)i, 1, -(float)i);
+    }
+    {
+        async_file file(in_path, true);
+        file.write(points.data(), points.size(), 0).get();
+    }
+
+    set_num_threads(3);
+    vec_pipeline<float, 3> pipeline(1000);
+    pipeline
+        .then("scale",
+              [](vec3<float>* v, std::size_t c, std::uint64_t) {
+                  for (std::size_t i = 0; i < c; i++)
+                      v[i] = v[i] * 2.0f;
+              })
+        .then("shift", [](vec3<float>* v, std::size_t c, std::uint64_t) {
+            for (std::size_t i = 0; i < c; i++)
+                v[i] = v[i] + 1.0f;
+        });
+    double sum = 0;
+    std::uint64_t expected_first = 0;
+    bool ordered = true;
+    pipeline_stats stats = pipeline.run(
+        in_path, [&](const vec3<float>* v, std::size_t c, std::uint64_t first) {
+            ordered = ordered && (first == expected_first);
+            expected_first += c;
+            for (std::size_t i = 0; i < c; i++)
+                sum += v[i].y;
+        });
+    pipeline.run(in_path, out_path);
+    set_num_threads(0);
+
+    std::vector<vec3<float>> loaded(count);
+    {
+        async_file file(out_path, false);
+        file.read(loaded.data(), loaded.size(), 0).get();
+    }
+    std::remove(in_path);
+    std::remove(out_path);
+    for (int i = 0; i < count; i++) {
+        if (loaded[i] != points[i] * 2.0f + 1.0f)
+            return false;
+    }
+    return ordered && (sum == 3.0 * count) && (stats.chunks == 11) &&
+           (stats.stages.size() == 4) && (stats.stages[1].items == count);
+}
+
+// a missing input reports failure and leaves the output alone, and a stage
+// that throws waits for the prefetch before its buffer goes away
+bool test_pipeline_failures() {
+    const char* in_path = "test_pipeline_in.bin";
+    const char* out_path = "test_pipeline_out.bin";
+    std::vector<vec3<float>> points(5000, vec3<float>(1, 2, 3));
+    {
+        async_file in(in_path, true);
+        async_file out(out_path, true);
+        in.write(points.data(), points.size(), 0).get();
+        out.write(points.data(), 10, 0).get();
+    }
+    vec_pipeline<float, 3> pipeline(1000);
+    pipeline_stats missing =
+        pipeline.run("test_pipeline_missing.bin", out_path);
+    bool ok = !missing.ok && (missing.chunks == 0);
+    {
+        async_file out(out_path, false);
+        ok = ok && (out.size() == 10 * sizeof(vec3<float>));
+    }
+    pipeline.then("fail", [](vec3<float>*, std::size_t, std::uint64_t) {
+        throw 1;
+    });
+    bool threw = false;
+    try {
+        pipeline.run(in_path,
+                     [](const vec3<float>*, std::size_t, std::uint64_t) {});
+    } catch (int) {
+        threw = true;
+    }
+    std::remove(in_path);
+    std::remove(out_path);
+    return ok && threw;
+}
+
+template <typename T> bool test_point_cloud_roundtrip() {
+    const char* path = "test_points.ply";
+    const int count = 5003;
+    std::vector<vec3<T>> points(count);
+    std::vector<vec4<std::uint8_t>> colors(count);
+    for (int i = 0; i < count; i++) {
+        points[i] = vec3<T>((T)i * (T)0.125, -(T)i, (T)1 / (T)(i + 1));
+        colors[i] = vec4<std::uint8_t>(i % 256, (i * 7) % 256, 3, 200);
+    }
+    set_num_threads(4);
+    bool ok = true;
+    for (int binary = 0; binary < 2; binary++) {
+        std::vector<vec3<T>> loaded;
+        std::vector<vec4<std::uint8_t>> loaded_colors;
+        std::vector<T> x, y, z;
+        ok = ok && write_ply(path, points.data(), count, colors.data(),
+                             binary == 1);
+        ok = ok && read_ply(path, loaded, &loaded_colors);
+        ok = ok && read_ply(path, x, y, z);
+        ok = ok && (loaded == points) && (loaded_colors == colors);
+        ok = ok && (x.size() == (std::size_t)count) && (y[10] == points[10].y);
+    }
+    {
+        std::vector<vec3<T>> loaded;
+        std::vector<vec4<std::uint8_t>> loaded_colors;
+        ok = ok && write_xyz(path, points.data(), count, colors.data());
+        ok = ok && read_xyz(path, loaded, &loaded_colors);
+        ok = ok && (loaded == points) && (loaded_colors.size() == count) &&
+             (loaded_colors[77] == vec4<std::uint8_t>(77, 27, 3, 255));
+    }
+    set_num_threads(0);
+    std::remove(path);
+    return ok;
+}
+
+bool test_ply_ascii_with_faces() {
+    const char* path = "test_faces.ply";
+    FILE* f = std::fopen(path, "w");
+    std::fprintf(f, "ply\nformat ascii 1.0\ncomment made by hand\n"
+                    "element vertex 3\nproperty float x\nproperty float y\n"
+                    "property float z\nproperty float nx\n"
+                    "element face 1\nproperty list uchar int vertex_index\n"
+                    "end_header\n1 2 3 0\n4 5 6 0\n\n7 8 9 1\n3 0 1 2\n");
+    std::fclose(f);
+    std::vector<vec3<float>> loaded;
+    bool ok = read_ply(path, loaded);
+    std::remove(path);
+    return ok && (loaded.size() == 3) && (loaded[2] == vec3<float>(7, 8, 9));
+}
+
+// vertex counts the file cannot hold fail cleanly instead of allocating,
+// and an empty XYZ file reads back as no points
+bool test_point_cloud_malformed() {
+    const char* path = "test_malformed.ply";
+    const char* headers[] = {
+        "ply\nformat binary_little_endian 1.0\n"
+        "element vertex 4611686018427387904\nproperty float x\n"
+        "property float y\nproperty float z\nend_header\n",
+        // skip + count * stride wraps around
+        "ply\nformat binary_little_endian 1.0\nelement pad 1\n"
+        "property uchar p\nelement vertex 1537228672809129302\n"
+        "property float x\nproperty float y\nproperty float z\n"
+        "end_header\n",
+        // skipping the first element overflows
+        "ply\nformat binary_little_endian 1.0\n"
+        "element pad 9223372036854775807\nproperty double p\n"
+        "element vertex 1\nproperty float x\nproperty float y\n"
+        "property float z\nend_header\n",
+        "ply\nformat ascii 1.0\nelement vertex 99999999999999\n"
+        "property float x\nproperty float y\nproperty float z\n"
+        "end_header\n1 2 3\n4 5 6\n"};
+    bool ok = true;
+    for (const char* header : headers) {
+        FILE* f = std::fopen(path, "wb");
+        std::fputs(header, f);
+        std::fputs("0123456789abcdef0123456789abcdef", f);
+        std::fclose(f);
+        std::vector<vec3<float>> loaded;
+        ok = ok && !read_ply(path, loaded);
+    }
+    std::vector<vec3<float>> loaded(3);
+    ok = ok && write_xyz(path, loaded.data(), 0) && read_xyz(path, loaded) &&
+         loaded.empty();
+    std::remove(path);
+    return ok;
+}
+
+template <typename T, std::size_t n> bool test_vec_array() {
+    vec_array<T, n> a;
+    for (int i = 0; i < 1000; i++) {
+        vec<T, n> v;
+        v[0] = (T)i;
+        a.push_back(v);
+    }
+    if (((std::uintptr_t)a.data() % cache_line_size) != 0)
+        return false;
+    if ((a.padded_scalars() * sizeof(T)) % cache_line_size != 0)
+        return false;
+    for (std::size_t i = a.size() * n; i < a.padded_scalars(); i++) {
+        if (a.scalars()[i] != 0)
+            return false;
+    }
+    vec_array<T, n> b = a;
+    b.resize(10);
+    b.resize(20);
+    if ((b[9][0] != 9) || (b[15][0] != 0) || (a[999][0] != 999))
+        return false;
+
+    vec_array<T, n> huge(1 << 18,
+                         aligned_allocator<vec<T, n>>(page_policy::huge));
+    huge[(1 << 18) - 1][0] = 1;
+    std::vector<vec<T, n>, aligned_allocator<vec<T, n>, 32>> v(3);
+    return ((std::uintptr_t)v.data() % 32) == 0;
+}
+
+bool test_arena() {
+    arena a(1024);
+    arena::marker start = a.mark();
+    for (int frame = 0; frame < 3; frame++) {
+        vec_array<float, 3, arena_allocator<vec3<float>>> scratch(
+            (arena_allocator<vec3<float>>(a)));
+        for (int i = 0; i < 500; i++) {
+            scratch.push_back(vec3<float>((float)i, 0, 0));
+        }
+        std::vector<int, arena_allocator<int>> ids(
+            100, 7, arena_allocator<int>(a));
+        if ((scratch[499].x != 499) || (ids[99] != 7))
+            return false;
+        {
+            arena_scope scope(a);
+            a.allocate(4000);
+        }
+        a.reset();
+    }
+    arena_stats stats = a.stats();
+    bool ok = (stats.in_use == 0) && (stats.high_water >= 500 * 12) &&
+              (stats.blocks == 1) && (a.mark().block == start.block);
+    {
+        scratch_buffer<int> buf(10, 3);
+        ok = ok && (buf[9] == 3) && (thread_arena().stats().in_use > 0);
+    }
+    // kernels take their scratch from the thread arena and give it back
+    thread_arena().reset_stats();
+    std::vector<std::uint32_t> keys(5000);
+    for (int i = 0; i < 5000; i++) {
+        keys[i] = (std::uint32_t)(i * 7919) % 5000;
+    }
+    radix_sort(keys.data(), keys.size());
+    stats = thread_arena().stats();
+    return ok && (stats.in_use == 0) && (stats.allocations > 0) &&
+           (stats.high_water >= 2 * 5000 * sizeof(std::uint32_t)) &&
+           std::is_sorted(keys.begin(), keys.end());
+}
+
+bool test_numa_vec_array() {
+    bool ok = numa_node_count() >= 1;
+    set_num_threads(3);
+    set_pin_threads(true);
+    numa_vec_array<double, 3> a(1 << 20);
+    numa_vec_array<double, 3> b(
+        1000, numa_allocator<vec3<double>>(numa_policy::interleave));
+    first_touch_fill(b.data(), b.size(), vec3<double>(1, 2, 3));
+    set_pin_threads(false);
+    set_num_threads(0);
+    ok = ok && (a[(1 << 20) - 1] == vec3<double>()) &&
+         (b[999] == vec3<double>(1, 2, 3));
+    b.resize(5000);
+    return ok && (b[999] == vec3<double>(1, 2, 3)) &&
+           (b[4999] == vec3<double>());
+}
+
+template <typename T, std::size_t n> bool test_streaming_transform() {
+    const int count = 10007;
+    std::vector<vec<T, n>> a(count), b(count), cached(count), streamed(count);
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < (int)n; k++) {
+            a[i][k] = (T)(i + k);
+            b[i][k] = (T)(2 * k);
+        }
+    }
+    set_num_threads(3);
+    axpy(a.data(), (T)3, b.data(), cached.data(), count, store_policy::cached);
+    axpy(a.data(), (T)3, b.data(), streamed.data(), count,
+         store_policy::streaming);
+    transform(
+        a.data(), a.data(), count,
+        [](const vec<T, n>& v) { return v + (T)1; }, store_policy::streaming);
+    set_num_threads(0);
+    std::vector<vec<T, n>> filled(3);
+    fill(filled.data() + 1, 1, b[1], store_policy::streaming);
+    return (cached == streamed) &&
+           (streamed[5] == (a[5] - (T)1) * (T)3 + b[5]) &&
+           (filled[0] == vec<T, n>()) && (filled[1] == b[1]) &&
+           (filled[2] == vec<T, n>()) && (last_level_cache_size() > 0);
+}
+
+template <typename T, std::size_t n> bool test_gather_scatter() {
+    const int count = 5003;
+    std::vector<vec<T, n>> src(count), gathered(count), sums(7);
+    std::vector<std::uint32_t> idx(count);
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < (int)n; k++) {
+            src[i][k] = (T)(i * (int)n + k);
+        }
+        idx[i] = (std::uint32_t)((i * 7919) % count);
+    }
+    set_num_threads(3);
+    set_prefetch_distance(8);
+    gather(src.data(), idx.data(), gathered.data(), count);
+    set_num_threads(0);
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        ok = ok && (gathered[i] == src[idx[i]]);
+    }
+    // every index repeats, so the sums catch lost updates
+    std::vector<std::uint32_t> buckets(count);
+    vec<T, n> expected[7];
+    for (int i = 0; i < count; i++) {
+        buckets[i] = (std::uint32_t)(i % 7);
+        expected[i % 7] = expected[i % 7] + src[i];
+    }
+    scatter_add(src.data(), buckets.data(), sums.data(), count);
+    for (int b = 0; b < 7; b++) {
+        ok = ok && (sums[b] == expected[b]);
+    }
+    set_prefetch_distance(16);
+    return ok;
+}
+
+// deterministic points in [0, scale) on every axis
+template <typename T, std::size_t n>
+std::vector<vec<T, n>> random_points(int count, std::uint32_t seed,
+                                     T scale = 1) {
+    std::vector<vec<T, n>> out(count);
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < (int)n; k++) {
+            seed = seed * 1664525u + 1013904223u;
+            out[i][k] = (T)(seed >> 8) / (T)(1 << 24) * scale;
+        }
+    }
+    return out;
+}
+
+template <typename T, std::size_t n> bool test_kd_tree() {
+    std::vector<vec<T, n>> points = random_points<T, n>(3001, 7);
+    std::vector<vec<T, n>> queries = random_points<T, n>(50, 11);
+    set_num_threads(3);
+    kd_tree<T, n> tree(points.data(), points.size(), 4);
+    const std::size_t k = 5;
+    std::vector<neighbor<T>> batch(queries.size() * k);
+    tree.knn(queries.data(), queries.size(), k, batch.data());
+    std::vector<std::vector<neighbor<T>>> within;
+    const T r = (T)0.3;
+    tree.radius(queries.data(), queries.size(), r, within);
+    set_num_threads(0);
+    for (int q = 0; q < (int)queries.size(); q++) {
+        std::vector<T> brute(points.size());
+        std::size_t inside = 0;
+        for (int i = 0; i < (int)points.size(); i++) {
+            brute[i] = points[i].distance2(queries[q]);
+            inside += brute[i] <= r * r ? 1 : 0;
+        }
+        std::sort(brute.begin(), brute.end());
+        for (int j = 0; j < (int)k; j++) {
+            neighbor<T> got = batch[q * k + j];
+            if ((got.distance2 != brute[j]) ||
+                (points[got.index].distance2(queries[q]) != brute[j]))
+                return false;
+        }
+        if (within[q].size() != inside)
+            return false;
+    }
+    // asking for more neighbours than points pads with npos
+    kd_tree<T, n> small(points.data(), 3);
+    std::vector<neighbor<T>> padded(4);
+    small.knn(queries.data(), 1, 4, padded.data());
+    return (small.size() == 3) && (padded[3].index == kd_tree<T, n>::npos);
+}
+
+// entry parameter of a ray into a box, or infinity for a miss
+float ray_box(const aabb<float, 3>& box, const ray& r) {
+    float near = r.tmin, far = r.tmax;
+    for (int k = 0; k < 3; k++) {
+        float inv = 1.0f / r.direction[k];
+        float t1 = (box.lo[k] - r.origin[k]) * inv;
+        float t2 = (box.hi[k] - r.origin[k]) * inv;
+        near = std::max(near, std::min(t1, t2));
+        far = std::min(far, std::max(t1, t2));
+    }
+    return near <= far ? near : std::numeric_limits<float>::infinity();
+}
+
+template <std::size_t W> bool test_bvh() {
+    std::vector<vec3<float>> centers = random_points<float, 3>(2000, 3, 10);
+    std::vector<vec3<float>> sizes = random_points<float, 3>(2000, 5, 0.4f);
+    std::vector<aabb<float, 3>> boxes(centers.size());
+    for (int i = 0; i < (int)boxes.size(); i++) {
+        boxes[i] = aabb<float, 3>(centers[i] - sizes[i], centers[i] + sizes[i]);
+    }
+    set_num_threads(3);
+    bvh<W> tree(boxes.data(), boxes.size());
+    set_num_threads(0);
+    const aabb<float, 3>* b = boxes.data();
+    auto hit = [b](std::uint32_t p, const ray& r) { return ray_box(b[p], r); };
+    std::vector<vec3<float>> starts = random_points<float, 3>(100, 9, 10);
+    std::vector<vec3<float>> ends = random_points<float, 3>(100, 13, 10);
+    for (int q = 0; q < (int)starts.size(); q++) {
+        ray r(starts[q] - vec3<float>(5, 5, 5), ends[q] - starts[q]);
+        ray s = ray::segment(starts[q], ends[q]);
+        float nearest = std::numeric_limits<float>::infinity();
+        bool segment_hit = false;
+        int containing = 0;
+        for (int i = 0; i < (int)boxes.size(); i++) {
+            nearest = std::min(nearest, ray_box(boxes[i], r));
+            segment_hit = segment_hit || (ray_box(boxes[i], s) <= 1);
+            containing += boxes[i].contains(ends[q]) ? 1 : 0;
+        }
+        ray_hit h = tree.closest_hit(r, hit);
+        if ((h.t != nearest) ||
+            ((h.primitive == bvh<W>::npos) != (nearest == r.tmax)))
+            return false;
+        if (tree.any_hit(s, hit) != segment_hit)
+            return false;
+        int found = 0;
+        tree.contains(ends[q], [&](std::uint32_t p) {
+            found += boxes[p].contains(ends[q]) ? 1 : 0;
+        });
+        if (found != containing)
+            return false;
+    }
+    return (tree.size() == boxes.size()) && (tree.node_count() > 1);
+}
+
+// a ray along +x whose origin lies on a face plane of the boxes, with a
+// zero (or negative zero) z direction, still hits them on every build
+template <std::size_t W> bool test_bvh_face_ray() {
+    std::vector<aabb<float, 3>> boxes(64);
+    for (int i = 0; i < (int)boxes.size(); i++) {
+        boxes[i] = aabb<float, 3>(vec3<float>(2.0f + 2 * i, 0, 0),
+                                  vec3<float>(3.0f + 2 * i, 1, 1));
+    }
+    bvh<W> tree(boxes.data(), boxes.size());
+    const aabb<float, 3>* b = boxes.data();
+    // the boxes are only crossed along x, so the entry is lo.x - origin.x
+    auto hit = [b](std::uint32_t p, const ray& r) {
+        return (r.origin.z >= b[p].lo.z) && (r.origin.z <= b[p].hi.z)
+                   ? b[p].lo.x - r.origin.x
+                   : std::numeric_limits<float>::infinity();
+    };
+    bool ok = true;
+    const float faces[3] = {0.0f, 1.0f, 1.5f};
+    for (int f = 0; f < 3; f++) {
+        for (int sign = 0; sign < 2; sign++) {
+            ray r(vec3<float>(0, 0.5f, faces[f]),
+                  vec3<float>(1, 0, sign ? -0.0f : 0.0f));
+            ray_hit h = tree.closest_hit(r, hit);
+            bool expect = faces[f] <= 1;
+            ok = ok && (tree.any_hit(r, hit) == expect) &&
+                 ((h.primitive == 0) == expect) && (!expect || (h.t == 2));
+        }
+    }
+    return ok;
+}
+
+template <typename T> bool test_cell_list(T radius) {
+    std::vector<vec3<T>> points = random_points<T, 3>(1500, 17, (T)4);
+    set_num_threads(3);
+    cell_list<T> cells(points.data(), points.size(), radius);
+    std::vector<int> pairs(points.size(), 0);
+    std::vector<T> sum(points.size(), 0);
+    cells.for_each_pair([&](std::uint32_t i, std::uint32_t, T d2) {
+        pairs[i]++;
+        sum[i] += d2;
+    });
+    set_num_threads(0);
+    for (int i = 0; i < (int)points.size(); i++) {
+        int expected = 0, queried = 0;
+        for (int j = 0; j < (int)points.size(); j++) {
+            if ((j != i) && (points[i].distance2(points[j]) <= radius * radius))
+                expected++;
+        }
+        cells.query(points[i], [&](std::uint32_t j, T d2) {
+            queried += (d2 == points[i].distance2(points[j])) ? 1 : 0;
+        });
+        // the query also finds the point itself
+        if ((pairs[i] != expected) || (queried != expected + 1))
+            return false;
+    }
+    return (cells.size() == points.size()) &&
+           (cells.cell_start(cells.cell_count()) == points.size());
+}
+
+// one ulp either side of multiples of the box, and negative denormals,
+// stay in [0, box) on the scalar and array paths
+template <typename T> bool test_wrap_boundaries() {
+    const vec3<T> box((T)0.3, (T)1.7, (T)10);
+    std::vector<vec3<T>> points;
+    for (int m = -60; m <= 60; m++) {
+        for (int side = -1; side <= 1; side++) {
+            vec3<T> p;
+            for (int k = 0; k < 3; k++) {
+                T x = (T)m * box[k];
+                p[k] = side == 0 ? x
+                                 : std::nextafter(
+                                       x, side * std::numeric_limits<T>::max());
+            }
+            points.push_back(p);
+        }
+    }
+    T denormal = -std::numeric_limits<T>::denorm_min();
+    points.push_back(vec3<T>(denormal, denormal * 3, (T)-12.000001));
+    points.push_back(vec3<T>((T)-1.50000012, -box.y, box.z));
+    std::vector<vec3<T>> wrapped = points;
+    wrap(wrapped.data(), wrapped.size(), box);
+    for (int i = 0; i < (int)points.size(); i++) {
+        vec3<T> one = wrap(points[i], box);
+        for (int k = 0; k < 3; k++) {
+            if ((one[k] < 0) || (one[k] >= box[k]) || (wrapped[i][k] < 0) ||
+                (wrapped[i][k] >= box[k]))
+                return false;
+        }
+    }
+    return true;
+}
+
+template <typename T, std::size_t n> bool test_periodic() {
+    vec<T, n> box, shifted, inside;
+    std::vector<vec<T, n>> points = random_points<T, n>(1001, 23, (T)30);
+    for (int k = 0; k < (int)n; k++) {
+        box[k] = (T)(10 + k);
+    }
+    for (int i = 0; i < (int)points.size(); i++) {
+        points[i] = points[i] - (T)10; // in [-10, 20)
+    }
+    std::vector<vec<T, n>> wrapped = points;
+    wrap(wrapped.data(), wrapped.size(), box);
+    for (int i = 0; i < (int)points.size(); i++) {
+        vec<T, n> one = wrap(points[i], box);
+        for (int k = 0; k < (int)n; k++) {
+            // the wrapped value is in range and differs by whole boxes
+            T turns = (points[i][k] - wrapped[i][k]) / box[k];
+            if ((wrapped[i][k] < 0) || (wrapped[i][k] >= box[k]) ||
+                (std::fabs(turns - std::floor(turns + (T)0.5)) > (T)1e-3) ||
+                (std::fabs(one[k] - wrapped[i][k]) > (T)1e-4))
+                return false;
+        }
+    }
+    for (int k = 0; k < (int)n; k++) {
+        shifted[k] = (T)0.5;
+        inside[k] = box[k] - (T)0.5;
+    }
+    vec<T, n> d = difference_periodic(shifted, inside, box);
+    bool ok = std::fabs(distance2_periodic(shifted, inside, box) -
+                        (T)n * (T)1) < (T)1e-4;
+    for (int k = 0; k < (int)n; k++) {
+        ok = ok && (std::fabs(d[k] - (T)1) < (T)1e-4) &&
+             (minimum_image(vec<T, n>(box * (T)0.75), box)[k] < 0);
+    }
+    // a cluster straddling the boundary gets a tight box
+    vec<T, n> cluster[2] = {shifted, inside};
+    aabb<T, n> tight = bounding_box_periodic(cluster, 2, box);
+    for (int k = 0; k < (int)n; k++) {
+        ok = ok && (std::fabs(tight.hi[k] - tight.lo[k] - (T)1) < (T)1e-4);
+    }
+    return ok && (distance2_periodic(tight, shifted, box) == 0) &&
+           (distance2_periodic(tight, inside, box) == 0);
+}
+
+// large coordinates and a small radius: q +- radius can round across
+// four cells
+bool test_cell_list_far_origin() {
+    std::vector<vec3<float>> points =
+        random_points<float, 3>(20000, 31, 0.5f);
+    for (int i = 0; i < (int)points.size(); i++) {
+        points[i] = points[i] + 1000.0f;
+    }
+    const float radius = 0.01f;
+    cell_list<float> cells(points.data(), points.size(), radius);
+    std::vector<vec3<float>> queries = random_points<float, 3>(3000, 37, 0.6f);
+    for (int q = 0; q < (int)queries.size(); q++) {
+        vec3<float> p = queries[q] + 999.95f;
+        int expected = 0, queried = 0;
+        for (int j = 0; j < (int)points.size(); j++) {
+            expected += points[j].distance2(p) <= radius * radius;
+        }
+        cells.query(p, [&](std::uint32_t, float) { queried++; });
+        if (queried != expected)
+            return false;
+    }
+    return true;
+}
+
+template <typename T> bool test_cell_list_periodic(T radius) {
+    const vec3<T> box(4, 5, 6);
+    std::vector<vec3<T>> points = random_points<T, 3>(1200, 29, (T)6);
+    set_num_threads(3);
+    cell_list<T> cells(points.data(), points.size(), radius, box);
+    std::vector<int> pairs(points.size(), 0);
+    cells.for_each_pair(
+        [&](std::uint32_t i, std::uint32_t, T) { pairs[i]++; });
+    set_num_threads(0);
+    for (int i = 0; i < (int)points.size(); i++) {
+        int expected = 0, queried = 0;
+        for (int j = 0; j < (int)points.size(); j++) {
+            if ((j != i) && (distance2_periodic(points[i], points[j], box) <=
+                             radius * radius))
+                expected++;
+        }
+        cells.query(points[i],
+                    [&](std::uint32_t, T) { queried++; });
+        if ((pairs[i] != expected) || (queried != expected + 1))
+            return false;
+    }
+    return cells.periodic();
+}
+
+bool test_curves() {
+    typedef std::uint32_t u32;
+    bool ok = (morton_encode(vec3<u32>(1, 0, 0)) == 1) &&
+              (morton_encode(vec3<u32>(0, 1, 0)) == 2) &&
+              (morton_encode(vec3<u32>(0, 0, 1)) == 4) &&
+              (morton_encode(vec2<u32>(0, 0xffffffffu)) ==
+               0xaaaaaaaaaaaaaaaaull);
+    std::uint32_t seed = 99;
+    for (int i = 0; i < 1000; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        vec2<u32> p2(seed, seed * 7u);
+        vec3<u32> p3(seed & 0x1fffff, (seed >> 5) & 0x1fffff, i);
+        ok = ok && (morton_decode2(morton_encode(p2)) == p2) &&
+             (morton_decode3(morton_encode(p3)) == p3) &&
+             (hilbert_decode2(hilbert_encode(p2)) == p2) &&
+             (hilbert_decode3(hilbert_encode(p3)) == p3);
+    }
+    // consecutive Hilbert indices are neighbouring cells
+    for (std::uint64_t h = 0; h < 4096; h++) {
+        vec2<u32> a = hilbert_decode2(h), b = hilbert_decode2(h + 1);
+        vec3<u32> c = hilbert_decode3(h), d = hilbert_decode3(h + 1);
+        int step2 =
+            std::abs((int)a.x - (int)b.x) + std::abs((int)a.y - (int)b.y);
+        int step3 = std::abs((int)c.x - (int)d.x) +
+                    std::abs((int)c.y - (int)d.y) +
+                    std::abs((int)c.z - (int)d.z);
+        ok = ok && (step2 == 1) && (step3 == 1);
+    }
+    std::vector<vec3<float>> points = random_points<float, 3>(1001, 41, 5.0f);
+    aabb<float, 3> box = bounding_box(points.data(), points.size());
+    std::vector<std::uint64_t> morton(points.size()), hilbert(points.size());
+    set_num_threads(3);
+    morton_encode(points.data(), points.size(), box, morton.data());
+    hilbert_encode(points.data(), points.size(), box, hilbert.data());
+    set_num_threads(0);
+    for (int i = 0; i < (int)points.size(); i++) {
+        ok = ok && (morton[i] == morton_encode(points[i], box)) &&
+             (hilbert[i] == hilbert_encode(points[i], box));
+    }
+    vec3<u32> top = grid_coordinates(box.hi, box);
+    return ok && (top.x == (1u << curve_bits3) - 1) &&
+           (grid_coordinates(box.lo, box) == vec3<u32>(0, 0, 0));
+}
+
+bool test_radix_sort_pairs() {
+    const std::size_t count = 60000;
+    std::vector<std::uint64_t> keys(count);
+    std::vector<std::uint32_t> values(count);
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> expected(count);
+    std::uint32_t seed = 5;
+    for (std::size_t i = 0; i < count; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        // few distinct keys, spread over the high and low digits
+        keys[i] = ((std::uint64_t)(seed >> 28) << 52) | (seed >> 30);
+        values[i] = (std::uint32_t)i;
+        expected[i] = std::make_pair(keys[i], values[i]);
+    }
+    std::stable_sort(expected.begin(), expected.end(),
+                     [](const std::pair<std::uint64_t, std::uint32_t>& a,
+                        const std::pair<std::uint64_t, std::uint32_t>& b) {
+                         return a.first < b.first;
+                     });
+    set_num_threads(3);
+    radix_sort(keys.data(), values.data(), count);
+    set_num_threads(0);
+    bool ok = true;
+    for (std::size_t i = 0; i < count; i++) {
+        ok = ok && (keys[i] == expected[i].first) &&
+             (values[i] == expected[i].second);
+    }
+    return ok;
+}
+
+template <typename K> bool test_radix_sort(K scale) {
+    const std::size_t count = 70000;
+    std::vector<K> keys(count), values(count);
+    std::uint32_t seed = 77;
+    for (std::size_t i = 0; i < count; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        double unit = (double)(seed >> 12) / (1 << 19) - 1.0; // [-1, 1)
+        keys[i] = std::is_signed<K>::value ? (K)(unit * (double)scale)
+                                           : (K)(seed >> 16);
+    }
+    if (std::numeric_limits<K>::has_infinity) {
+        keys[3] = std::numeric_limits<K>::infinity();
+        keys[7] = -std::numeric_limits<K>::infinity();
+    }
+    keys[11] = std::numeric_limits<K>::max();
+    keys[13] = std::numeric_limits<K>::lowest();
+    std::vector<K> expected = keys;
+    std::sort(expected.begin(), expected.end());
+    set_num_threads(3);
+    values = keys;
+    radix_sort(keys.data(), count);
+    // the payload mode, carrying a copy of each key as its value
+    std::vector<K> paired = values;
+    radix_sort(paired.data(), values.data(), count);
+    set_num_threads(0);
+    return (keys == expected) && (paired == expected) && (values == expected);
+}
+
+template <typename T> bool test_radix_sort_vec() {
+    const int count = 40000;
+    std::vector<vec3<T>> points = random_points<T, 3>(count, 31, (T)4);
+    for (int i = 0; i < count; i += 3) {
+        points[i].y = -points[i].y; // negative keys
+    }
+    std::vector<vec3<T>> by_y = points, by_key = points;
+    std::vector<std::uint32_t> ids(count), key_ids(count);
+    for (int i = 0; i < count; i++) {
+        ids[i] = key_ids[i] = (std::uint32_t)i;
+    }
+    set_num_threads(3);
+    radix_sort_by_component(by_y.data(), count, 1, ids.data());
+    // integer keys with many ties check stability
+    radix_sort_by_key(
+        by_key.data(), count, [](const vec3<T>& p) { return (int)p.z; },
+        key_ids.data());
+    std::vector<vec3<T>> alone = points;
+    radix_sort_by_component(alone.data(), count, 0);
+    set_num_threads(0);
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        ok = ok && (by_y[i] == points[ids[i]]) &&
+             (by_key[i] == points[key_ids[i]]);
+        if (i > 0) {
+            ok = ok && (by_y[i - 1].y <= by_y[i].y) &&
+                 (alone[i - 1].x <= alone[i].x);
+            int a = (int)by_key[i - 1].z, b = (int)by_key[i].z;
+            ok = ok && ((a < b) || ((a == b) && (key_ids[i - 1] < key_ids[i])));
+        }
+    }
+    return ok;
+}
+
+template <typename T> bool test_spatial_sort(curve_order order) {
+    const int count = 5000;
+    std::vector<vec3<T>> points = random_points<T, 3>(count, 23, (T)10);
+    std::vector<vec3<T>> velocities(count);
+    std::vector<float> masses(count);
+    for (int i = 0; i < count; i++) {
+        velocities[i] = points[i] * (T)2;
+        masses[i] = (float)i;
+    }
+    aabb<T, 3> box = bounding_box(points.data(), count);
+    set_num_threads(3);
+    std::vector<std::uint32_t> perm = spatial_sort(
+        points.data(), count, order, velocities.data(), masses.data());
+    set_num_threads(0);
+    std::vector<bool> seen(count, false);
+    bool ok = (int)perm.size() == count;
+    std::uint64_t last = 0;
+    for (int i = 0; ok && (i < count); i++) {
+        std::uint64_t key = order == curve_order::morton
+                                ? morton_encode(points[i], box)
+                                : hilbert_encode(points[i], box);
+        ok = (key >= last) && !seen[perm[i]] &&
+             (masses[i] == (float)perm[i]) &&
+             (velocities[i] == points[i] * (T)2);
+        seen[perm[i]] = true;
+        last = key;
+    }
+    // the permutation reorders other arrays the same way
+    std::vector<std::uint32_t> ids(count);
+    for (int i = 0; i < count; i++) {
+        ids[i] = (std::uint32_t)i;
+    }
+    permute(perm.data(), ids.data(), count);
+    return ok && (ids == perm);
+}
+
+template <typename T> bool test_vec_hash_map() {
+    vec_hash_map<T, 3, int> map;
+    std::unordered_map<vec3<T>, int> reference;
+    std::uint32_t seed = 3;
+    bool ok = map.empty() && !map.find(vec3<T>(0, 0, 0));
+    for (int i = 0; i < 200000; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        // a small key space, so inserts, hits and erases all happen
+        vec3<T> key((T)((seed >> 8) % 64) - 32, (T)((seed >> 14) % 64),
+                    (T)((seed >> 20) % 16) - 8);
+        int op = (int)(seed >> 28);
+        if (op < 6) {
+            bool inserted = map.insert(key, i).second;
+            ok = ok && (inserted == reference.insert({key, i}).second);
+        } else if (op < 9) {
+            ok = ok && (map.erase(key) == (reference.erase(key) == 1));
+        } else if (op < 12) {
+            map[key] += 1;
+            reference[key] += 1;
+        } else {
+            const int* found = map.find(key);
+            auto it = reference.find(key);
+            ok = ok && ((found == nullptr) == (it == reference.end())) &&
+                 (!found || (*found == it->second));
+        }
+    }
+    std::size_t visited = 0;
+    map.for_each([&](const vec3<T>& key, int& value) {
+        auto it = reference.find(key);
+        ok = ok && (it != reference.end()) && (it->second == value);
+        visited++;
+    });
+    ok = ok && (visited == reference.size()) && (map.size() == visited);
+    map.clear();
+    map.reserve(1000);
+    std::size_t reserved = map.capacity();
+    for (int i = 0; i < 1000; i++) {
+        map.insert(vec3<T>((T)i, (T)-i, (T)(i % 7)), i);
+    }
+    return ok && (map.size() == 1000) && (map.capacity() == reserved) &&
+           (*map.find(vec3<T>(500, -500, 500 % 7)) == 500);
+}
+
+bool test_std_hash_vec() {
+    std::unordered_set<vec2<float>> floats;
+    floats.insert(vec2<float>(1.5f, -2.0f));
+    floats.insert(vec2<float>(1.5f, -2.0f));
+    floats.insert(vec2<float>(-2.0f, 1.5f));
+    std::hash<vec4<std::int64_t>> h;
+    return (floats.size() == 2) &&
+           (h(vec4<std::int64_t>(1, 2, 3, 4)) !=
+            h(vec4<std::int64_t>(2, 1, 3, 4))) &&
+           (h(vec4<std::int64_t>(1, 2, 3, 4)) ==
+            h(vec4<std::int64_t>(1, 2, 3, 4)));
+}
+
+// an OpenGL perspective (60 degrees, square) from (5, 5, 15) looking down -z
+template <typename T> frustum<T> test_frustum() {
+    T f = (T)1 / std::tan((T)0.5235987755982988), z0 = (T)0.5, z1 = 20;
+    T projection[16] = {f, 0, 0, 0, 0, f, 0, 0, 0, 0, (z1 + z0) / (z0 - z1),
+                        2 * z1 * z0 / (z0 - z1), 0, 0, -1, 0};
+    T view[16] = {1, 0, 0, -5, 0, 1, 0, -5, 0, 0, 1, -15, 0, 0, 0, 1};
+    T m[16];
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            m[4 * i + j] = 0;
+            for (int k = 0; k < 4; k++) {
+                m[4 * i + j] += projection[4 * i + k] * view[4 * k + j];
+            }
+        }
+    }
+    return frustum<T>::from_matrix(m);
+}
+
+template <typename T> bool test_octree(std::size_t capacity) {
+    const int count = 3000;
+    std::vector<vec3<T>> points = random_points<T, 3>(count, 51, (T)10);
+    for (int i = 0; i < 40; i++) {
+        points[count - 1 - i] = points[i % 4]; // duplicates pile up
+    }
+    set_num_threads(3);
+    octree<T> tree(points.data(), count, capacity);
+    set_num_threads(0);
+    const std::vector<octree_node<T>>& nodes = tree.nodes();
+    bool ok = (octree<T>().depth() == 0) &&
+              (tree.size() == (std::size_t)count) &&
+              (tree.level_begin(tree.depth()) == nodes.size());
+    std::vector<int> covered(count, 0);
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+        const octree_node<T>& node = nodes[i];
+        if (node.leaf()) {
+            ok = ok && ((node.end - node.begin <= capacity) ||
+                        (node.level == curve_bits3));
+            for (std::uint32_t p = node.begin; p < node.end; p++) {
+                covered[tree.sorted_indices()[p]]++;
+                ok = ok && node.bounds.contains(tree.sorted_points()[p]);
+            }
+        } else {
+            // children tile the node's range in order
+            std::uint32_t at = node.begin;
+            for (int c = 0; c < node.child_count; c++) {
+                const octree_node<T>& child = nodes[node.first_child + c];
+                ok = ok && (child.begin == at) && (child.end > at) &&
+                     (child.level == node.level + 1);
+                at = child.end;
+            }
+            ok = ok && (at == node.end);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        ok = ok && (covered[i] == 1);
+    }
+
+    const frustum<T> view = test_frustum<T>();
+    const aabb<T, 3> box(vec3<T>(2, 3, 1), vec3<T>(6, 5, 9));
+    std::vector<vec3<T>> queries = random_points<T, 3>(50, 52, (T)10);
+    const std::size_t k = 8;
+    std::vector<neighbor<T>> nearest(queries.size() * k);
+    set_num_threads(3);
+    tree.knn(queries.data(), queries.size(), k, nearest.data());
+    set_num_threads(0);
+    std::vector<std::uint32_t> in_box, in_view, expect_box, expect_view;
+    tree.range(box, in_box);
+    tree.range(view, in_view);
+    for (int i = 0; i < count; i++) {
+        if (box.contains(points[i]))
+            expect_box.push_back((std::uint32_t)i);
+        if (view.contains(points[i]))
+            expect_view.push_back((std::uint32_t)i);
+    }
+    std::sort(in_box.begin(), in_box.end());
+    std::sort(in_view.begin(), in_view.end());
+    ok = ok && (in_box == expect_box) && (in_view == expect_view) &&
+         !expect_view.empty() && ((int)expect_view.size() < count);
+    for (std::size_t q = 0; q < queries.size(); q++) {
+        std::vector<T> d2(count);
+        std::size_t inside = 0;
+        for (int i = 0; i < count; i++) {
+            d2[i] = points[i].distance2(queries[q]);
+            inside += d2[i] <= (T)1;
+        }
+        std::vector<neighbor<T>> within;
+        ok = ok && (tree.radius(queries[q], (T)1, within) == inside);
+        std::sort(d2.begin(), d2.end());
+        for (std::size_t j = 0; j < k; j++) {
+            ok = ok && (nearest[q * k + j].distance2 == d2[j]);
+        }
+    }
+    return ok;
+}
+
+bool test_frustum_planes() {
+    const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0,
+                                0, 0, 1, 0, 0, 0, 0, 1};
+    frustum<float> cube = frustum<float>::from_matrix(identity);
+    return cube.contains(vec3<float>(0.5f, -0.5f, 0.9f)) &&
+           !cube.contains(vec3<float>(1.5f, 0, 0)) &&
+           (cube.classify(aabb<float, 3>(vec3<float>(-0.5f, -0.5f, -0.5f),
+                                         vec3<float>(0.5f, 0.5f, 0.5f))) ==
+            1) &&
+           (cube.classify(aabb<float, 3>(vec3<float>(0.5f, 0.5f, 0.5f),
+                                         vec3<float>(2, 2, 2))) == 0) &&
+           (cube.classify(aabb<float, 3>(vec3<float>(2, 2, 2),
+                                         vec3<float>(3, 3, 3))) == -1);
+}
+
+// relative RMS error of approximate against exact accelerations
+template <typename T>
+double relative_rms(const std::vector<vec3<T>>& approx,
+                    const std::vector<vec3<T>>& exact) {
+    double error = 0, norm = 0;
+    for (std::size_t i = 0; i < exact.size(); i++) {
+        error += (double)(approx[i] - exact[i]).length2();
+        norm += (double)exact[i].length2();
+    }
+    return std::sqrt(error / norm);
+}
+
+template <typename T> bool test_barnes_hut(double tolerance) {
+    const int count = 3000;
+    const T eps = (T)0.01;
+    std::vector<vec3<T>> points = random_points<T, 3>(count, 61, (T)1);
+    std::vector<T> masses(count);
+    for (int i = 0; i < count; i++) {
+        // a dense clump in one corner, so the tree is uneven
+        if (i % 3 == 0)
+            points[i] = points[i] * (T)0.1;
+        masses[i] = (T)(0.5 + (i % 7) / 7.0);
+    }
+    std::vector<vec3<T>> exact(count, vec3<T>(0, 0, 0));
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < count; j++) {
+            T s = points[i].distance2(points[j]) + eps * eps;
+            if (i != j)
+                exact[i] = exact[i] + (points[j] - points[i]) *
+                                          (masses[j] / (s * std::sqrt(s)));
+        }
+    }
+    barnes_hut<T> solver(points.data(), masses.data(), count, 8);
+    std::vector<vec3<T>> direct(count), mono(count), quad(count);
+    std::vector<vec3<T>> threaded(count);
+    solver.accelerations(direct.data(), 0, eps);
+    solver.accelerations(mono.data(), (T)0.6, eps, false);
+    solver.accelerations(quad.data(), (T)0.6, eps);
+    set_num_threads(3);
+    solver.accelerations(threaded.data(), (T)0.6, eps);
+    set_num_threads(0);
+    double total = 0;
+    for (int i = 0; i < count; i++) {
+        total += masses[i];
+    }
+    double e_direct = relative_rms(direct, exact);
+    double e_mono = relative_rms(mono, exact);
+    double e_quad = relative_rms(quad, exact);
+    // a single point walks alone; with theta 0 it sums everything
+    vec3<T> at = solver.acceleration(points[5], 0, eps);
+    double at_error = (double)(at - exact[5]).length() / exact[5].length();
+    return (e_direct < tolerance * 1e-3) && (at_error < tolerance * 1e-3) &&
+           (e_quad < 0.7 * e_mono) && (e_quad < tolerance) &&
+           (e_mono < 2 * tolerance) && (threaded == quad) &&
+           (std::fabs(solver.total_mass() - total) < 1e-3 * total);
+}
+
+// converged k-means is a Lloyd fixed point, whatever the thread count
+template <typename T, std::size_t n>
+bool test_kmeans(std::size_t k, double tolerance) {
+    std::vector<vec<T, n>> points = random_points<T, n>(3000, 61);
+    // pull the points towards a few centres so there is structure to find
+    for (int i = 0; i < (int)points.size(); i++) {
+        vec<T, n> centre = points[i % 7];
+        points[i] = centre + (points[i] - centre) * (T)0.3;
+    }
+    kmeans<T, n> serial, km;
+    set_num_threads(1);
+    bool ok = serial.fit(points.data(), points.size(), k, 300);
+    set_num_threads(3);
+    ok = ok && km.fit(points.data(), points.size(), k, 300);
+    set_num_threads(0);
+    const kmeans_stats& stats = km.stats();
+    ok = ok && (km.labels() == serial.labels()) &&
+         (stats.iterations.size() > 1) &&
+         (stats.iterations[0].reassigned == points.size()) &&
+         (stats.iterations.back().reassigned == 0) &&
+         (stats.distances() - stats.iterations[0].distances <
+          (stats.iterations.size() - 1) * points.size() * k / 2);
+    std::vector<vec<double, n>> sums(k);
+    std::vector<int> sizes(k, 0);
+    double inertia = 0;
+    for (int i = 0; i < (int)points.size(); i++) {
+        std::uint32_t label = km.labels()[i];
+        T own = points[i].distance2(km.centroids()[label]);
+        for (std::size_t j = 0; j < k; j++) {
+            ok = ok && (own <= points[i].distance2(km.centroids()[j]) *
+                                   (1 + (T)tolerance));
+        }
+        ok = ok && (km.nearest(points[i]) == label ||
+                    points[i].distance2(km.centroids()[km.nearest(
+                        points[i])]) >= own * (1 - (T)tolerance));
+        sums[label] = sums[label] + vec<double, n>(points[i]);
+        sizes[label]++;
+        inertia += own;
+    }
+    for (std::size_t j = 0; j < k; j++) {
+        vec<double, n> mean = sums[j] / (double)sizes[j];
+        ok = ok && (sizes[j] > 0) &&
+             (mean.distance2(vec<double, n>(km.centroids()[j])) <
+              tolerance * tolerance);
+    }
+    return ok && (std::abs(inertia - stats.inertia) < tolerance * inertia);
+}
+
+// friends-of-friends groups against an O(n^2) union-find
+template <typename T> bool test_friends_of_friends(bool periodic) {
+    const vec3<T> box(4, 5, 6);
+    const T b = (T)0.3;
+    std::vector<vec3<T>> points = random_points<T, 3>(900, 47, (T)4);
+    int count = (int)points.size();
+    std::vector<int> rep(count);
+    for (int i = 0; i < count; i++) {
+        rep[i] = i;
+    }
+    auto find = [&](int i) {
+        while (rep[i] != i) {
+            i = rep[i] = rep[rep[i]];
+        }
+        return i;
+    };
+    for (int i = 0; i < count; i++) {
+        for (int j = i + 1; j < count; j++) {
+            T d2 = periodic ? distance2_periodic(points[i], points[j], box)
+                            : points[i].distance2(points[j]);
+            if (d2 <= b * b)
+                rep[std::max(find(i), find(j))] = std::min(find(i), find(j));
+        }
+    }
+    std::vector<int> size(count, 0);
+    for (int i = 0; i < count; i++) {
+        size[find(i)]++;
+    }
+    friends_of_friends<T> serial, fof;
+    set_num_threads(1);
+    if (periodic)
+        serial.build(points.data(), count, b, box, 2);
+    else
+        serial.build(points.data(), count, b, 2);
+    set_num_threads(3);
+    if (periodic)
+        fof.build(points.data(), count, b, box, 2);
+    else
+        fof.build(points.data(), count, b, 2);
+    set_num_threads(0);
+    const std::vector<std::uint32_t>& ids = fof.group_ids();
+    bool ok = (ids == serial.group_ids()) && (fof.group_count() > 10);
+    std::vector<int> group_rep(fof.group_count(), -1);
+    for (int i = 0; i < count; i++) {
+        int r = find(i);
+        if (size[r] < 2) {
+            ok = ok && (ids[i] == friends_of_friends<T>::npos);
+            continue;
+        }
+        if (ids[i] >= fof.group_count())
+            return false;
+        if (group_rep[ids[i]] < 0)
+            group_rep[ids[i]] = r;
+        ok = ok && (group_rep[ids[i]] == r);
+    }
+    for (int g = 0; g < (int)fof.group_count(); g++) {
+        const fof_group<T>& group = fof.groups()[g];
+        const std::uint32_t* members = fof.members(g);
+        ok = ok && (group_rep[g] >= 0) &&
+             ((int)group.size == size[group_rep[g]]) &&
+             ((g == 0) || (group.size <= fof.groups()[g - 1].size));
+        vec3<T> sum(0, 0, 0);
+        for (int k = 0; k < (int)group.size; k++) {
+            ok = ok && (ids[members[k]] == (std::uint32_t)g) &&
+                 ((k == 0) || (members[k - 1] < members[k]));
+            vec3<T> d = points[members[k]] - points[members[0]];
+            sum = sum + (periodic ? minimum_image(d, box) : d);
+        }
+        vec3<T> centroid = points[members[0]] + sum / (T)group.size;
+        T error = periodic ? distance2_periodic(centroid, group.centroid, box)
+                           : centroid.distance2(group.centroid);
+        ok = ok && (error < (T)1e-8) &&
+             (periodic || ((group.bounds.lo.x >= 0) &&
+                           (group.bounds.hi.z <= (T)4)));
+    }
+    return ok;
+}
+
+// a periodic group straddling the x = 0 face keeps its centroid on it
+bool test_friends_of_friends_wrap() {
+    const vec3<float> box(4, 4, 4);
+    std::vector<vec3<float>> points = {
+        vec3<float>(3.9f, 1, 1), vec3<float>(0.1f, 1, 1),
+        vec3<float>(3.95f, 1.1f, 1), vec3<float>(2, 2, 2)};
+    friends_of_friends<float> fof;
+    fof.build(points.data(), points.size(), 0.25f, box, 2);
+    const fof_group<float>& group = fof.groups()[0];
+    vec3<float> expected(3.9833333f, 1.0333333f, 1);
+    return (fof.group_count() == 1) && (group.size == 3) &&
+           (fof.group_ids()[3] == friends_of_friends<float>::npos) &&
+           (distance2_periodic(group.centroid, expected, box) < 1e-10f) &&
+           (group.bounds.hi.x - group.bounds.lo.x < 0.25f);
+}
+
+template <typename T> bool test_direct_accelerations(double tolerance) {
+    // odd, so register blocks and leftover targets are both exercised
+    const int count = 1001;
+    std::vector<vec3<T>> points = random_points<T, 3>(count, 71, (T)1);
+    points[7] = points[3]; // coincident pairs contribute nothing
+    std::vector<T> masses(count);
+    for (int i = 0; i < count; i++) {
+        masses[i] = (T)(0.25 + (i % 5) / 5.0);
+    }
+    bool ok = true;
+    for (int soft = 0; soft < 2; soft++) {
+        const double eps = soft ? 0.05 : 0;
+        std::vector<vec3<T>> exact(count);
+        for (int i = 0; i < count; i++) {
+            double a[3] = {0, 0, 0};
+            for (int j = 0; j < count; j++) {
+                double d[3], r2 = 0;
+                for (int k = 0; k < 3; k++) {
+                    d[k] = (double)points[j][k] - (double)points[i][k];
+                    r2 += d[k] * d[k];
+                }
+                if (r2 == 0)
+                    continue;
+                double s = r2 + eps * eps;
+                for (int k = 0; k < 3; k++) {
+                    a[k] -= 2 * d[k] * masses[j] / (s * std::sqrt(s));
+                }
+            }
+            exact[i] = vec3<T>((T)a[0], (T)a[1], (T)a[2]);
+        }
+        std::vector<vec3<T>> serial(count), threaded(count);
+        direct_accelerations(points.data(), masses.data(), count,
+                             serial.data(), (T)eps, (T)-2);
+        set_num_threads(3);
+        direct_accelerations(points.data(), masses.data(), count,
+                             threaded.data(), (T)eps, (T)-2);
+        set_num_threads(0);
+        ok = ok && (relative_rms(serial, exact) < tolerance) &&
+             (relative_rms(threaded, exact) < tolerance);
+    }
+    // like charges repel: with coupling -k the field points away
+    T x[2] = {0, 1}, y[2] = {0, 0}, z[2] = {0, 0}, q[2] = {1, 1};
+    T ax[2], ay[2], az[2];
+    direct_accelerations(x, y, z, q, 2, ax, ay, az, (T)0, (T)-1);
+    return ok && (std::fabs(ax[0] + 1) < tolerance) &&
+           (std::fabs(ax[1] - 1) < tolerance) && (ay[0] == 0) &&
+           (az[1] == 0);
+}
+
+bool test_mass_assignment_weights() {
+    const vec3<double> box(8, 8, 8);
+    const vec3<double> corner(2, 3, 4), centre(2.5, 3.5, 4.5);
+    mesh<double> cic(8, 8, 8, box), tsc(8, 8, 8, box), edge(8, 8, 8, box);
+    double one = 1;
+    // a corner shared by 8 cells splits evenly; a cell centre stays put
+    deposit(cic, &corner, &one, 1, mass_assignment::cic);
+    bool ok = (cic(1, 2, 3) == 0.125) && (cic(2, 3, 4) == 0.125);
+    deposit(cic, &centre, &one, 1, mass_assignment::cic);
+    ok = ok && (cic(2, 3, 4) == 1.125);
+    deposit(tsc, &centre, &one, 1, mass_assignment::tsc);
+    ok = ok && (tsc(2, 3, 4) == 0.75 * 0.75 * 0.75) &&
+         (tsc(1, 3, 4) == 0.125 * 0.75 * 0.75) &&
+         (tsc(3, 2, 4) == 0.125 * 0.125 * 0.75);
+    // clouds wrap around the box
+    vec3<double> near_edge(7.75, 0.25, -8.25);
+    deposit(edge, &near_edge, &one, 1, mass_assignment::cic);
+    ok = ok && (std::fabs(edge(7, 0, 7) - 0.75 * 0.75 * 0.75) < 1e-15) &&
+         (std::fabs(edge(0, 7, 0) - 0.25 * 0.25 * 0.25) < 1e-15);
+    return ok;
+}
+
+template <typename T> bool test_mesh_deposit(mass_assignment scheme) {
+    // 22 planes: an odd number of slabs for TSC, merged into the last
+    const int count = 5000;
+    const vec3<T> box(2, 3, 4);
+    std::vector<vec3<T>> points = random_points<T, 3>(count, 81, (T)1);
+    std::vector<T> masses(count);
+    double total = 0;
+    for (int i = 0; i < count; i++) {
+        // some outside the box, to be wrapped
+        points[i] = vec3<T>(points[i].x * 2, points[i].y * 3 + 1,
+                            points[i].z * 6);
+        masses[i] = (T)(1 + i % 3);
+        total += masses[i];
+    }
+    mesh<T> serial(10, 12, 22, box), threaded(10, 12, 22, box);
+    mesh<T> naive(10, 12, 22, box), thin(10, 12, 2, box);
+    deposit(serial, points.data(), masses.data(), count, scheme);
+    set_num_threads(3);
+    deposit(threaded, points.data(), masses.data(), count, scheme);
+    set_num_threads(0);
+    for (int i = 0; i < count; i++) {
+        deposit(naive, &points[i], &masses[i], 1, scheme);
+    }
+    deposit(thin, points.data(), masses.data(), count, scheme);
+    double sum = 0, thin_sum = 0, difference = 0;
+    bool same = true;
+    for (std::size_t c = 0; c < serial.size(); c++) {
+        sum += serial.data()[c];
+        difference += std::fabs(serial.data()[c] - naive.data()[c]);
+        same = same && (serial.data()[c] == threaded.data()[c]);
+    }
+    for (std::size_t c = 0; c < thin.size(); c++) {
+        thin_sum += thin.data()[c];
+    }
+    // the gather is the transpose of the deposit: sum of m * g(p) equals
+    // the grid dot product of g with the deposited masses
+    mesh<T> field(10, 12, 22, box);
+    for (int z = 0; z < 22; z++) {
+        for (int y = 0; y < 12; y++) {
+            for (int x = 0; x < 10; x++) {
+                field(x, y, z) = (T)std::sin(0.7 * x + 0.3 * y - 0.45 * z);
+            }
+        }
+    }
+    std::vector<T> at(count);
+    gather(field, points.data(), count, scheme, at.data());
+    double particle_side = 0, grid_side = 0;
+    for (int i = 0; i < count; i++) {
+        particle_side += (double)masses[i] * at[i];
+    }
+    for (std::size_t c = 0; c < field.size(); c++) {
+        grid_side += (double)field.data()[c] * serial.data()[c];
+    }
+    const double tolerance = sizeof(T) == 4 ? 1e-5 : 1e-12;
+    return same && (std::fabs(sum - total) < tolerance * total) &&
+           (std::fabs(thin_sum - total) < tolerance * total) &&
+           (difference < tolerance * total) &&
+           (std::fabs(particle_side - grid_side) < tolerance * total);
+}
+
+template <typename T> bool test_mesh_gather() {
+    // CIC and TSC reproduce a linear field exactly away from the seam
+    const vec3<T> box(16, 16, 16);
+    mesh<T> gx(16, 16, 16, box), gy(16, 16, 16, box), gz(16, 16, 16, box);
+    for (int z = 0; z < 16; z++) {
+        for (int y = 0; y < 16; y++) {
+            for (int x = 0; x < 16; x++) {
+                gx(x, y, z) = (T)(x + 0.5);
+                gy(x, y, z) = (T)(2 * (y + 0.5));
+                gz(x, y, z) = (T)(z + 0.5) - (T)(x + 0.5);
+            }
+        }
+    }
+    const int count = 200;
+    std::vector<vec3<T>> points = random_points<T, 3>(count, 82, (T)1);
+    for (int i = 0; i < count; i++) {
+        points[i] = points[i] * (T)10 + vec3<T>(3, 3, 3);
+    }
+    std::vector<vec3<T>> out(count);
+    std::vector<T> scalar(count);
+    bool ok = true;
+    for (int s = 1; s < 3; s++) {
+        mass_assignment scheme = (mass_assignment)s;
+        gather(gx, gy, gz, points.data(), count, scheme, out.data());
+        gather(gx, points.data(), count, scheme, scalar.data());
+        for (int i = 0; i < count; i++) {
+            const vec3<T>& p = points[i];
+            vec3<T> expected(p.x, 2 * p.y, p.z - p.x);
+            ok = ok && ((out[i] - expected).length() < (T)1e-4) &&
+                 (scalar[i] == out[i].x);
+        }
+    }
+    gather(gx, points.data(), count, mass_assignment::ngp, scalar.data());
+    for (int i = 0; i < count; i++) {
+        ok = ok && (scalar[i] == std::floor(points[i].x) + (T)0.5);
+    }
+    return ok;
+}
+
+// O(n^2) DFT in double, the reference for the FFTs
+std::vector<std::complex<double>>
+naive_dft(const std::vector<std::complex<double>>& x, double sign) {
+    std::size_t n = x.size();
+    std::vector<std::complex<double>> out(n);
+    for (std::size_t k = 0; k < n; k++) {
+        for (std::size_t j = 0; j < n; j++) {
+            double angle = sign * 6.283185307179586 * (double)(j * k % n) / n;
+            out[k] += x[j] * std::complex<double>(std::cos(angle),
+                                                  std::sin(angle));
+        }
+    }
+    return out;
+}
+
+template <typename T> bool test_fft(double tolerance) {
+    // powers of 2 and 4, mixed radices, and generic odd factors
+    const std::size_t lengths[] = {1,  2,  3,  4,  5,  6,   7,   8,  9,
+                                   12, 15, 16, 30, 49, 64, 77, 128, 360};
+    bool ok = true;
+    for (std::size_t length : lengths) {
+        std::vector<std::complex<T>> x(length);
+        std::vector<std::complex<double>> exact(length);
+        for (std::size_t j = 0; j < length; j++) {
+            x[j] = std::complex<T>((T)std::sin(0.3 * j + 1),
+                                   (T)std::cos(1.7 * j * j));
+            exact[j] = std::complex<double>(x[j].real(), x[j].imag());
+        }
+        for (int d = 0; d < 2; d++) {
+            fft_direction direction =
+                d ? fft_direction::inverse : fft_direction::forward;
+            std::vector<std::complex<double>> expected =
+                naive_dft(exact, d ? 1.0 : -1.0);
+            std::vector<std::complex<T>> y = x;
+            fft_plan<T> plan(length);
+            plan.transform(y.data(), direction);
+            double error = 0, norm = 0;
+            for (std::size_t k = 0; k < length; k++) {
+                std::complex<double> yk(y[k].real(), y[k].imag());
+                error += std::norm(yk - expected[k]);
+                norm += std::norm(expected[k]);
+            }
+            ok = ok && (std::sqrt(error / norm) < tolerance);
+        }
+    }
+    // a batch of lanes matches the transforms one by one
+    const std::size_t n = 60, lanes = 5;
+    fft_plan<T> plan(n);
+    std::vector<T> re(n * lanes), im(n * lanes), work(2 * n * lanes);
+    std::vector<std::vector<std::complex<T>>> single(
+        lanes, std::vector<std::complex<T>>(n));
+    for (std::size_t b = 0; b < lanes; b++) {
+        for (std::size_t j = 0; j < n; j++) {
+            re[j * lanes + b] = (T)std::sin(0.1 * j * (b + 1));
+            im[j * lanes + b] = (T)b;
+            single[b][j] = std::complex<T>(re[j * lanes + b], (T)b);
+        }
+        plan.transform(single[b].data(), fft_direction::forward);
+    }
+    plan.transform_lanes(re.data(), im.data(), lanes, fft_direction::forward,
+                         work.data());
+    for (std::size_t b = 0; b < lanes; b++) {
+        for (std::size_t k = 0; k < n; k++) {
+            std::complex<T> batched(re[k * lanes + b], im[k * lanes + b]);
+            ok = ok && (std::abs(batched - single[b][k]) <
+                        tolerance * std::sqrt((double)n) * (1 + b));
+        }
+    }
+    return ok;
+}
+
+template <typename T> bool test_real_fft(double tolerance) {
+    const std::size_t lengths[] = {1, 2, 6, 9, 16, 30, 35, 128};
+    bool ok = true;
+    for (std::size_t length : lengths) {
+        real_fft_plan<T> plan(length);
+        std::vector<T> x(length), back(length);
+        std::vector<std::complex<T>> full(length);
+        for (std::size_t j = 0; j < length; j++) {
+            x[j] = (T)std::sin(0.7 * j * j + 0.2);
+            full[j] = std::complex<T>(x[j], 0);
+        }
+        fft_plan<T>(length).transform(full.data(), fft_direction::forward);
+        std::vector<std::complex<T>> half(plan.spectrum_size());
+        plan.forward(x.data(), half.data());
+        double scale = std::sqrt((double)length);
+        for (std::size_t k = 0; k < half.size(); k++) {
+            ok = ok && (std::abs(half[k] - full[k]) < tolerance * scale);
+        }
+        plan.inverse(half.data(), back.data());
+        for (std::size_t j = 0; j < length; j++) {
+            ok = ok && (std::fabs(back[j] / (T)length - x[j]) < tolerance);
+        }
+    }
+    return ok;
+}
+
+template <typename T>
+bool test_fft3d(int nx, int ny, int nz, double tolerance) {
+    const std::size_t count = (std::size_t)nx * ny * nz;
+    std::vector<T> grid(count);
+    std::vector<std::complex<double>> exact(count);
+    for (std::size_t i = 0; i < count; i++) {
+        grid[i] = (T)std::sin(0.37 * i * i + 1);
+        exact[i] = grid[i];
+    }
+    // separable reference: 1D DFTs along x, then y, then z
+    const int dims[3] = {nx, ny, nz};
+    const std::size_t steps[3] = {1, (std::size_t)nx, (std::size_t)nx * ny};
+    for (int k = 0; k < 3; k++) {
+        std::size_t n = dims[k], step = steps[k];
+        for (std::size_t i = 0; i < count; i++) {
+            if ((i / step) % n != 0)
+                continue;
+            std::vector<std::complex<double>> line(n);
+            for (std::size_t e = 0; e < n; e++) {
+                line[e] = exact[i + e * step];
+            }
+            line = naive_dft(line, -1);
+            for (std::size_t e = 0; e < n; e++) {
+                exact[i + e * step] = line[e];
+            }
+        }
+    }
+    fft3d<T> fft(nx, ny, nz);
+    std::vector<std::complex<T>> complex_grid(count), half(fft.spectrum_size());
+    for (std::size_t i = 0; i < count; i++) {
+        complex_grid[i] = std::complex<T>(grid[i], 0);
+    }
+    fft.transform(complex_grid.data(), fft_direction::forward);
+    fft.forward(grid.data(), half.data());
+    std::vector<std::complex<T>> threaded(fft.spectrum_size());
+    set_num_threads(3);
+    fft.forward(grid.data(), threaded.data());
+    set_num_threads(0);
+    double error = 0, half_error = 0, norm = 0;
+    const std::size_t hx = nx / 2 + 1;
+    for (std::size_t i = 0; i < count; i++) {
+        std::complex<double> c(complex_grid[i].real(), complex_grid[i].imag());
+        error += std::norm(c - exact[i]);
+        norm += std::norm(exact[i]);
+        std::size_t x = i % nx, row = i / nx;
+        if (x < hx) {
+            std::complex<T> h = half[row * hx + x];
+            half_error += std::norm(std::complex<double>(h.real(), h.imag()) -
+                                    exact[i]);
+        }
+    }
+    bool same = true;
+    for (std::size_t i = 0; i < half.size(); i++) {
+        same = same && (half[i] == threaded[i]);
+    }
+    // round trips, scaled by the grid size
+    std::vector<T> back(count);
+    fft.inverse(half.data(), back.data());
+    fft.transform(complex_grid.data(), fft_direction::inverse);
+    double back_error = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        back_error = std::max(
+            back_error, (double)std::fabs(back[i] / (T)count - grid[i]));
+        back_error = std::max(
+            back_error, (double)std::abs(complex_grid[i] / (T)count -
+                                         std::complex<T>(grid[i], 0)));
+    }
+    return same && (std::sqrt(error / norm) < tolerance) &&
+           (std::sqrt(half_error / norm) < tolerance) &&
+           (back_error < tolerance);
+}
+
 int main() {
 
     RUN_TESTS(CONSTRUCTOR_VARARGS_TEST)
@@ -197,6 +1876,89 @@ int main() {
     RUN_TESTS(REASSIGN_TEST)
     RUN_TESTS(SPECIAL_REASSIGN_TEST)
 
+    TEST((test_quantize_roundtrip(0.01f)))
+    TEST((test_quantize_roundtrip(0.5f)))
+    TEST((test_quantize_top_code()))
+    TEST((test_delta_roundtrip(delta_predictor::previous)))
+    TEST((test_delta_roundtrip(delta_predictor::linear)))
+    TEST((test_delta_malformed()))
+    TEST((test_async_roundtrip(true)))
+    TEST((test_async_roundtrip(false)))
+    TEST((test_pipeline()))
+    TEST((test_pipeline_failures()))
+    TEST((test_point_cloud_roundtrip<float>()))
+    TEST((test_point_cloud_roundtrip<double>()))
+    TEST((test_ply_ascii_with_faces()))
+    TEST((test_point_cloud_malformed()))
+    TEST((test_vec_array<float, 3>()))
+    TEST((test_vec_array<double, 4>()))
+    TEST((test_vec_array<float, 7>()))
+    TEST((test_arena()))
+    TEST((test_numa_vec_array()))
+    TEST((test_streaming_transform<float, 4>()))
+    TEST((test_streaming_transform<double, 3>()))
+    TEST((test_streaming_transform<unsigned char, 5>()))
+    TEST((test_gather_scatter<float, 3>()))
+    TEST((test_gather_scatter<int, 5>()))
+    TEST((test_gather_scatter<double, 2>()))
+    TEST((test_kd_tree<float, 3>()))
+    TEST((test_kd_tree<float, 8>()))
+    TEST((test_kd_tree<double, 2>()))
+    TEST((test_bvh<4>()))
+    TEST((test_bvh<8>()))
+    TEST((test_bvh_face_ray<4>()))
+    TEST((test_bvh_face_ray<8>()))
+    TEST((test_cell_list<float>(0.3f)))
+    TEST((test_cell_list<double>(0.01)))
+    TEST((test_cell_list<float>(5.0f)))
+    TEST((test_cell_list_far_origin()))
+    TEST((test_periodic<float, 3>()))
+    TEST((test_periodic<double, 3>()))
+    TEST((test_periodic<double, 5>()))
+    TEST((test_wrap_boundaries<float>()))
+    TEST((test_wrap_boundaries<double>()))
+    TEST((test_cell_list_periodic<float>(0.4f)))
+    TEST((test_cell_list_periodic<double>(1.9)))
+    TEST((test_curves()))
+    TEST((test_radix_sort_pairs()))
+    TEST((test_radix_sort<float>(1e30f)))
+    TEST((test_radix_sort<double>(1e-3)))
+    TEST((test_radix_sort<std::int32_t>(1 << 20)))
+    TEST((test_radix_sort<std::int64_t>(std::int64_t(1) << 40)))
+    TEST((test_radix_sort<std::uint16_t>(1)))
+    TEST((test_radix_sort_vec<float>()))
+    TEST((test_radix_sort_vec<double>()))
+    TEST((test_spatial_sort<float>(curve_order::morton)))
+    TEST((test_spatial_sort<double>(curve_order::hilbert)))
+    TEST((test_vec_hash_map<int>()))
+    TEST((test_vec_hash_map<std::int16_t>()))
+    TEST((test_std_hash_vec()))
+    TEST((test_frustum_planes()))
+    TEST((test_octree<float>(16)))
+    TEST((test_octree<double>(1)))
+    TEST((test_barnes_hut<double>(1e-2)))
+    TEST((test_barnes_hut<float>(1e-2)))
+    TEST((test_direct_accelerations<float>(1e-5)))
+    TEST((test_direct_accelerations<double>(1e-12)))
+    TEST((test_mass_assignment_weights()))
+    TEST((test_mesh_deposit<float>(mass_assignment::ngp)))
+    TEST((test_mesh_deposit<float>(mass_assignment::cic)))
+    TEST((test_mesh_deposit<double>(mass_assignment::tsc)))
+    TEST((test_mesh_gather<float>()))
+    TEST((test_mesh_gather<double>()))
+    TEST((test_fft<float>(1e-5)))
+    TEST((test_fft<double>(1e-13)))
+    TEST((test_real_fft<float>(1e-5)))
+    TEST((test_real_fft<double>(1e-13)))
+    TEST((test_fft3d<float>(8, 6, 20, 1e-5)))
+    TEST((test_fft3d<double>(9, 5, 4, 1e-13)))
+    TEST((test_friends_of_friends<float>(false)))
+    TEST((test_friends_of_friends<double>(true)))
+    TEST((test_friends_of_friends_wrap()))
+    TEST((test_kmeans<float, 16>(12, 1e-5)))
+    TEST((test_kmeans<double, 40>(5, 1e-12)))
+    TEST((test_kmeans<float, 3>(1, 1e-5)))
+
     std::cout << "Passed: " << tests_passed << "/"
               << (tests_passed + tests_failed) << std::endl;
     return 0;